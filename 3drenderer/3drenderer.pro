@@ -22,6 +22,10 @@ DEFINES += QT_DEPRECATED_WARNINGS
 # You can also select to disable deprecated APIs only up to a certain version of Qt.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+# Timed scopes of the import and render phases, saved as a Chrome trace from
+# the window. Comment it out to compile them out.
+DEFINES += ENABLE_TRACING
+
 FORMS += \
     mainwindow.ui
 
@@ -35,7 +39,34 @@ HEADERS += \
     tiny_obj_loader.h \
     uvwrapper.h \
     uvsphericalwrapper.h \
-    uvcubewrapper.h
+    uvcubewrapper.h \
+    vertexpacker.h \
+    indexbatcher.h \
+    rangeallocator.h \
+    gpuuploadmanager.h \
+    uniformbuffer.h \
+    framescheduler.h \
+    shadercache.h \
+    scene.h \
+    bvh.h \
+    frustumculler.h \
+    threadpool.h \
+    occlusionculler.h \
+    picker.h \
+    raycaster.h \
+    raytracer.h \
+    aobaker.h \
+    normalmapbaker.h \
+    mipchain.h \
+    blockcompressor.h \
+    heightmapconverter.h \
+    pagefile.h \
+    virtualtexture.h \
+    pagefeedback.h \
+    textureatlas.h \
+    textureloader.h \
+    tracer.h \
+    softwarerenderer.h
 
 SOURCES += \
     renderwidget.cpp \
@@ -45,7 +76,34 @@ SOURCES += \
     mesh.cpp \
     uvwrapper.cpp \
     uvsphericalwrapper.cpp \
-    uvcubewrapper.cpp
+    uvcubewrapper.cpp \
+    vertexpacker.cpp \
+    indexbatcher.cpp \
+    rangeallocator.cpp \
+    gpuuploadmanager.cpp \
+    uniformbuffer.cpp \
+    framescheduler.cpp \
+    shadercache.cpp \
+    scene.cpp \
+    bvh.cpp \
+    frustumculler.cpp \
+    threadpool.cpp \
+    occlusionculler.cpp \
+    picker.cpp \
+    raycaster.cpp \
+    raytracer.cpp \
+    aobaker.cpp \
+    normalmapbaker.cpp \
+    mipchain.cpp \
+    blockcompressor.cpp \
+    heightmapconverter.cpp \
+    pagefile.cpp \
+    virtualtexture.cpp \
+    pagefeedback.cpp \
+    textureatlas.cpp \
+    textureloader.cpp \
+    tracer.cpp \
+    softwarerenderer.cpp
 
 RESOURCES += \
     data.qrc
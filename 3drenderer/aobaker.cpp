@@ -0,0 +1,197 @@
+#include "aobaker.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <thread>
+
+const int AOBaker::BATCH_VERTICES;
+
+// Ray origins are moved off the surface by this fraction of the bounds
+// diagonal, so rays leaving along a face do not hit it again
+static const float BIAS_SCALE = 1e-4f;
+
+// Seeded by the vertex index, so a vertex always gets the same rays
+static inline unsigned int hashSeed(unsigned int x)
+{
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+// Uniform in [0, 1)
+static inline float nextRandom(unsigned int& state)
+{
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return (state >> 8) * (1.0f / 16777216.0f);
+}
+
+AOBaker::AOBaker(ThreadPool* threadPool)
+{
+  this->isOwnThreadPool = threadPool == nullptr;
+  this->threadPool = this->isOwnThreadPool ? new ThreadPool() : threadPool;
+  this->rayCaster = new RayCaster(this->threadPool);
+  this->isCancelled = false;
+  this->bakedVertices = 0;
+  this->numVertices = 0;
+  this->numRays = 0;
+}
+
+AOBaker::~AOBaker()
+{
+  delete this->rayCaster;
+  if (this->isOwnThreadPool)
+  {
+    delete this->threadPool;
+  }
+}
+
+bool AOBaker::bake(const std::vector<glm::vec3>& positions,
+                   const std::vector<glm::vec3>& normals,
+                   const std::vector<unsigned int>& indices,
+                   int numRays,
+                   float maxDistance,
+                   std::vector<float>& visibility,
+                   const std::function<bool(float)>& progress)
+{
+  this->isCancelled = false;
+  this->bakedVertices = 0;
+  this->numVertices = (int) positions.size();
+  this->numRays = 0;
+  numRays = std::max(numRays, 1);
+
+  this->rayCaster->build(positions, indices);
+  BoundingBox bounds = this->rayCaster->getBounds();
+  float bias = this->rayCaster->isEmpty() ? 0.0f : BIAS_SCALE * glm::length(bounds.max - bounds.min);
+
+  // Baked along the BVH triangle order, so the vertices of a job are close
+  // together and their rays go through the same nodes
+  std::vector<unsigned int> vertexOrder;
+  vertexOrder.reserve(positions.size());
+  std::vector<bool> isOrdered(positions.size(), false);
+  const std::vector<unsigned int>& triangleOrder = this->rayCaster->getTriangleOrder();
+  for (unsigned int i = 0; i < triangleOrder.size(); i++)
+  {
+    for (int k = 0; k < 3; k++)
+    {
+      unsigned int v = indices[3 * triangleOrder[i] + k];
+      if (!isOrdered[v])
+      {
+        isOrdered[v] = true;
+        vertexOrder.push_back(v);
+      }
+    }
+  }
+  for (unsigned int v = 0; v < positions.size(); v++)
+  {
+    if (!isOrdered[v])
+    {
+      vertexOrder.push_back(v);
+    }
+  }
+
+  std::vector<float> baked(positions.size(), 1.0f);
+  int numBatches = (this->numVertices + BATCH_VERTICES - 1) / BATCH_VERTICES;
+  std::vector<unsigned int> batchRays(numBatches, 0);
+  std::thread::id callingThread = std::this_thread::get_id();
+  this->threadPool->parallelFor(numBatches, [&](int batch)
+  {
+    if (this->isCancelled)
+    {
+      return;
+    }
+    int end = std::min((batch + 1) * BATCH_VERTICES, this->numVertices);
+    for (int i = batch * BATCH_VERTICES; i < end; i++)
+    {
+      int v = (int) vertexOrder[i];
+      float length = glm::length(normals[v]);
+      if (length > 0.0f && !this->rayCaster->isEmpty())
+      {
+        baked[v] = this->bakeVertex(positions[v], normals[v] / length, v, numRays, maxDistance, bias);
+        batchRays[batch] += numRays;
+      }
+    }
+    int done = this->bakedVertices.fetch_add(end - batch * BATCH_VERTICES) + end - batch * BATCH_VERTICES;
+    if (progress && std::this_thread::get_id() == callingThread && !progress((float) done / this->numVertices))
+    {
+      this->isCancelled = true;
+    }
+  });
+
+  for (int batch = 0; batch < numBatches; batch++)
+  {
+    this->numRays += batchRays[batch];
+  }
+  if (this->isCancelled)
+  {
+    return false;
+  }
+  if (progress)
+  {
+    progress(1.0f);
+  }
+  visibility.swap(baked);
+  return true;
+}
+
+float AOBaker::bakeVertex(const glm::vec3& position, const glm::vec3& normal, int vertex, int numRays, float maxDistance, float bias) const
+{
+  // Tangent frame around the normal (Duff et al., Building an orthonormal
+  // basis, revisited)
+  float sign = std::copysign(1.0f, normal.z);
+  float a = -1.0f / (sign + normal.z);
+  float b = normal.x * normal.y * a;
+  glm::vec3 tangent(1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+  glm::vec3 bitangent(b, sign + normal.y * normal.y * a, -normal.y);
+
+  // Jittered cells over the unit square, mapped to the hemisphere with a
+  // cosine density. There is exactly one cell per ray, all of the same
+  // area: the rows that get one more cell when numRays is not a square are
+  // taller in proportion, so no part of the square is over or under sampled.
+  int numRows = std::max((int) std::sqrt((float) numRays), 1);
+  int baseColumns = numRays / numRows;
+  int extraColumns = numRays % numRows;
+  unsigned int state = hashSeed((unsigned int) vertex) | 1u;
+
+  Ray ray;
+  ray.origin = position + bias * normal;
+  ray.tMin = 0.0f;
+  ray.tMax = maxDistance;
+  int numVisible = 0;
+  int firstCell = 0;
+  for (int row = 0; row < numRows; row++)
+  {
+    int numColumns = baseColumns + (row < extraColumns ? 1 : 0);
+    for (int column = 0; column < numColumns; column++)
+    {
+      float u = (column + nextRandom(state)) / numColumns;
+      float v = (firstCell + numColumns * nextRandom(state)) / numRays;
+      float r = std::sqrt(u);
+      float phi = 6.28318531f * v;
+      ray.direction = (r * std::cos(phi)) * tangent + (r * std::sin(phi)) * bitangent + std::sqrt(std::max(1.0f - u, 0.0f)) * normal;
+      numVisible += !this->rayCaster->occluded(ray);
+    }
+    firstCell += numColumns;
+  }
+  return (float) numVisible / numRays;
+}
+
+void AOBaker::cancel()
+{
+  this->isCancelled = true;
+}
+
+float AOBaker::getProgress()
+{
+  return this->numVertices > 0 ? (float) this->bakedVertices / this->numVertices : 0.0f;
+}
+
+unsigned long long AOBaker::getNumRays()
+{
+  return this->numRays;
+}
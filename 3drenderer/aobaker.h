@@ -0,0 +1,58 @@
+#ifndef AOBAKER_H
+#define AOBAKER_H
+
+#include "glm/glm.hpp"
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#include "raycaster.h"
+#include "threadpool.h"
+
+// Per-vertex ambient occlusion, from rays cast over the hemisphere of the
+// vertex normals against the triangles of the mesh. The rays of a vertex
+// are stratified and cosine weighted, so the result is the visible fraction
+// of the diffuse ambient light. The same mesh and settings always bake the
+// same values, whatever the number of threads.
+class AOBaker
+{
+private:
+  ThreadPool* threadPool;
+  bool isOwnThreadPool;
+
+  RayCaster* rayCaster;
+  std::atomic<bool> isCancelled;
+  std::atomic<int> bakedVertices;
+  int numVertices;
+  unsigned long long numRays;
+
+  float bakeVertex(const glm::vec3& position, const glm::vec3& normal, int vertex, int numRays, float maxDistance, float bias) const;
+
+public:
+  // Vertices baked by a single job, between progress reports
+  static const int BATCH_VERTICES = 64;
+
+  // Without a thread pool, one is created
+  AOBaker(ThreadPool* threadPool = nullptr);
+  ~AOBaker();
+
+  // Visibility in [0, 1] of every vertex, 1 when nothing is hit within
+  // maxDistance. The progress callback runs on the calling thread, with the
+  // fraction of the vertices done; returning false cancels the bake. False
+  // when cancelled, the output is then left as it was.
+  bool bake(const std::vector<glm::vec3>& positions,
+            const std::vector<glm::vec3>& normals,
+            const std::vector<unsigned int>& indices,
+            int numRays,
+            float maxDistance,
+            std::vector<float>& visibility,
+            const std::function<bool(float)>& progress = std::function<bool(float)>());
+  // From any thread, the bake in progress stops after its current jobs
+  void cancel();
+  // From any thread
+  float getProgress();
+  // Rays cast by the last bake
+  unsigned long long getNumRays();
+};
+
+#endif // AOBAKER_H
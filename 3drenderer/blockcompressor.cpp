@@ -0,0 +1,856 @@
+#include "blockcompressor.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define BLOCKCOMPRESSOR_SSE2
+#endif
+
+// Least squares passes over the endpoints of BC1 color, and of BC7 by
+// quality
+static const int COLOR_REFINEMENTS = 2;
+static const int BC7_REFINEMENTS[3] = { 0, 2, 6 };
+
+// Position between the endpoints of the BC1 indices
+static const float COLOR_WEIGHTS[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+// Interpolation weights of the 4-bit BC7 indices, out of 64
+static const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// 7-bit values of the BC7 mode 6 endpoints, each with its shared low bit
+struct BC7Endpoints
+{
+  int values[2][4];
+  int pBits[2];
+};
+
+static inline float clampFloat(float value)
+{
+  return std::min(std::max(value, 0.0f), 255.0f);
+}
+
+// The 4x4 texels of a block in planes of channels, repeating the edges
+// past the texture
+static void loadBlock(const unsigned char* texels, int width, int height, int blockX, int blockY, float planes[4][16])
+{
+  for (int y = 0; y < 4; y++)
+  {
+    const unsigned char* row = texels + (size_t) std::min(blockY * 4 + y, height - 1) * width * 4;
+    for (int x = 0; x < 4; x++)
+    {
+      const unsigned char* texel = row + std::min(blockX * 4 + x, width - 1) * 4;
+      for (int c = 0; c < 4; c++)
+      {
+        planes[c][y * 4 + x] = texel[c];
+      }
+    }
+  }
+}
+
+// Nearest palette color of every texel over the first channels, returning
+// the summed squared error
+static float fitIndices(const float planes[4][16], const float palette[][4], int numColors, int numChannels, unsigned char* indices)
+{
+#ifdef BLOCKCOMPRESSOR_SSE2
+  // Four texels at once against every color
+  __m128 total = _mm_setzero_ps();
+  for (int i = 0; i < 16; i += 4)
+  {
+    __m128 texels[4];
+    for (int c = 0; c < numChannels; c++)
+    {
+      texels[c] = _mm_loadu_ps(&planes[c][i]);
+    }
+    __m128 best = _mm_set1_ps(FLT_MAX);
+    __m128i bestIndex = _mm_setzero_si128();
+    for (int k = 0; k < numColors; k++)
+    {
+      __m128 distance = _mm_setzero_ps();
+      for (int c = 0; c < numChannels; c++)
+      {
+        __m128 d = _mm_sub_ps(texels[c], _mm_set1_ps(palette[k][c]));
+        distance = _mm_add_ps(distance, _mm_mul_ps(d, d));
+      }
+      __m128i isCloser = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+      best = _mm_min_ps(distance, best);
+      bestIndex = _mm_or_si128(_mm_andnot_si128(isCloser, bestIndex), _mm_and_si128(isCloser, _mm_set1_epi32(k)));
+    }
+    total = _mm_add_ps(total, best);
+    int bestIndices[4];
+    _mm_storeu_si128((__m128i*) bestIndices, bestIndex);
+    for (int j = 0; j < 4; j++)
+    {
+      indices[i + j] = (unsigned char) bestIndices[j];
+    }
+  }
+  float sums[4];
+  _mm_storeu_ps(sums, total);
+  return sums[0] + sums[1] + sums[2] + sums[3];
+#else
+  float total = 0.0f;
+  for (int i = 0; i < 16; i++)
+  {
+    float best = FLT_MAX;
+    for (int k = 0; k < numColors; k++)
+    {
+      float distance = 0.0f;
+      for (int c = 0; c < numChannels; c++)
+      {
+        float d = planes[c][i] - palette[k][c];
+        distance += d * d;
+      }
+      if (distance < best)
+      {
+        best = distance;
+        indices[i] = (unsigned char) k;
+      }
+    }
+    total += best;
+  }
+  return total;
+#endif
+}
+
+// Endpoints at the extremes of the texels along their principal axis
+static void fitPrincipalAxis(const float planes[4][16], int numChannels, float* e0, float* e1)
+{
+  float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+  for (int c = 0; c < numChannels; c++)
+  {
+    for (int i = 0; i < 16; i++)
+    {
+      mean[c] += planes[c][i];
+    }
+    mean[c] /= 16.0f;
+  }
+  float covariance[4][4] = {};
+  for (int i = 0; i < 16; i++)
+  {
+    for (int a = 0; a < numChannels; a++)
+    {
+      for (int b = a; b < numChannels; b++)
+      {
+        covariance[a][b] += (planes[a][i] - mean[a]) * (planes[b][i] - mean[b]);
+      }
+    }
+  }
+  int largest = 0;
+  for (int a = 0; a < numChannels; a++)
+  {
+    for (int b = 0; b < a; b++)
+    {
+      covariance[a][b] = covariance[b][a];
+    }
+    if (covariance[a][a] > covariance[largest][largest])
+    {
+      largest = a;
+    }
+  }
+
+  // Power iteration from the channel of the largest variance. A flat
+  // block keeps it, and gets both endpoints at its color.
+  float axis[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+  axis[largest] = 1.0f;
+  for (int iteration = 0; iteration < 8; iteration++)
+  {
+    float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    float length = 0.0f;
+    for (int a = 0; a < numChannels; a++)
+    {
+      for (int b = 0; b < numChannels; b++)
+      {
+        next[a] += covariance[a][b] * axis[b];
+      }
+      length += next[a] * next[a];
+    }
+    if (length < 1e-12f)
+    {
+      break;
+    }
+    length = std::sqrt(length);
+    for (int a = 0; a < numChannels; a++)
+    {
+      axis[a] = next[a] / length;
+    }
+  }
+
+  float low = FLT_MAX;
+  float high = -FLT_MAX;
+  for (int i = 0; i < 16; i++)
+  {
+    float t = 0.0f;
+    for (int c = 0; c < numChannels; c++)
+    {
+      t += (planes[c][i] - mean[c]) * axis[c];
+    }
+    low = std::min(low, t);
+    high = std::max(high, t);
+  }
+  for (int c = 0; c < 4; c++)
+  {
+    e0[c] = c < numChannels ? clampFloat(mean[c] + axis[c] * low) : 0.0f;
+    e1[c] = c < numChannels ? clampFloat(mean[c] + axis[c] * high) : 0.0f;
+  }
+}
+
+// Endpoints minimizing the squared error of the texels at the given
+// positions between them, false when every texel is at the same position
+static bool solveEndpoints(const float planes[4][16], const float* positions, int numChannels, float* e0, float* e1)
+{
+  float a = 0.0f;
+  float b = 0.0f;
+  float c = 0.0f;
+  float x[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+  float y[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+  for (int i = 0; i < 16; i++)
+  {
+    float w = positions[i];
+    a += (1.0f - w) * (1.0f - w);
+    b += (1.0f - w) * w;
+    c += w * w;
+    for (int channel = 0; channel < numChannels; channel++)
+    {
+      x[channel] += (1.0f - w) * planes[channel][i];
+      y[channel] += w * planes[channel][i];
+    }
+  }
+  float determinant = a * c - b * b;
+  if (std::fabs(determinant) < 1e-6f)
+  {
+    return false;
+  }
+  for (int channel = 0; channel < numChannels; channel++)
+  {
+    e0[channel] = clampFloat((c * x[channel] - b * y[channel]) / determinant);
+    e1[channel] = clampFloat((a * y[channel] - b * x[channel]) / determinant);
+  }
+  return true;
+}
+
+static inline int quantize(float value, int maximum)
+{
+  return std::min((int) (value * maximum / 255.0f + 0.5f), maximum);
+}
+
+static inline int to565(const float* color)
+{
+  return (quantize(color[0], 31) << 11) | (quantize(color[1], 63) << 5) | quantize(color[2], 31);
+}
+
+static inline void expand565(int color, int* channels)
+{
+  int r = color >> 11;
+  int g = (color >> 5) & 63;
+  int b = color & 31;
+  channels[0] = (r << 3) | (r >> 2);
+  channels[1] = (g << 2) | (g >> 4);
+  channels[2] = (b << 3) | (b >> 2);
+}
+
+// The colors of a BC1 block, with the shades of the 4 color mode or the
+// half and the transparent black of the other one
+static void buildColorPalette(int color0, int color1, bool isFourColor, int palette[4][4])
+{
+  expand565(color0, palette[0]);
+  expand565(color1, palette[1]);
+  for (int c = 0; c < 3; c++)
+  {
+    if (isFourColor)
+    {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c] + 1) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c] + 1) / 3;
+    }
+    else
+    {
+      palette[2][c] = (palette[0][c] + palette[1][c] + 1) / 2;
+      palette[3][c] = 0;
+    }
+  }
+  palette[0][3] = 255;
+  palette[1][3] = 255;
+  palette[2][3] = 255;
+  palette[3][3] = isFourColor ? 255 : 0;
+}
+
+static float fitColors(const float planes[4][16], const float* e0, const float* e1, int& color0, int& color1, unsigned char* indices)
+{
+  color0 = to565(e0);
+  color1 = to565(e1);
+  int shades[4][4];
+  buildColorPalette(color0, color1, true, shades);
+  float palette[4][4];
+  for (int k = 0; k < 4; k++)
+  {
+    for (int c = 0; c < 4; c++)
+    {
+      palette[k][c] = (float) shades[k][c];
+    }
+  }
+  return fitIndices(planes, palette, 4, 3, indices);
+}
+
+// BC1 color in the 4 color mode, the one BC3 always decodes
+static void encodeColorBlock(const float planes[4][16], unsigned char* output)
+{
+  float e0[4];
+  float e1[4];
+  fitPrincipalAxis(planes, 3, e0, e1);
+  int color0;
+  int color1;
+  unsigned char indices[16];
+  float error = fitColors(planes, e0, e1, color0, color1, indices);
+  for (int refinement = 0; refinement < COLOR_REFINEMENTS && error > 0.0f; refinement++)
+  {
+    float positions[16];
+    for (int i = 0; i < 16; i++)
+    {
+      positions[i] = COLOR_WEIGHTS[indices[i]];
+    }
+    if (!solveEndpoints(planes, positions, 3, e0, e1))
+    {
+      break;
+    }
+    int refinedColor0;
+    int refinedColor1;
+    unsigned char refinedIndices[16];
+    float refinedError = fitColors(planes, e0, e1, refinedColor0, refinedColor1, refinedIndices);
+    if (refinedError >= error)
+    {
+      break;
+    }
+    error = refinedError;
+    color0 = refinedColor0;
+    color1 = refinedColor1;
+    memcpy(indices, refinedIndices, 16);
+  }
+
+  // The 4 color mode needs color0 above color1. Swapped, the shades swap
+  // in pairs: 0 and 1, 2 and 3.
+  if (color0 < color1)
+  {
+    std::swap(color0, color1);
+    for (int i = 0; i < 16; i++)
+    {
+      indices[i] ^= 1;
+    }
+  }
+  else if (color0 == color1)
+  {
+    memset(indices, 0, 16);
+  }
+  unsigned int bits = 0;
+  for (int i = 0; i < 16; i++)
+  {
+    bits |= (unsigned int) indices[i] << (2 * i);
+  }
+  output[0] = (unsigned char) color0;
+  output[1] = (unsigned char) (color0 >> 8);
+  output[2] = (unsigned char) color1;
+  output[3] = (unsigned char) (color1 >> 8);
+  for (int i = 0; i < 4; i++)
+  {
+    output[4 + i] = (unsigned char) (bits >> (8 * i));
+  }
+}
+
+// The values of a BC4 block: 8 shades with value0 above value1, otherwise
+// 6 shades, 0 and 255
+static void buildChannelPalette(int value0, int value1, int palette[8])
+{
+  palette[0] = value0;
+  palette[1] = value1;
+  if (value0 > value1)
+  {
+    for (int k = 2; k < 8; k++)
+    {
+      palette[k] = ((8 - k) * value0 + (k - 1) * value1 + 3) / 7;
+    }
+  }
+  else
+  {
+    for (int k = 2; k < 6; k++)
+    {
+      palette[k] = ((6 - k) * value0 + (k - 1) * value1 + 2) / 5;
+    }
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+}
+
+static int fitChannel(const int* values, int value0, int value1, unsigned char* indices)
+{
+  int palette[8];
+  buildChannelPalette(value0, value1, palette);
+  int error = 0;
+  for (int i = 0; i < 16; i++)
+  {
+    int best = INT_MAX;
+    for (int k = 0; k < 8; k++)
+    {
+      int d = (values[i] - palette[k]) * (values[i] - palette[k]);
+      if (d < best)
+      {
+        best = d;
+        indices[i] = (unsigned char) k;
+      }
+    }
+    error += best;
+  }
+  return error;
+}
+
+// One channel in a BC4 block, the alpha of BC3 and each half of BC5
+static void encodeChannelBlock(const float* plane, unsigned char* output)
+{
+  int values[16];
+  int low = 255;
+  int high = 0;
+  // Without the extremes the 6 shade mode has for free
+  int innerLow = 255;
+  int innerHigh = 0;
+  for (int i = 0; i < 16; i++)
+  {
+    values[i] = (int) plane[i];
+    low = std::min(low, values[i]);
+    high = std::max(high, values[i]);
+    if (values[i] != 0 && values[i] != 255)
+    {
+      innerLow = std::min(innerLow, values[i]);
+      innerHigh = std::max(innerHigh, values[i]);
+    }
+  }
+
+  int value0 = high;
+  int value1 = low;
+  unsigned char indices[16];
+  int error = fitChannel(values, value0, value1, indices);
+  if (error > 0 && (low == 0 || high == 255))
+  {
+    if (innerLow > innerHigh)
+    {
+      innerLow = 0;
+      innerHigh = 0;
+    }
+    unsigned char innerIndices[16];
+    int innerError = fitChannel(values, innerLow, innerHigh, innerIndices);
+    if (innerError < error)
+    {
+      value0 = innerLow;
+      value1 = innerHigh;
+      memcpy(indices, innerIndices, 16);
+    }
+  }
+
+  unsigned long long bits = 0;
+  for (int i = 0; i < 16; i++)
+  {
+    bits |= (unsigned long long) indices[i] << (3 * i);
+  }
+  output[0] = (unsigned char) value0;
+  output[1] = (unsigned char) value1;
+  for (int i = 0; i < 6; i++)
+  {
+    output[2 + i] = (unsigned char) (bits >> (8 * i));
+  }
+}
+
+static float fitBC7(const float planes[4][16], const BC7Endpoints& endpoints, unsigned char* indices)
+{
+  float palette[16][4];
+  for (int c = 0; c < 4; c++)
+  {
+    int value0 = (endpoints.values[0][c] << 1) | endpoints.pBits[0];
+    int value1 = (endpoints.values[1][c] << 1) | endpoints.pBits[1];
+    for (int k = 0; k < 16; k++)
+    {
+      palette[k][c] = (float) (((64 - BC7_WEIGHTS[k]) * value0 + BC7_WEIGHTS[k] * value1 + 32) >> 6);
+    }
+  }
+  return fitIndices(planes, palette, 16, 4, indices);
+}
+
+static float quantizeBC7(const float* endpoint, int pBit, int* values)
+{
+  float error = 0.0f;
+  for (int c = 0; c < 4; c++)
+  {
+    values[c] = std::min(std::max((int) ((endpoint[c] - pBit) * 0.5f + 0.5f), 0), 127);
+    float d = (float) ((values[c] << 1) | pBit) - endpoint[c];
+    error += d * d;
+  }
+  return error;
+}
+
+// The endpoints in 7 bits, with the shared bits closest to each of them, or
+// the pair fitting the texels best
+static float quantizeEndpoints(const float planes[4][16], const float* e0, const float* e1, bool isPairSearch, BC7Endpoints& endpoints, unsigned char* indices)
+{
+  if (!isPairSearch)
+  {
+    const float* e[2] = { e0, e1 };
+    for (int j = 0; j < 2; j++)
+    {
+      int values[4];
+      float error0 = quantizeBC7(e[j], 0, endpoints.values[j]);
+      float error1 = quantizeBC7(e[j], 1, values);
+      endpoints.pBits[j] = error1 < error0 ? 1 : 0;
+      if (error1 < error0)
+      {
+        memcpy(endpoints.values[j], values, sizeof(values));
+      }
+    }
+    return fitBC7(planes, endpoints, indices);
+  }
+
+  float best = FLT_MAX;
+  for (int pair = 0; pair < 4; pair++)
+  {
+    BC7Endpoints candidate;
+    candidate.pBits[0] = pair & 1;
+    candidate.pBits[1] = pair >> 1;
+    quantizeBC7(e0, candidate.pBits[0], candidate.values[0]);
+    quantizeBC7(e1, candidate.pBits[1], candidate.values[1]);
+    unsigned char candidateIndices[16];
+    float error = fitBC7(planes, candidate, candidateIndices);
+    if (error < best)
+    {
+      best = error;
+      endpoints = candidate;
+      memcpy(indices, candidateIndices, 16);
+    }
+  }
+  return best;
+}
+
+static void writeBits(unsigned char* output, int& position, unsigned int value, int count)
+{
+  for (int i = 0; i < count; i++, position++)
+  {
+    if ((value >> i) & 1)
+    {
+      output[position >> 3] |= (unsigned char) (1 << (position & 7));
+    }
+  }
+}
+
+static unsigned int readBits(const unsigned char* input, int& position, int count)
+{
+  unsigned int value = 0;
+  for (int i = 0; i < count; i++, position++)
+  {
+    value |= (unsigned int) ((input[position >> 3] >> (position & 7)) & 1) << i;
+  }
+  return value;
+}
+
+// BC7 mode 6: a single pair of RGBA endpoints and 4-bit indices, the mode
+// of the widest range of blocks. The quality sets how long its endpoints
+// are searched.
+static void encodeBC7Block(const float planes[4][16], BlockCompressor::Quality quality, unsigned char* output)
+{
+  float e0[4];
+  float e1[4];
+  fitPrincipalAxis(planes, 4, e0, e1);
+  bool isPairSearch = quality != BlockCompressor::FAST_QUALITY;
+  BC7Endpoints endpoints;
+  unsigned char indices[16];
+  float error = quantizeEndpoints(planes, e0, e1, isPairSearch, endpoints, indices);
+
+  for (int refinement = 0; refinement < BC7_REFINEMENTS[quality] && error > 0.0f; refinement++)
+  {
+    float positions[16];
+    for (int i = 0; i < 16; i++)
+    {
+      positions[i] = BC7_WEIGHTS[indices[i]] / 64.0f;
+    }
+    if (!solveEndpoints(planes, positions, 4, e0, e1))
+    {
+      break;
+    }
+    BC7Endpoints refined;
+    unsigned char refinedIndices[16];
+    float refinedError = quantizeEndpoints(planes, e0, e1, isPairSearch, refined, refinedIndices);
+    if (refinedError >= error)
+    {
+      break;
+    }
+    error = refinedError;
+    endpoints = refined;
+    memcpy(indices, refinedIndices, 16);
+  }
+
+  if (quality == BlockCompressor::SLOW_QUALITY)
+  {
+    // Every value a step either way, for as long as one lowers the error
+    bool isImproved = true;
+    for (int pass = 0; pass < 4 && isImproved && error > 0.0f; pass++)
+    {
+      isImproved = false;
+      for (int j = 0; j < 2; j++)
+      {
+        for (int c = 0; c < 4; c++)
+        {
+          for (int step = -1; step <= 1; step += 2)
+          {
+            int value = endpoints.values[j][c] + step;
+            if (value < 0 || value > 127)
+            {
+              continue;
+            }
+            BC7Endpoints candidate = endpoints;
+            candidate.values[j][c] = value;
+            unsigned char candidateIndices[16];
+            float candidateError = fitBC7(planes, candidate, candidateIndices);
+            if (candidateError < error)
+            {
+              error = candidateError;
+              endpoints = candidate;
+              memcpy(indices, candidateIndices, 16);
+              isImproved = true;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // The index of the first texel has no top bit, so it must be below 8.
+  // The weights are symmetric: swapped endpoints take mirrored indices.
+  if (indices[0] >= 8)
+  {
+    for (int c = 0; c < 4; c++)
+    {
+      std::swap(endpoints.values[0][c], endpoints.values[1][c]);
+    }
+    std::swap(endpoints.pBits[0], endpoints.pBits[1]);
+    for (int i = 0; i < 16; i++)
+    {
+      indices[i] = (unsigned char) (15 - indices[i]);
+    }
+  }
+
+  memset(output, 0, 16);
+  int position = 0;
+  // Mode 6 is six zero bits and a one
+  writeBits(output, position, 1 << 6, 7);
+  for (int c = 0; c < 4; c++)
+  {
+    writeBits(output, position, endpoints.values[0][c], 7);
+    writeBits(output, position, endpoints.values[1][c], 7);
+  }
+  writeBits(output, position, endpoints.pBits[0], 1);
+  writeBits(output, position, endpoints.pBits[1], 1);
+  for (int i = 0; i < 16; i++)
+  {
+    writeBits(output, position, indices[i], i == 0 ? 3 : 4);
+  }
+}
+
+static void decodeColorBlock(const unsigned char* input, bool isBC1, unsigned char* texels)
+{
+  int color0 = input[0] | (input[1] << 8);
+  int color1 = input[2] | (input[3] << 8);
+  int palette[4][4];
+  buildColorPalette(color0, color1, !isBC1 || color0 > color1, palette);
+  unsigned int bits = input[4] | (input[5] << 8) | (input[6] << 16) | ((unsigned int) input[7] << 24);
+  for (int i = 0; i < 16; i++)
+  {
+    const int* color = palette[(bits >> (2 * i)) & 3];
+    for (int c = 0; c < 4; c++)
+    {
+      texels[4 * i + c] = (unsigned char) color[c];
+    }
+  }
+}
+
+static void decodeChannelBlock(const unsigned char* input, unsigned char* texels, int channel)
+{
+  int palette[8];
+  buildChannelPalette(input[0], input[1], palette);
+  unsigned long long bits = 0;
+  for (int i = 0; i < 6; i++)
+  {
+    bits |= (unsigned long long) input[2 + i] << (8 * i);
+  }
+  for (int i = 0; i < 16; i++)
+  {
+    texels[4 * i + channel] = (unsigned char) palette[(bits >> (3 * i)) & 7];
+  }
+}
+
+static void decodeBC7Block(const unsigned char* input, unsigned char* texels)
+{
+  if ((input[0] & 0x7f) != 0x40)
+  {
+    memset(texels, 0, 64);
+    return;
+  }
+  int position = 7;
+  int values[2][4];
+  for (int c = 0; c < 4; c++)
+  {
+    values[0][c] = (int) readBits(input, position, 7);
+    values[1][c] = (int) readBits(input, position, 7);
+  }
+  int pBit0 = (int) readBits(input, position, 1);
+  int pBit1 = (int) readBits(input, position, 1);
+  for (int i = 0; i < 16; i++)
+  {
+    int w = BC7_WEIGHTS[readBits(input, position, i == 0 ? 3 : 4)];
+    for (int c = 0; c < 4; c++)
+    {
+      int value0 = (values[0][c] << 1) | pBit0;
+      int value1 = (values[1][c] << 1) | pBit1;
+      texels[4 * i + c] = (unsigned char) (((64 - w) * value0 + w * value1 + 32) >> 6);
+    }
+  }
+}
+
+BlockCompressor::BlockCompressor(ThreadPool* threadPool)
+{
+  this->isOwnThreadPool = threadPool == nullptr;
+  this->threadPool = this->isOwnThreadPool ? new ThreadPool() : threadPool;
+}
+
+BlockCompressor::~BlockCompressor()
+{
+  if (this->isOwnThreadPool)
+  {
+    delete this->threadPool;
+  }
+}
+
+int BlockCompressor::getBlockBytes(Format format)
+{
+  return format == BC1 ? 8 : 16;
+}
+
+size_t BlockCompressor::getCompressedSize(Format format, int width, int height)
+{
+  return (size_t) ((width + 3) / 4) * ((height + 3) / 4) * getBlockBytes(format);
+}
+
+void BlockCompressor::compress(const unsigned char* texels,
+                               int width,
+                               int height,
+                               Format format,
+                               Quality quality,
+                               CompressedLevel& level)
+{
+  int blocksWide = (width + 3) / 4;
+  int blocksHigh = (height + 3) / 4;
+  int blockBytes = getBlockBytes(format);
+  level.width = width;
+  level.height = height;
+  level.blocks.resize(getCompressedSize(format, width, height));
+  unsigned char* blocks = level.blocks.data();
+
+  // A row of blocks per job
+  this->threadPool->parallelFor(blocksHigh, [&](int blockY)
+  {
+    float planes[4][16];
+    for (int blockX = 0; blockX < blocksWide; blockX++)
+    {
+      loadBlock(texels, width, height, blockX, blockY, planes);
+      unsigned char* output = blocks + ((size_t) blockY * blocksWide + blockX) * blockBytes;
+      switch (format)
+      {
+        case BC1:
+          encodeColorBlock(planes, output);
+          break;
+        case BC3:
+          encodeChannelBlock(planes[3], output);
+          encodeColorBlock(planes, output + 8);
+          break;
+        case BC5:
+          encodeChannelBlock(planes[2], output);
+          encodeChannelBlock(planes[1], output + 8);
+          break;
+        case BC7:
+          encodeBC7Block(planes, quality, output);
+          break;
+      }
+    }
+  });
+}
+
+void BlockCompressor::decompress(const CompressedLevel& level, Format format, std::vector<unsigned char>& texels)
+{
+  int blocksWide = (level.width + 3) / 4;
+  int blocksHigh = (level.height + 3) / 4;
+  int blockBytes = getBlockBytes(format);
+  texels.resize((size_t) level.width * level.height * 4);
+
+  for (int blockY = 0; blockY < blocksHigh; blockY++)
+  {
+    for (int blockX = 0; blockX < blocksWide; blockX++)
+    {
+      const unsigned char* input = &level.blocks[((size_t) blockY * blocksWide + blockX) * blockBytes];
+      unsigned char block[64];
+      switch (format)
+      {
+        case BC1:
+          decodeColorBlock(input, true, block);
+          break;
+        case BC3:
+          decodeColorBlock(input + 8, false, block);
+          decodeChannelBlock(input, block, 3);
+          break;
+        case BC5:
+          decodeChannelBlock(input, block, 2);
+          decodeChannelBlock(input + 8, block, 1);
+          for (int i = 0; i < 16; i++)
+          {
+            float x = block[4 * i + 2] / 127.5f - 1.0f;
+            float y = block[4 * i + 1] / 127.5f - 1.0f;
+            float z = std::sqrt(std::max(1.0f - x * x - y * y, 0.0f));
+            block[4 * i + 0] = (unsigned char) ((z + 1.0f) * 127.5f + 0.5f);
+            block[4 * i + 3] = 255;
+          }
+          break;
+        case BC7:
+          decodeBC7Block(input, block);
+          break;
+      }
+
+      for (int y = 0; y < 4 && blockY * 4 + y < level.height; y++)
+      {
+        for (int x = 0; x < 4 && blockX * 4 + x < level.width; x++)
+        {
+          memcpy(&texels[((size_t) (blockY * 4 + y) * level.width + blockX * 4 + x) * 4], &block[(y * 4 + x) * 4], 4);
+        }
+      }
+    }
+  }
+}
+
+double BlockCompressor::computePSNR(const unsigned char* source,
+                                    const unsigned char* decoded,
+                                    int width,
+                                    int height,
+                                    Format format)
+{
+  int firstChannel = format == BC5 ? 1 : 0;
+  int lastChannel = format == BC1 || format == BC5 ? 2 : 3;
+  double error = 0.0;
+  size_t numTexels = (size_t) width * height;
+  for (size_t i = 0; i < numTexels; i++)
+  {
+    for (int c = firstChannel; c <= lastChannel; c++)
+    {
+      double d = (double) source[4 * i + c] - decoded[4 * i + c];
+      error += d * d;
+    }
+  }
+  if (error == 0.0)
+  {
+    return std::numeric_limits<double>::infinity();
+  }
+  double meanError = error / ((double) numTexels * (lastChannel - firstChannel + 1));
+  return 10.0 * std::log10(255.0 * 255.0 / meanError);
+}
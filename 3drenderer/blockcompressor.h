@@ -0,0 +1,83 @@
+#ifndef BLOCKCOMPRESSOR_H
+#define BLOCKCOMPRESSOR_H
+
+#include <cstddef>
+#include <vector>
+
+#include "threadpool.h"
+
+// A level in 4x4 blocks, row by row. The blocks on the right and bottom
+// edges of sizes not a multiple of 4 repeat the edge texels.
+struct CompressedLevel
+{
+  int width;
+  int height;
+  std::vector<unsigned char> blocks;
+};
+
+// BCn encoder (S3TC, RGTC and BPTC), the formats the GPU samples in place
+// at 4 or 8 bits per texel. The channels are the bytes of the RGBA8 texels
+// in order, as glTexImage2D takes them with GL_RGBA, so a compressed
+// texture swizzles in the shaders like an uncompressed one. The blocks of a
+// level are encoded in parallel.
+class BlockCompressor
+{
+private:
+  ThreadPool* threadPool;
+  bool isOwnThreadPool;
+
+public:
+  enum Format
+  {
+    // 4 bits per texel, opaque 565 color with 4 shades per block
+    BC1,
+    // 8 bits per texel, BC1 color and 8 shades of alpha
+    BC3,
+    // 8 bits per texel, two channels of 8 shades: bytes 2 and 1 of the
+    // texels, the tangent and bitangent components of a normal map (red and
+    // green of a Format_ARGB32 image). The third is rebuilt when sampled.
+    BC5,
+    // 8 bits per texel, RGBA with 16 shades per block
+    BC7
+  };
+
+  // Endpoint search effort of BC7, BC1 to BC5 always take the same
+  enum Quality
+  {
+    // Endpoints from the principal axis of the block
+    FAST_QUALITY,
+    // Refined by least squares, with the best pair of shared bits
+    NORMAL_QUALITY,
+    // More refinement, then a search around the endpoints
+    SLOW_QUALITY
+  };
+
+  // Without a thread pool, one is created
+  BlockCompressor(ThreadPool* threadPool = nullptr);
+  ~BlockCompressor();
+
+  static int getBlockBytes(Format format);
+  static size_t getCompressedSize(Format format, int width, int height);
+
+  void compress(const unsigned char* texels,
+                int width,
+                int height,
+                Format format,
+                Quality quality,
+                CompressedLevel& level);
+
+  // Back to RGBA8, for the error of the encoding. BC5 rebuilds the third
+  // component of the normal in byte 0, and only the BC7 mode written by
+  // compress is decoded.
+  static void decompress(const CompressedLevel& level, Format format, std::vector<unsigned char>& texels);
+
+  // Peak signal to noise ratio in dB of the channels the format keeps,
+  // infinite for identical texels
+  static double computePSNR(const unsigned char* source,
+                            const unsigned char* decoded,
+                            int width,
+                            int height,
+                            Format format);
+};
+
+#endif // BLOCKCOMPRESSOR_H
@@ -0,0 +1,568 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <cfloat>
+
+#if defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define BVH_SSE2
+#endif
+
+const int BVH::NUM_BINS;
+const int BVH::MIN_BINS;
+const int BVH::MIN_SUBTREE_TRIANGLES;
+const float BVH::TRAVERSAL_COST = 1.0f;
+const float BVH::INTERSECTION_COST = 1.0f;
+
+// Bounds computed or refit by a single job
+static const int BOUNDS_BATCH = 4096;
+
+static inline BoundingBox emptyBounds()
+{
+  return { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+}
+
+static inline float surfaceArea(const BoundingBox& box)
+{
+  glm::vec3 d = glm::max(box.max - box.min, glm::vec3(0.0f));
+  return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+// Bounds of a SAH bin, the fourth lane is unused
+struct Bin
+{
+  alignas(16) float min[4];
+  alignas(16) float max[4];
+};
+
+static inline void clearBin(Bin& bin)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    bin.min[i] = FLT_MAX;
+    bin.max[i] = -FLT_MAX;
+  }
+}
+
+// min and max point at four floats
+static inline void growBin(Bin& bin, const float* min, const float* max)
+{
+#ifdef BVH_SSE2
+  _mm_store_ps(bin.min, _mm_min_ps(_mm_load_ps(bin.min), _mm_loadu_ps(min)));
+  _mm_store_ps(bin.max, _mm_max_ps(_mm_load_ps(bin.max), _mm_loadu_ps(max)));
+#else
+  for (int i = 0; i < 3; i++)
+  {
+    bin.min[i] = std::min(bin.min[i], min[i]);
+    bin.max[i] = std::max(bin.max[i], max[i]);
+  }
+#endif
+}
+
+static inline float binArea(const Bin& bin)
+{
+  float dx = std::max(bin.max[0] - bin.min[0], 0.0f);
+  float dy = std::max(bin.max[1] - bin.min[1], 0.0f);
+  float dz = std::max(bin.max[2] - bin.min[2], 0.0f);
+  return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+BVH::BVH(ThreadPool* threadPool)
+{
+  this->isOwnThreadPool = threadPool == nullptr;
+  this->threadPool = this->isOwnThreadPool ? new ThreadPool() : threadPool;
+}
+
+BVH::~BVH()
+{
+  if (this->isOwnThreadPool)
+  {
+    delete this->threadPool;
+  }
+}
+
+void BVH::build(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices)
+{
+  int numTriangles = (int) (indices.size() / 3);
+  this->references.resize(numTriangles);
+  int numBatches = (numTriangles + BOUNDS_BATCH - 1) / BOUNDS_BATCH;
+  this->threadPool->parallelFor(numBatches, [this, &positions, &indices, numTriangles](int batch)
+  {
+    for (int t = batch * BOUNDS_BATCH; t < std::min((batch + 1) * BOUNDS_BATCH, numTriangles); t++)
+    {
+      const glm::vec3& a = positions[indices[3 * t]];
+      const glm::vec3& b = positions[indices[3 * t + 1]];
+      const glm::vec3& c = positions[indices[3 * t + 2]];
+      this->references[t] = { glm::min(glm::min(a, b), c), (unsigned int) t, glm::max(glm::max(a, b), c), 0.0f };
+    }
+  });
+  this->buildReferences();
+}
+
+void BVH::build(const std::vector<BoundingBox>& bounds)
+{
+  int numPrimitives = (int) bounds.size();
+  this->references.resize(numPrimitives);
+  for (int i = 0; i < numPrimitives; i++)
+  {
+    this->references[i] = { bounds[i].min, (unsigned int) i, bounds[i].max, 0.0f };
+  }
+  this->buildReferences();
+}
+
+void BVH::buildReferences()
+{
+  int numTriangles = (int) this->references.size();
+  this->nodes.clear();
+  this->triangleOrder.resize(numTriangles);
+  if (numTriangles == 0)
+  {
+    return;
+  }
+
+  BoundingBox rootBounds = this->getRangeBounds(0, numTriangles);
+  this->nodes.push_back({ rootBounds.min, 0, rootBounds.max, 0 });
+
+  // The top of the tree on this thread, down to ranges small enough to be
+  // built by a single job
+  int minSubtreeTriangles = std::max(MIN_SUBTREE_TRIANGLES, numTriangles / (8 * this->threadPool->getNumThreads()));
+  std::vector<BuildTask> tasks;
+  this->buildNodes(this->nodes, 0, 0, numTriangles, minSubtreeTriangles, &tasks);
+
+  // Largest first, for a better balance
+  std::sort(tasks.begin(), tasks.end(), [](const BuildTask& a, const BuildTask& b)
+  {
+    return a.end - a.begin > b.end - b.begin;
+  });
+  this->threadPool->parallelFor((int) tasks.size(), [this, &tasks](int t)
+  {
+    BuildTask& task = tasks[t];
+    task.nodes.push_back(this->nodes[task.node]);
+    this->buildNodes(task.nodes, 0, task.begin, task.end, 0, nullptr);
+  });
+
+  // Local node i > 0 goes to offset + i, the local root replaces the task
+  // node. Appended after the top of the tree, children still follow their
+  // parent.
+  for (unsigned int t = 0; t < tasks.size(); t++)
+  {
+    BuildTask& task = tasks[t];
+    int offset = (int) this->nodes.size() - 1;
+    for (unsigned int i = 0; i < task.nodes.size(); i++)
+    {
+      BVHNode node = task.nodes[i];
+      if (node.numTriangles == 0)
+      {
+        node.first += offset;
+      }
+      if (i == 0)
+      {
+        this->nodes[task.node] = node;
+      }
+      else
+      {
+        this->nodes.push_back(node);
+      }
+    }
+  }
+
+  for (int i = 0; i < numTriangles; i++)
+  {
+    this->triangleOrder[i] = this->references[i].triangle;
+  }
+  this->references.clear();
+  this->references.shrink_to_fit();
+}
+
+void BVH::buildNodes(std::vector<BVHNode>& nodes, int root, int begin, int end, int minTriangles, std::vector<BuildTask>* tasks)
+{
+  struct Range
+  {
+    int node;
+    int begin;
+    int end;
+  };
+  std::vector<Range> stack;
+  stack.push_back({ root, begin, end });
+  while (!stack.empty())
+  {
+    Range range = stack.back();
+    stack.pop_back();
+
+    if (tasks && range.end - range.begin <= minTriangles)
+    {
+      tasks->push_back({ range.node, range.begin, range.end, std::vector<BVHNode>() });
+      continue;
+    }
+
+    BoundingBox bounds = { nodes[range.node].min, nodes[range.node].max };
+    BoundingBox leftBounds;
+    BoundingBox rightBounds;
+    int middle;
+    if (!this->splitRange(range.begin, range.end, bounds, middle, leftBounds, rightBounds))
+    {
+      nodes[range.node].first = range.begin;
+      nodes[range.node].numTriangles = range.end - range.begin;
+      continue;
+    }
+
+    int first = (int) nodes.size();
+    nodes[range.node].first = first;
+    nodes[range.node].numTriangles = 0;
+    nodes.push_back({ leftBounds.min, 0, leftBounds.max, 0 });
+    nodes.push_back({ rightBounds.min, 0, rightBounds.max, 0 });
+    stack.push_back({ first + 1, middle, range.end });
+    stack.push_back({ first, range.begin, middle });
+  }
+}
+
+bool BVH::splitRange(int begin,
+                     int end,
+                     const BoundingBox& bounds,
+                     int& middle,
+                     BoundingBox& leftBounds,
+                     BoundingBox& rightBounds)
+{
+  int count = end - begin;
+  if (count <= 1)
+  {
+    return false;
+  }
+
+  // Centroids are kept doubled, min + max
+  BuildReference* references = this->references.data();
+  Bin centroidBounds;
+  clearBin(centroidBounds);
+  for (int i = begin; i < end; i++)
+  {
+    float centroid[4];
+    for (int axis = 0; axis < 3; axis++)
+    {
+      centroid[axis] = references[i].min[axis] + references[i].max[axis];
+    }
+    centroid[3] = 0.0f;
+    growBin(centroidBounds, centroid, centroid);
+  }
+  glm::vec3 minCentroid(centroidBounds.min[0], centroidBounds.min[1], centroidBounds.min[2]);
+  glm::vec3 extent = glm::vec3(centroidBounds.max[0], centroidBounds.max[1], centroidBounds.max[2]) - minCentroid;
+
+  // Coincident centroids: only a median split of the order separates them
+  if (extent.x <= 0.0f && extent.y <= 0.0f && extent.z <= 0.0f)
+  {
+    if (count <= MAX_LEAF_TRIANGLES)
+    {
+      return false;
+    }
+    middle = begin + count / 2;
+    leftBounds = this->getRangeBounds(begin, middle);
+    rightBounds = this->getRangeBounds(middle, end);
+    return true;
+  }
+
+  // All three axes binned in one pass. Small ranges use fewer bins, as
+  // clearing and sweeping them would cost more than the binning itself.
+  int numBins = std::min(NUM_BINS, std::max(MIN_BINS, count));
+  float scale[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+  for (int axis = 0; axis < 3; axis++)
+  {
+    scale[axis] = extent[axis] > 0.0f ? numBins * (1.0f - FLT_EPSILON) / extent[axis] : 0.0f;
+  }
+  int binCounts[3][NUM_BINS] = {};
+  Bin bins[3][NUM_BINS];
+  for (int axis = 0; axis < 3; axis++)
+  {
+    for (int b = 0; b < numBins; b++)
+    {
+      clearBin(bins[axis][b]);
+    }
+  }
+#ifdef BVH_SSE2
+  __m128 binOrigin = _mm_setr_ps(minCentroid.x, minCentroid.y, minCentroid.z, 0.0f);
+  __m128 binScale = _mm_loadu_ps(scale);
+  __m128i lastBin = _mm_set1_epi32(numBins - 1);
+#endif
+  for (int i = begin; i < end; i++)
+  {
+    const float* min = &references[i].min.x;
+    const float* max = &references[i].max.x;
+    alignas(16) int bin[4];
+#ifdef BVH_SSE2
+    __m128 centroid = _mm_add_ps(_mm_loadu_ps(min), _mm_loadu_ps(max));
+    __m128i index = _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(centroid, binOrigin), binScale));
+    // No _mm_min_epi32 before SSE4.1
+    index = _mm_xor_si128(lastBin, _mm_and_si128(_mm_xor_si128(index, lastBin), _mm_cmplt_epi32(index, lastBin)));
+    _mm_store_si128((__m128i*) bin, index);
+#else
+    for (int axis = 0; axis < 3; axis++)
+    {
+      bin[axis] = std::min((int) ((min[axis] + max[axis] - minCentroid[axis]) * scale[axis]), numBins - 1);
+    }
+#endif
+    for (int axis = 0; axis < 3; axis++)
+    {
+      binCounts[axis][bin[axis]]++;
+      growBin(bins[axis][bin[axis]], min, max);
+    }
+  }
+
+  float bestCost = FLT_MAX;
+  int bestAxis = -1;
+  int bestSplit = 0;
+  float parentArea = std::max(surfaceArea(bounds), FLT_MIN);
+  for (int axis = 0; axis < 3; axis++)
+  {
+    if (extent[axis] <= 0.0f)
+    {
+      continue;
+    }
+
+    // Right side sweep first, then the left one evaluates every split
+    float rightCosts[NUM_BINS];
+    Bin sweep;
+    clearBin(sweep);
+    int sweepCount = 0;
+    for (int b = numBins - 1; b > 0; b--)
+    {
+      growBin(sweep, bins[axis][b].min, bins[axis][b].max);
+      sweepCount += binCounts[axis][b];
+      rightCosts[b] = sweepCount > 0 ? binArea(sweep) * sweepCount : -1.0f;
+    }
+    clearBin(sweep);
+    sweepCount = 0;
+    for (int b = 1; b < numBins; b++)
+    {
+      growBin(sweep, bins[axis][b - 1].min, bins[axis][b - 1].max);
+      sweepCount += binCounts[axis][b - 1];
+      if (sweepCount == 0 || rightCosts[b] < 0.0f)
+      {
+        continue;
+      }
+      float cost = TRAVERSAL_COST + INTERSECTION_COST * (binArea(sweep) * sweepCount + rightCosts[b]) / parentArea;
+      if (cost < bestCost)
+      {
+        bestCost = cost;
+        bestAxis = axis;
+        bestSplit = b;
+      }
+    }
+  }
+
+  if (bestAxis < 0 || (count <= MAX_LEAF_TRIANGLES && INTERSECTION_COST * count <= bestCost))
+  {
+    return false;
+  }
+
+  Bin left;
+  Bin right;
+  clearBin(left);
+  clearBin(right);
+  for (int b = 0; b < numBins; b++)
+  {
+    growBin(b < bestSplit ? left : right, bins[bestAxis][b].min, bins[bestAxis][b].max);
+  }
+  leftBounds = { glm::vec3(left.min[0], left.min[1], left.min[2]), glm::vec3(left.max[0], left.max[1], left.max[2]) };
+  rightBounds = { glm::vec3(right.min[0], right.min[1], right.min[2]), glm::vec3(right.max[0], right.max[1], right.max[2]) };
+
+  float axisScale = scale[bestAxis];
+  float axisMin = minCentroid[bestAxis];
+  middle = (int) (std::partition(references + begin, references + end, [bestAxis, bestSplit, axisScale, axisMin, numBins](const BuildReference& reference)
+  {
+    return std::min((int) ((reference.min[bestAxis] + reference.max[bestAxis] - axisMin) * axisScale), numBins - 1) < bestSplit;
+  }) - references);
+  return true;
+}
+
+BoundingBox BVH::getRangeBounds(int begin, int end)
+{
+  BoundingBox box = emptyBounds();
+  for (int i = begin; i < end; i++)
+  {
+    box.min = glm::min(box.min, this->references[i].min);
+    box.max = glm::max(box.max, this->references[i].max);
+  }
+  return box;
+}
+
+void BVH::refit(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices)
+{
+  // Leaves in parallel, then the inner nodes from the last one, as children
+  // always follow their parent
+  int numNodes = (int) this->nodes.size();
+  int numBatches = (numNodes + BOUNDS_BATCH - 1) / BOUNDS_BATCH;
+  this->threadPool->parallelFor(numBatches, [this, &positions, &indices, numNodes](int batch)
+  {
+    for (int n = batch * BOUNDS_BATCH; n < std::min((batch + 1) * BOUNDS_BATCH, numNodes); n++)
+    {
+      BVHNode& node = this->nodes[n];
+      if (node.numTriangles == 0)
+      {
+        continue;
+      }
+      node.min = glm::vec3(FLT_MAX);
+      node.max = glm::vec3(-FLT_MAX);
+      for (int i = node.first; i < node.first + node.numTriangles; i++)
+      {
+        unsigned int t = this->triangleOrder[i];
+        for (int k = 0; k < 3; k++)
+        {
+          node.min = glm::min(node.min, positions[indices[3 * t + k]]);
+          node.max = glm::max(node.max, positions[indices[3 * t + k]]);
+        }
+      }
+    }
+  });
+
+  for (int n = numNodes - 1; n >= 0; n--)
+  {
+    BVHNode& node = this->nodes[n];
+    if (node.numTriangles == 0)
+    {
+      const BVHNode& left = this->nodes[node.first];
+      const BVHNode& right = this->nodes[node.first + 1];
+      node.min = glm::min(left.min, right.min);
+      node.max = glm::max(left.max, right.max);
+    }
+  }
+}
+
+template<int WIDTH>
+void BVH::collapse(std::vector<WideBVHNode<WIDTH> >& wideNodes) const
+{
+  wideNodes.clear();
+  if (this->nodes.empty())
+  {
+    return;
+  }
+  this->collapseNode<WIDTH>(0, wideNodes);
+}
+
+template<int WIDTH>
+int BVH::collapseNode(int node, std::vector<WideBVHNode<WIDTH> >& wideNodes) const
+{
+  int index = (int) wideNodes.size();
+  wideNodes.push_back(WideBVHNode<WIDTH>());
+
+  // A leaf root ends up as the only child. Otherwise the inner child with
+  // the largest area is opened until there are WIDTH of them.
+  int children[WIDTH];
+  int numChildren = 0;
+  if (this->nodes[node].numTriangles > 0)
+  {
+    children[numChildren++] = node;
+  }
+  else
+  {
+    children[numChildren++] = this->nodes[node].first;
+    children[numChildren++] = this->nodes[node].first + 1;
+  }
+  while (numChildren < WIDTH)
+  {
+    int largest = -1;
+    float largestArea = -1.0f;
+    for (int i = 0; i < numChildren; i++)
+    {
+      const BVHNode& child = this->nodes[children[i]];
+      float area = surfaceArea({ child.min, child.max });
+      if (child.numTriangles == 0 && area > largestArea)
+      {
+        largest = i;
+        largestArea = area;
+      }
+    }
+    if (largest < 0)
+    {
+      break;
+    }
+    int opened = children[largest];
+    children[largest] = this->nodes[opened].first;
+    children[numChildren++] = this->nodes[opened].first + 1;
+  }
+
+  for (int i = 0; i < WIDTH; i++)
+  {
+    if (i >= numChildren)
+    {
+      WideBVHNode<WIDTH>& wide = wideNodes[index];
+      wide.minX[i] = wide.minY[i] = wide.minZ[i] = FLT_MAX;
+      wide.maxX[i] = wide.maxY[i] = wide.maxZ[i] = -FLT_MAX;
+      wide.child[i] = EMPTY_CHILD;
+      wide.numTriangles[i] = 0;
+      continue;
+    }
+
+    const BVHNode& child = this->nodes[children[i]];
+    int childIndex = child.numTriangles > 0 ? ~child.first : this->collapseNode<WIDTH>(children[i], wideNodes);
+    // After the recursion, which may have moved the wide nodes
+    WideBVHNode<WIDTH>& wide = wideNodes[index];
+    wide.minX[i] = child.min.x;
+    wide.minY[i] = child.min.y;
+    wide.minZ[i] = child.min.z;
+    wide.maxX[i] = child.max.x;
+    wide.maxY[i] = child.max.y;
+    wide.maxZ[i] = child.max.z;
+    wide.child[i] = childIndex;
+    wide.numTriangles[i] = child.numTriangles;
+  }
+  return index;
+}
+
+template void BVH::collapse<4>(std::vector<WideBVHNode<4> >& wideNodes) const;
+template void BVH::collapse<8>(std::vector<WideBVHNode<8> >& wideNodes) const;
+
+const std::vector<BVHNode>& BVH::getNodes() const
+{
+  return this->nodes;
+}
+
+const std::vector<unsigned int>& BVH::getTriangleOrder() const
+{
+  return this->triangleOrder;
+}
+
+float BVH::getSAHCost() const
+{
+  if (this->nodes.empty())
+  {
+    return 0.0f;
+  }
+  float rootArea = std::max(surfaceArea({ this->nodes[0].min, this->nodes[0].max }), FLT_MIN);
+  double cost = 0.0;
+  for (unsigned int n = 0; n < this->nodes.size(); n++)
+  {
+    const BVHNode& node = this->nodes[n];
+    float area = surfaceArea({ node.min, node.max }) / rootArea;
+    cost += node.numTriangles == 0 ? TRAVERSAL_COST * area : INTERSECTION_COST * node.numTriangles * area;
+  }
+  return (float) cost;
+}
+
+int BVH::getNumLeaves() const
+{
+  int numLeaves = 0;
+  for (unsigned int n = 0; n < this->nodes.size(); n++)
+  {
+    numLeaves += this->nodes[n].numTriangles > 0;
+  }
+  return numLeaves;
+}
+
+int BVH::getDepth() const
+{
+  if (this->nodes.empty())
+  {
+    return 0;
+  }
+  // Parents come first, so one forward pass gives every depth
+  std::vector<int> depths(this->nodes.size(), 1);
+  int depth = 1;
+  for (unsigned int n = 0; n < this->nodes.size(); n++)
+  {
+    const BVHNode& node = this->nodes[n];
+    if (node.numTriangles == 0)
+    {
+      depths[node.first] = depths[node.first + 1] = depths[n] + 1;
+    }
+    depth = std::max(depth, depths[n]);
+  }
+  return depth;
+}
@@ -0,0 +1,129 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "glm/glm.hpp"
+#include <vector>
+
+#include "frustumculler.h"
+#include "threadpool.h"
+
+// 32 bytes. The children of a node are stored next to each other, and
+// always after their parent.
+struct BVHNode
+{
+  glm::vec3 min;
+  // Inner node: index of the first child. Leaf: first entry of the
+  // triangle order.
+  int first;
+  glm::vec3 max;
+  // 0 for inner nodes
+  int numTriangles;
+};
+
+// Up to WIDTH children as SoA, so one SIMD test covers all of them
+template<int WIDTH>
+struct WideBVHNode
+{
+  float minX[WIDTH];
+  float minY[WIDTH];
+  float minZ[WIDTH];
+  float maxX[WIDTH];
+  float maxY[WIDTH];
+  float maxZ[WIDTH];
+  // >= 0: wide node index, < 0: ~first entry of the triangle order, with
+  // numTriangles[i] triangles. Empty slots are EMPTY_CHILD, with inverted
+  // bounds so no ray or box ever overlaps them.
+  int child[WIDTH];
+  int numTriangles[WIDTH];
+};
+
+// Bounding volume hierarchy over the triangles of a mesh, built with a
+// binned surface area heuristic. The top of the tree is split on the
+// calling thread, then the subtrees below are built in parallel.
+class BVH
+{
+private:
+  struct BuildTask
+  {
+    int node;
+    int begin;
+    int end;
+    // Built on its own, the local root is the task node
+    std::vector<BVHNode> nodes;
+  };
+
+  // Triangle bounds, moved around by the partitions so the binning reads
+  // them in order. 32 bytes, each corner loads as one vector.
+  struct BuildReference
+  {
+    glm::vec3 min;
+    unsigned int triangle;
+    glm::vec3 max;
+    float padding;
+  };
+
+  ThreadPool* threadPool;
+  bool isOwnThreadPool;
+
+  std::vector<BVHNode> nodes;
+  std::vector<unsigned int> triangleOrder;
+
+  // Only during the build, in the triangle order
+  std::vector<BuildReference> references;
+
+  // Partitions the range around the best binned split, false when it is
+  // better left as a leaf
+  bool splitRange(int begin,
+                  int end,
+                  const BoundingBox& bounds,
+                  int& middle,
+                  BoundingBox& leftBounds,
+                  BoundingBox& rightBounds);
+  // Splits down from the given root, children appended to nodes
+  void buildNodes(std::vector<BVHNode>& nodes, int root, int begin, int end, int minTriangles, std::vector<BuildTask>* tasks);
+  BoundingBox getRangeBounds(int begin, int end);
+  // Builds the tree over the references, already set
+  void buildReferences();
+
+  template<int WIDTH>
+  int collapseNode(int node, std::vector<WideBVHNode<WIDTH> >& wideNodes) const;
+
+public:
+  static const int NUM_BINS = 16;
+  static const int MIN_BINS = 4;
+  static const int MAX_LEAF_TRIANGLES = 8;
+  // Ranges under this size are built as a whole by a single job
+  static const int MIN_SUBTREE_TRIANGLES = 4096;
+  static const int EMPTY_CHILD = -2147483647 - 1;
+  // Relative costs of a node traversal and a triangle test
+  static const float TRAVERSAL_COST;
+  static const float INTERSECTION_COST;
+
+  // Without a thread pool, one is created
+  BVH(ThreadPool* threadPool = nullptr);
+  ~BVH();
+
+  // Three indices per triangle
+  void build(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices);
+  // Over arbitrary primitives, given by their bounds. The triangle order
+  // is then the primitive order.
+  void build(const std::vector<BoundingBox>& bounds);
+  // Same topology, moved vertices: only the bounds are updated
+  void refit(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices);
+
+  // The wide nodes are built from the binary ones, again after a refit.
+  // Wide node 0 is the root.
+  template<int WIDTH>
+  void collapse(std::vector<WideBVHNode<WIDTH> >& wideNodes) const;
+
+  const std::vector<BVHNode>& getNodes() const;
+  // Triangle of each entry, leaves refer to ranges of it
+  const std::vector<unsigned int>& getTriangleOrder() const;
+
+  // Expected cost of a random ray, relative to the root surface area
+  float getSAHCost() const;
+  int getNumLeaves() const;
+  int getDepth() const;
+};
+
+#endif // BVH_H
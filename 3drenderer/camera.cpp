@@ -45,6 +45,16 @@ glm::mat4x4 Camera::getProjectionMatrix()
                            this->zFar);
 }
 
+void Camera::getRay(glm::vec2 screenCoordinates, glm::vec3& origin, glm::vec3& direction)
+{
+  glm::mat4 inverseViewProjection = glm::inverse(this->getProjectionMatrix() * this->getViewMatrix());
+  glm::vec2 ndc = 2.0f * screenCoordinates / glm::vec2(this->width, this->height) - 1.0f;
+  glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndc, -1.0f, 1.0f);
+  glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndc, 1.0f, 1.0f);
+  origin = glm::vec3(nearPoint) / nearPoint.w;
+  direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
+}
+
 void Camera::zoomBy(float delta)
 {
   this->eye += 0.1f * (this->at - this->eye) * delta/abs(delta);
@@ -92,12 +102,21 @@ glm::vec3 Camera::arcballScreenCoordsToUnitSphere(glm::vec2 screenCoordinates)
 }
 
 void Camera::arcballMoveScreenCoordinates(glm::vec2 m1, glm::vec2 m2)
+{
+  this->arcballRotate(this->getArcballRotation(m1, m2));
+}
+
+glm::quat Camera::getArcballRotation(glm::vec2 m1, glm::vec2 m2)
 {
   glm::vec3 p1 = this->arcballScreenCoordsToUnitSphere(m1);
   glm::vec3 p2 = this->arcballScreenCoordsToUnitSphere(m2);
 
   glm::vec3 cross = glm::cross(p1, p2);
-  glm::quat q = glm::quat(glm::dot(p1, p2), cross.x, cross.y, cross.z);
+  return glm::quat(glm::dot(p1, p2), cross.x, cross.y, cross.z);
+}
+
+void Camera::arcballRotate(glm::quat q)
+{
   glm::mat4 R = glm::toMat4(q);
 
   glm::mat4 F = glm::translate(glm::lookAt(this->eye, this->at, this->up), this->eye - this->at);
@@ -36,10 +36,18 @@ public:
   glm::mat4x4 getViewMatrix();
   glm::mat4x4 getProjectionMatrix();
 
+  // Ray through a point of the viewport, in pixels from its bottom left
+  // corner. It starts on the near plane, with a unit direction.
+  void getRay(glm::vec2 screenCoordinates, glm::vec3& origin, glm::vec3& direction);
+
   void zoomBy(float delta);
   void cameraPan(glm::vec2 delta);
 
   void arcballMoveScreenCoordinates(glm::vec2 m1, glm::vec2 m2);
+  // Rotation of the arcball drag from m1 to m2, in the camera frame
+  glm::quat getArcballRotation(glm::vec2 m1, glm::vec2 m2);
+  // Orbits the camera by a rotation given in its own frame
+  void arcballRotate(glm::quat q);
 
 };
 
@@ -1,34 +1,92 @@
 #version 460 core
 
-uniform bool isWireframeOverwrite;
-uniform bool isEdgesVisible;
-uniform bool isFlatFaces;
-uniform bool isDiffuseTextureActive;
-uniform bool isBumpMapActive;
-
-uniform vec3 diffuseColor;
-uniform float materialShininess;
+layout( std140, binding = 1 ) uniform MaterialBlock
+{
+  bool isWireframeOverwrite;
+  bool isEdgesVisible;
+  bool isFlatFaces;
+  bool isDiffuseTextureActive;
+  bool isBumpMapActive;
+  bool isPackedVertexFormat;
+  bool isBumpMapTwoChannel;
+  bool isDiffuseTextureVirtual;
+};
+
+// Shader variants define the features as constants, the generic program
+// reads them from the material block
+#ifndef WIREFRAME_OVERWRITE
+  #define WIREFRAME_OVERWRITE isWireframeOverwrite
+#endif
+#ifndef EDGES_VISIBLE
+  #define EDGES_VISIBLE isEdgesVisible
+#endif
+#ifndef DIFFUSE_TEXTURE
+  #define DIFFUSE_TEXTURE isDiffuseTextureActive
+#endif
+#ifndef BUMP_MAP
+  #define BUMP_MAP isBumpMapActive
+#endif
 
 uniform sampler2D diffuseTextureSampler;
 uniform sampler2D bumpMapSampler;
 
+layout( std140, binding = 2 ) uniform VirtualTextureBlock
+{
+  // width, height, tile size, page size
+  ivec4 virtualSize;
+  // border, levels, physical texture size
+  ivec4 virtualLayout;
+  // xy: first page table entry of each level
+  ivec4 pageTableOffsets[16];
+};
+
+uniform sampler2D physicalPageSampler;
+uniform sampler2D pageTableSampler;
+
 in vec3 fragmentPositionVSpace;
 in vec3 fragmentNormalVSpace;
 in vec3 fragmentTangentVSpace;
 in vec3 fragmentBitangentVSpace;
 in vec3 fragmentTriangleCoordinate;
 in vec2 fragmentUV;
+in float fragmentOcclusion;
+// rgb: diffuse color, a: shininess
+flat in vec4 fragmentMaterial;
 
 out vec3 finalColor;
 
+// The page table entry of the page at the level of detail of the UV points
+// at the finest resident page under it, sampled in its slot
+vec4 sampleVirtualTexture(vec2 uv)
+{
+    vec2 dx = dFdx(uv * vec2(virtualSize.xy));
+    vec2 dy = dFdy(uv * vec2(virtualSize.xy));
+    float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-12));
+    int level = clamp(int(floor(lod)), 0, virtualLayout.y - 1);
+
+    uv = fract(uv);
+    ivec2 levelSize = max(virtualSize.xy >> level, ivec2(1));
+    ivec2 levelTiles = (levelSize + virtualSize.z - 1) / virtualSize.z;
+    ivec2 page = min(ivec2(uv * vec2(levelSize)) / virtualSize.z, levelTiles - 1);
+    ivec3 entry = ivec3(texelFetch(pageTableSampler, pageTableOffsets[level].xy + page, 0).xyz * 255.0 + 0.5);
+
+    // Levels round down, the last page of a level takes the leftover texels
+    ivec2 residentSize = max(virtualSize.xy >> entry.z, ivec2(1));
+    ivec2 residentTiles = (residentSize + virtualSize.z - 1) / virtualSize.z;
+    ivec2 residentPage = min(page >> (entry.z - level), residentTiles - 1);
+    vec2 inPage = uv * vec2(residentSize) - vec2(residentPage * virtualSize.z);
+    vec2 physical = (vec2(entry.xy * virtualSize.w + virtualLayout.x) + inPage) / float(virtualLayout.z);
+    return textureLod(physicalPageSampler, physical, 0.0);
+}
+
 void main()
 {
-    if((isWireframeOverwrite || isEdgesVisible) && (fragmentTriangleCoordinate.x < 0.01 || fragmentTriangleCoordinate.y < 0.01 || fragmentTriangleCoordinate.z < 0.01))
+    if((WIREFRAME_OVERWRITE || EDGES_VISIBLE) && (fragmentTriangleCoordinate.x < 0.01 || fragmentTriangleCoordinate.y < 0.01 || fragmentTriangleCoordinate.z < 0.01))
     {
         finalColor = vec3(1, 1, 1);
         return;
     }
-    if(isWireframeOverwrite)
+    if(WIREFRAME_OVERWRITE)
     {
         discard;
         return;
@@ -36,11 +94,16 @@ void main()
 
     vec3 lightPositionVSpace = vec3(0.0, 0.0, 0.0);
 
-    vec3 materialAmbient = diffuseColor;
-    vec3 materialDiffuse = diffuseColor;
+    vec3 materialAmbient = fragmentMaterial.rgb;
+    vec3 materialDiffuse = fragmentMaterial.rgb;
     vec3 materialSpecular = vec3(1.0, 1.0, 1.0);
 
-    if(isDiffuseTextureActive)
+    if(DIFFUSE_TEXTURE && isDiffuseTextureVirtual)
+    {
+      materialAmbient = sampleVirtualTexture(fragmentUV).bgr;
+      materialDiffuse = materialAmbient;
+    }
+    else if(DIFFUSE_TEXTURE)
     {
       materialAmbient = texture(diffuseTextureSampler, fragmentUV).bgr;
       materialDiffuse = texture(diffuseTextureSampler, fragmentUV).bgr;
@@ -50,9 +113,16 @@ void main()
     vec3 realN = N;
     vec3 L = normalize((lightPositionVSpace - fragmentPositionVSpace));
 
-    if(isBumpMapActive)
+    if(BUMP_MAP)
     {
-      vec3 bump = ((texture(bumpMapSampler, fragmentUV).bgr * 2.0) - 1.0);
+      vec4 texel = texture(bumpMapSampler, fragmentUV);
+      vec3 bump = ((texel.bgr * 2.0) - 1.0);
+      if(isBumpMapTwoChannel)
+      {
+        // BC5 keeps the tangent and bitangent components in red and green
+        bump.rg = (texel.rg * 2.0) - 1.0;
+        bump.b = sqrt(max(1.0 - dot(bump.rg, bump.rg), 0.0));
+      }
       N = bump.r * fragmentTangentVSpace +
           bump.g * fragmentBitangentVSpace +
           bump.b * fragmentNormalVSpace;
@@ -68,7 +138,7 @@ void main()
     }
 
     // AMBIENT
-    vec3 ambient = vec3(0.1, 0.1, 0.1) * materialAmbient;
+    vec3 ambient = vec3(0.1, 0.1, 0.1) * materialAmbient * fragmentOcclusion;
 
     // DIFUSE
     vec3 diffuse = incidence * materialDiffuse;
@@ -76,7 +146,7 @@ void main()
     // SPECULAR
     vec3 V = normalize((vec3(0.0, 0.0, 0.0) - fragmentPositionVSpace));
     vec3 H = normalize(L + V);
-    float specualarFactor = pow(max(dot(N,H),0.0), materialShininess);
+    float specualarFactor = pow(max(dot(N,H),0.0), fragmentMaterial.a);
     vec3 specular = specualarFactor * materialSpecular;
 
     finalColor = ambient + diffuse + specular;
@@ -0,0 +1,136 @@
+#include "framescheduler.h"
+
+#include <algorithm>
+
+FrameScheduler::FrameScheduler(QWidget* widget, unsigned int statisticsWindow)
+{
+  this->widget = widget;
+  this->isFramePending = false;
+  this->statisticsWindow = statisticsWindow > 0 ? statisticsWindow : 1;
+  this->frameTimes.reserve(this->statisticsWindow);
+  this->nextFrameTime = 0;
+  this->frameCount = 0;
+  this->coalescedEvents = 0;
+  this->clearInput();
+}
+
+void FrameScheduler::clearInput()
+{
+  this->hasArcballMove = false;
+  this->panDelta = glm::vec2(0.0f, 0.0f);
+  this->zoomSteps = 0;
+  this->pendingEvents = 0;
+}
+
+void FrameScheduler::addArcballMove(glm::quat rotation)
+{
+  // Each move is in the camera frame left by the previous ones, so the
+  // rotations compose in event order as if applied one at a time
+  this->arcballRotation = this->hasArcballMove ? this->arcballRotation * rotation : rotation;
+  this->hasArcballMove = true;
+  this->pendingEvents++;
+  this->requestFrame();
+}
+
+void FrameScheduler::addPan(glm::vec2 delta)
+{
+  this->panDelta += delta;
+  this->pendingEvents++;
+  this->requestFrame();
+}
+
+void FrameScheduler::addZoom(float delta)
+{
+  // Each wheel event zooms by a fixed step, whatever its delta
+  if(delta > 0.0f)
+  {
+    this->zoomSteps++;
+  }
+  else if(delta < 0.0f)
+  {
+    this->zoomSteps--;
+  }
+  this->pendingEvents++;
+  this->requestFrame();
+}
+
+void FrameScheduler::requestFrame()
+{
+  if(this->isFramePending)
+  {
+    return;
+  }
+  this->isFramePending = true;
+  this->widget->update();
+}
+
+void FrameScheduler::beginFrame()
+{
+  // Anything dirtied from now on needs another frame
+  this->isFramePending = false;
+  this->frameTimer.start();
+}
+
+void FrameScheduler::endFrame()
+{
+  float milliseconds = this->frameTimer.nsecsElapsed() / 1000000.0f;
+  if(this->frameTimes.size() < this->statisticsWindow)
+  {
+    this->frameTimes.push_back(milliseconds);
+  }
+  else
+  {
+    this->frameTimes[this->nextFrameTime] = milliseconds;
+  }
+  this->nextFrameTime = (this->nextFrameTime + 1) % this->statisticsWindow;
+  this->frameCount++;
+}
+
+bool FrameScheduler::applyInput(Camera* camera)
+{
+  if(this->pendingEvents == 0)
+  {
+    return false;
+  }
+
+  if(this->hasArcballMove)
+  {
+    camera->arcballRotate(this->arcballRotation);
+  }
+  if(this->panDelta != glm::vec2(0.0f, 0.0f))
+  {
+    camera->cameraPan(this->panDelta);
+  }
+  for(int i = 0; i < glm::abs(this->zoomSteps); i++)
+  {
+    camera->zoomBy(this->zoomSteps > 0 ? 1.0f : -1.0f);
+  }
+
+  this->coalescedEvents += this->pendingEvents - 1;
+  this->clearInput();
+  return true;
+}
+
+float FrameScheduler::getFrameTimePercentile(float percentile)
+{
+  if(this->frameTimes.empty())
+  {
+    return 0.0f;
+  }
+
+  std::vector<float> sorted = this->frameTimes;
+  percentile = glm::clamp(percentile, 0.0f, 100.0f);
+  size_t rank = (size_t) (percentile / 100.0f * (sorted.size() - 1) + 0.5f);
+  std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+  return sorted[rank];
+}
+
+unsigned int FrameScheduler::getFrameCount()
+{
+  return this->frameCount;
+}
+
+unsigned int FrameScheduler::getCoalescedEventCount()
+{
+  return this->coalescedEvents;
+}
@@ -0,0 +1,66 @@
+#ifndef FRAMESCHEDULER_H
+#define FRAMESCHEDULER_H
+
+#include <QWidget>
+#include <QElapsedTimer>
+
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "camera.h"
+
+// Render on demand pacing for a widget:
+//  - input events only accumulate deltas, the camera math runs once per
+//    frame when the frame applies them;
+//  - a repaint is requested when some state is dirty, and never more than
+//    one is in flight, so the paint rate follows the swap (vsync) rate.
+// It also keeps the CPU times of the last frames for statistics.
+class FrameScheduler
+{
+private:
+  QWidget* widget;
+  bool isFramePending;
+
+  // Input accumulated since the last frame
+  bool hasArcballMove;
+  // Product of the rotations of the moves, in the camera frame
+  glm::quat arcballRotation;
+  glm::vec2 panDelta;
+  int zoomSteps;
+  unsigned int pendingEvents;
+  unsigned int coalescedEvents;
+
+  // Frame times ring, in milliseconds
+  QElapsedTimer frameTimer;
+  std::vector<float> frameTimes;
+  unsigned int statisticsWindow;
+  unsigned int nextFrameTime;
+  unsigned int frameCount;
+public:
+  FrameScheduler(QWidget* widget, unsigned int statisticsWindow = 512);
+
+  // Rotation of one arcball event, from Camera::getArcballRotation
+  void addArcballMove(glm::quat rotation);
+  void addPan(glm::vec2 delta);
+  void addZoom(float delta);
+  void clearInput();
+
+  // Marks the widget dirty, at most one repaint is queued at a time
+  void requestFrame();
+
+  // Frame boundaries, to be called at the start and the end of paintGL
+  void beginFrame();
+  void endFrame();
+
+  // Applies the accumulated input to the camera, once per frame.
+  // Returns true when the camera changed.
+  bool applyInput(Camera* camera);
+
+  // Percentile (0 to 100) of the CPU frame times of the last frames, in ms
+  float getFrameTimePercentile(float percentile);
+  unsigned int getFrameCount();
+  // Input events merged into an earlier one of the same frame
+  unsigned int getCoalescedEventCount();
+};
+
+#endif // FRAMESCHEDULER_H
@@ -0,0 +1,310 @@
+#include "frustumculler.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define FRUSTUMCULLER_SSE2
+#endif
+
+FrustumCuller::FrustumCuller()
+{
+
+}
+
+void FrustumCuller::build(const std::vector<BoundingBox>& bounds)
+{
+  this->nodes.clear();
+  this->objects.resize(bounds.size());
+  this->centroids.resize(bounds.size());
+  for (unsigned int i = 0; i < bounds.size(); i++)
+  {
+    this->objects[i] = i;
+    this->centroids[i] = (bounds[i].min + bounds[i].max) * 0.5f;
+  }
+
+  if (!bounds.empty())
+  {
+    this->nodes.reserve(bounds.size() / 3 + 1);
+    this->buildNode(bounds, 0, (int) bounds.size());
+  }
+  this->lastRejectingPlane.assign(this->nodes.size(), 0);
+}
+
+int FrustumCuller::buildNode(const std::vector<BoundingBox>& bounds, int begin, int end)
+{
+  int index = (int) this->nodes.size();
+  this->nodes.push_back(CullNode());
+
+  // The largest range is split at its median until there are four of them,
+  // ranges stay in order so every subtree is contiguous in the objects array
+  int rangeBegin[4] = { begin };
+  int rangeEnd[4] = { end };
+  int numRanges = 1;
+  while (numRanges < 4)
+  {
+    int largest = -1;
+    for (int r = 0; r < numRanges; r++)
+    {
+      int size = rangeEnd[r] - rangeBegin[r];
+      if (size > 1 && (largest < 0 || size > rangeEnd[largest] - rangeBegin[largest]))
+      {
+        largest = r;
+      }
+    }
+    if (largest < 0)
+    {
+      break;
+    }
+
+    int b = rangeBegin[largest];
+    int e = rangeEnd[largest];
+    glm::vec3 centroidMin = this->centroids[this->objects[b]];
+    glm::vec3 centroidMax = centroidMin;
+    for (int i = b + 1; i < e; i++)
+    {
+      centroidMin = glm::min(centroidMin, this->centroids[this->objects[i]]);
+      centroidMax = glm::max(centroidMax, this->centroids[this->objects[i]]);
+    }
+    glm::vec3 extent = centroidMax - centroidMin;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+    int mid = (b + e) / 2;
+    const std::vector<glm::vec3>& centroids = this->centroids;
+    std::nth_element( this->objects.begin() + b,
+                      this->objects.begin() + mid,
+                      this->objects.begin() + e,
+                      [&centroids, axis](unsigned int o0, unsigned int o1)
+                      {
+                        return centroids[o0][axis] < centroids[o1][axis];
+                      });
+
+    for (int r = numRanges; r > largest + 1; r--)
+    {
+      rangeBegin[r] = rangeBegin[r - 1];
+      rangeEnd[r] = rangeEnd[r - 1];
+    }
+    rangeEnd[largest] = mid;
+    rangeBegin[largest + 1] = mid;
+    rangeEnd[largest + 1] = e;
+    numRanges++;
+  }
+
+  // Filled apart, the recursion can reallocate the nodes
+  CullNode node;
+  for (int lane = 0; lane < 4; lane++)
+  {
+    if (lane >= numRanges)
+    {
+      node.minX[lane] = node.minY[lane] = node.minZ[lane] = 0.0f;
+      node.maxX[lane] = node.maxY[lane] = node.maxZ[lane] = 0.0f;
+      node.child[lane] = 0;
+      node.firstObject[lane] = 0;
+      node.numObjects[lane] = 0;
+      continue;
+    }
+
+    BoundingBox box = bounds[this->objects[rangeBegin[lane]]];
+    for (int i = rangeBegin[lane] + 1; i < rangeEnd[lane]; i++)
+    {
+      box.min = glm::min(box.min, bounds[this->objects[i]].min);
+      box.max = glm::max(box.max, bounds[this->objects[i]].max);
+    }
+    node.minX[lane] = box.min.x;
+    node.minY[lane] = box.min.y;
+    node.minZ[lane] = box.min.z;
+    node.maxX[lane] = box.max.x;
+    node.maxY[lane] = box.max.y;
+    node.maxZ[lane] = box.max.z;
+    node.firstObject[lane] = rangeBegin[lane];
+    node.numObjects[lane] = rangeEnd[lane] - rangeBegin[lane];
+    if (node.numObjects[lane] == 1)
+    {
+      node.child[lane] = ~((int) this->objects[rangeBegin[lane]]);
+    }
+    else
+    {
+      node.child[lane] = this->buildNode(bounds, rangeBegin[lane], rangeEnd[lane]);
+    }
+  }
+  this->nodes[index] = node;
+  return index;
+}
+
+void FrustumCuller::emitSubtree(int first, int count, std::vector<unsigned int>& visible)
+{
+  visible.insert(visible.end(), this->objects.begin() + first, this->objects.begin() + first + count);
+}
+
+void FrustumCuller::cull(const glm::mat4& viewProjection, std::vector<unsigned int>& visible)
+{
+  visible.clear();
+  if (this->nodes.empty())
+  {
+    return;
+  }
+
+  glm::vec4 planes[NUM_PLANES];
+  FrustumCuller::extractPlanes(viewProjection, planes);
+
+  // Each entry carries the planes its subtree still has to be tested against
+  struct StackEntry
+  {
+    int node;
+    int planeMask;
+  };
+  StackEntry stack[256];
+  int stackSize = 0;
+  stack[stackSize++] = { 0, ALL_PLANES };
+
+  while (stackSize > 0)
+  {
+    StackEntry entry = stack[--stackSize];
+    const CullNode& node = this->nodes[entry.node];
+
+    int valid = 0;
+    for (int lane = 0; lane < 4; lane++)
+    {
+      valid |= (node.numObjects[lane] > 0) << lane;
+    }
+
+    int outside = 0;
+    int insideMasks[4] = { 0, 0, 0, 0 };
+    int firstPlane = this->lastRejectingPlane[entry.node];
+    for (int k = 0; k < NUM_PLANES; k++)
+    {
+      int p = (firstPlane + k) % NUM_PLANES;
+      if (!(entry.planeMask & (1 << p)))
+      {
+        continue;
+      }
+      const glm::vec4& plane = planes[p];
+
+      // The farthest corner along the normal decides if a box is outside,
+      // the nearest one if it is fully inside
+      int outsideBits = 0;
+      int insideBits = 0;
+#ifdef FRUSTUMCULLER_SSE2
+      __m128 nx = _mm_set1_ps(plane.x);
+      __m128 ny = _mm_set1_ps(plane.y);
+      __m128 nz = _mm_set1_ps(plane.z);
+      __m128 d = _mm_set1_ps(plane.w);
+      __m128 farDistance = _mm_add_ps(_mm_add_ps(
+                                        _mm_mul_ps(nx, _mm_loadu_ps(plane.x > 0.0f ? node.maxX : node.minX)),
+                                        _mm_mul_ps(ny, _mm_loadu_ps(plane.y > 0.0f ? node.maxY : node.minY))),
+                                      _mm_add_ps(
+                                        _mm_mul_ps(nz, _mm_loadu_ps(plane.z > 0.0f ? node.maxZ : node.minZ)),
+                                        d));
+      __m128 nearDistance = _mm_add_ps( _mm_add_ps(
+                                          _mm_mul_ps(nx, _mm_loadu_ps(plane.x > 0.0f ? node.minX : node.maxX)),
+                                          _mm_mul_ps(ny, _mm_loadu_ps(plane.y > 0.0f ? node.minY : node.maxY))),
+                                        _mm_add_ps(
+                                          _mm_mul_ps(nz, _mm_loadu_ps(plane.z > 0.0f ? node.minZ : node.maxZ)),
+                                          d));
+      outsideBits = _mm_movemask_ps(_mm_cmplt_ps(farDistance, _mm_setzero_ps()));
+      insideBits = _mm_movemask_ps(_mm_cmpge_ps(nearDistance, _mm_setzero_ps()));
+#else
+      for (int lane = 0; lane < 4; lane++)
+      {
+        float farDistance = plane.x * (plane.x > 0.0f ? node.maxX[lane] : node.minX[lane]) +
+                            plane.y * (plane.y > 0.0f ? node.maxY[lane] : node.minY[lane]) +
+                            plane.z * (plane.z > 0.0f ? node.maxZ[lane] : node.minZ[lane]) + plane.w;
+        float nearDistance = plane.x * (plane.x > 0.0f ? node.minX[lane] : node.maxX[lane]) +
+                             plane.y * (plane.y > 0.0f ? node.minY[lane] : node.maxY[lane]) +
+                             plane.z * (plane.z > 0.0f ? node.minZ[lane] : node.maxZ[lane]) + plane.w;
+        outsideBits |= (farDistance < 0.0f) << lane;
+        insideBits |= (nearDistance >= 0.0f) << lane;
+      }
+#endif
+
+      outside |= outsideBits;
+      for (int lane = 0; lane < 4; lane++)
+      {
+        insideMasks[lane] |= ((insideBits >> lane) & 1) << p;
+      }
+      if ((outside & valid) == valid)
+      {
+        this->lastRejectingPlane[entry.node] = (unsigned char) p;
+        break;
+      }
+    }
+
+    int hit = valid & ~outside;
+    for (int lane = 0; lane < 4; lane++)
+    {
+      if (!(hit & (1 << lane)))
+      {
+        continue;
+      }
+      int planeMask = entry.planeMask & ~insideMasks[lane];
+      if (node.child[lane] < 0)
+      {
+        visible.push_back((unsigned int) ~node.child[lane]);
+      }
+      else if (planeMask == 0)
+      {
+        this->emitSubtree(node.firstObject[lane], node.numObjects[lane], visible);
+      }
+      else
+      {
+        stack[stackSize++] = { node.child[lane], planeMask };
+      }
+    }
+  }
+}
+
+int FrustumCuller::getNumNodes()
+{
+  return (int) this->nodes.size();
+}
+
+void FrustumCuller::cullLinear( const std::vector<BoundingBox>& bounds,
+                                const glm::mat4& viewProjection,
+                                std::vector<unsigned int>& visible)
+{
+  visible.clear();
+  glm::vec4 planes[NUM_PLANES];
+  FrustumCuller::extractPlanes(viewProjection, planes);
+
+  for (unsigned int i = 0; i < bounds.size(); i++)
+  {
+    bool isOutside = false;
+    for (int p = 0; p < NUM_PLANES && !isOutside; p++)
+    {
+      glm::vec3 farCorner(planes[p].x > 0.0f ? bounds[i].max.x : bounds[i].min.x,
+                          planes[p].y > 0.0f ? bounds[i].max.y : bounds[i].min.y,
+                          planes[p].z > 0.0f ? bounds[i].max.z : bounds[i].min.z);
+      isOutside = glm::dot(glm::vec3(planes[p]), farCorner) + planes[p].w < 0.0f;
+    }
+    if (!isOutside)
+    {
+      visible.push_back(i);
+    }
+  }
+}
+
+void FrustumCuller::extractPlanes(const glm::mat4& viewProjection, glm::vec4 planes[NUM_PLANES])
+{
+  // Gribb-Hartmann, from the rows of the matrix (glm is column major)
+  glm::vec4 rows[4];
+  for (int r = 0; r < 4; r++)
+  {
+    rows[r] = glm::vec4(viewProjection[0][r], viewProjection[1][r], viewProjection[2][r], viewProjection[3][r]);
+  }
+  planes[0] = rows[3] + rows[0]; // left
+  planes[1] = rows[3] - rows[0]; // right
+  planes[2] = rows[3] + rows[1]; // bottom
+  planes[3] = rows[3] - rows[1]; // top
+  planes[4] = rows[3] + rows[2]; // near
+  planes[5] = rows[3] - rows[2]; // far
+}
+
+BoundingBox FrustumCuller::transformBounds(const BoundingBox& box, const glm::mat4& transform)
+{
+  glm::vec3 center = glm::vec3(transform * glm::vec4((box.min + box.max) * 0.5f, 1.0f));
+  glm::vec3 halfExtent = (box.max - box.min) * 0.5f;
+  glm::vec3 extent =  glm::abs(glm::vec3(transform[0])) * halfExtent.x +
+                      glm::abs(glm::vec3(transform[1])) * halfExtent.y +
+                      glm::abs(glm::vec3(transform[2])) * halfExtent.z;
+  return { center - extent, center + extent };
+}
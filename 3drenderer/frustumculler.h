@@ -0,0 +1,71 @@
+#ifndef FRUSTUMCULLER_H
+#define FRUSTUMCULLER_H
+
+#include "glm/glm.hpp"
+#include <vector>
+
+struct BoundingBox
+{
+  glm::vec3 min;
+  glm::vec3 max;
+};
+
+// Four children per node, stored as SoA so one SIMD test covers all of them
+struct CullNode
+{
+  float minX[4];
+  float minY[4];
+  float minZ[4];
+  float maxX[4];
+  float maxY[4];
+  float maxZ[4];
+  // >= 0: inner node index, < 0: ~object index
+  int child[4];
+  // Objects below each child, a range of the objects array
+  int firstObject[4];
+  int numObjects[4];
+};
+
+// Frustum culling of object bounds over a 4-wide BVH. Children fully inside
+// a plane drop it for their whole subtree, and each node starts with the
+// plane that rejected its children last time (coherency between frames).
+class FrustumCuller
+{
+private:
+  std::vector<CullNode> nodes;
+  std::vector<unsigned int> objects;
+  std::vector<glm::vec3> centroids;
+  // Plane cache, one entry per node
+  std::vector<unsigned char> lastRejectingPlane;
+
+  int buildNode(const std::vector<BoundingBox>& bounds, int begin, int end);
+  void emitSubtree(int first, int count, std::vector<unsigned int>& visible);
+
+public:
+  enum
+  {
+    NUM_PLANES = 6,
+    ALL_PLANES = (1 << NUM_PLANES) - 1
+  };
+
+  FrustumCuller();
+
+  void build(const std::vector<BoundingBox>& bounds);
+
+  // Indices of the objects intersecting the frustum, in no particular order
+  void cull(const glm::mat4& viewProjection, std::vector<unsigned int>& visible);
+
+  int getNumNodes();
+
+  // Reference version, every box against every plane
+  static void cullLinear( const std::vector<BoundingBox>& bounds,
+                          const glm::mat4& viewProjection,
+                          std::vector<unsigned int>& visible);
+
+  // Inward facing planes (xyz: normal, w: distance), not normalized
+  static void extractPlanes(const glm::mat4& viewProjection, glm::vec4 planes[NUM_PLANES]);
+
+  static BoundingBox transformBounds(const BoundingBox& box, const glm::mat4& transform);
+};
+
+#endif // FRUSTUMCULLER_H
@@ -8,6 +8,8 @@ in vec3 vertexNormalVSpace[];
 in vec3 vertexTangentVSpace[];
 in vec3 vertexBitangentVSpace[];
 in vec2 vertexTextureVSpace[];
+in float vertexOcclusion[];
+flat in vec4 vertexMaterial[];
 
 out vec3 fragmentPositionVSpace;
 out vec3 fragmentNormalVSpace;
@@ -15,6 +17,8 @@ out vec3 fragmentTangentVSpace;
 out vec3 fragmentBitangentVSpace;
 out vec3 fragmentTriangleCoordinate;
 out vec2 fragmentUV;
+out float fragmentOcclusion;
+flat out vec4 fragmentMaterial;
 
 void main()
 {
@@ -26,6 +30,8 @@ void main()
     fragmentTangentVSpace = vertexTangentVSpace[0];
     fragmentBitangentVSpace = vertexBitangentVSpace[0];
     fragmentUV = vertexTextureVSpace[0];
+    fragmentOcclusion = vertexOcclusion[0];
+    fragmentMaterial = vertexMaterial[0];
     EmitVertex();
 
     gl_Position = gl_in[1].gl_Position;
@@ -35,6 +41,8 @@ void main()
     fragmentTangentVSpace = vertexTangentVSpace[1];
     fragmentBitangentVSpace = vertexBitangentVSpace[1];
     fragmentUV = vertexTextureVSpace[1];
+    fragmentOcclusion = vertexOcclusion[1];
+    fragmentMaterial = vertexMaterial[1];
     EmitVertex();
 
     gl_Position = gl_in[2].gl_Position;
@@ -44,6 +52,8 @@ void main()
     fragmentTangentVSpace = vertexTangentVSpace[2];
     fragmentBitangentVSpace = vertexBitangentVSpace[2];
     fragmentUV = vertexTextureVSpace[2];
+    fragmentOcclusion = vertexOcclusion[2];
+    fragmentMaterial = vertexMaterial[2];
     EmitVertex();
 
     EndPrimitive();
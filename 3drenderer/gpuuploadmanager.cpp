@@ -0,0 +1,198 @@
+#include "gpuuploadmanager.h"
+
+#include <cstring>
+
+GPUUploadManager::GPUUploadManager( QOpenGLFunctions_4_5_Core* gl,
+                                    size_t blockSize,
+                                    size_t ringCapacity)
+{
+  this->gl = gl;
+  this->blockSize = blockSize;
+  this->ringCapacity = ringCapacity;
+  this->ringHead = 0;
+  this->ringTail = 0;
+  this->stagedBytes = 0;
+
+  this->isMapped = this->createStorage(ringCapacity, &(this->ringBuffer), &(this->ringPointer));
+}
+
+GPUUploadManager::~GPUUploadManager()
+{
+  while(!this->fences.empty())
+  {
+    this->gl->glDeleteSync(this->fences.front().fence);
+    this->fences.pop_front();
+  }
+
+  for(unsigned int i = 0; i < this->blocks.size(); i++)
+  {
+    this->gl->glBindBuffer(GL_COPY_WRITE_BUFFER, this->blocks[i].buffer);
+    this->gl->glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    this->gl->glDeleteBuffers(1, &(this->blocks[i].buffer));
+    delete this->blocks[i].allocator;
+  }
+
+  if(this->isMapped)
+  {
+    this->gl->glBindBuffer(GL_COPY_WRITE_BUFFER, this->ringBuffer);
+    this->gl->glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    this->gl->glDeleteBuffers(1, &(this->ringBuffer));
+  }
+}
+
+bool GPUUploadManager::createStorage(size_t size, unsigned int* buffer, unsigned char** pointer)
+{
+  const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+  this->gl->glGenBuffers(1, buffer);
+  this->gl->glBindBuffer(GL_COPY_WRITE_BUFFER, *buffer);
+  this->gl->glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+  *pointer = (unsigned char*) this->gl->glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+
+  if(!*pointer)
+  {
+    this->gl->glDeleteBuffers(1, buffer);
+    *buffer = 0;
+    return false;
+  }
+  return true;
+}
+
+bool GPUUploadManager::isValid() const
+{
+  return this->isMapped;
+}
+
+UploadRange GPUUploadManager::allocate(size_t size, size_t alignment)
+{
+  for(unsigned int i = 0; i < this->blocks.size(); i++)
+  {
+    size_t offset = this->blocks[i].allocator->allocate(size, alignment);
+    if(offset != RangeAllocator::INVALID_OFFSET)
+    {
+      return { this->blocks[i].buffer, offset, size, this->blocks[i].pointer + offset, (int) i };
+    }
+  }
+
+  // The existing blocks are full, only then new storage is created
+  Block block;
+  size_t capacity = size > this->blockSize ? size : this->blockSize;
+  if(!this->createStorage(capacity, &(block.buffer), &(block.pointer)))
+  {
+    return { 0, 0, 0, nullptr, -1 };
+  }
+  block.allocator = new RangeAllocator(capacity);
+  this->blocks.push_back(block);
+
+  size_t offset = block.allocator->allocate(size, alignment);
+  return { block.buffer, offset, size, block.pointer + offset, (int) this->blocks.size() - 1 };
+}
+
+void GPUUploadManager::release(UploadRange& range)
+{
+  if(range.block < 0)
+  {
+    return;
+  }
+  this->pendingReleases.push_back(range);
+  range = { 0, 0, 0, nullptr, -1 };
+}
+
+void GPUUploadManager::update(const UploadRange& range, const void* data, size_t size, size_t offset)
+{
+  const unsigned char* source = (const unsigned char*) data;
+
+  this->gl->glBindBuffer(GL_COPY_READ_BUFFER, this->ringBuffer);
+  this->gl->glBindBuffer(GL_COPY_WRITE_BUFFER, range.buffer);
+
+  // Big updates are split in ring sized chunks
+  size_t maxChunk = this->ringCapacity / 2;
+  while(size > 0)
+  {
+    size_t chunk = size < maxChunk ? size : maxChunk;
+    size_t ringOffset = this->allocateRing(chunk);
+
+    memcpy(this->ringPointer + ringOffset, source, chunk);
+    this->gl->glCopyBufferSubData(GL_COPY_READ_BUFFER,
+                                  GL_COPY_WRITE_BUFFER,
+                                  ringOffset,
+                                  range.offset + offset,
+                                  chunk);
+    source += chunk;
+    offset += chunk;
+    size -= chunk;
+    this->stagedBytes += chunk;
+  }
+}
+
+size_t GPUUploadManager::allocateRing(size_t size)
+{
+  const size_t alignment = 16;
+  size = (size + alignment - 1) / alignment * alignment;
+
+  // Allocations never wrap around the end of the ring
+  size_t physical = this->ringHead % this->ringCapacity;
+  size_t skip = physical + size > this->ringCapacity ? this->ringCapacity - physical : 0;
+
+  while(this->ringHead + skip + size - this->ringTail > this->ringCapacity)
+  {
+    if(this->fences.empty())
+    {
+      // Everything written so far belongs to the current frame
+      this->endFrame();
+    }
+    this->retireOldestFence();
+  }
+
+  this->ringHead += skip;
+  size_t offset = this->ringHead % this->ringCapacity;
+  this->ringHead += size;
+  return offset;
+}
+
+void GPUUploadManager::retireOldestFence()
+{
+  FrameFence& oldest = this->fences.front();
+
+  GLenum status = this->gl->glClientWaitSync(oldest.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+  while(status == GL_TIMEOUT_EXPIRED)
+  {
+    status = this->gl->glClientWaitSync(oldest.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+  }
+  this->gl->glDeleteSync(oldest.fence);
+
+  this->ringTail = oldest.ringHead;
+  for(unsigned int i = 0; i < oldest.releasedRanges.size(); i++)
+  {
+    UploadRange& range = oldest.releasedRanges[i];
+    this->blocks[range.block].allocator->free(range.offset);
+  }
+  this->fences.pop_front();
+}
+
+void GPUUploadManager::endFrame()
+{
+  FrameFence frame;
+  frame.fence = this->gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  frame.ringHead = this->ringHead;
+  frame.releasedRanges.swap(this->pendingReleases);
+  this->fences.push_back(frame);
+
+  // Recycles whatever the GPU is already done with, without waiting
+  while(this->fences.size() > 1)
+  {
+    GLenum status = this->gl->glClientWaitSync(this->fences.front().fence, 0, 0);
+    if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+    {
+      break;
+    }
+    this->retireOldestFence();
+  }
+}
+
+size_t GPUUploadManager::takeStagedBytes()
+{
+  size_t bytes = this->stagedBytes;
+  this->stagedBytes = 0;
+  return bytes;
+}
@@ -0,0 +1,95 @@
+#ifndef GPUUPLOADMANAGER_H
+#define GPUUPLOADMANAGER_H
+
+#include <QOpenGLFunctions_4_5_Core>
+
+#include <vector>
+#include <deque>
+
+#include "rangeallocator.h"
+
+// Suballocation of one of the manager's buffers
+struct UploadRange
+{
+  unsigned int buffer;
+  size_t offset;
+  size_t size;
+  // persistently mapped address of the range, valid while it is allocated
+  unsigned char* pointer;
+  int block;
+};
+
+// Uploads built on immutable storage (glBufferStorage) persistently and
+// coherently mapped:
+//  - mesh data is suballocated from large blocks, so reloads never
+//    reallocate GPU storage, and fresh ranges are written straight through
+//    their mapped pointer;
+//  - ranges the GPU may still be reading are updated through a streaming
+//    ring buffer and glCopyBufferSubData. The ring is guarded by one fence
+//    per frame, which also delays the reuse of released ranges.
+// Only needs a current GL 4.4 context, so it runs headless as well.
+class GPUUploadManager
+{
+private:
+  struct Block
+  {
+    unsigned int buffer;
+    unsigned char* pointer;
+    RangeAllocator* allocator;
+  };
+
+  struct FrameFence
+  {
+    GLsync fence;
+    // ring position when the fence was inserted
+    unsigned long long ringHead;
+    std::vector<UploadRange> releasedRanges;
+  };
+
+  QOpenGLFunctions_4_5_Core* gl;
+
+  size_t blockSize;
+  std::vector<Block> blocks;
+
+  unsigned int ringBuffer;
+  unsigned char* ringPointer;
+  size_t ringCapacity;
+  // monotonic positions, the physical offset is position % ringCapacity
+  unsigned long long ringHead;
+  unsigned long long ringTail;
+
+  std::deque<FrameFence> fences;
+  std::vector<UploadRange> pendingReleases;
+
+  size_t stagedBytes;
+  bool isMapped;
+
+  bool createStorage(size_t size, unsigned int* buffer, unsigned char** pointer);
+  void retireOldestFence();
+  size_t allocateRing(size_t size);
+public:
+  GPUUploadManager( QOpenGLFunctions_4_5_Core* gl,
+                    size_t blockSize = 64 << 20,
+                    size_t ringCapacity = 16 << 20);
+  ~GPUUploadManager();
+
+  // False when the driver could not map the ring, the manager is unusable
+  bool isValid() const;
+
+  // New range, safe to write through its pointer right away. The block is
+  // -1 and the pointer null when no new storage could be mapped.
+  UploadRange allocate(size_t size, size_t alignment = 16);
+  // The range is recycled once the frames that may use it are done
+  void release(UploadRange& range);
+
+  // Overwrites a range that may be in use by the GPU
+  void update(const UploadRange& range, const void* data, size_t size, size_t offset = 0);
+
+  // Fences the frame, to be called after its last draw
+  void endFrame();
+
+  // Bytes that went through the ring since the last call
+  size_t takeStagedBytes();
+};
+
+#endif // GPUUPLOADMANAGER_H
@@ -0,0 +1,198 @@
+#include "heightmapconverter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#if defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define HEIGHTMAPCONVERTER_SSE2
+#endif
+
+const int HeightMapConverter::BAND_HEIGHT;
+const int HeightMapConverter::GRAY_TOLERANCE;
+
+// Heights are the sum of the three color channels
+static const float MAX_HEIGHT = 765.0f;
+
+// Sum of the color channels of a row, with a wrapped texel on each side:
+// heights[-1] and heights[width] are valid
+static void loadHeights(const unsigned char* row, int width, float* heights)
+{
+  int x = 0;
+#ifdef HEIGHTMAPCONVERTER_SSE2
+  // b + g and r of each texel are added by madd, then the pairs
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i channels = _mm_set_epi16(0, 1, 1, 1, 0, 1, 1, 1);
+  for (; x + 4 <= width; x += 4)
+  {
+    __m128i texels = _mm_loadu_si128((const __m128i*) (row + 4 * x));
+    __m128i low = _mm_madd_epi16(_mm_unpacklo_epi8(texels, zero), channels);
+    __m128i high = _mm_madd_epi16(_mm_unpackhi_epi8(texels, zero), channels);
+    __m128 even = _mm_shuffle_ps(_mm_castsi128_ps(low), _mm_castsi128_ps(high), _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 odd = _mm_shuffle_ps(_mm_castsi128_ps(low), _mm_castsi128_ps(high), _MM_SHUFFLE(3, 1, 3, 1));
+    __m128i sums = _mm_add_epi32(_mm_castps_si128(even), _mm_castps_si128(odd));
+    _mm_storeu_ps(heights + x, _mm_cvtepi32_ps(sums));
+  }
+#endif
+  for (; x < width; x++)
+  {
+    heights[x] = (float) (row[4 * x] + row[4 * x + 1] + row[4 * x + 2]);
+  }
+  heights[-1] = heights[width - 1];
+  heights[width] = heights[0];
+}
+
+// The normal of one texel, same operations in the same order as the SIMD
+// rows so both give the same bytes
+static inline void convertTexel(const float* up,
+                                const float* middle,
+                                const float* down,
+                                int x,
+                                float side,
+                                float center,
+                                float scale,
+                                unsigned char* output)
+{
+  float gx = side * (up[x + 1] - up[x - 1]) + center * (middle[x + 1] - middle[x - 1]) + side * (down[x + 1] - down[x - 1]);
+  float gy = side * (down[x - 1] - up[x - 1]) + center * (down[x] - up[x]) + side * (down[x + 1] - up[x + 1]);
+  float nx = gx * scale;
+  float ny = gy * scale;
+  float inverseLength = 1.0f / std::sqrt(nx * nx + ny * ny + 1.0f);
+  output[0] = (unsigned char) (int) (inverseLength * 127.5f + 128.0f);
+  output[1] = (unsigned char) (int) (ny * inverseLength * 127.5f + 128.0f);
+  output[2] = (unsigned char) (int) (nx * inverseLength * 127.5f + 128.0f);
+  output[3] = 255;
+}
+
+static void convertRow(const float* up,
+                       const float* middle,
+                       const float* down,
+                       int width,
+                       float side,
+                       float center,
+                       float scale,
+                       unsigned char* output)
+{
+  int x = 0;
+#ifdef HEIGHTMAPCONVERTER_SSE2
+  const __m128 sides = _mm_set1_ps(side);
+  const __m128 centers = _mm_set1_ps(center);
+  const __m128 scales = _mm_set1_ps(scale);
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 half = _mm_set1_ps(127.5f);
+  const __m128 offset = _mm_set1_ps(128.0f);
+  const __m128i alpha = _mm_set1_epi32((int) 0xff000000u);
+  for (; x + 4 <= width; x += 4)
+  {
+    __m128 upLeft = _mm_loadu_ps(up + x - 1);
+    __m128 upCenter = _mm_loadu_ps(up + x);
+    __m128 upRight = _mm_loadu_ps(up + x + 1);
+    __m128 downLeft = _mm_loadu_ps(down + x - 1);
+    __m128 downCenter = _mm_loadu_ps(down + x);
+    __m128 downRight = _mm_loadu_ps(down + x + 1);
+    __m128 middleLeft = _mm_loadu_ps(middle + x - 1);
+    __m128 middleRight = _mm_loadu_ps(middle + x + 1);
+
+    __m128 gx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(sides, _mm_sub_ps(upRight, upLeft)),
+                                      _mm_mul_ps(centers, _mm_sub_ps(middleRight, middleLeft))),
+                           _mm_mul_ps(sides, _mm_sub_ps(downRight, downLeft)));
+    __m128 gy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(sides, _mm_sub_ps(downLeft, upLeft)),
+                                      _mm_mul_ps(centers, _mm_sub_ps(downCenter, upCenter))),
+                           _mm_mul_ps(sides, _mm_sub_ps(downRight, upRight)));
+    __m128 nx = _mm_mul_ps(gx, scales);
+    __m128 ny = _mm_mul_ps(gy, scales);
+    __m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), one)));
+
+    __m128i n = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(inverseLength, half), offset));
+    __m128i b = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(ny, inverseLength), half), offset));
+    __m128i t = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(nx, inverseLength), half), offset));
+    __m128i texels = _mm_or_si128(_mm_or_si128(n, _mm_slli_epi32(b, 8)), _mm_or_si128(_mm_slli_epi32(t, 16), alpha));
+    _mm_storeu_si128((__m128i*) (output + 4 * x), texels);
+  }
+#endif
+  for (; x < width; x++)
+  {
+    convertTexel(up, middle, down, x, side, center, scale, output + 4 * x);
+  }
+}
+
+HeightMapConverter::HeightMapConverter(ThreadPool* threadPool)
+{
+  this->isOwnThreadPool = threadPool == nullptr;
+  this->threadPool = this->isOwnThreadPool ? new ThreadPool() : threadPool;
+}
+
+HeightMapConverter::~HeightMapConverter()
+{
+  if (this->isOwnThreadPool)
+  {
+    delete this->threadPool;
+  }
+}
+
+bool HeightMapConverter::isHeightMap(const unsigned char* texels, int width, int height)
+{
+  // A few colored texels are allowed, JPEG blocks around sharp edges
+  size_t numTexels = (size_t) width * height;
+  size_t maxColored = numTexels / 100;
+  size_t colored = 0;
+  for (size_t i = 0; i < numTexels; i++)
+  {
+    const unsigned char* texel = texels + 4 * i;
+    int minChannel = std::min(std::min(texel[0], texel[1]), texel[2]);
+    int maxChannel = std::max(std::max(texel[0], texel[1]), texel[2]);
+    if (maxChannel - minChannel > GRAY_TOLERANCE && ++colored > maxColored)
+    {
+      return false;
+    }
+  }
+  return numTexels > 0;
+}
+
+void HeightMapConverter::convert(const unsigned char* texels,
+                                 int width,
+                                 int height,
+                                 float strength,
+                                 Kernel kernel,
+                                 std::vector<unsigned char>& normals)
+{
+  normals.resize((size_t) width * height * 4);
+  if (width <= 0 || height <= 0)
+  {
+    return;
+  }
+
+  // Normalized to the slope per texel: the weights sum, times the two
+  // texels between the taps. Positive slopes tilt the normal back.
+  float side = kernel == SCHARR_KERNEL ? 3.0f : 1.0f;
+  float center = kernel == SCHARR_KERNEL ? 10.0f : 2.0f;
+  float scale = -strength / (MAX_HEIGHT * 2.0f * (2.0f * side + center));
+
+  // Bands own their rows and load the heights of the rows around them
+  int numBands = (height + BAND_HEIGHT - 1) / BAND_HEIGHT;
+  unsigned char* output = normals.data();
+  this->threadPool->parallelFor(numBands, [&](int band)
+  {
+    int firstRow = band * BAND_HEIGHT;
+    int numRows = std::min(BAND_HEIGHT, height - firstRow);
+    int stride = width + 2;
+    std::vector<float> heights((size_t) (numRows + 2) * stride);
+    for (int r = 0; r < numRows + 2; r++)
+    {
+      int y = ((firstRow + r - 1) % height + height) % height;
+      loadHeights(texels + (size_t) y * width * 4, width, &heights[(size_t) r * stride + 1]);
+    }
+    for (int r = 0; r < numRows; r++)
+    {
+      convertRow(&heights[(size_t) r * stride + 1],
+                 &heights[(size_t) (r + 1) * stride + 1],
+                 &heights[(size_t) (r + 2) * stride + 1],
+                 width,
+                 side,
+                 center,
+                 scale,
+                 output + (size_t) (firstRow + r) * width * 4);
+    }
+  });
+}
@@ -0,0 +1,53 @@
+#ifndef HEIGHTMAPCONVERTER_H
+#define HEIGHTMAPCONVERTER_H
+
+#include <vector>
+
+#include "threadpool.h"
+
+// Tangent space normal maps from grayscale height maps, so bump textures
+// of either kind shade the same. The slopes come from a 3x3 derivative
+// kernel wrapping around the edges like the repeating texture, and the
+// normals are written in the byte order the fragment shader reads: the
+// tangent component in byte 2, the bitangent one in byte 1 and the normal
+// one in byte 0, alpha 255.
+class HeightMapConverter
+{
+private:
+  ThreadPool* threadPool;
+  bool isOwnThreadPool;
+
+public:
+  enum Kernel
+  {
+    // 1 2 1 smoothing across the slope
+    SOBEL_KERNEL,
+    // 3 10 3, closer to rotation invariant
+    SCHARR_KERNEL
+  };
+
+  // Rows converted by a single job
+  static const int BAND_HEIGHT = 32;
+  // Channels further apart than this make a texel colored
+  static const int GRAY_TOLERANCE = 8;
+
+  // Without a thread pool, one is created
+  HeightMapConverter(ThreadPool* threadPool = nullptr);
+  ~HeightMapConverter();
+
+  // True when the RGBA8 texels are gray, up to the chroma noise of lossy
+  // files: a normal map is never gray, its flat texels are blue
+  static bool isHeightMap(const unsigned char* texels, int width, int height);
+
+  // Normals of the heights, the average of the color channels. The
+  // strength is the height of a full white texel over a black one, in
+  // texels: higher makes steeper bumps.
+  void convert(const unsigned char* texels,
+               int width,
+               int height,
+               float strength,
+               Kernel kernel,
+               std::vector<unsigned char>& normals);
+};
+
+#endif // HEIGHTMAPCONVERTER_H
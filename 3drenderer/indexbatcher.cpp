@@ -0,0 +1,88 @@
+#include "indexbatcher.h"
+
+IndexBatcher::IndexBatcher()
+{
+
+}
+
+void IndexBatcher::build( const std::vector<unsigned int>& indices,
+                          unsigned int numVertices,
+                          std::vector<unsigned short>& shortIndices,
+                          std::vector<unsigned int>& vertexRemap,
+                          std::vector<Submesh>& submeshes)
+{
+  shortIndices.clear();
+  vertexRemap.clear();
+  submeshes.clear();
+
+  if (indices.empty())
+  {
+    return;
+  }
+
+  shortIndices.reserve(indices.size());
+
+  // Everything fits in a single batch
+  if (numVertices <= MAX_BATCH_VERTICES)
+  {
+    for (unsigned int i = 0; i < indices.size(); i++)
+    {
+      shortIndices.push_back((unsigned short) indices[i]);
+    }
+    submeshes.push_back({ 0, (unsigned int) indices.size(), 0 });
+    return;
+  }
+
+  // Greedy split: triangles are appended to the current batch until one of
+  // them would need a vertex past the 16-bit range.
+  // localIndex[v] is only valid when batchOf[v] is the current batch.
+  std::vector<int> batchOf(numVertices, -1);
+  std::vector<unsigned short> localIndex(numVertices);
+
+  vertexRemap.reserve(numVertices + numVertices / 8);
+
+  int batch = 0;
+  Submesh current = { 0, 0, 0 };
+  unsigned int batchVertices = 0;
+
+  for (unsigned int i = 0; i + 2 < indices.size(); i += 3)
+  {
+    unsigned int newVertices = 0;
+    for (int k = 0; k < 3; k++)
+    {
+      unsigned int v = indices[i + k];
+      if (batchOf[v] != batch)
+      {
+        // a degenerated triangle could count the same vertex twice, which
+        // only makes the split slightly conservative
+        newVertices++;
+      }
+    }
+
+    if (batchVertices + newVertices > MAX_BATCH_VERTICES)
+    {
+      submeshes.push_back(current);
+      batch++;
+      current.firstIndex = (unsigned int) shortIndices.size();
+      current.indexCount = 0;
+      current.baseVertex = (int) vertexRemap.size();
+      batchVertices = 0;
+    }
+
+    for (int k = 0; k < 3; k++)
+    {
+      unsigned int v = indices[i + k];
+      if (batchOf[v] != batch)
+      {
+        batchOf[v] = batch;
+        localIndex[v] = (unsigned short) batchVertices;
+        vertexRemap.push_back(v);
+        batchVertices++;
+      }
+      shortIndices.push_back(localIndex[v]);
+    }
+    current.indexCount += 3;
+  }
+
+  submeshes.push_back(current);
+}
@@ -0,0 +1,48 @@
+#ifndef INDEXBATCHER_H
+#define INDEXBATCHER_H
+
+#include <vector>
+
+// Range of the index buffer drawn with its own base vertex
+struct Submesh
+{
+  unsigned int firstIndex;
+  unsigned int indexCount;
+  int baseVertex;
+};
+
+class IndexBatcher
+{
+public:
+  // Number of vertices a 16-bit index can address
+  static const unsigned int MAX_BATCH_VERTICES = 65536;
+
+  IndexBatcher();
+
+  // Converts the triangle list to 16-bit indices. Meshes with more vertices
+  // than a short can address are split in submeshes, each one referencing a
+  // contiguous range of at most MAX_BATCH_VERTICES vertices starting at its
+  // base vertex. In that case vertexRemap receives, for every vertex of the
+  // new vertex array, the index of the original vertex it copies (vertices
+  // shared between batches are duplicated). An empty vertexRemap means the
+  // vertex array can be used as is.
+  void build( const std::vector<unsigned int>& indices,
+              unsigned int numVertices,
+              std::vector<unsigned short>& shortIndices,
+              std::vector<unsigned int>& vertexRemap,
+              std::vector<Submesh>& submeshes);
+
+  template<class T>
+  static void remap(std::vector<T>& attribute, const std::vector<unsigned int>& vertexRemap)
+  {
+    std::vector<T> remapped;
+    remapped.reserve(vertexRemap.size());
+    for (unsigned int i = 0; i < vertexRemap.size(); i++)
+    {
+      remapped.push_back(attribute[vertexRemap[i]]);
+    }
+    attribute.swap(remapped);
+  }
+};
+
+#endif // INDEXBATCHER_H
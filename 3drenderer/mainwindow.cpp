@@ -2,6 +2,16 @@
 #include "ui_mainwindow.h"
 #include <QFileDialog>
 #include <QImage>
+#include <QImageReader>
+#include <QProgressDialog>
+#include <QDebug>
+#include <QFile>
+
+#include "tracer.h"
+
+// Diffuse textures larger than this on a side are imported as virtual
+// textures
+static const int VIRTUAL_TEXTURE_MIN_SIZE = 8192;
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
@@ -14,6 +24,11 @@ MainWindow::MainWindow(QWidget *parent) :
                 this,
                 SLOT(onImportOBJClick(bool)));
 
+  this->connect(this->ui->importOBJInstancesButton,
+                SIGNAL(clicked(bool)),
+                this,
+                SLOT(onImportOBJInstancesClick(bool)));
+
   this->connect(this->ui->importDiffuseTextureButton,
                 SIGNAL(clicked(bool)),
                 this,
@@ -29,6 +44,34 @@ MainWindow::MainWindow(QWidget *parent) :
                 this,
                 SLOT(onCameraResetClick(bool)));
 
+  this->connect(this->ui->saveSoftwareRenderButton,
+                SIGNAL(clicked(bool)),
+                this,
+                SLOT(onSaveSoftwareRenderClick(bool)));
+
+  this->connect(this->ui->saveRayTracedRenderButton,
+                SIGNAL(clicked(bool)),
+                this,
+                SLOT(onSaveRayTracedRenderClick(bool)));
+
+  this->connect(this->ui->saveTraceButton,
+                SIGNAL(clicked(bool)),
+                this,
+                SLOT(onSaveTraceClick(bool)));
+#ifndef ENABLE_TRACING
+  this->ui->saveTraceButton->hide();
+#endif
+
+  this->connect(this->ui->bakeAOButton,
+                SIGNAL(clicked(bool)),
+                this,
+                SLOT(onBakeAOClick(bool)));
+
+  this->connect(this->ui->bakeNormalMapButton,
+                SIGNAL(clicked(bool)),
+                this,
+                SLOT(onBakeNormalMapClick(bool)));
+
   // Checkboxes
 
   this->connect(this->ui->checkboxWireframeOverwrite,
@@ -56,6 +99,26 @@ MainWindow::MainWindow(QWidget *parent) :
                 this,
                 SLOT(onSetBumMapActive(bool)));
 
+  this->connect(this->ui->checkboxPackedVertexFormat,
+                SIGNAL(clicked(bool)),
+                this,
+                SLOT(onSetPackedVertexFormat(bool)));
+
+  this->connect(this->ui->checkboxSeparateVertexStreams,
+                SIGNAL(clicked(bool)),
+                this,
+                SLOT(onSetSeparateVertexStreams(bool)));
+
+  this->connect(this->ui->checkboxFrustumCulling,
+                SIGNAL(clicked(bool)),
+                this,
+                SLOT(onSetFrustumCulling(bool)));
+
+  this->connect(this->ui->checkboxOcclusionCulling,
+                SIGNAL(clicked(bool)),
+                this,
+                SLOT(onSetOcclusionCulling(bool)));
+
   // Spin Boxes
 
   this->connect(this->ui->spinBoxR,
@@ -78,6 +141,18 @@ MainWindow::MainWindow(QWidget *parent) :
                 this,
                 SLOT(onChangeShininess(double)));
 
+  // Combo Boxes
+
+  this->connect(this->ui->comboBoxMipFilter,
+                SIGNAL(currentIndexChanged(int)),
+                this,
+                SLOT(onChangeMipFilter(int)));
+
+  this->connect(this->ui->comboBoxTextureCompression,
+                SIGNAL(currentIndexChanged(int)),
+                this,
+                SLOT(onChangeTextureCompression(int)));
+
   this->connect(this->ui->radioButtonSpherical,
                 SIGNAL(clicked(bool)),
                 this,
@@ -88,8 +163,15 @@ MainWindow::MainWindow(QWidget *parent) :
                 this,
                 SLOT(onClickCubeMapping(bool)));
 
+  this->connect(this->ui->openGLWidget,
+                SIGNAL(picked(PickResult)),
+                this,
+                SLOT(onPicked(PickResult)));
+
   this->sendDiffuseColorToOpenGL();
   this->ui->openGLWidget->setShininess(this->ui->spinBoxShininess->value());
+  this->onChangeMipFilter(this->ui->comboBoxMipFilter->currentIndex());
+  this->onChangeTextureCompression(this->ui->comboBoxTextureCompression->currentIndex());
 }
 
 
@@ -105,6 +187,20 @@ void MainWindow::onClickCubeMapping(bool value)
     this->ui->openGLWidget->setSphericalMapping(false);
 }
 
+void MainWindow::onPicked(const PickResult& result)
+{
+  if(result.instance < 0)
+  {
+    this->ui->statusBar->clearMessage();
+    return;
+  }
+  this->ui->statusBar->showMessage(QString("Instance %1, face %2, vertex %3, halfedge %4")
+                                   .arg(result.instance)
+                                   .arg(result.face)
+                                   .arg(result.vertex)
+                                   .arg(result.halfedge));
+}
+
 void MainWindow::onImportOBJClick(bool isClicked)
 {
   QString fileName = QFileDialog::getOpenFileName(this,
@@ -116,24 +212,81 @@ void MainWindow::onImportOBJClick(bool isClicked)
   this->ui->openGLWidget->importOBJFromPath(buffer);
 }
 
-void MainWindow::onImportDiffuseTextureClick(bool isClicked)
+void MainWindow::onImportOBJInstancesClick(bool isClicked)
 {
   QString fileName = QFileDialog::getOpenFileName(this,
-                                                  tr("Open Diffuse Texture File"),
+                                                  tr("Open OBJ File"),
                                                   "",
-                                                  tr("All Files (*)"));
+                                                  tr("OBJ Files (*.obj);;All Files (*)"));
   QByteArray array = fileName.toLocal8Bit();
   char* buffer = array.data();
+  this->ui->openGLWidget->importOBJInstances(buffer, this->ui->spinBoxInstances->value());
+}
 
-  QPixmap labelPixmap(fileName);
-  labelPixmap = labelPixmap.scaled( this->ui->diffuseTextureLabel->width(),
-                                    this->ui->diffuseTextureLabel->height(),
-                                    Qt::KeepAspectRatio,
-                                    Qt::FastTransformation);
-  QImage img(fileName);
-
-  this->ui->diffuseTextureLabel->setPixmap(labelPixmap);
-  this->ui->openGLWidget->importDiffuseTexture(img);
+void MainWindow::onImportDiffuseTextureClick(bool isClicked)
+{
+  QStringList fileNames = QFileDialog::getOpenFileNames(this,
+                                                        tr("Open Diffuse Texture Files"),
+                                                        "",
+                                                        tr("All Files (*)"));
+  if(fileNames.isEmpty())
+  {
+    return;
+  }
+
+  QLabel* label = this->ui->diffuseTextureLabel;
+  std::function<void(const QImage&)> showTexture = [label](const QImage& img)
+  {
+    label->setPixmap(QPixmap::fromImage(img.scaled(label->width(),
+                                                   label->height(),
+                                                   Qt::KeepAspectRatio,
+                                                   Qt::FastTransformation)));
+  };
+  // Several textures are spread over the meshes through one atlas, the
+  // files in name order on the meshes in import order
+  if(fileNames.size() > 1)
+  {
+    fileNames.sort();
+    std::vector<int> meshTextures(fileNames.size());
+    for(int i = 0; i < fileNames.size(); i++)
+    {
+      meshTextures[i] = i;
+    }
+    this->ui->openGLWidget->importDiffuseAtlas(fileNames, meshTextures, showTexture);
+    return;
+  }
+
+  QString fileName = fileNames[0];
+  QSize size = QImageReader(fileName).size();
+  if(size.width() > VIRTUAL_TEXTURE_MIN_SIZE || size.height() > VIRTUAL_TEXTURE_MIN_SIZE)
+  {
+    // Open until the page file is built, the GUI keeps running
+    QProgressDialog* dialog = new QProgressDialog(tr("Cutting the texture into pages..."), tr("Cancel"), 0, 100, this);
+    dialog->setWindowModality(Qt::WindowModal);
+    dialog->setMinimumDuration(500);
+    dialog->setValue(0);
+    bool isStarted = this->ui->openGLWidget->importVirtualTexture(fileName, [dialog](float progress)
+    {
+      dialog->setValue((int) (progress * 100.0f));
+      return !dialog->wasCanceled();
+    },
+    [dialog, label, size](bool isImported)
+    {
+      dialog->deleteLater();
+      if(isImported)
+      {
+        label->setText(tr("%1 x %2 virtual texture").arg(size.width()).arg(size.height()));
+      }
+    });
+    if(!isStarted)
+    {
+      delete dialog;
+    }
+    return;
+  }
+
+  // Decoded once, off the GUI thread; the label shows the texture in use
+  this->ui->openGLWidget->importDiffuseTexture(fileName, showTexture);
 }
 
 
@@ -143,25 +296,129 @@ void MainWindow::onImportBumpMapClick(bool isClicked)
                                                   tr("Open Bump Map Texture File"),
                                                   "",
                                                   tr("All Files (*)"));
+  if(fileName.isEmpty())
+  {
+    return;
+  }
+
+  QLabel* label = this->ui->bumpMapTextureLabel;
+  this->ui->openGLWidget->setHeightMapStrength((float) this->ui->spinBoxBumpStrength->value());
+  this->ui->openGLWidget->importBumpMap(fileName, [label](const QImage& img)
+  {
+    label->setPixmap(QPixmap::fromImage(img.scaled(label->width(),
+                                                   label->height(),
+                                                   Qt::KeepAspectRatio,
+                                                   Qt::FastTransformation)));
+  });
+}
+
+void MainWindow::onCameraResetClick(bool isClicked)
+{
+  this->ui->openGLWidget->resetCamera();
+}
+
+void MainWindow::onSaveSoftwareRenderClick(bool isClicked)
+{
+  QString fileName = QFileDialog::getSaveFileName(this,
+                                                  tr("Save Software Render"),
+                                                  "",
+                                                  tr("PNG Files (*.png);;All Files (*)"));
+  if(fileName.isEmpty())
+  {
+    return;
+  }
+  QImage img = this->ui->openGLWidget->renderSoftware(this->ui->openGLWidget->width(),
+                                                      this->ui->openGLWidget->height());
+  img.save(fileName);
+}
+
+void MainWindow::onSaveRayTracedRenderClick(bool isClicked)
+{
+  QString fileName = QFileDialog::getSaveFileName(this,
+                                                  tr("Save Ray Traced Render"),
+                                                  "",
+                                                  tr("PNG Files (*.png);;All Files (*)"));
+  if(fileName.isEmpty())
+  {
+    return;
+  }
+  QImage img = this->ui->openGLWidget->renderRayTraced(this->ui->openGLWidget->width(),
+                                                       this->ui->openGLWidget->height());
+  img.save(fileName);
+}
+
+void MainWindow::onSaveTraceClick(bool isClicked)
+{
+  QString fileName = QFileDialog::getSaveFileName(this,
+                                                  tr("Save Trace"),
+                                                  "",
+                                                  tr("Chrome Trace Files (*.json);;All Files (*)"));
+  if(fileName.isEmpty())
+  {
+    return;
+  }
+  if(!Tracer::writeChromeTrace(QFile::encodeName(fileName).toStdString()))
+  {
+    qDebug() << "Cannot write the trace to" << fileName;
+  }
+}
+
+void MainWindow::onBakeAOClick(bool isClicked)
+{
+  QProgressDialog dialog(tr("Baking ambient occlusion..."), tr("Cancel"), 0, 100, this);
+  dialog.setWindowModality(Qt::WindowModal);
+  dialog.setMinimumDuration(500);
+  this->ui->openGLWidget->bakeAmbientOcclusion(this->ui->spinBoxAORays->value(), [&dialog](float progress)
+  {
+    dialog.setValue((int) (progress * 100.0f));
+    return !dialog.wasCanceled();
+  });
+}
+
+void MainWindow::onBakeNormalMapClick(bool isClicked)
+{
+  QString fileName = QFileDialog::getOpenFileName(this,
+                                                  tr("Open High Poly OBJ File"),
+                                                  "",
+                                                  tr("OBJ Files (*.obj);;All Files (*)"));
+  if(fileName.isEmpty())
+  {
+    return;
+  }
   QByteArray array = fileName.toLocal8Bit();
   char* buffer = array.data();
 
-  QPixmap labelPixmap(fileName);
+  QProgressDialog dialog(tr("Baking normal map..."), tr("Cancel"), 0, 100, this);
+  dialog.setWindowModality(Qt::WindowModal);
+  dialog.setMinimumDuration(500);
+  QImage img = this->ui->openGLWidget->bakeNormalMap(buffer, this->ui->spinBoxNormalMapSize->value(), [&dialog](float progress)
+  {
+    dialog.setValue((int) (progress * 100.0f));
+    return !dialog.wasCanceled();
+  });
+  if(img.isNull())
+  {
+    return;
+  }
+
+  QString saveName = QFileDialog::getSaveFileName(this,
+                                                  tr("Save Normal Map"),
+                                                  "",
+                                                  tr("PNG Files (*.png);;All Files (*)"));
+  if(!saveName.isEmpty())
+  {
+    img.save(saveName);
+  }
+
+  QPixmap labelPixmap = QPixmap::fromImage(img);
   labelPixmap = labelPixmap.scaled( this->ui->bumpMapTextureLabel->width(),
                                     this->ui->bumpMapTextureLabel->height(),
                                     Qt::KeepAspectRatio,
                                     Qt::FastTransformation);
-  QImage img(fileName);
-
   this->ui->bumpMapTextureLabel->setPixmap(labelPixmap);
   this->ui->openGLWidget->importBumpMap(img);
 }
 
-void MainWindow::onCameraResetClick(bool isClicked)
-{
-  this->ui->openGLWidget->resetCamera();
-}
-
 void MainWindow::onSetWireframeOverwrite(bool value)
 {
   this->ui->openGLWidget->setWireframeOverwrite(value);
@@ -187,6 +444,26 @@ void MainWindow::onSetBumMapActive(bool value)
   this->ui->openGLWidget->setBumMapActive(value);
 }
 
+void MainWindow::onSetPackedVertexFormat(bool value)
+{
+  this->ui->openGLWidget->setPackedVertexFormat(value);
+}
+
+void MainWindow::onSetSeparateVertexStreams(bool value)
+{
+  this->ui->openGLWidget->setSeparateVertexStreams(value);
+}
+
+void MainWindow::onSetFrustumCulling(bool value)
+{
+  this->ui->openGLWidget->setFrustumCulling(value);
+}
+
+void MainWindow::onSetOcclusionCulling(bool value)
+{
+  this->ui->openGLWidget->setOcclusionCulling(value);
+}
+
 void MainWindow::onChangeDiffuseColorR(double r)
 {
   this->sendDiffuseColorToOpenGL();
@@ -207,6 +484,36 @@ void MainWindow::onChangeShininess(double s)
   this->ui->openGLWidget->setShininess(s);
 }
 
+void MainWindow::onChangeMipFilter(int index)
+{
+  // In the order of the combo box items
+  this->ui->openGLWidget->setTextureMipFilter(index == 1 ? MipChain::KAISER_FILTER : MipChain::BOX_FILTER);
+}
+
+void MainWindow::onChangeTextureCompression(int index)
+{
+  // In the order of the combo box items
+  static const TextureLoader::Compression COMPRESSIONS[] = {
+    TextureLoader::NO_COMPRESSION,
+    TextureLoader::BC1_BC3_COMPRESSION,
+    TextureLoader::BC7_COMPRESSION,
+    TextureLoader::BC7_COMPRESSION,
+    TextureLoader::BC7_COMPRESSION
+  };
+  static const BlockCompressor::Quality QUALITIES[] = {
+    BlockCompressor::NORMAL_QUALITY,
+    BlockCompressor::NORMAL_QUALITY,
+    BlockCompressor::FAST_QUALITY,
+    BlockCompressor::NORMAL_QUALITY,
+    BlockCompressor::SLOW_QUALITY
+  };
+  if(index < 0 || index >= 5)
+  {
+    return;
+  }
+  this->ui->openGLWidget->setTextureCompression(COMPRESSIONS[index], QUALITIES[index]);
+}
+
 void MainWindow::sendDiffuseColorToOpenGL()
 {
   float r = this->ui->spinBoxR->value();
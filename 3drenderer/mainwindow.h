@@ -3,6 +3,8 @@
 
 #include <QMainWindow>
 
+#include "picker.h"
+
 namespace Ui {
   class MainWindow;
 }
@@ -22,16 +24,26 @@ private:
 
 public slots:
     void onImportOBJClick(bool isClicked);
+    void onImportOBJInstancesClick(bool isClicked);
     void onImportDiffuseTextureClick(bool isClicked);
     void onImportBumpMapClick(bool isClicked);
 
     void onCameraResetClick(bool isClicked);
+    void onSaveSoftwareRenderClick(bool isClicked);
+    void onSaveRayTracedRenderClick(bool isClicked);
+    void onSaveTraceClick(bool isClicked);
+    void onBakeAOClick(bool isClicked);
+    void onBakeNormalMapClick(bool isClicked);
 
     void onSetWireframeOverwrite(bool value);
     void onSetEdgesVisible(bool value);
     void onSetFlatFaces(bool value);
     void onSetDiffuseTextureActive(bool value);
     void onSetBumMapActive(bool value);
+    void onSetPackedVertexFormat(bool value);
+    void onSetSeparateVertexStreams(bool value);
+    void onSetFrustumCulling(bool value);
+    void onSetOcclusionCulling(bool value);
 
     void onChangeDiffuseColorR(double r);
     void onChangeDiffuseColorG(double g);
@@ -39,8 +51,13 @@ public slots:
 
     void onChangeShininess(double s);
 
+    void onChangeMipFilter(int index);
+    void onChangeTextureCompression(int index);
+
     void onClickSphericalMapping(bool value);
     void onClickCubeMapping(bool value);
+
+    void onPicked(const PickResult& result);
 };
 
 #endif // MAINWINDOW_H
@@ -1,14 +1,40 @@
 #include "mesh.h"
+#include "tracer.h"
 
 #include "glm/glm.hpp"
 #include <QDebug>
+#include <algorithm>
 
 #define TINYOBJLOADER_IMPLEMENTATION // define this in only *one* .cc
 #include "tiny_obj_loader.h"
 
-Mesh::Mesh()
+// Texture names of an MTL file are relative to the OBJ file, with either
+// kind of slash
+static std::string getTexturePath(std::string name, const std::string& directory)
 {
+  if (name.empty())
+  {
+    return name;
+  }
+  std::replace(name.begin(), name.end(), '\\', '/');
+  bool isAbsolute = name[0] == '/' || (name.size() > 1 && name[1] == ':');
+  return isAbsolute ? name : directory + name;
+}
+
+// Faces are sorted by material, a range ends where the material changes
+static void addToMaterialRange(std::vector<MaterialRange>* ranges, int material, unsigned int firstIndex, unsigned int numIndices)
+{
+  if (ranges->empty() || ranges->back().material != material ||
+      ranges->back().firstIndex + ranges->back().numIndices != firstIndex)
+  {
+    ranges->push_back({ material, firstIndex, 0 });
+  }
+  ranges->back().numIndices += numIndices;
+}
 
+Mesh::Mesh()
+{
+  this->occlusionRays = 0;
 }
 
 int Mesh::hV(int v)
@@ -63,12 +89,26 @@ Halfedge Mesh::newH()
 
 void Mesh::loadObj(std::string inputFilePath)
 {
+  TRACE_SCOPE("Mesh::loadObj");
+  this->vertexOcclusion.clear();
+  this->occlusionRays = 0;
+  this->materials.clear();
+  this->faceMaterials.clear();
+
   tinyobj::attrib_t attrib;
   std::vector<tinyobj::shape_t> shapes;
   std::vector<tinyobj::material_t> materials;
 
+  // MTL libraries are looked up next to the OBJ file
+  std::string directory;
+  size_t slash = inputFilePath.find_last_of("/\\");
+  if (slash != std::string::npos)
+  {
+    directory = inputFilePath.substr(0, slash + 1);
+  }
+
   std::string err;
-  bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, inputFilePath.c_str());
+  bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, inputFilePath.c_str(), directory.empty() ? NULL : directory.c_str());
 
   if (!err.empty())
   {
@@ -99,6 +139,8 @@ void Mesh::loadObj(std::string inputFilePath)
     size_t index_offset = 0;
     for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
       this->faces.push_back(this->newF());
+      int material = f < shapes[s].mesh.material_ids.size() ? shapes[s].mesh.material_ids[f] : -1;
+      this->faceMaterials.push_back(material >= 0 && material < (int) materials.size() ? material : -1);
       int fv = shapes[s].mesh.num_face_vertices[f];
       int halfEdgeIndex = this->halfedges.size();
       for (size_t v = 0; v < fv; v++) {
@@ -142,13 +184,108 @@ void Mesh::loadObj(std::string inputFilePath)
       index_offset += fv;
     }
   }
+
+  for (size_t m = 0; m < materials.size(); m++)
+  {
+    ObjMaterial material;
+    material.name = materials[m].name;
+    material.diffuseColor = glm::vec3(materials[m].diffuse[0], materials[m].diffuse[1], materials[m].diffuse[2]);
+    material.shininess = materials[m].shininess;
+    material.diffuseTexturePath = getTexturePath(materials[m].diffuse_texname, directory);
+    material.bumpTexturePath = getTexturePath(materials[m].bump_texname.empty() ? materials[m].normal_texname : materials[m].bump_texname, directory);
+    this->materials.push_back(material);
+  }
+  this->sortFacesByMaterial();
+}
+
+void Mesh::sortFacesByMaterial()
+{
+  if (this->materials.empty())
+  {
+    std::fill(this->faceMaterials.begin(), this->faceMaterials.end(), -1);
+    return;
+  }
+
+  // Untextured materials first, then by diffuse and bump texture
+  std::vector<int> order(this->materials.size());
+  for (unsigned int m = 0; m < order.size(); m++)
+  {
+    order[m] = m;
+  }
+  std::stable_sort(order.begin(), order.end(), [this](int a, int b)
+  {
+    const ObjMaterial& first = this->materials[a];
+    const ObjMaterial& second = this->materials[b];
+    if (first.diffuseTexturePath.empty() != second.diffuseTexturePath.empty())
+    {
+      return first.diffuseTexturePath.empty();
+    }
+    if (first.bumpTexturePath.empty() != second.bumpTexturePath.empty())
+    {
+      return first.bumpTexturePath.empty();
+    }
+    if (first.diffuseTexturePath != second.diffuseTexturePath)
+    {
+      return first.diffuseTexturePath < second.diffuseTexturePath;
+    }
+    return first.bumpTexturePath < second.bumpTexturePath;
+  });
+  // Faces without a material come first
+  std::vector<int> rank(this->materials.size() + 1);
+  rank[0] = 0;
+  for (unsigned int i = 0; i < order.size(); i++)
+  {
+    rank[order[i] + 1] = i + 1;
+  }
+
+  std::vector<int> faceOrder(this->faces.size());
+  for (unsigned int f = 0; f < faceOrder.size(); f++)
+  {
+    faceOrder[f] = f;
+  }
+  std::stable_sort(faceOrder.begin(), faceOrder.end(), [&](int a, int b)
+  {
+    return rank[this->faceMaterials[a] + 1] < rank[this->faceMaterials[b] + 1];
+  });
+
+  // The halfedges follow their face to its new index
+  std::vector<Face> sortedFaces(this->faces.size());
+  std::vector<int> sortedMaterials(this->faces.size());
+  for (unsigned int f = 0; f < faceOrder.size(); f++)
+  {
+    sortedFaces[f] = this->faces[faceOrder[f]];
+    sortedMaterials[f] = this->faceMaterials[faceOrder[f]];
+    int h = sortedFaces[f].halfedge;
+    do
+    {
+      this->halfedges[h].face = f;
+      h = this->halfedges[h].next;
+    }
+    while (h != sortedFaces[f].halfedge);
+  }
+  this->faces.swap(sortedFaces);
+  this->faceMaterials.swap(sortedMaterials);
+}
+
+const std::vector<ObjMaterial>& Mesh::getMaterials()
+{
+  return this->materials;
+}
+
+int Mesh::getFaceMaterial(int f)
+{
+  return f < (int) this->faceMaterials.size() ? this->faceMaterials[f] : -1;
 }
 
 void Mesh::getTriangles(  std::vector<glm::vec3>* vertices,
                           std::vector<glm::vec3>* normals,
                           std::vector<unsigned int>* indices,
-                          bool isFlatFaces)
+                          bool isFlatFaces,
+                          std::vector<float>* occlusion,
+                          std::vector<MaterialRange>* materialRanges)
 {
+  TRACE_SCOPE("Mesh::getTriangles");
+  bool isBaked = this->vertexOcclusion.size() == this->vertices.size();
   if (isFlatFaces)
   {
     for(int f=0; f<this->faces.size(); f++)
@@ -162,6 +299,10 @@ void Mesh::getTriangles(  std::vector<glm::vec3>* vertices,
       {
         vertices->push_back(this->vertices[vH(h)].position);
         normals->push_back(normal);
+        if(occlusion)
+        {
+          occlusion->push_back(isBaked ? this->vertexOcclusion[vH(h)] : 1.0f);
+        }
         h = nH(h);
         numVertices++;
       }
@@ -173,6 +314,10 @@ void Mesh::getTriangles(  std::vector<glm::vec3>* vertices,
         indices->push_back(vertexInitialIndex+j+1);
         indices->push_back(vertexInitialIndex+j+2);
       }
+      if(materialRanges)
+      {
+        addToMaterialRange(materialRanges, this->getFaceMaterial(f), (unsigned int) indices->size() - 3 * (numVertices - 2), 3 * (numVertices - 2));
+      }
     }
   }
   else
@@ -181,15 +326,105 @@ void Mesh::getTriangles(  std::vector<glm::vec3>* vertices,
     {
       vertices->push_back(this->vertices[v].position);
       normals->push_back(this->getVertexNormal(v));
+      if(occlusion)
+      {
+        occlusion->push_back(isBaked ? this->vertexOcclusion[v] : 1.0f);
+      }
     }
     for(int f=0; f < this->faces.size(); f++)
     {
       indices->push_back(vH(hF(f)));
       indices->push_back(vH(nH(hF(f))));
       indices->push_back(vH(nH(nH(hF(f)))));
+      if(materialRanges)
+      {
+        addToMaterialRange(materialRanges, this->getFaceMaterial(f), (unsigned int) indices->size() - 3, 3);
+      }
+    }
+  }
+}
+
+void Mesh::getFaceTriangles( std::vector<glm::vec3>* vertices,
+                              std::vector<unsigned int>* indices,
+                              std::vector<int>* triangleFaces)
+{
+  for(unsigned int v=0; v < this->vertices.size(); v++)
+  {
+    vertices->push_back(this->vertices[v].position);
+  }
+  for(unsigned int f=0; f < this->faces.size(); f++)
+  {
+    int h0 = hF(f);
+    for(int h = nH(h0); nH(h) != h0; h = nH(h))
+    {
+      indices->push_back(vH(h0));
+      indices->push_back(vH(h));
+      indices->push_back(vH(nH(h)));
+      triangleFaces->push_back(f);
     }
   }
+}
+
+void Mesh::getVertexNormals(std::vector<glm::vec3>* normals)
+{
+  for(int v=0; v < this->vertices.size(); v++)
+  {
+    normals->push_back(this->getVertexNormal(v));
+  }
+}
+
+void Mesh::setVertexOcclusion(const std::vector<float>& occlusion, int numRays)
+{
+  this->vertexOcclusion = occlusion;
+  this->occlusionRays = numRays;
+}
+
+const std::vector<float>& Mesh::getVertexOcclusion()
+{
+  return this->vertexOcclusion;
+}
+
+int Mesh::getOcclusionRays()
+{
+  return this->occlusionRays;
+}
+
+int Mesh::getNumVertices()
+{
+  return this->vertices.size();
+}
+
+int Mesh::getNumFaces()
+{
+  return this->faces.size();
+}
+
+glm::vec3 Mesh::getVertexPosition(int v)
+{
+  return this->vertices[v].position;
+}
+
+std::vector<int> Mesh::getFaceHalfedges(int f)
+{
+  std::vector<int> output;
+  int h = hF(f);
+  do
+  {
+    output.push_back(h);
+    h = nH(h);
+  }
+  while(h != hF(f));
+  return output;
+}
 
+int Mesh::getHalfedgeVertex(int h)
+{
+  return vH(h);
+}
+
+int Mesh::getHalfedgeSourceVertex(int h)
+{
+  return vH(pH(h));
 }
 
 glm::vec3 Mesh::getFaceNormal(int f)
@@ -215,11 +450,27 @@ std::vector<int> Mesh::getVertexFacesIndexes(int v)
 {
   std::vector<int> output;
   int hi = hV(v);
+  if (hi < 0)
+  {
+    return output;
+  }
   do
   {
     output.push_back(fH(hi));
     hi = oH(pH(hi));
   }
-  while(hi != hV(v));
+  while(hi >= 0 && hi != hV(v));
+
+  // On a boundary, the faces on the other side of the first one
+  if (hi < 0)
+  {
+    hi = oH(hV(v));
+    while (hi >= 0)
+    {
+      hi = nH(hi);
+      output.push_back(fH(hi));
+      hi = oH(hi);
+    }
+  }
   return output;
 }
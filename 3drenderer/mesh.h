@@ -18,6 +18,27 @@ struct Face
   int halfedge;
 };
 
+// Material of an OBJ file, from its MTL library. Texture paths are
+// absolute or relative to the working directory, empty without a texture.
+struct ObjMaterial
+{
+  std::string name;
+  glm::vec3 diffuseColor;
+  float shininess;
+  std::string diffuseTexturePath;
+  // bump or norm, a height map or a normal map
+  std::string bumpTexturePath;
+};
+
+// Indices output by getTriangles whose faces use the same material, -1
+// for the faces without one
+struct MaterialRange
+{
+  int material;
+  unsigned int firstIndex;
+  unsigned int numIndices;
+};
+
 struct Halfedge
 {
   // vertex it points
@@ -34,6 +55,15 @@ private:
   std::vector<Vertex> vertices;
   std::vector<Face> faces;
   std::vector<Halfedge> halfedges;
+  // Faces are sorted by material, the textured materials after the others
+  // and grouped by texture, so the ranges drawn one after the other share
+  // most of their state
+  std::vector<ObjMaterial> materials;
+  std::vector<int> faceMaterials;
+  // Baked ambient visibility of the vertices, kept with the mesh so the
+  // uploads do not bake it again
+  std::vector<float> vertexOcclusion;
+  int occlusionRays;
 
   Vertex newV(glm::vec3 pos);
   Face newF();
@@ -50,10 +80,43 @@ private:
   std::vector<int> getVertexFacesIndexes(int v);
   glm::vec3 getFaceNormal(int f);
   glm::vec3 getVertexNormal(int v);
+  void sortFacesByMaterial();
 public:
   Mesh();
-  void getTriangles(std::vector<glm::vec3>* vertices, std::vector<glm::vec3>* normals, std::vector<unsigned int>* indices, bool isFlatFaces);
+  // The occlusion output, if given, gets the baked value of every output
+  // vertex, 1 when nothing is baked. The material ranges, if given, get the
+  // ranges of the output indices, in the order of the faces.
+  void getTriangles(std::vector<glm::vec3>* vertices,
+                    std::vector<glm::vec3>* normals,
+                    std::vector<unsigned int>* indices,
+                    bool isFlatFaces,
+                    std::vector<float>* occlusion = nullptr,
+                    std::vector<MaterialRange>* materialRanges = nullptr);
+  // Faces fan triangulated over the mesh vertices, with the face of every
+  // triangle
+  void getFaceTriangles(std::vector<glm::vec3>* vertices, std::vector<unsigned int>* indices, std::vector<int>* triangleFaces);
+  // Materials come from the MTL libraries next to the file
   void loadObj(std::string inputFilePath);
+  const std::vector<ObjMaterial>& getMaterials();
+  // Index in getMaterials, -1 without a material
+  int getFaceMaterial(int f);
+
+  // One smooth normal per mesh vertex, as getTriangles outputs them
+  void getVertexNormals(std::vector<glm::vec3>* normals);
+  // Ambient visibility per mesh vertex, with the number of rays of the
+  // bake. Empty and 0 until baked.
+  void setVertexOcclusion(const std::vector<float>& occlusion, int numRays);
+  const std::vector<float>& getVertexOcclusion();
+  int getOcclusionRays();
+
+  int getNumVertices();
+  int getNumFaces();
+  glm::vec3 getVertexPosition(int v);
+  // Halfedges around the face, each one pointing to the next corner
+  std::vector<int> getFaceHalfedges(int f);
+  // Vertex the halfedge points to, and the one it starts from
+  int getHalfedgeVertex(int h);
+  int getHalfedgeSourceVertex(int h);
 };
 
 #endif // TRIANGLEMESH_H
@@ -0,0 +1,266 @@
+#include "mipchain.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define MIPCHAIN_SSE2
+#endif
+
+// Taps of the Kaiser filter, at the source texels -3.5 to 3.5 away from
+// the center of the target one
+static const int KAISER_TAPS = 8;
+static const float KAISER_ALPHA = 4.0f;
+
+static inline int wrap(int a, int size)
+{
+  a %= size;
+  return a < 0 ? a + size : a;
+}
+
+// Modified Bessel function of the first kind, order 0
+static float besselI0(float x)
+{
+  float sum = 1.0f;
+  float term = 1.0f;
+  for (int k = 1; k < 20; k++)
+  {
+    term *= (x * 0.5f / k) * (x * 0.5f / k);
+    sum += term;
+  }
+  return sum;
+}
+
+// Sinc at the half band of the source, windowed, normalized to 1
+struct KaiserWeights
+{
+  float weights[KAISER_TAPS];
+
+  KaiserWeights()
+  {
+    float radius = KAISER_TAPS * 0.5f;
+    float sum = 0.0f;
+    for (int k = 0; k < KAISER_TAPS; k++)
+    {
+      float d = k - (KAISER_TAPS - 1) * 0.5f;
+      float x = 3.14159265f * d * 0.5f;
+      float r = d / radius;
+      float window = besselI0(KAISER_ALPHA * std::sqrt(std::max(1.0f - r * r, 0.0f))) / besselI0(KAISER_ALPHA);
+      this->weights[k] = std::sin(x) / x * window;
+      sum += this->weights[k];
+    }
+    for (int k = 0; k < KAISER_TAPS; k++)
+    {
+      this->weights[k] /= sum;
+    }
+  }
+};
+
+static const float* getKaiserWeights()
+{
+  static const KaiserWeights kaiser;
+  return kaiser.weights;
+}
+
+int MipChain::getNumLevels(int width, int height)
+{
+  int levels = 1;
+  while (width > 1 || height > 1)
+  {
+    width = std::max(width / 2, 1);
+    height = std::max(height / 2, 1);
+    levels++;
+  }
+  return levels;
+}
+
+void MipChain::build(const unsigned char* texels,
+                     int width,
+                     int height,
+                     Filter filter,
+                     std::vector<MipLevel>& levels)
+{
+  levels.resize(getNumLevels(width, height) - 1);
+  for (unsigned int i = 0; i < levels.size(); i++)
+  {
+    if (filter == KAISER_FILTER)
+    {
+      downsampleKaiser(texels, width, height, levels[i]);
+    }
+    else
+    {
+      downsampleBox(texels, width, height, levels[i]);
+    }
+    texels = levels[i].texels.data();
+    width = levels[i].width;
+    height = levels[i].height;
+  }
+}
+
+void MipChain::downsampleBox(const unsigned char* texels, int width, int height, MipLevel& level)
+{
+  level.width = std::max(width / 2, 1);
+  level.height = std::max(height / 2, 1);
+  level.texels.resize((size_t) level.width * level.height * 4);
+
+  for (int y = 0; y < level.height; y++)
+  {
+    const unsigned char* row0 = texels + (size_t) std::min(2 * y, height - 1) * width * 4;
+    const unsigned char* row1 = texels + (size_t) std::min(2 * y + 1, height - 1) * width * 4;
+    unsigned char* output = &level.texels[(size_t) y * level.width * 4];
+    int x = 0;
+#ifdef MIPCHAIN_SSE2
+    // Two target texels from four source ones of each row. With a source
+    // of one texel the target is a copy, done below.
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+    for (; width > 1 && x + 2 <= level.width; x += 2)
+    {
+      __m128i a = _mm_loadu_si128((const __m128i*) (row0 + 8 * x));
+      __m128i b = _mm_loadu_si128((const __m128i*) (row1 + 8 * x));
+      __m128i low = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+      __m128i high = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+      low = _mm_add_epi16(low, _mm_srli_si128(low, 8));
+      high = _mm_add_epi16(high, _mm_srli_si128(high, 8));
+      __m128i sum = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(low, high), two), 2);
+      _mm_storel_epi64((__m128i*) (output + 4 * x), _mm_packus_epi16(sum, sum));
+    }
+#endif
+    for (; x < level.width; x++)
+    {
+      int x0 = std::min(2 * x, width - 1) * 4;
+      int x1 = std::min(2 * x + 1, width - 1) * 4;
+      for (int c = 0; c < 4; c++)
+      {
+        output[4 * x + c] = (unsigned char) ((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+      }
+    }
+  }
+}
+
+// One source row filtered horizontally into floats, the target's width
+static void filterKaiserRow(const unsigned char* input, int width, int targetWidth, const float* weights, float* source, float* output)
+{
+  int i = 0;
+#ifdef MIPCHAIN_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= width * 4; i += 16)
+  {
+    __m128i bytes = _mm_loadu_si128((const __m128i*) (input + i));
+    __m128i low = _mm_unpacklo_epi8(bytes, zero);
+    __m128i high = _mm_unpackhi_epi8(bytes, zero);
+    _mm_storeu_ps(source + i, _mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero)));
+    _mm_storeu_ps(source + i + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero)));
+    _mm_storeu_ps(source + i + 8, _mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero)));
+    _mm_storeu_ps(source + i + 12, _mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero)));
+  }
+#endif
+  for (; i < width * 4; i++)
+  {
+    source[i] = input[i];
+  }
+#ifdef MIPCHAIN_SSE2
+  __m128 weights4[KAISER_TAPS];
+  for (int k = 0; k < KAISER_TAPS; k++)
+  {
+    weights4[k] = _mm_set1_ps(weights[k]);
+  }
+#endif
+  for (int x = 0; x < targetWidth; x++)
+  {
+    int first = 2 * x + 1 - KAISER_TAPS / 2;
+    bool isInside = first >= 0 && first + KAISER_TAPS <= width;
+#ifdef MIPCHAIN_SSE2
+    __m128 sum = _mm_setzero_ps();
+    for (int k = 0; k < KAISER_TAPS; k++)
+    {
+      int s = isInside ? first + k : wrap(first + k, width);
+      sum = _mm_add_ps(sum, _mm_mul_ps(weights4[k], _mm_loadu_ps(&source[4 * s])));
+    }
+    _mm_storeu_ps(output + 4 * x, sum);
+#else
+    float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int k = 0; k < KAISER_TAPS; k++)
+    {
+      int s = isInside ? first + k : wrap(first + k, width);
+      for (int c = 0; c < 4; c++)
+      {
+        sum[c] += weights[k] * source[4 * s + c];
+      }
+    }
+    for (int c = 0; c < 4; c++)
+    {
+      output[4 * x + c] = sum[c];
+    }
+#endif
+  }
+}
+
+void MipChain::downsampleKaiser(const unsigned char* texels, int width, int height, MipLevel& level)
+{
+  level.width = std::max(width / 2, 1);
+  level.height = std::max(height / 2, 1);
+  level.texels.resize((size_t) level.width * level.height * 4);
+  const float* weights = getKaiserWeights();
+#ifdef MIPCHAIN_SSE2
+  __m128 weights4[KAISER_TAPS];
+  for (int k = 0; k < KAISER_TAPS; k++)
+  {
+    weights4[k] = _mm_set1_ps(weights[k]);
+  }
+#endif
+
+  // The rows under the vertical taps, filtered horizontally. Consecutive
+  // target rows share six of their eight, so a ring keeps them.
+  int rowFloats = level.width * 4;
+  std::vector<float> ring((size_t) KAISER_TAPS * rowFloats);
+  int ringRows[KAISER_TAPS];
+  std::fill(ringRows, ringRows + KAISER_TAPS, -1);
+  std::vector<float> source((size_t) width * 4);
+
+  for (int y = 0; y < level.height; y++)
+  {
+    const float* taps[KAISER_TAPS];
+    for (int k = 0; k < KAISER_TAPS; k++)
+    {
+      int row = 2 * y + 1 - KAISER_TAPS / 2 + k;
+      int slot = wrap(row, KAISER_TAPS);
+      float* filtered = &ring[(size_t) slot * rowFloats];
+      if (ringRows[slot] != row)
+      {
+        filterKaiserRow(texels + (size_t) wrap(row, height) * width * 4, width, level.width, weights, source.data(), filtered);
+        ringRows[slot] = row;
+      }
+      taps[k] = filtered;
+    }
+    unsigned char* output = &level.texels[(size_t) y * rowFloats];
+#ifdef MIPCHAIN_SSE2
+    for (int i = 0; i < rowFloats; i += 4)
+    {
+      __m128 sum = _mm_setzero_ps();
+      for (int k = 0; k < KAISER_TAPS; k++)
+      {
+        sum = _mm_add_ps(sum, _mm_mul_ps(weights4[k], _mm_loadu_ps(taps[k] + i)));
+      }
+      // Rounded, and clamped to bytes by the saturating packs
+      __m128i words = _mm_packs_epi32(_mm_cvtps_epi32(sum), _mm_setzero_si128());
+      int texel = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+      output[i + 0] = (unsigned char) texel;
+      output[i + 1] = (unsigned char) (texel >> 8);
+      output[i + 2] = (unsigned char) (texel >> 16);
+      output[i + 3] = (unsigned char) (texel >> 24);
+    }
+#else
+    for (int i = 0; i < rowFloats; i++)
+    {
+      float sum = 0.0f;
+      for (int k = 0; k < KAISER_TAPS; k++)
+      {
+        sum += weights[k] * taps[k][i];
+      }
+      output[i] = (unsigned char) std::min(std::max(sum + 0.5f, 0.0f), 255.0f);
+    }
+#endif
+  }
+}
@@ -0,0 +1,44 @@
+#ifndef MIPCHAIN_H
+#define MIPCHAIN_H
+
+#include <vector>
+
+// RGBA8 texels of a mip level, rows packed without padding
+struct MipLevel
+{
+  int width;
+  int height;
+  std::vector<unsigned char> texels;
+};
+
+// Mip levels built on the CPU, so a texture is uploaded with all its
+// levels instead of asking the driver for glGenerateMipmap. Every level
+// halves the previous one (rounding down, like GL), down to 1x1. Texels
+// are filtered as the bytes they are, whatever their channel order.
+class MipChain
+{
+public:
+  enum Filter
+  {
+    // 2x2 average, the cheapest
+    BOX_FILTER,
+    // 8x8 Kaiser windowed sinc, sharper, wrapping around the edges like
+    // the repeating texture it samples
+    KAISER_FILTER
+  };
+
+  // Levels including the full size one
+  static int getNumLevels(int width, int height);
+
+  // The levels below the given texels, from the half size one down to 1x1
+  static void build(const unsigned char* texels,
+                    int width,
+                    int height,
+                    Filter filter,
+                    std::vector<MipLevel>& levels);
+
+  static void downsampleBox(const unsigned char* texels, int width, int height, MipLevel& level);
+  static void downsampleKaiser(const unsigned char* texels, int width, int height, MipLevel& level);
+};
+
+#endif // MIPCHAIN_H
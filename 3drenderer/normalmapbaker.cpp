@@ -0,0 +1,419 @@
+#include "normalmapbaker.h"
+#include "tracer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+const int NormalMapBaker::TILE_SIZE;
+const int NormalMapBaker::PADDING;
+
+// Texel centers on a shared edge are inside both triangles
+static const float EDGE_EPSILON = 1e-5f;
+
+static inline int floorDiv(int a, int b)
+{
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+static inline int wrap(int a, int size)
+{
+  return a - floorDiv(a, size) * size;
+}
+
+static inline void encodeNormal(const glm::vec3& normal, unsigned char* texel)
+{
+  glm::vec3 c = glm::clamp(normal * 0.5f + 0.5f, 0.0f, 1.0f) * 255.0f + 0.5f;
+  texel[0] = (unsigned char) c.z;
+  texel[1] = (unsigned char) c.y;
+  texel[2] = (unsigned char) c.x;
+  texel[3] = 255;
+}
+
+static inline glm::vec3 decodeNormal(const unsigned char* texel)
+{
+  return glm::vec3(texel[2], texel[1], texel[0]) * (2.0f / 255.0f) - 1.0f;
+}
+
+// Calls tile() once for every tile of a wrapped texture row or column that
+// texels first..last touch
+template<typename Function>
+static void forEachWrappedTile(int first, int last, int size, int tileSize, Function tile)
+{
+  if (last - first + 1 >= size)
+  {
+    for (int t = 0; t * tileSize < size; t++)
+    {
+      tile(t);
+    }
+    return;
+  }
+  int previous = -1;
+  for (int x = first; x <= last;)
+  {
+    int w = wrap(x, size);
+    int t = w / tileSize;
+    if (t != previous)
+    {
+      tile(t);
+    }
+    previous = t;
+    x += std::min(tileSize - w % tileSize, size - w);
+  }
+}
+
+NormalMapBaker::NormalMapBaker(ThreadPool* threadPool)
+{
+  this->isOwnThreadPool = threadPool == nullptr;
+  this->threadPool = this->isOwnThreadPool ? new ThreadPool() : threadPool;
+  this->rayCaster = new RayCaster(this->threadPool);
+  this->isCancelled = false;
+  this->bakedTiles = 0;
+  this->numTiles = 0;
+  this->coveredTexels = 0;
+}
+
+NormalMapBaker::~NormalMapBaker()
+{
+  delete this->rayCaster;
+  if (this->isOwnThreadPool)
+  {
+    delete this->threadPool;
+  }
+}
+
+void NormalMapBaker::computeTangentBasis(const std::vector<glm::vec3>& positions,
+                                         const std::vector<glm::vec2>& UVs,
+                                         const std::vector<unsigned int>& indices,
+                                         std::vector<glm::vec3>& tangents,
+                                         std::vector<glm::vec3>& bitangents)
+{
+  TRACE_SCOPE("NormalMapBaker::computeTangentBasis");
+  // For averaging out
+  std::vector<int> numFacesInThatVertex(positions.size());
+
+  tangents.assign(positions.size(), glm::vec3(0.0f));
+  bitangents.assign(positions.size(), glm::vec3(0.0f));
+
+  for (unsigned int i = 0; i < indices.size(); i++)
+  {
+    numFacesInThatVertex[indices[i]]++;
+  }
+
+  for (unsigned int i = 0; i + 2 < indices.size(); i += 3)
+  {
+    // Shortcuts for positions indexes
+    int vi0 = indices[i + 0];
+    int vi1 = indices[i + 1];
+    int vi2 = indices[i + 2];
+
+    // Edges of the triangle : position delta
+    glm::vec3 deltaPos1 = positions[vi1] - positions[vi0];
+    glm::vec3 deltaPos2 = positions[vi2] - positions[vi0];
+
+    // UV delta
+    glm::vec2 deltaUV1 = UVs[vi1] - UVs[vi0];
+    glm::vec2 deltaUV2 = UVs[vi2] - UVs[vi0];
+
+    float r = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV1.y * deltaUV2.x);
+    glm::vec3 tangent = glm::normalize((deltaPos1 * deltaUV2.y - deltaPos2 * deltaUV1.y) * r);
+    glm::vec3 bitangent = glm::normalize((deltaPos2 * deltaUV1.x - deltaPos1 * deltaUV2.x) * r);
+
+    // Same tangent for the three corners, averaged over the faces of
+    // every vertex
+    tangents[vi0] += tangent / (float) numFacesInThatVertex[vi0];
+    tangents[vi1] += tangent / (float) numFacesInThatVertex[vi1];
+    tangents[vi2] += tangent / (float) numFacesInThatVertex[vi2];
+
+    bitangents[vi0] += bitangent / (float) numFacesInThatVertex[vi0];
+    bitangents[vi1] += bitangent / (float) numFacesInThatVertex[vi1];
+    bitangents[vi2] += bitangent / (float) numFacesInThatVertex[vi2];
+  }
+}
+
+void NormalMapBaker::setHighPolyMesh(const std::vector<glm::vec3>& positions,
+                                     const std::vector<glm::vec3>& normals,
+                                     const std::vector<unsigned int>& indices)
+{
+  this->rayCaster->build(positions, indices);
+  this->highNormals = normals.size() == positions.size() ? normals : std::vector<glm::vec3>();
+  this->highIndices = indices;
+  this->highFaceNormals.clear();
+  if (this->highNormals.empty())
+  {
+    for (unsigned int i = 0; i + 2 < indices.size(); i += 3)
+    {
+      glm::vec3 normal = glm::cross(positions[indices[i + 1]] - positions[indices[i]],
+                                    positions[indices[i + 2]] - positions[indices[i]]);
+      float length = glm::length(normal);
+      this->highFaceNormals.push_back(length > 0.0f ? normal / length : glm::vec3(0.0f));
+    }
+  }
+}
+
+void NormalMapBaker::binTriangles(const std::vector<UVTriangle>& triangles, int width, int height, std::vector<std::vector<int> >& bins) const
+{
+  int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+  int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+  bins.assign(tilesX * tilesY, std::vector<int>());
+  for (unsigned int i = 0; i < triangles.size(); i++)
+  {
+    const UVTriangle& triangle = triangles[i];
+    forEachWrappedTile(triangle.minY, triangle.maxY, height, TILE_SIZE, [&](int tileY)
+    {
+      forEachWrappedTile(triangle.minX, triangle.maxX, width, TILE_SIZE, [&](int tileX)
+      {
+        std::vector<int>& bin = bins[tileY * tilesX + tileX];
+        // A range wrapping back into its first tile visits it twice
+        if (bin.empty() || bin.back() != (int) i)
+        {
+          bin.push_back((int) i);
+        }
+      });
+    });
+  }
+}
+
+bool NormalMapBaker::bake(const std::vector<glm::vec3>& positions,
+                          const std::vector<glm::vec3>& normals,
+                          const std::vector<glm::vec2>& UVs,
+                          const std::vector<unsigned int>& indices,
+                          int width,
+                          int height,
+                          float maxDistance,
+                          std::vector<unsigned char>& texels,
+                          const std::function<bool(float)>& progress)
+{
+  this->isCancelled = false;
+  this->bakedTiles = 0;
+  this->coveredTexels = 0;
+  width = std::max(width, 1);
+  height = std::max(height, 1);
+
+  std::vector<glm::vec3> tangents;
+  std::vector<glm::vec3> bitangents;
+  computeTangentBasis(positions, UVs, indices, tangents, bitangents);
+
+  // Smallest first, so seams stretched over the whole layout only keep the
+  // texels nothing else covers
+  std::vector<UVTriangle> triangles;
+  glm::vec2 scale((float) width, (float) height);
+  for (unsigned int i = 0; i + 2 < indices.size(); i += 3)
+  {
+    UVTriangle triangle;
+    triangle.triangle = (int) i / 3;
+    for (int k = 0; k < 3; k++)
+    {
+      triangle.corners[k] = UVs[indices[i + k]] * scale;
+    }
+    glm::vec2 e1 = triangle.corners[1] - triangle.corners[0];
+    glm::vec2 e2 = triangle.corners[2] - triangle.corners[0];
+    triangle.area = std::abs(e1.x * e2.y - e1.y * e2.x) * 0.5f;
+    glm::vec2 min = glm::min(triangle.corners[0], glm::min(triangle.corners[1], triangle.corners[2]));
+    glm::vec2 max = glm::max(triangle.corners[0], glm::max(triangle.corners[1], triangle.corners[2]));
+    triangle.minX = (int) std::ceil(min.x - 0.5f);
+    triangle.minY = (int) std::ceil(min.y - 0.5f);
+    triangle.maxX = (int) std::floor(max.x - 0.5f);
+    triangle.maxY = (int) std::floor(max.y - 0.5f);
+    if (triangle.area > 0.0f && triangle.minX <= triangle.maxX && triangle.minY <= triangle.maxY)
+    {
+      triangles.push_back(triangle);
+    }
+  }
+  std::sort(triangles.begin(), triangles.end(), [](const UVTriangle& a, const UVTriangle& b)
+  {
+    return a.area < b.area || (a.area == b.area && a.triangle < b.triangle);
+  });
+
+  std::vector<std::vector<int> > bins;
+  this->binTriangles(triangles, width, height, bins);
+  int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+  this->numTiles = (int) bins.size();
+
+  std::vector<unsigned char> baked((size_t) width * height * 4);
+  std::vector<unsigned char> isCovered((size_t) width * height, 0);
+  std::vector<int> tileCovered(this->numTiles, 0);
+  bool isHighPolyEmpty = this->rayCaster->isEmpty();
+  std::thread::id callingThread = std::this_thread::get_id();
+  this->threadPool->parallelFor(this->numTiles, [&](int tile)
+  {
+    if (this->isCancelled)
+    {
+      return;
+    }
+    const std::vector<int>& bin = bins[tile];
+    int x0 = (tile % tilesX) * TILE_SIZE;
+    int y0 = (tile / tilesX) * TILE_SIZE;
+    int x1 = std::min(x0 + TILE_SIZE, width);
+    int y1 = std::min(y0 + TILE_SIZE, height);
+    for (int y = y0; y < y1; y++)
+    {
+      for (int x = x0; x < x1; x++)
+      {
+        unsigned char* texel = &baked[((size_t) y * width + x) * 4];
+        encodeNormal(glm::vec3(0.0f, 0.0f, 1.0f), texel);
+
+        // First triangle of the bin over the texel center, at any of the
+        // places the wrapped texel repeats inside its bounds
+        const UVTriangle* covering = nullptr;
+        glm::vec3 w;
+        for (unsigned int j = 0; j < bin.size() && !covering; j++)
+        {
+          const UVTriangle& triangle = triangles[bin[j]];
+          const glm::vec2* c = triangle.corners;
+          float area2 = (c[1].x - c[0].x) * (c[2].y - c[0].y) - (c[1].y - c[0].y) * (c[2].x - c[0].x);
+          for (int ty = y + floorDiv(triangle.minY - y + height - 1, height) * height; ty <= triangle.maxY && !covering; ty += height)
+          {
+            for (int tx = x + floorDiv(triangle.minX - x + width - 1, width) * width; tx <= triangle.maxX && !covering; tx += width)
+            {
+              glm::vec2 p(tx + 0.5f, ty + 0.5f);
+              w.x = ((c[2].x - c[1].x) * (p.y - c[1].y) - (c[2].y - c[1].y) * (p.x - c[1].x)) / area2;
+              w.y = ((c[0].x - c[2].x) * (p.y - c[2].y) - (c[0].y - c[2].y) * (p.x - c[2].x)) / area2;
+              w.z = 1.0f - w.x - w.y;
+              if (w.x >= -EDGE_EPSILON && w.y >= -EDGE_EPSILON && w.z >= -EDGE_EPSILON)
+              {
+                covering = &triangle;
+              }
+            }
+          }
+        }
+        if (!covering)
+        {
+          continue;
+        }
+
+        const unsigned int* corners = &indices[3 * covering->triangle];
+        glm::vec3 position = w.x * positions[corners[0]] + w.y * positions[corners[1]] + w.z * positions[corners[2]];
+        glm::vec3 normal = w.x * normals[corners[0]] + w.y * normals[corners[1]] + w.z * normals[corners[2]];
+        glm::vec3 tangent = w.x * tangents[corners[0]] + w.y * tangents[corners[1]] + w.z * tangents[corners[2]];
+        glm::vec3 bitangent = w.x * bitangents[corners[0]] + w.y * bitangents[corners[1]] + w.z * bitangents[corners[2]];
+        float length = glm::length(normal);
+        glm::vec3 direction = length > 0.0f ? normal / length : glm::vec3(0.0f, 0.0f, 1.0f);
+
+        // From the cage inwards, the first high poly surface within
+        // maxDistance of the low poly one
+        glm::vec3 highNormal = direction;
+        Ray ray;
+        ray.origin = position + maxDistance * direction;
+        ray.direction = -direction;
+        ray.tMin = 0.0f;
+        ray.tMax = 2.0f * maxDistance;
+        RayHit hit;
+        if (!isHighPolyEmpty && this->rayCaster->intersect(ray, hit))
+        {
+          glm::vec3 hitNormal;
+          if (this->highNormals.empty())
+          {
+            hitNormal = this->highFaceNormals[hit.triangle];
+          }
+          else
+          {
+            const unsigned int* highCorners = &this->highIndices[3 * hit.triangle];
+            hitNormal = (1.0f - hit.u - hit.v) * this->highNormals[highCorners[0]] +
+                        hit.u * this->highNormals[highCorners[1]] +
+                        hit.v * this->highNormals[highCorners[2]];
+          }
+          float hitLength = glm::length(hitNormal);
+          highNormal = hitLength > 0.0f ? hitNormal / hitLength : direction;
+        }
+
+        // The fragment shaders rebuild the normal as the components times
+        // the interpolated tangent, bitangent and normal, which are not
+        // orthonormal: the components solve that system
+        glm::mat3 basis(tangent, bitangent, normal);
+        float determinant = glm::determinant(basis);
+        glm::vec3 bump(0.0f, 0.0f, 1.0f);
+        if (std::abs(determinant) > 1e-12f)
+        {
+          glm::vec3 solved = glm::inverse(basis) * highNormal;
+          float solvedLength = glm::length(solved);
+          if (solvedLength > 0.0f)
+          {
+            bump = solved / solvedLength;
+          }
+        }
+        encodeNormal(bump, texel);
+        isCovered[(size_t) y * width + x] = 1;
+        tileCovered[tile]++;
+      }
+    }
+    int done = this->bakedTiles.fetch_add(1) + 1;
+    if (progress && std::this_thread::get_id() == callingThread && !progress((float) done / this->numTiles))
+    {
+      this->isCancelled = true;
+    }
+  });
+
+  if (this->isCancelled)
+  {
+    return false;
+  }
+  for (int tile = 0; tile < this->numTiles; tile++)
+  {
+    this->coveredTexels += tileCovered[tile];
+  }
+  this->dilate(baked, isCovered, width, height);
+  if (progress)
+  {
+    progress(1.0f);
+  }
+  texels.swap(baked);
+  return true;
+}
+
+void NormalMapBaker::dilate(std::vector<unsigned char>& texels, std::vector<unsigned char>& isCovered, int width, int height)
+{
+  // Every pass grows the charts by a texel, with the average of the
+  // covered neighbours, wrapping like the UVs
+  std::vector<unsigned char> nextCovered;
+  for (int pass = 0; pass < PADDING; pass++)
+  {
+    nextCovered = isCovered;
+    this->threadPool->parallelFor(height, [&](int y)
+    {
+      for (int x = 0; x < width; x++)
+      {
+        if (isCovered[(size_t) y * width + x])
+        {
+          continue;
+        }
+        glm::vec3 sum(0.0f);
+        int count = 0;
+        for (int dy = -1; dy <= 1; dy++)
+        {
+          for (int dx = -1; dx <= 1; dx++)
+          {
+            size_t neighbour = (size_t) wrap(y + dy, height) * width + wrap(x + dx, width);
+            if (isCovered[neighbour])
+            {
+              sum += decodeNormal(&texels[neighbour * 4]);
+              count++;
+            }
+          }
+        }
+        float length = glm::length(sum);
+        if (count > 0 && length > 0.0f)
+        {
+          encodeNormal(sum / length, &texels[((size_t) y * width + x) * 4]);
+          nextCovered[(size_t) y * width + x] = 1;
+        }
+      }
+    });
+    isCovered.swap(nextCovered);
+  }
+}
+
+void NormalMapBaker::cancel()
+{
+  this->isCancelled = true;
+}
+
+float NormalMapBaker::getProgress()
+{
+  return this->numTiles > 0 ? (float) this->bakedTiles / this->numTiles : 0.0f;
+}
+
+int NormalMapBaker::getCoveredTexels()
+{
+  return this->coveredTexels;
+}
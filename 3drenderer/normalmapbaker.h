@@ -0,0 +1,103 @@
+#ifndef NORMALMAPBAKER_H
+#define NORMALMAPBAKER_H
+
+#include "glm/glm.hpp"
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#include "raycaster.h"
+#include "threadpool.h"
+
+// Tangent space normal map of a high poly mesh over the UV layout of a low
+// poly one. Every texel covered by a low poly triangle casts a ray from the
+// cage around the low poly surface, inwards along its interpolated normal,
+// and the normal of the high poly surface hit is written in the tangent
+// basis of the low poly vertices. The texels are baked by tiles over the
+// thread pool, and the same meshes always bake the same texture, whatever
+// the number of threads.
+class NormalMapBaker
+{
+private:
+  struct UVTriangle
+  {
+    int triangle;
+    // Corners in texels, before the UVs are wrapped
+    glm::vec2 corners[3];
+    float area;
+    // Texel centers inside the corners' bounds
+    int minX;
+    int minY;
+    int maxX;
+    int maxY;
+  };
+
+  ThreadPool* threadPool;
+  bool isOwnThreadPool;
+
+  RayCaster* rayCaster;
+  std::vector<glm::vec3> highNormals;
+  std::vector<glm::vec3> highFaceNormals;
+  std::vector<unsigned int> highIndices;
+
+  std::atomic<bool> isCancelled;
+  std::atomic<int> bakedTiles;
+  int numTiles;
+  int coveredTexels;
+
+  void binTriangles(const std::vector<UVTriangle>& triangles, int width, int height, std::vector<std::vector<int> >& bins) const;
+  void dilate(std::vector<unsigned char>& texels, std::vector<unsigned char>& isCovered, int width, int height);
+
+public:
+  // Texels of a tile, on each side
+  static const int TILE_SIZE = 32;
+  // Texels around the UV charts filled from their borders, so filtering
+  // and mipmaps do not bring in the flat normal around them
+  static const int PADDING = 4;
+
+  // Without a thread pool, one is created
+  NormalMapBaker(ThreadPool* threadPool = nullptr);
+  ~NormalMapBaker();
+
+  // Tangents and bitangents of the vertices from their UVs, averaged over
+  // the triangles around them. The renderer and the baker both use this
+  // basis, so the baked texels decode to the high poly normals.
+  static void computeTangentBasis(const std::vector<glm::vec3>& positions,
+                                  const std::vector<glm::vec2>& UVs,
+                                  const std::vector<unsigned int>& indices,
+                                  std::vector<glm::vec3>& tangents,
+                                  std::vector<glm::vec3>& bitangents);
+
+  // The mesh the normals are taken from, kept for the next bakes. Face
+  // normals are used when no vertex normals are given.
+  void setHighPolyMesh(const std::vector<glm::vec3>& positions,
+                       const std::vector<glm::vec3>& normals,
+                       const std::vector<unsigned int>& indices);
+
+  // Texels of width x height, 4 bytes each, in the byte order of the
+  // textures the renderer loads (blue, green, red, alpha), with the tangent
+  // in red, the bitangent in green and the normal in blue. UVs wrap around
+  // the texture; where several triangles cover a texel, the smallest one in
+  // UV space is baked. Rays search the high poly mesh up to maxDistance on
+  // both sides of the low poly surface, texels without a hit keep the low
+  // poly normal. The progress callback runs on the calling thread, with
+  // the fraction of the tiles done; returning false cancels the bake. False
+  // when cancelled, the output is then left as it was.
+  bool bake(const std::vector<glm::vec3>& positions,
+            const std::vector<glm::vec3>& normals,
+            const std::vector<glm::vec2>& UVs,
+            const std::vector<unsigned int>& indices,
+            int width,
+            int height,
+            float maxDistance,
+            std::vector<unsigned char>& texels,
+            const std::function<bool(float)>& progress = std::function<bool(float)>());
+  // From any thread, the bake in progress stops after its current tiles
+  void cancel();
+  // From any thread
+  float getProgress();
+  // Texels of the last bake under a low poly triangle, before the padding
+  int getCoveredTexels();
+};
+
+#endif // NORMALMAPBAKER_H
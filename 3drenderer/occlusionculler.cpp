@@ -0,0 +1,401 @@
+#include "occlusionculler.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define OCCLUSIONCULLER_SSE2
+#endif
+
+// Twice the signed area of abp, positive when p is left of ab
+static inline float edgeFunction(const glm::vec2& a, const glm::vec2& b, const glm::vec2& p)
+{
+  return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+}
+
+#ifdef OCCLUSIONCULLER_SSE2
+static inline float horizontalMin(__m128 v)
+{
+  v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+  v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+  return _mm_cvtss_f32(v);
+}
+#endif
+
+OcclusionCuller::OcclusionCuller(int width, int height, ThreadPool* threadPool)
+{
+  this->width = width;
+  this->height = height;
+  this->isOwnThreadPool = threadPool == nullptr;
+  this->threadPool = this->isOwnThreadPool ? new ThreadPool() : threadPool;
+
+  int levelWidth = width;
+  int levelHeight = height;
+  for (;;)
+  {
+    this->hiZSizes.push_back(glm::ivec2(levelWidth, levelHeight));
+    this->hiZ.push_back(std::vector<float>(levelWidth * levelHeight, 1.0f));
+    if (levelWidth == 1 && levelHeight == 1)
+    {
+      break;
+    }
+    levelWidth = std::max(levelWidth / 2, 1);
+    levelHeight = std::max(levelHeight / 2, 1);
+  }
+}
+
+OcclusionCuller::~OcclusionCuller()
+{
+  if (this->isOwnThreadPool)
+  {
+    delete this->threadPool;
+  }
+}
+
+void OcclusionCuller::clearOccluders()
+{
+  this->occluders.clear();
+}
+
+void OcclusionCuller::addOccluder( const std::vector<glm::vec3>& positions,
+                                   const std::vector<unsigned int>& indices,
+                                   const glm::mat4& model)
+{
+  this->occluders.push_back({ &positions, &indices, model });
+}
+
+void OcclusionCuller::render(const glm::mat4& viewProjection)
+{
+  this->viewProjection = viewProjection;
+
+  // Each occluder is set up by a single job, into its own triangle list
+  this->triangles.resize(this->occluders.size());
+  this->threadPool->parallelFor((int) this->occluders.size(), [this](int occluder)
+  {
+    this->setupTriangles(occluder);
+  });
+
+  // Bands own their rows, so no two jobs write the same pixel
+  int numBands = (this->height + BAND_HEIGHT - 1) / BAND_HEIGHT;
+  this->threadPool->parallelFor(numBands, [this](int band)
+  {
+    this->rasterizeBand(band * BAND_HEIGHT, std::min((band + 1) * BAND_HEIGHT, this->height));
+  });
+
+  this->buildHiZ();
+}
+
+void OcclusionCuller::setupTriangles(int occluder)
+{
+  const Occluder& o = this->occluders[occluder];
+  std::vector<OccluderTriangle>& output = this->triangles[occluder];
+  output.clear();
+
+  glm::mat4 modelViewProjection = this->viewProjection * o.model;
+  std::vector<glm::vec4> clip(o.positions->size());
+  for (unsigned int i = 0; i < clip.size(); i++)
+  {
+    clip[i] = modelViewProjection * glm::vec4((*o.positions)[i], 1.0f);
+  }
+
+  const std::vector<unsigned int>& indices = *o.indices;
+  for (unsigned int i = 0; i + 2 < indices.size(); i += 3)
+  {
+    this->addTriangle(clip[indices[i]], clip[indices[i + 1]], clip[indices[i + 2]], output);
+  }
+}
+
+void OcclusionCuller::addTriangle(glm::vec4 c0, glm::vec4 c1, glm::vec4 c2, std::vector<OccluderTriangle>& output)
+{
+  // Clipped against the near plane (z > -w) only, the other planes are
+  // handled by the screen bounds
+  glm::vec4 input[3] = { c0, c1, c2 };
+  glm::vec4 polygon[4];
+  int numVertices = 0;
+  for (int i = 0; i < 3; i++)
+  {
+    const glm::vec4& a = input[i];
+    const glm::vec4& b = input[(i + 1) % 3];
+    float da = a.z + a.w;
+    float db = b.z + b.w;
+    if (da >= 0.0f)
+    {
+      polygon[numVertices++] = a;
+    }
+    if ((da >= 0.0f) != (db >= 0.0f))
+    {
+      polygon[numVertices++] = a + (b - a) * (da / (da - db));
+    }
+  }
+  if (numVertices < 3)
+  {
+    return;
+  }
+
+  glm::vec2 screen[4];
+  float depth[4];
+  for (int i = 0; i < numVertices; i++)
+  {
+    glm::vec3 ndc = glm::vec3(polygon[i]) / std::max(polygon[i].w, 1e-7f);
+    screen[i] = glm::vec2((ndc.x * 0.5f + 0.5f) * this->width, (ndc.y * 0.5f + 0.5f) * this->height);
+    depth[i] = ndc.z * 0.5f + 0.5f;
+  }
+
+  for (int i = 1; i + 1 < numVertices; i++)
+  {
+    OccluderTriangle t;
+    t.v0 = screen[0];
+    t.v1 = screen[i];
+    t.v2 = screen[i + 1];
+    t.z = glm::vec3(depth[0], depth[i], depth[i + 1]);
+
+    // Back faces are hidden by the front ones of closed occluders
+    if (edgeFunction(t.v0, t.v1, t.v2) <= 0.0f)
+    {
+      continue;
+    }
+
+    glm::vec2 minCorner = glm::min(glm::min(t.v0, t.v1), t.v2);
+    glm::vec2 maxCorner = glm::max(glm::max(t.v0, t.v1), t.v2);
+    t.minX = std::max((int) std::floor(minCorner.x), 0);
+    t.minY = std::max((int) std::floor(minCorner.y), 0);
+    t.maxX = std::min((int) std::ceil(maxCorner.x), this->width - 1);
+    t.maxY = std::min((int) std::ceil(maxCorner.y), this->height - 1);
+    if (t.minX > t.maxX || t.minY > t.maxY)
+    {
+      continue;
+    }
+    output.push_back(t);
+  }
+}
+
+void OcclusionCuller::rasterizeBand(int y0, int y1)
+{
+  float* depth = this->hiZ[0].data();
+  std::fill(depth + y0 * this->width, depth + y1 * this->width, 1.0f);
+
+  for (unsigned int o = 0; o < this->triangles.size(); o++)
+  {
+    const std::vector<OccluderTriangle>& occluderTriangles = this->triangles[o];
+    for (unsigned int i = 0; i < occluderTriangles.size(); i++)
+    {
+      const OccluderTriangle& t = occluderTriangles[i];
+      int minY = std::max(t.minY, y0);
+      int maxY = std::min(t.maxY, y1 - 1);
+      if (minY > maxY)
+      {
+        continue;
+      }
+
+      float invArea = 1.0f / edgeFunction(t.v0, t.v1, t.v2);
+      // Edge functions are stepped along the row, sampled at pixel centers
+      float stepX0 = -(t.v2.y - t.v1.y);
+      float stepX1 = -(t.v0.y - t.v2.y);
+      float stepX2 = -(t.v1.y - t.v0.y);
+      for (int y = minY; y <= maxY; y++)
+      {
+        glm::vec2 p(t.minX + 0.5f, y + 0.5f);
+        float w0 = edgeFunction(t.v1, t.v2, p);
+        float w1 = edgeFunction(t.v2, t.v0, p);
+        float w2 = edgeFunction(t.v0, t.v1, p);
+        float* row = depth + y * this->width;
+        for (int x = t.minX; x <= t.maxX; x++)
+        {
+          if (w0 >= 0.0f && w1 >= 0.0f && w2 >= 0.0f)
+          {
+            float z = (w0 * t.z.x + w1 * t.z.y + w2 * t.z.z) * invArea;
+            row[x] = std::min(row[x], z);
+          }
+          w0 += stepX0;
+          w1 += stepX1;
+          w2 += stepX2;
+        }
+      }
+    }
+  }
+}
+
+void OcclusionCuller::buildHiZ()
+{
+  for (unsigned int level = 1; level < this->hiZ.size(); level++)
+  {
+    const std::vector<float>& source = this->hiZ[level - 1];
+    std::vector<float>& destination = this->hiZ[level];
+    glm::ivec2 sourceSize = this->hiZSizes[level - 1];
+    glm::ivec2 size = this->hiZSizes[level];
+    for (int y = 0; y < size.y; y++)
+    {
+      int sy0 = std::min(2 * y, sourceSize.y - 1);
+      int sy1 = std::min(2 * y + 1, sourceSize.y - 1);
+      for (int x = 0; x < size.x; x++)
+      {
+        int sx0 = std::min(2 * x, sourceSize.x - 1);
+        int sx1 = std::min(2 * x + 1, sourceSize.x - 1);
+        destination[y * size.x + x] = std::max( std::max(source[sy0 * sourceSize.x + sx0], source[sy0 * sourceSize.x + sx1]),
+                                                std::max(source[sy1 * sourceSize.x + sx0], source[sy1 * sourceSize.x + sx1]));
+      }
+    }
+  }
+}
+
+bool OcclusionCuller::projectBounds(const BoundingBox& box, glm::vec2& minNDC, glm::vec2& maxNDC, float& minDepth)
+{
+  // Corners are the min corner plus any of the three edges
+  glm::vec4 origin = this->viewProjection * glm::vec4(box.min, 1.0f);
+  glm::vec3 size = box.max - box.min;
+  glm::vec4 edgeX = this->viewProjection[0] * size.x;
+  glm::vec4 edgeY = this->viewProjection[1] * size.y;
+  glm::vec4 edgeZ = this->viewProjection[2] * size.z;
+
+#ifdef OCCLUSIONCULLER_SSE2
+  // Eight corners as SoA: lanes 0-3 on the min z face, the others on the max one
+  const __m128 maskX = _mm_setr_ps(0.0f, 1.0f, 0.0f, 1.0f);
+  const __m128 maskY = _mm_setr_ps(0.0f, 0.0f, 1.0f, 1.0f);
+  __m128 coordinates[2][4];
+  for (int c = 0; c < 4; c++)
+  {
+    __m128 face = _mm_add_ps( _mm_set1_ps(origin[c]),
+                              _mm_add_ps( _mm_mul_ps(maskX, _mm_set1_ps(edgeX[c])),
+                                          _mm_mul_ps(maskY, _mm_set1_ps(edgeY[c]))));
+    coordinates[0][c] = face;
+    coordinates[1][c] = _mm_add_ps(face, _mm_set1_ps(edgeZ[c]));
+  }
+
+  __m128 minX = _mm_set1_ps(1e30f);
+  __m128 minY = _mm_set1_ps(1e30f);
+  __m128 minZ = _mm_set1_ps(1e30f);
+  __m128 maxX = _mm_set1_ps(-1e30f);
+  __m128 maxY = _mm_set1_ps(-1e30f);
+  for (int face = 0; face < 2; face++)
+  {
+    __m128 x = coordinates[face][0];
+    __m128 y = coordinates[face][1];
+    __m128 z = coordinates[face][2];
+    __m128 w = coordinates[face][3];
+    __m128 behind = _mm_or_ps(_mm_cmplt_ps(z, _mm_sub_ps(_mm_setzero_ps(), w)),
+                              _mm_cmple_ps(w, _mm_set1_ps(1e-7f)));
+    if (_mm_movemask_ps(behind))
+    {
+      return false;
+    }
+    __m128 invW = _mm_div_ps(_mm_set1_ps(1.0f), w);
+    x = _mm_mul_ps(x, invW);
+    y = _mm_mul_ps(y, invW);
+    z = _mm_mul_ps(z, invW);
+    minX = _mm_min_ps(minX, x);
+    minY = _mm_min_ps(minY, y);
+    minZ = _mm_min_ps(minZ, z);
+    maxX = _mm_max_ps(maxX, x);
+    maxY = _mm_max_ps(maxY, y);
+  }
+  minNDC = glm::vec2(horizontalMin(minX), horizontalMin(minY));
+  maxNDC = glm::vec2(-horizontalMin(_mm_sub_ps(_mm_setzero_ps(), maxX)), -horizontalMin(_mm_sub_ps(_mm_setzero_ps(), maxY)));
+  minDepth = horizontalMin(minZ) * 0.5f + 0.5f;
+#else
+  minNDC = glm::vec2(1e30f);
+  maxNDC = glm::vec2(-1e30f);
+  minDepth = 1e30f;
+  for (int corner = 0; corner < 8; corner++)
+  {
+    glm::vec4 clip = origin;
+    clip += corner & 1 ? edgeX : glm::vec4(0.0f);
+    clip += corner & 2 ? edgeY : glm::vec4(0.0f);
+    clip += corner & 4 ? edgeZ : glm::vec4(0.0f);
+    if (clip.z < -clip.w || clip.w <= 1e-7f)
+    {
+      return false;
+    }
+    glm::vec3 ndc = glm::vec3(clip) / clip.w;
+    minNDC = glm::min(minNDC, glm::vec2(ndc));
+    maxNDC = glm::max(maxNDC, glm::vec2(ndc));
+    minDepth = std::min(minDepth, ndc.z * 0.5f + 0.5f);
+  }
+#endif
+  return true;
+}
+
+bool OcclusionCuller::isVisible(const BoundingBox& box)
+{
+  // Crossing the near plane: nothing reliable to compare against
+  glm::vec2 minNDC;
+  glm::vec2 maxNDC;
+  float minDepth;
+  if (!this->projectBounds(box, minNDC, maxNDC, minDepth))
+  {
+    return true;
+  }
+
+  int x0 = (int) std::floor((minNDC.x * 0.5f + 0.5f) * this->width);
+  int y0 = (int) std::floor((minNDC.y * 0.5f + 0.5f) * this->height);
+  int x1 = (int) std::floor((maxNDC.x * 0.5f + 0.5f) * this->width);
+  int y1 = (int) std::floor((maxNDC.y * 0.5f + 0.5f) * this->height);
+  if (x1 < 0 || y1 < 0 || x0 >= this->width || y0 >= this->height)
+  {
+    return false;
+  }
+  x0 = std::max(x0, 0);
+  y0 = std::max(y0, 0);
+  x1 = std::min(x1, this->width - 1);
+  y1 = std::min(y1, this->height - 1);
+
+  // Coarsest level where the rectangle covers at most 2x2 texels
+  unsigned int level = 0;
+  while (level + 1 < this->hiZ.size() && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+  {
+    level++;
+  }
+
+  const std::vector<float>& depth = this->hiZ[level];
+  glm::ivec2 size = this->hiZSizes[level];
+  float maxDepth = 0.0f;
+  for (int y = y0 >> level; y <= std::min(y1 >> level, size.y - 1); y++)
+  {
+    for (int x = x0 >> level; x <= std::min(x1 >> level, size.x - 1); x++)
+    {
+      maxDepth = std::max(maxDepth, depth[y * size.x + x]);
+    }
+  }
+  return minDepth <= maxDepth;
+}
+
+void OcclusionCuller::cull( const std::vector<BoundingBox>& bounds,
+                            const std::vector<unsigned int>& candidates,
+                            std::vector<unsigned int>& visible)
+{
+  const int chunkSize = 1024;
+  std::vector<unsigned char> isCandidateVisible(candidates.size());
+  int numChunks = (int) ((candidates.size() + chunkSize - 1) / chunkSize);
+  this->threadPool->parallelFor(numChunks, [&](int chunk)
+  {
+    size_t end = std::min(candidates.size(), (size_t) (chunk + 1) * chunkSize);
+    for (size_t i = (size_t) chunk * chunkSize; i < end; i++)
+    {
+      isCandidateVisible[i] = this->isVisible(bounds[candidates[i]]);
+    }
+  });
+
+  visible.clear();
+  for (unsigned int i = 0; i < candidates.size(); i++)
+  {
+    if (isCandidateVisible[i])
+    {
+      visible.push_back(candidates[i]);
+    }
+  }
+}
+
+int OcclusionCuller::getWidth()
+{
+  return this->width;
+}
+
+int OcclusionCuller::getHeight()
+{
+  return this->height;
+}
+
+const std::vector<float>& OcclusionCuller::getDepthBuffer()
+{
+  return this->hiZ[0];
+}
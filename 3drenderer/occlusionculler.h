@@ -0,0 +1,86 @@
+#ifndef OCCLUSIONCULLER_H
+#define OCCLUSIONCULLER_H
+
+#include "glm/glm.hpp"
+#include <vector>
+
+#include "frustumculler.h"
+#include "threadpool.h"
+
+// Occluder triangle after clipping and projection, in pixels
+struct OccluderTriangle
+{
+  glm::vec2 v0;
+  glm::vec2 v1;
+  glm::vec2 v2;
+  // depth in [0, 1]
+  glm::vec3 z;
+  int minX;
+  int minY;
+  int maxX;
+  int maxY;
+};
+
+// Software occlusion culling: the occluders are rasterized on the CPU into
+// a small depth buffer, which is reduced into a pyramid keeping the farthest
+// depth of each texel. A box is hidden when its nearest point is behind the
+// farthest occluder depth over the texels its projection covers.
+class OcclusionCuller
+{
+private:
+  struct Occluder
+  {
+    const std::vector<glm::vec3>* positions;
+    const std::vector<unsigned int>* indices;
+    glm::mat4 model;
+  };
+
+  int width;
+  int height;
+  ThreadPool* threadPool;
+  bool isOwnThreadPool;
+
+  std::vector<Occluder> occluders;
+  std::vector<std::vector<OccluderTriangle> > triangles;
+  // Level 0 is the depth buffer
+  std::vector<std::vector<float> > hiZ;
+  std::vector<glm::ivec2> hiZSizes;
+  glm::mat4 viewProjection;
+
+  void setupTriangles(int occluder);
+  void addTriangle(glm::vec4 c0, glm::vec4 c1, glm::vec4 c2, std::vector<OccluderTriangle>& output);
+  void rasterizeBand(int y0, int y1);
+  void buildHiZ();
+  // False when the box crosses the near plane
+  bool projectBounds(const BoundingBox& box, glm::vec2& minNDC, glm::vec2& maxNDC, float& minDepth);
+
+public:
+  // Rows rasterized by a single job
+  static const int BAND_HEIGHT = 8;
+
+  // The size must be a power of two. Without a thread pool, one is created.
+  OcclusionCuller(int width = 256, int height = 128, ThreadPool* threadPool = nullptr);
+  ~OcclusionCuller();
+
+  void clearOccluders();
+  // The geometry is referenced, not copied
+  void addOccluder( const std::vector<glm::vec3>& positions,
+                    const std::vector<unsigned int>& indices,
+                    const glm::mat4& model);
+
+  // Rasterizes the occluders and builds the pyramid
+  void render(const glm::mat4& viewProjection);
+
+  bool isVisible(const BoundingBox& box);
+
+  // Keeps the visible candidates, in order
+  void cull(const std::vector<BoundingBox>& bounds,
+            const std::vector<unsigned int>& candidates,
+            std::vector<unsigned int>& visible);
+
+  int getWidth();
+  int getHeight();
+  const std::vector<float>& getDepthBuffer();
+};
+
+#endif // OCCLUSIONCULLER_H
@@ -0,0 +1,186 @@
+#include "pagefeedback.h"
+
+#include <algorithm>
+#include <cmath>
+
+const int PageFeedback::DOWNSCALE;
+
+// Twice the signed area of abp, positive when p is left of ab
+static inline float edgeFunction(const glm::vec2& a, const glm::vec2& b, const glm::vec2& p)
+{
+  return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+}
+
+PageFeedback::PageFeedback()
+{
+  this->texture = nullptr;
+  this->width = 0;
+  this->height = 0;
+}
+
+void PageFeedback::begin(VirtualTexture* texture, int viewportWidth, int viewportHeight)
+{
+  this->texture = texture;
+  this->width = std::max((viewportWidth + DOWNSCALE - 1) / DOWNSCALE, 1);
+  this->height = std::max((viewportHeight + DOWNSCALE - 1) / DOWNSCALE, 1);
+  this->depth.assign(this->width * this->height, 1.0f);
+  this->pages.assign(this->width * this->height, VirtualTexture::NO_PAGE);
+}
+
+void PageFeedback::draw(const std::vector<glm::vec3>& positions,
+                        const std::vector<glm::vec2>& UVs,
+                        const std::vector<unsigned int>& indices,
+                        unsigned int firstIndex,
+                        unsigned int numIndices,
+                        const glm::mat4& modelViewProjection)
+{
+  if (!this->texture)
+  {
+    return;
+  }
+  for (unsigned int i = firstIndex; i + 2 < firstIndex + numIndices && i + 2 < indices.size(); i += 3)
+  {
+    ClipVertex vertices[3];
+    for (int k = 0; k < 3; k++)
+    {
+      unsigned int index = indices[i + k];
+      vertices[k].position = modelViewProjection * glm::vec4(positions[index], 1.0f);
+      vertices[k].uv = UVs[index];
+    }
+    this->drawTriangle(vertices[0], vertices[1], vertices[2]);
+  }
+}
+
+void PageFeedback::drawTriangle(const ClipVertex& c0, const ClipVertex& c1, const ClipVertex& c2)
+{
+  // Clipped against the near plane (z > -w) only, the other planes are
+  // handled by the buffer bounds
+  const ClipVertex* input[3] = { &c0, &c1, &c2 };
+  ClipVertex polygon[4];
+  int numVertices = 0;
+  for (int i = 0; i < 3; i++)
+  {
+    const ClipVertex& a = *input[i];
+    const ClipVertex& b = *input[(i + 1) % 3];
+    float da = a.position.z + a.position.w;
+    float db = b.position.z + b.position.w;
+    if (da >= 0.0f)
+    {
+      polygon[numVertices++] = a;
+    }
+    if ((da >= 0.0f) != (db >= 0.0f))
+    {
+      float t = da / (da - db);
+      polygon[numVertices].position = a.position + (b.position - a.position) * t;
+      polygon[numVertices].uv = a.uv + (b.uv - a.uv) * t;
+      numVertices++;
+    }
+  }
+  if (numVertices < 3)
+  {
+    return;
+  }
+
+  // UVs over w and 1 / w are linear on the screen
+  glm::vec2 screen[4];
+  glm::vec3 attributes[4];
+  float z[4];
+  for (int i = 0; i < numVertices; i++)
+  {
+    float invW = 1.0f / std::max(polygon[i].position.w, 1e-7f);
+    glm::vec3 ndc = glm::vec3(polygon[i].position) * invW;
+    screen[i] = glm::vec2((ndc.x * 0.5f + 0.5f) * this->width, (ndc.y * 0.5f + 0.5f) * this->height);
+    attributes[i] = glm::vec3(polygon[i].uv * invW, invW);
+    z[i] = ndc.z * 0.5f + 0.5f;
+  }
+
+  glm::vec2 textureSize(this->texture->getWidth(), this->texture->getHeight());
+  for (int i = 1; i + 1 < numVertices; i++)
+  {
+    // Both windings, back faces are not culled by the renderer
+    int i1 = i;
+    int i2 = i + 1;
+    float area = edgeFunction(screen[0], screen[i1], screen[i2]);
+    if (area < 0.0f)
+    {
+      std::swap(i1, i2);
+      area = -area;
+    }
+    if (area <= 1e-12f)
+    {
+      continue;
+    }
+    const glm::vec2& v0 = screen[0];
+    const glm::vec2& v1 = screen[i1];
+    const glm::vec2& v2 = screen[i2];
+    float invArea = 1.0f / area;
+
+    glm::vec2 minCorner = glm::min(glm::min(v0, v1), v2);
+    glm::vec2 maxCorner = glm::max(glm::max(v0, v1), v2);
+    int minX = std::max((int) std::floor(minCorner.x), 0);
+    int minY = std::max((int) std::floor(minCorner.y), 0);
+    int maxX = std::min((int) std::ceil(maxCorner.x), this->width - 1);
+    int maxY = std::min((int) std::ceil(maxCorner.y), this->height - 1);
+
+    for (int y = minY; y <= maxY; y++)
+    {
+      for (int x = minX; x <= maxX; x++)
+      {
+        glm::vec2 p(x + 0.5f, y + 0.5f);
+        glm::vec3 w(edgeFunction(v1, v2, p), edgeFunction(v2, v0, p), edgeFunction(v0, v1, p));
+        if (w.x < 0.0f || w.y < 0.0f || w.z < 0.0f)
+        {
+          continue;
+        }
+        w *= invArea;
+        float pixelDepth = w.x * z[0] + w.y * z[i1] + w.z * z[i2];
+        int pixel = y * this->width + x;
+        if (pixelDepth >= this->depth[pixel])
+        {
+          continue;
+        }
+        this->depth[pixel] = pixelDepth;
+
+        // The neighbours' UVs on the same plane give the derivatives, over
+        // the viewport pixels a feedback pixel spans
+        glm::vec2 uv[3];
+        glm::vec2 offsets[3] = { glm::vec2(0.0f), glm::vec2(1.0f, 0.0f), glm::vec2(0.0f, 1.0f) };
+        for (int k = 0; k < 3; k++)
+        {
+          glm::vec2 q = p + offsets[k];
+          glm::vec3 b = glm::vec3(edgeFunction(v1, v2, q), edgeFunction(v2, v0, q), edgeFunction(v0, v1, q)) * invArea;
+          glm::vec3 a = b.x * attributes[0] + b.y * attributes[i1] + b.z * attributes[i2];
+          uv[k] = glm::vec2(a) / std::max(a.z, 1e-12f);
+        }
+        glm::vec2 dx = (uv[1] - uv[0]) * textureSize / (float) DOWNSCALE;
+        glm::vec2 dy = (uv[2] - uv[0]) * textureSize / (float) DOWNSCALE;
+        float lod = 0.5f * std::log2(std::max(std::max(glm::dot(dx, dx), glm::dot(dy, dy)), 1e-12f));
+        this->pages[pixel] = this->texture->getPage(uv[0].x, uv[0].y, lod);
+      }
+    }
+  }
+}
+
+void PageFeedback::end(std::vector<unsigned int>& requests)
+{
+  requests.clear();
+  for (unsigned int i = 0; i < this->pages.size(); i++)
+  {
+    if (this->pages[i] != VirtualTexture::NO_PAGE)
+    {
+      requests.push_back(this->pages[i]);
+    }
+  }
+  std::sort(requests.begin(), requests.end());
+  requests.erase(std::unique(requests.begin(), requests.end()), requests.end());
+}
+
+int PageFeedback::getWidth()
+{
+  return this->width;
+}
+
+int PageFeedback::getHeight()
+{
+  return this->height;
+}
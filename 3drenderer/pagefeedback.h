@@ -0,0 +1,51 @@
+#ifndef PAGEFEEDBACK_H
+#define PAGEFEEDBACK_H
+
+#include "glm/glm.hpp"
+#include <vector>
+
+#include "virtualtexture.h"
+
+// The pages of a virtual texture a frame samples. The meshes are
+// rasterized on the CPU into a buffer smaller than the viewport, keeping
+// for each pixel the page of the nearest surface at the level of detail the
+// fragment shader picks from its UV derivatives.
+class PageFeedback
+{
+private:
+  VirtualTexture* texture;
+  int width;
+  int height;
+  std::vector<float> depth;
+  std::vector<unsigned int> pages;
+
+  struct ClipVertex
+  {
+    glm::vec4 position;
+    glm::vec2 uv;
+  };
+
+  void drawTriangle(const ClipVertex& c0, const ClipVertex& c1, const ClipVertex& c2);
+
+public:
+  // Viewport pixels per feedback pixel, in each direction
+  static const int DOWNSCALE = 8;
+
+  PageFeedback();
+
+  void begin(VirtualTexture* texture, int viewportWidth, int viewportHeight);
+  // Triangles [firstIndex, firstIndex + numIndices) of the indices
+  void draw(const std::vector<glm::vec3>& positions,
+            const std::vector<glm::vec2>& UVs,
+            const std::vector<unsigned int>& indices,
+            unsigned int firstIndex,
+            unsigned int numIndices,
+            const glm::mat4& modelViewProjection);
+  // Every page sampled since begin, once
+  void end(std::vector<unsigned int>& requests);
+
+  int getWidth();
+  int getHeight();
+};
+
+#endif // PAGEFEEDBACK_H
@@ -0,0 +1,302 @@
+#include "pagefile.h"
+
+#include <algorithm>
+#include <cstring>
+
+const int PageFile::TILE_SIZE;
+const int PageFile::BORDER;
+
+static inline int wrap(int a, int size)
+{
+  a %= size;
+  return a < 0 ? a + size : a;
+}
+
+static inline int getTiles(int size)
+{
+  return (size + PageFile::TILE_SIZE - 1) / PageFile::TILE_SIZE;
+}
+
+// Page files go past 2 GB
+static bool seekFile(std::FILE* file, long long offset)
+{
+#ifdef _WIN32
+  return _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+  return fseeko(file, (off_t) offset, SEEK_SET) == 0;
+#endif
+}
+
+int PageFile::getNumLevels(int width, int height)
+{
+  int levels = 1;
+  while (width > TILE_SIZE || height > TILE_SIZE)
+  {
+    width = std::max(width / 2, 1);
+    height = std::max(height / 2, 1);
+    levels++;
+  }
+  return levels;
+}
+
+bool PageFile::build(const std::string& path,
+                     int width,
+                     int height,
+                     const RowReader& reader,
+                     const std::function<bool(float)>& progress)
+{
+  int numLevels = getNumLevels(width, height);
+  int pageSize = TILE_SIZE + 2 * BORDER;
+  size_t pageBytes = (size_t) pageSize * pageSize * 4;
+  long long numPages = 0;
+  for (int level = 0; level < numLevels; level++)
+  {
+    numPages += (long long) getTiles(std::max(width >> level, 1)) * getTiles(std::max(height >> level, 1));
+  }
+
+  std::string partPath = path + ".part";
+  std::string levelPaths[2] = { path + ".level0", path + ".level1" };
+  std::FILE* output = std::fopen(partPath.c_str(), "wb");
+  if (!output)
+  {
+    return false;
+  }
+  PageFileHeader header;
+  memcpy(header.magic, "VTP1", 4);
+  header.width = width;
+  header.height = height;
+  header.tileSize = TILE_SIZE;
+  header.border = BORDER;
+  header.numLevels = numLevels;
+  bool isComplete = std::fwrite(&header, sizeof(header), 1, output) == 1;
+
+  // The rows under a row of pages, at most as wide as the first level
+  std::vector<unsigned char> band((size_t) pageSize * width * 4);
+  std::vector<unsigned char> page(pageBytes);
+  std::vector<unsigned char> nextRow;
+  std::FILE* levelInput = nullptr;
+  int levelWidth = width;
+  int levelHeight = height;
+  long long writtenPages = 0;
+  for (int level = 0; level < numLevels && isComplete; level++)
+  {
+    // The first level comes from the source, the next ones from the
+    // temporary file of the previous one
+    RowReader levelReader = reader;
+    if (level > 0)
+    {
+      levelReader = [&](int y, int numRows, unsigned char* texels)
+      {
+        isComplete = isComplete &&
+                     seekFile(levelInput, (long long) y * levelWidth * 4) &&
+                     std::fread(texels, (size_t) levelWidth * 4, numRows, levelInput) == (size_t) numRows;
+      };
+    }
+    bool hasNextLevel = level + 1 < numLevels;
+    int nextWidth = std::max(levelWidth / 2, 1);
+    int nextHeight = std::max(levelHeight / 2, 1);
+    std::FILE* levelOutput = nullptr;
+    if (hasNextLevel)
+    {
+      levelOutput = std::fopen(levelPaths[level % 2].c_str(), "wb");
+      isComplete = levelOutput != nullptr;
+      nextRow.resize((size_t) nextWidth * 4);
+    }
+
+    int tilesWide = getTiles(levelWidth);
+    int tilesHigh = getTiles(levelHeight);
+    for (int ty = 0; ty < tilesHigh && isComplete; ty++)
+    {
+      // In runs of consecutive rows, the borders wrap around
+      int firstRow = ty * TILE_SIZE - BORDER;
+      for (int y = 0; y < pageSize;)
+      {
+        int sourceRow = wrap(firstRow + y, levelHeight);
+        int count = std::min(pageSize - y, levelHeight - sourceRow);
+        levelReader(sourceRow, count, &band[(size_t) y * levelWidth * 4]);
+        y += count;
+      }
+
+      for (int tx = 0; tx < tilesWide; tx++)
+      {
+        int firstColumn = tx * TILE_SIZE - BORDER;
+        for (int y = 0; y < pageSize; y++)
+        {
+          const unsigned char* bandRow = &band[(size_t) y * levelWidth * 4];
+          unsigned char* pageRow = &page[(size_t) y * pageSize * 4];
+          for (int x = 0; x < pageSize;)
+          {
+            int sourceColumn = wrap(firstColumn + x, levelWidth);
+            int count = std::min(pageSize - x, levelWidth - sourceColumn);
+            memcpy(pageRow + 4 * x, bandRow + 4 * sourceColumn, (size_t) count * 4);
+            x += count;
+          }
+        }
+        isComplete = isComplete && std::fwrite(page.data(), pageBytes, 1, output) == 1;
+        writtenPages++;
+      }
+
+      // The rows of the next level under this row of tiles, 2x2 averages
+      for (int y = ty * TILE_SIZE / 2; hasNextLevel && y < std::min((ty + 1) * TILE_SIZE / 2, nextHeight); y++)
+      {
+        const unsigned char* row0 = &band[(size_t) (2 * y - firstRow) * levelWidth * 4];
+        const unsigned char* row1 = &band[(size_t) (std::min(2 * y + 1, levelHeight - 1) - firstRow) * levelWidth * 4];
+        for (int x = 0; x < nextWidth; x++)
+        {
+          int x0 = std::min(2 * x, levelWidth - 1) * 4;
+          int x1 = std::min(2 * x + 1, levelWidth - 1) * 4;
+          for (int c = 0; c < 4; c++)
+          {
+            nextRow[4 * x + c] = (unsigned char) ((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+          }
+        }
+        isComplete = isComplete && std::fwrite(nextRow.data(), nextRow.size(), 1, levelOutput) == 1;
+      }
+
+      if (progress && !progress((float) writtenPages / numPages))
+      {
+        isComplete = false;
+      }
+    }
+
+    if (levelInput)
+    {
+      std::fclose(levelInput);
+      levelInput = nullptr;
+    }
+    if (levelOutput)
+    {
+      std::fclose(levelOutput);
+      levelInput = std::fopen(levelPaths[level % 2].c_str(), "rb");
+      isComplete = isComplete && levelInput != nullptr;
+    }
+    levelWidth = nextWidth;
+    levelHeight = nextHeight;
+  }
+
+  if (levelInput)
+  {
+    std::fclose(levelInput);
+  }
+  isComplete = std::fclose(output) == 0 && isComplete;
+  std::remove(levelPaths[0].c_str());
+  std::remove(levelPaths[1].c_str());
+  if (!isComplete)
+  {
+    std::remove(partPath.c_str());
+    return false;
+  }
+  std::remove(path.c_str());
+  return std::rename(partPath.c_str(), path.c_str()) == 0;
+}
+
+PageFile::PageFile()
+{
+  this->file = nullptr;
+  memset(&this->header, 0, sizeof(this->header));
+}
+
+PageFile::~PageFile()
+{
+  this->close();
+}
+
+bool PageFile::open(const std::string& path)
+{
+  this->close();
+  this->file = std::fopen(path.c_str(), "rb");
+  if (!this->file)
+  {
+    return false;
+  }
+  if (std::fread(&this->header, sizeof(this->header), 1, this->file) != 1 ||
+      memcmp(this->header.magic, "VTP1", 4) != 0 ||
+      this->header.tileSize != TILE_SIZE ||
+      this->header.border != BORDER ||
+      this->header.width <= 0 ||
+      this->header.height <= 0 ||
+      this->header.numLevels != getNumLevels(this->header.width, this->header.height))
+  {
+    this->close();
+    return false;
+  }
+
+  long long offset = sizeof(this->header);
+  for (int level = 0; level < this->header.numLevels; level++)
+  {
+    this->levelOffsets.push_back(offset);
+    offset += (long long) this->getTilesWide(level) * this->getTilesHigh(level) * this->getPageBytes();
+  }
+  return true;
+}
+
+void PageFile::close()
+{
+  if (this->file)
+  {
+    std::fclose(this->file);
+    this->file = nullptr;
+  }
+  memset(&this->header, 0, sizeof(this->header));
+  this->levelOffsets.clear();
+}
+
+bool PageFile::isOpen()
+{
+  return this->file != nullptr;
+}
+
+int PageFile::getWidth()
+{
+  return this->header.width;
+}
+
+int PageFile::getHeight()
+{
+  return this->header.height;
+}
+
+int PageFile::getNumLevels()
+{
+  return this->header.numLevels;
+}
+
+int PageFile::getLevelWidth(int level)
+{
+  return std::max(this->header.width >> level, 1);
+}
+
+int PageFile::getLevelHeight(int level)
+{
+  return std::max(this->header.height >> level, 1);
+}
+
+int PageFile::getTilesWide(int level)
+{
+  return getTiles(this->getLevelWidth(level));
+}
+
+int PageFile::getTilesHigh(int level)
+{
+  return getTiles(this->getLevelHeight(level));
+}
+
+int PageFile::getPageSize()
+{
+  return TILE_SIZE + 2 * BORDER;
+}
+
+size_t PageFile::getPageBytes()
+{
+  return (size_t) this->getPageSize() * this->getPageSize() * 4;
+}
+
+bool PageFile::readPage(int level, int x, int y, unsigned char* texels)
+{
+  if (!this->file || level < 0 || level >= this->header.numLevels)
+  {
+    return false;
+  }
+  long long offset = this->levelOffsets[level] + ((long long) y * this->getTilesWide(level) + x) * (long long) this->getPageBytes();
+  return seekFile(this->file, offset) && std::fread(texels, this->getPageBytes(), 1, this->file) == 1;
+}
@@ -0,0 +1,77 @@
+#ifndef PAGEFILE_H
+#define PAGEFILE_H
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Header of a page file, followed by the pages of every level from the full
+// size one down, row by row
+struct PageFileHeader
+{
+  char magic[4];
+  int width;
+  int height;
+  int tileSize;
+  int border;
+  int numLevels;
+};
+
+// A texture too large to be allocated whole, cut into square tiles of every
+// mip level and stored as pages on disk, ready to be read one at a time.
+// A page is a tile with a border of the texels around it, wrapping around
+// the edges like the repeating texture it samples, so it filters on its
+// own. Levels halve like MipChain's box filter, down to the one that fits a
+// single tile. Texels are RGBA8 bytes, whatever their channel order.
+class PageFile
+{
+private:
+  std::FILE* file;
+  PageFileHeader header;
+  std::vector<long long> levelOffsets;
+
+public:
+  static const int TILE_SIZE = 128;
+  static const int BORDER = 4;
+
+  // Fills rows [y, y + numRows) of the source, packed without padding
+  typedef std::function<void(int y, int numRows, unsigned char* texels)> RowReader;
+
+  // Writes the page file of a source read a band of rows at a time, so it
+  // never has to fit in memory. The levels below the first go through
+  // temporary files next to the page file. The progress callback gets the
+  // fraction of the pages written, returning false cancels the build.
+  // False when cancelled or on a write error, the file is then not created.
+  static bool build(const std::string& path,
+                    int width,
+                    int height,
+                    const RowReader& reader,
+                    const std::function<bool(float)>& progress = std::function<bool(float)>());
+
+  static int getNumLevels(int width, int height);
+
+  PageFile();
+  ~PageFile();
+
+  bool open(const std::string& path);
+  void close();
+  bool isOpen();
+
+  int getWidth();
+  int getHeight();
+  int getNumLevels();
+  // Size of the level in texels, and in tiles
+  int getLevelWidth(int level);
+  int getLevelHeight(int level);
+  int getTilesWide(int level);
+  int getTilesHigh(int level);
+  // Side of a page, the tile and its borders
+  int getPageSize();
+  size_t getPageBytes();
+
+  // From one thread at a time, every reading thread opens its own
+  bool readPage(int level, int x, int y, unsigned char* texels);
+};
+
+#endif // PAGEFILE_H
@@ -0,0 +1,194 @@
+#include "picker.h"
+
+#include <algorithm>
+#include <cfloat>
+
+const int Picker::BATCH_RAYS;
+
+// Distance along the ray where it enters the box, false when it misses it
+static bool intersectBounds(const Ray& ray, const BoundingBox& box, float tMax)
+{
+  float tNear = ray.tMin;
+  float tFar = tMax;
+  for (int k = 0; k < 3; k++)
+  {
+    float invDirection = 1.0f / ray.direction[k];
+    float t0 = (box.min[k] - ray.origin[k]) * invDirection;
+    float t1 = (box.max[k] - ray.origin[k]) * invDirection;
+    if (t0 > t1)
+    {
+      std::swap(t0, t1);
+    }
+    // NaN, from a zero component on the slab boundary, keeps the box
+    tNear = t0 > tNear ? t0 : tNear;
+    tFar = t1 < tFar ? t1 : tFar;
+  }
+  return tNear <= tFar * (1.0f + 4.0f * FLT_EPSILON);
+}
+
+static float segmentDistance(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b)
+{
+  glm::vec3 ab = b - a;
+  float length2 = glm::dot(ab, ab);
+  float s = length2 > 0.0f ? glm::clamp(glm::dot(p - a, ab) / length2, 0.0f, 1.0f) : 0.0f;
+  return glm::length(p - (a + s * ab));
+}
+
+Picker::Picker(Scene* scene, ThreadPool* threadPool)
+{
+  this->scene = scene;
+  this->isOwnThreadPool = threadPool == nullptr;
+  this->threadPool = this->isOwnThreadPool ? new ThreadPool() : threadPool;
+  this->meshGeneration = scene->getMeshGeneration() - 1;
+  this->instanceGeneration = scene->getInstanceGeneration() - 1;
+}
+
+Picker::~Picker()
+{
+  this->clearMeshes();
+  if (this->isOwnThreadPool)
+  {
+    delete this->threadPool;
+  }
+}
+
+void Picker::clearMeshes()
+{
+  for (unsigned int i = 0; i < this->meshes.size(); i++)
+  {
+    delete this->meshes[i].rayCaster;
+  }
+  this->meshes.clear();
+}
+
+void Picker::update()
+{
+  // Built ahead of the queries, so they only read shared state
+  if (this->meshGeneration != this->scene->getMeshGeneration())
+  {
+    this->clearMeshes();
+    for (int m = 0; m < this->scene->getNumMeshes(); m++)
+    {
+      PickMesh pickMesh;
+      std::vector<glm::vec3> positions;
+      this->scene->getMesh(m)->getFaceTriangles(&positions, &pickMesh.indices, &pickMesh.triangleFaces);
+      pickMesh.bounds = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+      for (unsigned int v = 0; v < positions.size(); v++)
+      {
+        pickMesh.bounds.min = glm::min(pickMesh.bounds.min, positions[v]);
+        pickMesh.bounds.max = glm::max(pickMesh.bounds.max, positions[v]);
+      }
+      pickMesh.rayCaster = new RayCaster(this->threadPool);
+      pickMesh.rayCaster->build(positions, pickMesh.indices);
+      this->meshes.push_back(pickMesh);
+    }
+    this->meshGeneration = this->scene->getMeshGeneration();
+    this->instanceGeneration = this->scene->getInstanceGeneration() - 1;
+  }
+
+  if (this->instanceGeneration != this->scene->getInstanceGeneration())
+  {
+    int numInstances = this->scene->getNumInstances();
+    this->instanceBounds.resize(numInstances);
+    this->inverseModels.resize(numInstances);
+    for (int i = 0; i < numInstances; i++)
+    {
+      const SceneInstance& instance = this->scene->getInstance(i);
+      this->instanceBounds[i] = FrustumCuller::transformBounds(this->meshes[instance.mesh].bounds, instance.model);
+      this->inverseModels[i] = glm::inverse(instance.model);
+    }
+    this->instanceGeneration = this->scene->getInstanceGeneration();
+  }
+}
+
+bool Picker::pickRay(const Ray& ray, PickResult& result)
+{
+  result.instance = -1;
+  float tMax = ray.tMax;
+  RayHit nearestHit;
+  Ray nearestRay;
+  for (int i = 0; i < (int) this->instanceBounds.size(); i++)
+  {
+    int mesh = this->scene->getInstance(i).mesh;
+    if (this->meshes[mesh].rayCaster->isEmpty() || !intersectBounds(ray, this->instanceBounds[i], tMax))
+    {
+      continue;
+    }
+
+    // An affine map keeps the distances along the ray, in units of its
+    // direction, so the hits of all the instances compare as they are
+    const glm::mat4& inverseModel = this->inverseModels[i];
+    Ray objectRay = ray;
+    objectRay.origin = glm::vec3(inverseModel * glm::vec4(ray.origin, 1.0f));
+    objectRay.direction = glm::vec3(inverseModel * glm::vec4(ray.direction, 0.0f));
+    objectRay.tMax = tMax;
+
+    RayHit hit;
+    if (this->meshes[mesh].rayCaster->intersect(objectRay, hit))
+    {
+      tMax = hit.t;
+      nearestHit = hit;
+      nearestRay = objectRay;
+      result.instance = i;
+      result.mesh = mesh;
+    }
+  }
+  if (result.instance < 0)
+  {
+    return false;
+  }
+
+  const PickMesh& pickMesh = this->meshes[result.mesh];
+  Mesh* mesh = this->scene->getMesh(result.mesh);
+  glm::vec3 objectPosition = nearestRay.origin + nearestHit.t * nearestRay.direction;
+  result.face = pickMesh.triangleFaces[nearestHit.triangle];
+  result.position = ray.origin + nearestHit.t * ray.direction;
+  result.barycentric = glm::vec3(1.0f - nearestHit.u - nearestHit.v, nearestHit.u, nearestHit.v);
+  result.distance = nearestHit.t;
+
+  float vertexDistance = FLT_MAX;
+  float edgeDistance = FLT_MAX;
+  std::vector<int> halfedges = mesh->getFaceHalfedges(result.face);
+  for (unsigned int j = 0; j < halfedges.size(); j++)
+  {
+    int vertex = mesh->getHalfedgeVertex(halfedges[j]);
+    glm::vec3 target = mesh->getVertexPosition(vertex);
+    glm::vec3 source = mesh->getVertexPosition(mesh->getHalfedgeSourceVertex(halfedges[j]));
+    float distance = glm::length(objectPosition - target);
+    if (distance < vertexDistance)
+    {
+      vertexDistance = distance;
+      result.vertex = vertex;
+    }
+    distance = segmentDistance(objectPosition, source, target);
+    if (distance < edgeDistance)
+    {
+      edgeDistance = distance;
+      result.halfedge = halfedges[j];
+    }
+  }
+  return true;
+}
+
+PickResult Picker::pick(const glm::vec3& origin, const glm::vec3& direction)
+{
+  this->update();
+  PickResult result;
+  this->pickRay({ origin, 0.0f, direction, FLT_MAX }, result);
+  return result;
+}
+
+void Picker::pick(const std::vector<Ray>& rays, std::vector<PickResult>& results)
+{
+  this->update();
+  int numRays = (int) rays.size();
+  results.resize(numRays);
+  int numBatches = (numRays + BATCH_RAYS - 1) / BATCH_RAYS;
+  this->threadPool->parallelFor(numBatches, [this, &rays, &results, numRays](int batch)
+  {
+    for (int i = batch * BATCH_RAYS; i < std::min((batch + 1) * BATCH_RAYS, numRays); i++)
+    {
+      this->pickRay(rays[i], results[i]);
+    }
+  });
+}
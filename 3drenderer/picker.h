@@ -0,0 +1,73 @@
+#ifndef PICKER_H
+#define PICKER_H
+
+#include "glm/glm.hpp"
+#include <vector>
+
+#include "frustumculler.h"
+#include "raycaster.h"
+#include "scene.h"
+#include "threadpool.h"
+
+struct PickResult
+{
+  // -1 when the ray hits nothing, the other fields are then undefined
+  int instance;
+  int mesh;
+  int face;
+  // Corner of the face nearest to the hit
+  int vertex;
+  // Halfedge of the face along the edge nearest to the hit
+  int halfedge;
+  // World space
+  glm::vec3 position;
+  // Over the hit triangle of the face, for a fan triangulated polygon
+  glm::vec3 barycentric;
+  // Along the ray, in units of its direction
+  float distance;
+};
+
+// Ray queries against the meshes of a scene. Every mesh gets a ray caster
+// over its own vertices, the rays are moved into the object space of the
+// instances whose bounds they cross.
+class Picker
+{
+private:
+  struct PickMesh
+  {
+    RayCaster* rayCaster;
+    std::vector<unsigned int> indices;
+    std::vector<int> triangleFaces;
+    BoundingBox bounds;
+  };
+
+  Scene* scene;
+  ThreadPool* threadPool;
+  bool isOwnThreadPool;
+
+  std::vector<PickMesh> meshes;
+  unsigned int meshGeneration;
+  std::vector<BoundingBox> instanceBounds;
+  std::vector<glm::mat4> inverseModels;
+  unsigned int instanceGeneration;
+
+  // Rebuilds what the scene changes made stale
+  void update();
+  void clearMeshes();
+  bool pickRay(const Ray& ray, PickResult& result);
+
+public:
+  // Rays picked by a single job of a batch
+  static const int BATCH_RAYS = 64;
+
+  // Without a thread pool, one is created
+  Picker(Scene* scene, ThreadPool* threadPool = nullptr);
+  ~Picker();
+
+  // Nearest hit along a world space ray
+  PickResult pick(const glm::vec3& origin, const glm::vec3& direction);
+  // Many rays at once, spread over the thread pool
+  void pick(const std::vector<Ray>& rays, std::vector<PickResult>& results);
+};
+
+#endif // PICKER_H
@@ -0,0 +1,107 @@
+#include "rangeallocator.h"
+
+RangeAllocator::RangeAllocator(size_t capacity)
+{
+  this->capacity = capacity;
+  this->usedBytes = 0;
+  if (capacity > 0)
+  {
+    this->freeBlocks[0] = capacity;
+  }
+}
+
+size_t RangeAllocator::allocate(size_t size, size_t alignment)
+{
+  if (size == 0)
+  {
+    size = 1;
+  }
+  if (alignment == 0)
+  {
+    alignment = 1;
+  }
+
+  for (std::map<size_t, size_t>::iterator it = this->freeBlocks.begin(); it != this->freeBlocks.end(); ++it)
+  {
+    size_t blockOffset = it->first;
+    size_t blockSize = it->second;
+    size_t alignedOffset = (blockOffset + alignment - 1) / alignment * alignment;
+    size_t padding = alignedOffset - blockOffset;
+    if (padding + size > blockSize)
+    {
+      continue;
+    }
+
+    this->freeBlocks.erase(it);
+    // The padding stays free, the allocation starts at the aligned offset
+    if (padding > 0)
+    {
+      this->freeBlocks[blockOffset] = padding;
+    }
+    if (padding + size < blockSize)
+    {
+      this->freeBlocks[alignedOffset + size] = blockSize - padding - size;
+    }
+    this->usedBlocks[alignedOffset] = size;
+    this->usedBytes += size;
+    return alignedOffset;
+  }
+
+  return INVALID_OFFSET;
+}
+
+void RangeAllocator::free(size_t offset)
+{
+  std::map<size_t, size_t>::iterator used = this->usedBlocks.find(offset);
+  if (used == this->usedBlocks.end())
+  {
+    return;
+  }
+  size_t size = used->second;
+  this->usedBlocks.erase(used);
+  this->usedBytes -= size;
+
+  // Merge with the next free block
+  std::map<size_t, size_t>::iterator next = this->freeBlocks.find(offset + size);
+  if (next != this->freeBlocks.end())
+  {
+    size += next->second;
+    this->freeBlocks.erase(next);
+  }
+
+  // Merge with the previous free block
+  std::map<size_t, size_t>::iterator prev = this->freeBlocks.lower_bound(offset);
+  if (prev != this->freeBlocks.begin())
+  {
+    --prev;
+    if (prev->first + prev->second == offset)
+    {
+      prev->second += size;
+      return;
+    }
+  }
+  this->freeBlocks[offset] = size;
+}
+
+size_t RangeAllocator::getCapacity()
+{
+  return this->capacity;
+}
+
+size_t RangeAllocator::getUsedBytes()
+{
+  return this->usedBytes;
+}
+
+size_t RangeAllocator::getLargestFreeBlock()
+{
+  size_t largest = 0;
+  for (std::map<size_t, size_t>::iterator it = this->freeBlocks.begin(); it != this->freeBlocks.end(); ++it)
+  {
+    if (it->second > largest)
+    {
+      largest = it->second;
+    }
+  }
+  return largest;
+}
@@ -0,0 +1,32 @@
+#ifndef RANGEALLOCATOR_H
+#define RANGEALLOCATOR_H
+
+#include <map>
+#include <cstddef>
+
+// First fit suballocator of a fixed size range. It only does bookkeeping,
+// the memory itself belongs to whoever owns the range (e.g. a GPU buffer).
+class RangeAllocator
+{
+private:
+  size_t capacity;
+  size_t usedBytes;
+  // free blocks, offset -> size, adjacent blocks are always merged
+  std::map<size_t, size_t> freeBlocks;
+  // allocated blocks, offset -> size (including the alignment padding)
+  std::map<size_t, size_t> usedBlocks;
+public:
+  static const size_t INVALID_OFFSET = (size_t) -1;
+
+  RangeAllocator(size_t capacity);
+
+  // Returns INVALID_OFFSET when no free block is big enough
+  size_t allocate(size_t size, size_t alignment);
+  void free(size_t offset);
+
+  size_t getCapacity();
+  size_t getUsedBytes();
+  size_t getLargestFreeBlock();
+};
+
+#endif // RANGEALLOCATOR_H
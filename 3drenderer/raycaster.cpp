@@ -0,0 +1,488 @@
+#include "raycaster.h"
+
+#include <algorithm>
+#include <cfloat>
+
+#if defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define RAYCASTER_SSE2
+#endif
+
+const int RayCaster::BATCH_RAYS;
+
+// Traversal stack kept on the call stack, deeper trees (degenerate
+// inputs) get one on the heap
+static const int MAX_STACK = 256;
+
+// Box distances are widened by this, so the rounding of the slab test
+// never culls a box the watertight triangle test would hit (Ize, Robust
+// BVH ray traversal)
+static const float BOX_EPSILON = 1.0f + 2.0f * (3.0f * FLT_EPSILON * 0.5f) / (1.0f - 3.0f * FLT_EPSILON * 0.5f);
+
+// Per ray constants of the watertight test (Woop, Benthin and Wald): the
+// triangle is sheared into a space where the ray runs along +z
+struct ShearedRay
+{
+  int kx;
+  int ky;
+  int kz;
+  float sx;
+  float sy;
+  float sz;
+};
+
+static inline ShearedRay shearRay(const glm::vec3& direction)
+{
+  ShearedRay s;
+  glm::vec3 a = glm::abs(direction);
+  s.kz = a.x > a.y ? (a.x > a.z ? 0 : 2) : (a.y > a.z ? 1 : 2);
+  s.kx = (s.kz + 1) % 3;
+  s.ky = (s.kx + 1) % 3;
+  // Keeps the winding, so the sign tests do not depend on the direction
+  if (direction[s.kz] < 0.0f)
+  {
+    std::swap(s.kx, s.ky);
+  }
+  s.sx = direction[s.kx] / direction[s.kz];
+  s.sy = direction[s.ky] / direction[s.kz];
+  s.sz = 1.0f / direction[s.kz];
+  return s;
+}
+
+static inline bool intersectTriangle(const ShearedRay& s,
+                                     const Ray& ray,
+                                     const glm::vec3* corner,
+                                     float tMax,
+                                     RayHit& hit)
+{
+  glm::vec3 a = corner[0] - ray.origin;
+  glm::vec3 b = corner[1] - ray.origin;
+  glm::vec3 c = corner[2] - ray.origin;
+  float ax = a[s.kx] - s.sx * a[s.kz];
+  float ay = a[s.ky] - s.sy * a[s.kz];
+  float bx = b[s.kx] - s.sx * b[s.kz];
+  float by = b[s.ky] - s.sy * b[s.kz];
+  float cx = c[s.kx] - s.sx * c[s.kz];
+  float cy = c[s.ky] - s.sy * c[s.kz];
+
+  // Scaled barycentrics of a, b and c
+  float u = cx * by - cy * bx;
+  float v = ax * cy - ay * cx;
+  float w = bx * ay - by * ax;
+  // Exactly on an edge: recomputed in double, so the sign is right
+  if (u == 0.0f || v == 0.0f || w == 0.0f)
+  {
+    u = (float) ((double) cx * by - (double) cy * bx);
+    v = (float) ((double) ax * cy - (double) ay * cx);
+    w = (float) ((double) bx * ay - (double) by * ax);
+  }
+  if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f))
+  {
+    return false;
+  }
+  float det = u + v + w;
+  if (det == 0.0f)
+  {
+    return false;
+  }
+
+  float t = u * s.sz * a[s.kz] + v * s.sz * b[s.kz] + w * s.sz * c[s.kz];
+  if (det < 0.0f)
+  {
+    t = -t;
+  }
+  float absDet = std::abs(det);
+  if (t <= ray.tMin * absDet || t > tMax * absDet)
+  {
+    return false;
+  }
+
+  float invDet = 1.0f / det;
+  hit.t = t / absDet;
+  hit.u = v * invDet;
+  hit.v = w * invDet;
+  return true;
+}
+
+// Zero components get a huge inverse of the same sign, never a NaN
+static inline float safeInverse(float d)
+{
+  return std::abs(d) > 1e-30f ? 1.0f / d : (d < 0.0f ? -1e30f : 1e30f);
+}
+
+RayCaster::RayCaster(ThreadPool* threadPool)
+  : bvh(threadPool)
+{
+  this->isOwnThreadPool = threadPool == nullptr;
+  this->threadPool = this->isOwnThreadPool ? new ThreadPool() : threadPool;
+  this->stackCapacity = 1;
+}
+
+RayCaster::~RayCaster()
+{
+  if (this->isOwnThreadPool)
+  {
+    delete this->threadPool;
+  }
+}
+
+void RayCaster::build(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices)
+{
+  this->bvh.build(positions, indices);
+  this->bvh.collapse<4>(this->nodes);
+  this->updateCorners(positions, indices);
+  // Each wide level leaves at most three siblings on the stack, and the
+  // wide tree is never deeper than the binary one
+  this->stackCapacity = 3 * this->bvh.getDepth() + 1;
+}
+
+void RayCaster::refit(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices)
+{
+  this->bvh.refit(positions, indices);
+  this->bvh.collapse<4>(this->nodes);
+  this->updateCorners(positions, indices);
+}
+
+void RayCaster::updateCorners(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices)
+{
+  const std::vector<unsigned int>& order = this->bvh.getTriangleOrder();
+  this->corners.resize(3 * order.size());
+  for (unsigned int i = 0; i < order.size(); i++)
+  {
+    for (int k = 0; k < 3; k++)
+    {
+      this->corners[3 * i + k] = positions[indices[3 * order[i] + k]];
+    }
+  }
+}
+
+bool RayCaster::isEmpty() const
+{
+  return this->nodes.empty();
+}
+
+BoundingBox RayCaster::getBounds() const
+{
+  const std::vector<BVHNode>& bvhNodes = this->bvh.getNodes();
+  if (bvhNodes.empty())
+  {
+    return { glm::vec3(0.0f), glm::vec3(0.0f) };
+  }
+  return { bvhNodes[0].min, bvhNodes[0].max };
+}
+
+void RayCaster::setPacket(const Ray* rays, RayPacket& packet)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    packet.originX[i] = rays[i].origin.x;
+    packet.originY[i] = rays[i].origin.y;
+    packet.originZ[i] = rays[i].origin.z;
+    packet.invDirectionX[i] = safeInverse(rays[i].direction.x);
+    packet.invDirectionY[i] = safeInverse(rays[i].direction.y);
+    packet.invDirectionZ[i] = safeInverse(rays[i].direction.z);
+    packet.tMin[i] = rays[i].tMin;
+  }
+}
+
+int RayCaster::intersectBox(const RayPacket& packet,
+                            const glm::vec3& min,
+                            const glm::vec3& max,
+                            const float* tFar,
+                            float* tNear)
+{
+  // The directions differ in sign across lanes, so each slab is ordered
+  // with a min and a max
+#ifdef RAYCASTER_SSE2
+  __m128 x0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(min.x), _mm_load_ps(packet.originX)), _mm_load_ps(packet.invDirectionX));
+  __m128 x1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(max.x), _mm_load_ps(packet.originX)), _mm_load_ps(packet.invDirectionX));
+  __m128 y0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(min.y), _mm_load_ps(packet.originY)), _mm_load_ps(packet.invDirectionY));
+  __m128 y1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(max.y), _mm_load_ps(packet.originY)), _mm_load_ps(packet.invDirectionY));
+  __m128 z0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(min.z), _mm_load_ps(packet.originZ)), _mm_load_ps(packet.invDirectionZ));
+  __m128 z1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(max.z), _mm_load_ps(packet.originZ)), _mm_load_ps(packet.invDirectionZ));
+  __m128 t0 = _mm_max_ps(_mm_max_ps(_mm_min_ps(x0, x1), _mm_min_ps(y0, y1)),
+                         _mm_max_ps(_mm_min_ps(z0, z1), _mm_load_ps(packet.tMin)));
+  __m128 t1 = _mm_min_ps(_mm_min_ps(_mm_max_ps(x0, x1), _mm_max_ps(y0, y1)),
+                         _mm_min_ps(_mm_max_ps(z0, z1), _mm_loadu_ps(tFar)));
+  _mm_storeu_ps(tNear, t0);
+  return _mm_movemask_ps(_mm_cmple_ps(t0, _mm_mul_ps(t1, _mm_set1_ps(BOX_EPSILON))));
+#else
+  int mask = 0;
+  for (int i = 0; i < 4; i++)
+  {
+    float x0 = (min.x - packet.originX[i]) * packet.invDirectionX[i];
+    float x1 = (max.x - packet.originX[i]) * packet.invDirectionX[i];
+    float y0 = (min.y - packet.originY[i]) * packet.invDirectionY[i];
+    float y1 = (max.y - packet.originY[i]) * packet.invDirectionY[i];
+    float z0 = (min.z - packet.originZ[i]) * packet.invDirectionZ[i];
+    float z1 = (max.z - packet.originZ[i]) * packet.invDirectionZ[i];
+    float t0 = std::max(std::max(std::min(x0, x1), std::min(y0, y1)), std::max(std::min(z0, z1), packet.tMin[i]));
+    float t1 = std::min(std::min(std::max(x0, x1), std::max(y0, y1)), std::min(std::max(z0, z1), tFar[i]));
+    tNear[i] = t0;
+    mask |= (t0 <= t1 * BOX_EPSILON) << i;
+  }
+  return mask;
+#endif
+}
+
+const std::vector<unsigned int>& RayCaster::getTriangleOrder() const
+{
+  return this->bvh.getTriangleOrder();
+}
+
+bool RayCaster::intersect(const Ray& ray, RayHit& hit) const
+{
+  return this->traverse<false>(ray, hit);
+}
+
+bool RayCaster::occluded(const Ray& ray) const
+{
+  RayHit hit;
+  return this->traverse<true>(ray, hit);
+}
+
+template<bool IS_ANY_HIT>
+bool RayCaster::traverse(const Ray& ray, RayHit& hit) const
+{
+  hit.t = ray.tMax;
+  hit.triangle = -1;
+  if (this->nodes.empty())
+  {
+    return false;
+  }
+
+  ShearedRay sheared = shearRay(ray.direction);
+  const std::vector<unsigned int>& order = this->bvh.getTriangleOrder();
+
+  glm::vec3 invDirection(safeInverse(ray.direction.x), safeInverse(ray.direction.y), safeInverse(ray.direction.z));
+  // The near plane of each slab is the min side for a positive direction.
+  // With it, the inverted bounds of empty slots never overlap.
+  bool isNegative[3] = { invDirection.x < 0.0f, invDirection.y < 0.0f, invDirection.z < 0.0f };
+
+  struct StackEntry
+  {
+    int node;
+    float tNear;
+  };
+  StackEntry localStack[MAX_STACK];
+  std::vector<StackEntry> deepStack;
+  StackEntry* stack = localStack;
+  if (this->stackCapacity > MAX_STACK)
+  {
+    deepStack.resize(this->stackCapacity);
+    stack = deepStack.data();
+  }
+  int stackSize = 0;
+  stack[stackSize++] = { 0, ray.tMin };
+
+#ifdef RAYCASTER_SSE2
+  __m128 originX = _mm_set1_ps(ray.origin.x);
+  __m128 originY = _mm_set1_ps(ray.origin.y);
+  __m128 originZ = _mm_set1_ps(ray.origin.z);
+  __m128 invX = _mm_set1_ps(invDirection.x);
+  __m128 invY = _mm_set1_ps(invDirection.y);
+  __m128 invZ = _mm_set1_ps(invDirection.z);
+  __m128 rayMin = _mm_set1_ps(ray.tMin);
+#endif
+
+  while (stackSize > 0)
+  {
+    StackEntry entry = stack[--stackSize];
+    if (entry.tNear > hit.t)
+    {
+      continue;
+    }
+    const WideBVHNode<4>& node = this->nodes[entry.node];
+    const float* nearX = isNegative[0] ? node.maxX : node.minX;
+    const float* farX = isNegative[0] ? node.minX : node.maxX;
+    const float* nearY = isNegative[1] ? node.maxY : node.minY;
+    const float* farY = isNegative[1] ? node.minY : node.maxY;
+    const float* nearZ = isNegative[2] ? node.maxZ : node.minZ;
+    const float* farZ = isNegative[2] ? node.minZ : node.maxZ;
+
+    alignas(16) float tNear[4];
+    int mask = 0;
+#ifdef RAYCASTER_SSE2
+    __m128 t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearX), originX), invX),
+                           _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearY), originY), invY));
+    t0 = _mm_max_ps(_mm_max_ps(t0, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearZ), originZ), invZ)), rayMin);
+    __m128 t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farX), originX), invX),
+                           _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farY), originY), invY));
+    t1 = _mm_min_ps(_mm_min_ps(t1, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farZ), originZ), invZ)), _mm_set1_ps(hit.t));
+    mask = _mm_movemask_ps(_mm_cmple_ps(t0, _mm_mul_ps(t1, _mm_set1_ps(BOX_EPSILON))));
+    _mm_store_ps(tNear, t0);
+#else
+    for (int i = 0; i < 4; i++)
+    {
+      float t0 = std::max(std::max((nearX[i] - ray.origin.x) * invDirection.x,
+                                   (nearY[i] - ray.origin.y) * invDirection.y),
+                          std::max((nearZ[i] - ray.origin.z) * invDirection.z, ray.tMin));
+      float t1 = std::min(std::min((farX[i] - ray.origin.x) * invDirection.x,
+                                   (farY[i] - ray.origin.y) * invDirection.y),
+                          std::min((farZ[i] - ray.origin.z) * invDirection.z, hit.t));
+      tNear[i] = t0;
+      mask |= (t0 <= t1 * BOX_EPSILON) << i;
+    }
+#endif
+
+    // Leaves are tested right away, the inner children pushed farthest
+    // first so the nearest one is visited next
+    int numInner = 0;
+    StackEntry inner[4];
+    for (int i = 0; i < 4; i++)
+    {
+      if (!(mask & (1 << i)))
+      {
+        continue;
+      }
+      int child = node.child[i];
+      if (child >= 0)
+      {
+        int j = numInner++;
+        while (j > 0 && inner[j - 1].tNear < tNear[i])
+        {
+          inner[j] = inner[j - 1];
+          j--;
+        }
+        inner[j] = { child, tNear[i] };
+        continue;
+      }
+      int first = ~child;
+      for (int e = first; e < first + node.numTriangles[i]; e++)
+      {
+        if (intersectTriangle(sheared, ray, &this->corners[3 * e], hit.t, hit))
+        {
+          hit.triangle = (int) order[e];
+          if (IS_ANY_HIT)
+          {
+            return true;
+          }
+        }
+      }
+    }
+    for (int i = 0; i < numInner; i++)
+    {
+      stack[stackSize++] = inner[i];
+    }
+  }
+  return hit.triangle >= 0;
+}
+
+int RayCaster::intersectPacket(const Ray* rays, RayHit* hits, int activeMask) const
+{
+  // Inactive lanes never enter a box
+  alignas(16) float tFar[4];
+  ShearedRay sheared[4];
+  for (int i = 0; i < 4; i++)
+  {
+    if (activeMask & (1 << i))
+    {
+      hits[i].t = rays[i].tMax;
+      hits[i].triangle = -1;
+      sheared[i] = shearRay(rays[i].direction);
+    }
+    tFar[i] = activeMask & (1 << i) ? rays[i].tMax : -1.0f;
+  }
+  if (this->nodes.empty() || !activeMask)
+  {
+    return 0;
+  }
+
+  RayPacket packet;
+  setPacket(rays, packet);
+  const std::vector<unsigned int>& order = this->bvh.getTriangleOrder();
+
+  struct StackEntry
+  {
+    int node;
+    float tNear;
+  };
+  StackEntry localStack[MAX_STACK];
+  std::vector<StackEntry> deepStack;
+  StackEntry* stack = localStack;
+  if (this->stackCapacity > MAX_STACK)
+  {
+    deepStack.resize(this->stackCapacity);
+    stack = deepStack.data();
+  }
+  int stackSize = 0;
+  stack[stackSize++] = { 0, 0.0f };
+  int hitMask = 0;
+
+  while (stackSize > 0)
+  {
+    StackEntry entry = stack[--stackSize];
+    if (entry.tNear > std::max(std::max(tFar[0], tFar[1]), std::max(tFar[2], tFar[3])))
+    {
+      continue;
+    }
+    const WideBVHNode<4>& node = this->nodes[entry.node];
+    int numInner = 0;
+    StackEntry inner[4];
+    for (int c = 0; c < 4 && node.child[c] != BVH::EMPTY_CHILD; c++)
+    {
+      alignas(16) float tNear[4];
+      int mask = intersectBox(packet,
+                              glm::vec3(node.minX[c], node.minY[c], node.minZ[c]),
+                              glm::vec3(node.maxX[c], node.maxY[c], node.maxZ[c]),
+                              tFar,
+                              tNear);
+      if (!mask)
+      {
+        continue;
+      }
+
+      int child = node.child[c];
+      if (child >= 0)
+      {
+        // Ordered by the nearest entry over the lanes
+        float key = FLT_MAX;
+        for (int i = 0; i < 4; i++)
+        {
+          key = mask & (1 << i) ? std::min(key, tNear[i]) : key;
+        }
+        int j = numInner++;
+        while (j > 0 && inner[j - 1].tNear < key)
+        {
+          inner[j] = inner[j - 1];
+          j--;
+        }
+        inner[j] = { child, key };
+        continue;
+      }
+
+      int first = ~child;
+      for (int e = first; e < first + node.numTriangles[c]; e++)
+      {
+        for (int i = 0; i < 4; i++)
+        {
+          if ((mask & (1 << i)) && intersectTriangle(sheared[i], rays[i], &this->corners[3 * e], hits[i].t, hits[i]))
+          {
+            hits[i].triangle = (int) order[e];
+            tFar[i] = hits[i].t;
+            hitMask |= 1 << i;
+          }
+        }
+      }
+    }
+    for (int i = 0; i < numInner; i++)
+    {
+      stack[stackSize++] = inner[i];
+    }
+  }
+  return hitMask;
+}
+
+void RayCaster::intersect(const std::vector<Ray>& rays, std::vector<RayHit>& hits)
+{
+  int numRays = (int) rays.size();
+  hits.resize(numRays);
+  int numBatches = (numRays + BATCH_RAYS - 1) / BATCH_RAYS;
+  this->threadPool->parallelFor(numBatches, [this, &rays, &hits, numRays](int batch)
+  {
+    for (int i = batch * BATCH_RAYS; i < std::min((batch + 1) * BATCH_RAYS, numRays); i++)
+    {
+      this->intersect(rays[i], hits[i]);
+    }
+  });
+}
@@ -0,0 +1,104 @@
+#ifndef RAYCASTER_H
+#define RAYCASTER_H
+
+#include "glm/glm.hpp"
+#include <vector>
+
+#include "bvh.h"
+#include "threadpool.h"
+
+// Hits are searched in (tMin, tMax], the direction does not need to be
+// normalized (t is in units of it)
+struct Ray
+{
+  glm::vec3 origin;
+  float tMin;
+  glm::vec3 direction;
+  float tMax;
+};
+
+struct RayHit
+{
+  float t;
+  // -1 when nothing was hit
+  int triangle;
+  // Barycentrics of the second and third corners, the first one has
+  // 1 - u - v
+  float u;
+  float v;
+};
+
+// Four rays in SIMD lanes, for packet traversal
+struct RayPacket
+{
+  alignas(16) float originX[4];
+  alignas(16) float originY[4];
+  alignas(16) float originZ[4];
+  alignas(16) float invDirectionX[4];
+  alignas(16) float invDirectionY[4];
+  alignas(16) float invDirectionZ[4];
+  alignas(16) float tMin[4];
+};
+
+// Closest hit queries against the triangles of a mesh, through a 4-wide
+// BVH. The ray/triangle test is watertight: a ray through a shared edge or
+// vertex always hits one of the triangles around it.
+class RayCaster
+{
+private:
+  ThreadPool* threadPool;
+  bool isOwnThreadPool;
+
+  BVH bvh;
+  std::vector<WideBVHNode<4> > nodes;
+  // Three corners per entry of the BVH triangle order, so leaves read them
+  // in sequence
+  std::vector<glm::vec3> corners;
+  // Traversal stack entries the tree can need
+  int stackCapacity;
+
+  void updateCorners(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices);
+  // Any hit ends the traversal of occlusion queries
+  template<bool IS_ANY_HIT>
+  bool traverse(const Ray& ray, RayHit& hit) const;
+
+public:
+  // Rays cast by a single job of a batch
+  static const int BATCH_RAYS = 256;
+
+  static void setPacket(const Ray* rays, RayPacket& packet);
+  // Lanes of the packet entering the box before tFar, with the entry
+  // distances in tNear
+  static int intersectBox(const RayPacket& packet,
+                          const glm::vec3& min,
+                          const glm::vec3& max,
+                          const float* tFar,
+                          float* tNear);
+
+  // Without a thread pool, one is created
+  RayCaster(ThreadPool* threadPool = nullptr);
+  ~RayCaster();
+
+  // Three indices per triangle
+  void build(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices);
+  // Same triangles, moved vertices
+  void refit(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices);
+  bool isEmpty() const;
+
+  BoundingBox getBounds() const;
+  // Triangles in the order of the BVH leaves, neighbours in space are
+  // mostly neighbours in it
+  const std::vector<unsigned int>& getTriangleOrder() const;
+
+  // Closest hit, false on a miss
+  bool intersect(const Ray& ray, RayHit& hit) const;
+  // Whether anything is hit, stopping at the first hit found
+  bool occluded(const Ray& ray) const;
+  // Closest hits of four coherent rays, which go down the tree together.
+  // Lanes out of the mask are left as they are. Returns the lanes hit.
+  int intersectPacket(const Ray* rays, RayHit* hits, int activeMask) const;
+  // Many rays at once, spread over the thread pool
+  void intersect(const std::vector<Ray>& rays, std::vector<RayHit>& hits);
+};
+
+#endif // RAYCASTER_H
@@ -0,0 +1,434 @@
+#include "raytracer.h"
+
+#include <algorithm>
+#include <cfloat>
+
+const int RayTracer::TILE_SIZE;
+const int RayTracer::MAX_DISCARDS;
+
+// Traversal stack kept on the call stack, a deeper BVH over the draws
+// gets one on the heap
+static const int MAX_STACK = 64;
+
+// Barycentrics of the point where the ray crosses the plane of the
+// triangle, zero when it runs along it
+static glm::vec3 getPlaneBarycentrics(const glm::vec3* p, const glm::vec3& origin, const glm::vec3& direction)
+{
+  glm::vec3 e1 = p[1] - p[0];
+  glm::vec3 e2 = p[2] - p[0];
+  glm::vec3 n = glm::cross(e1, e2);
+  float denominator = glm::dot(n, direction);
+  float area2 = glm::dot(n, n);
+  if (denominator == 0.0f || area2 == 0.0f)
+  {
+    return glm::vec3(0.0f);
+  }
+  glm::vec3 q = origin + (glm::dot(n, p[0] - origin) / denominator) * direction - p[0];
+  float b1 = glm::dot(glm::cross(q, e2), n) / area2;
+  float b2 = glm::dot(glm::cross(e1, q), n) / area2;
+  return glm::vec3(1.0f - b1 - b2, b1, b2);
+}
+
+RayTracer::RayTracer(ThreadPool* threadPool)
+{
+  this->isOwnThreadPool = threadPool == nullptr;
+  this->threadPool = this->isOwnThreadPool ? new ThreadPool() : threadPool;
+  this->instanceBVH = new BVH(this->threadPool);
+  this->width = 0;
+  this->height = 0;
+  this->tilesX = 0;
+  this->tilesY = 0;
+  this->shading = { false, false, false, false };
+  this->isPacketTraversal = true;
+  this->stackCapacity = 1;
+}
+
+RayTracer::~RayTracer()
+{
+  this->clearRayCasters();
+  delete this->instanceBVH;
+  if (this->isOwnThreadPool)
+  {
+    delete this->threadPool;
+  }
+}
+
+void RayTracer::clearRayCasters()
+{
+  for (std::map<unsigned int, RayCaster*>::iterator it = this->rayCasters.begin(); it != this->rayCasters.end(); ++it)
+  {
+    delete it->second;
+  }
+  this->rayCasters.clear();
+}
+
+void RayTracer::setGeometry(const std::vector<InterleavedVertex>& vertices,
+                            const std::vector<unsigned int>& indices,
+                            const std::vector<float>& occlusion)
+{
+  this->vertices = vertices;
+  this->indices = indices;
+  this->occlusion = occlusion;
+  this->clearRayCasters();
+}
+
+void RayTracer::setDiffuseTexture(const unsigned char* texels, int width, int height)
+{
+  this->diffuseTexture.setImage(texels, width, height);
+}
+
+void RayTracer::setBumpMap(const unsigned char* texels, int width, int height)
+{
+  this->bumpMap.setImage(texels, width, height);
+}
+
+void RayTracer::setPacketTraversal(bool isPacketTraversal)
+{
+  this->isPacketTraversal = isPacketTraversal;
+}
+
+void RayTracer::beginFrame(int width, int height, const glm::mat4& view, const glm::mat4& projection, const SoftwareShading& shading)
+{
+  if (width != this->width || height != this->height)
+  {
+    this->width = width;
+    this->height = height;
+    this->tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    this->tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    this->colorBuffer.resize(4 * width * height);
+    this->tileRays.resize(this->tilesX * this->tilesY);
+  }
+  this->view = view;
+  this->inverseViewProjection = glm::inverse(projection * view);
+  this->shading = shading;
+  this->draws.clear();
+}
+
+void RayTracer::draw( unsigned int firstVertex,
+                      unsigned int numVertices,
+                      unsigned int firstIndex,
+                      unsigned int numIndices,
+                      const InstanceData& instance)
+{
+  if (numIndices < 3 || numVertices == 0)
+  {
+    return;
+  }
+  Draw draw;
+  draw.firstVertex = firstVertex;
+  draw.numVertices = numVertices;
+  draw.firstIndex = firstIndex;
+  draw.numIndices = numIndices - numIndices % 3;
+  draw.instance = instance;
+  draw.inverseModel = glm::inverse(instance.model);
+  draw.modelView = this->view * instance.model;
+  // The view matrix is rigid, it transforms normals as is
+  draw.normalMatrix = glm::mat3(this->view * instance.normalModel);
+  draw.rayCaster = nullptr;
+  this->draws.push_back(draw);
+}
+
+const RayCaster* RayTracer::getRayCaster(const Draw& draw)
+{
+  std::map<unsigned int, RayCaster*>::iterator it = this->rayCasters.find(draw.firstIndex);
+  if (it != this->rayCasters.end())
+  {
+    return it->second;
+  }
+
+  // Over the vertex range of the draw, as in the object space of its
+  // instances
+  std::vector<glm::vec3> positions(draw.numVertices);
+  for (unsigned int i = 0; i < draw.numVertices; i++)
+  {
+    positions[i] = this->vertices[draw.firstVertex + i].pos;
+  }
+  std::vector<unsigned int> indices(this->indices.begin() + draw.firstIndex,
+                                    this->indices.begin() + draw.firstIndex + draw.numIndices);
+  for (unsigned int i = 0; i < indices.size(); i++)
+  {
+    indices[i] -= draw.firstVertex;
+  }
+  RayCaster* rayCaster = new RayCaster(this->threadPool);
+  rayCaster->build(positions, indices);
+  this->rayCasters[draw.firstIndex] = rayCaster;
+  return rayCaster;
+}
+
+void RayTracer::endFrame()
+{
+  // The acceleration structures are built ahead of the tiles, which only
+  // read them
+  std::vector<BoundingBox> bounds(this->draws.size());
+  for (unsigned int d = 0; d < this->draws.size(); d++)
+  {
+    Draw& draw = this->draws[d];
+    draw.rayCaster = this->getRayCaster(draw);
+    // Empty meshes get a point, skipped when it is reached
+    bounds[d] = draw.rayCaster->isEmpty() ? BoundingBox{ glm::vec3(0.0f), glm::vec3(0.0f) }
+                                          : FrustumCuller::transformBounds(draw.rayCaster->getBounds(), draw.instance.model);
+  }
+  this->instanceBVH->build(bounds);
+  // Each level leaves at most one sibling on the stack
+  this->stackCapacity = this->instanceBVH->getDepth() + 1;
+
+  this->threadPool->parallelFor(this->tilesX * this->tilesY, [this](int tile)
+  {
+    this->traceTile(tile);
+  });
+}
+
+Ray RayTracer::getPrimaryRay(float x, float y)
+{
+  // From the near to the far plane, so hits are in the depth range the
+  // rasterizer clips to
+  glm::vec2 ndc(2.0f * x / this->width - 1.0f, 1.0f - 2.0f * y / this->height);
+  glm::vec4 nearPoint = this->inverseViewProjection * glm::vec4(ndc, -1.0f, 1.0f);
+  glm::vec4 farPoint = this->inverseViewProjection * glm::vec4(ndc, 1.0f, 1.0f);
+  glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+  return { origin, 0.0f, glm::vec3(farPoint) / farPoint.w - origin, 1.0f };
+}
+
+int RayTracer::traceRays(const Ray* rays, RayHit* hits, int* draws, int activeMask)
+{
+  alignas(16) float tFar[4];
+  for (int i = 0; i < 4; i++)
+  {
+    hits[i].t = rays[i].tMax;
+    hits[i].triangle = -1;
+    tFar[i] = activeMask & (1 << i) ? rays[i].tMax : -1.0f;
+  }
+  const std::vector<BVHNode>& nodes = this->instanceBVH->getNodes();
+  if (nodes.empty() || !activeMask)
+  {
+    return 0;
+  }
+
+  RayPacket packet;
+  RayCaster::setPacket(rays, packet);
+  const std::vector<unsigned int>& order = this->instanceBVH->getTriangleOrder();
+  int localStack[MAX_STACK];
+  std::vector<int> deepStack;
+  int* stack = localStack;
+  if (this->stackCapacity > MAX_STACK)
+  {
+    deepStack.resize(this->stackCapacity);
+    stack = deepStack.data();
+  }
+  int stackSize = 0;
+  stack[stackSize++] = 0;
+  int hitMask = 0;
+
+  while (stackSize > 0)
+  {
+    const BVHNode& node = nodes[stack[--stackSize]];
+    alignas(16) float tNear[4];
+    int mask = RayCaster::intersectBox(packet, node.min, node.max, tFar, tNear);
+    if (!mask)
+    {
+      continue;
+    }
+    if (node.numTriangles == 0)
+    {
+      stack[stackSize++] = node.first + 1;
+      stack[stackSize++] = node.first;
+      continue;
+    }
+
+    for (int e = node.first; e < node.first + node.numTriangles; e++)
+    {
+      int d = (int) order[e];
+      const Draw& draw = this->draws[d];
+      if (draw.rayCaster->isEmpty())
+      {
+        continue;
+      }
+      // An affine map keeps the distances along the rays
+      Ray objectRays[4];
+      for (int i = 0; i < 4; i++)
+      {
+        objectRays[i].origin = glm::vec3(draw.inverseModel * glm::vec4(rays[i].origin, 1.0f));
+        objectRays[i].tMin = rays[i].tMin;
+        objectRays[i].direction = glm::vec3(draw.inverseModel * glm::vec4(rays[i].direction, 0.0f));
+        objectRays[i].tMax = tFar[i];
+      }
+      RayHit objectHits[4];
+      int drawMask = 0;
+      if (this->isPacketTraversal)
+      {
+        drawMask = draw.rayCaster->intersectPacket(objectRays, objectHits, mask);
+      }
+      else
+      {
+        for (int i = 0; i < 4; i++)
+        {
+          if ((mask & (1 << i)) && draw.rayCaster->intersect(objectRays[i], objectHits[i]))
+          {
+            drawMask |= 1 << i;
+          }
+        }
+      }
+      for (int i = 0; i < 4; i++)
+      {
+        if (drawMask & (1 << i))
+        {
+          hits[i] = objectHits[i];
+          draws[i] = d;
+          tFar[i] = objectHits[i].t;
+        }
+      }
+      hitMask |= drawMask;
+    }
+  }
+  return hitMask;
+}
+
+void RayTracer::traceTile(int tile)
+{
+  int x0 = (tile % this->tilesX) * TILE_SIZE;
+  int y0 = (tile / this->tilesX) * TILE_SIZE;
+  int x1 = std::min(x0 + TILE_SIZE, this->width);
+  int y1 = std::min(y0 + TILE_SIZE, this->height);
+  unsigned int numRays = 0;
+
+  for (int y = y0; y < y1; y += 2)
+  {
+    for (int x = x0; x < x1; x += 2)
+    {
+      // Lanes: (x, y), (x + 1, y), (x, y + 1), (x + 1, y + 1)
+      Ray rays[4];
+      glm::vec3 colors[4];
+      int activeMask = 0;
+      for (int i = 0; i < 4; i++)
+      {
+        int px = std::min(x + (i & 1), x1 - 1);
+        int py = std::min(y + (i >> 1), y1 - 1);
+        rays[i] = this->getPrimaryRay(px + 0.5f, py + 0.5f);
+        colors[i] = glm::vec3(0.0f);
+        activeMask |= (px == x + (i & 1) && py == y + (i >> 1)) << i;
+      }
+
+      // Rays go on past the discarded fragments, until one is kept
+      int remainingMask = activeMask;
+      for (int layer = 0; layer <= MAX_DISCARDS && remainingMask; layer++)
+      {
+        RayHit hits[4];
+        int draws[4];
+        int hitMask = this->traceRays(rays, hits, draws, remainingMask);
+        for (int i = 0; i < 4; i++)
+        {
+          numRays += (remainingMask >> i) & 1;
+        }
+        remainingMask &= hitMask;
+        for (int i = 0; i < 4; i++)
+        {
+          if (!(remainingMask & (1 << i)))
+          {
+            continue;
+          }
+          glm::vec2 pixel(x + (i & 1) + 0.5f, y + (i >> 1) + 0.5f);
+          if (this->shadeHit(hits[i], draws[i], pixel, colors[i]))
+          {
+            remainingMask &= ~(1 << i);
+          }
+          else
+          {
+            // Past the hit, without finding the same triangle again
+            rays[i].tMin = hits[i].t * (1.0f + 4.0f * FLT_EPSILON);
+          }
+        }
+      }
+
+      for (int i = 0; i < 4; i++)
+      {
+        if (!(activeMask & (1 << i)))
+        {
+          continue;
+        }
+        unsigned char* pixel = this->colorBuffer.data() + 4 * ((y + (i >> 1)) * this->width + x + (i & 1));
+        pixel[0] = (unsigned char) (glm::clamp(colors[i].r, 0.0f, 1.0f) * 255.0f + 0.5f);
+        pixel[1] = (unsigned char) (glm::clamp(colors[i].g, 0.0f, 1.0f) * 255.0f + 0.5f);
+        pixel[2] = (unsigned char) (glm::clamp(colors[i].b, 0.0f, 1.0f) * 255.0f + 0.5f);
+        pixel[3] = 255;
+      }
+    }
+  }
+  this->tileRays[tile] = numRays;
+}
+
+bool RayTracer::shadeHit(const RayHit& hit, int draw, glm::vec2 pixel, glm::vec3& color)
+{
+  const Draw& d = this->draws[draw];
+  const unsigned int* triangle = this->indices.data() + d.firstIndex + 3 * hit.triangle;
+
+  // The vertex shader outputs of the corners, as emitted by the geometry
+  // shader
+  SoftwareVaryings v[3];
+  glm::vec3 corners[3];
+  for (int k = 0; k < 3; k++)
+  {
+    const InterleavedVertex& vertex = this->vertices[triangle[k]];
+    corners[k] = vertex.pos;
+    v[k].positionVSpace = glm::vec3(d.modelView * glm::vec4(vertex.pos, 1.0f));
+    v[k].normalVSpace = d.normalMatrix * vertex.normal;
+    v[k].tangentVSpace = d.normalMatrix * vertex.tangent;
+    v[k].bitangentVSpace = d.normalMatrix * vertex.bitangent;
+    v[k].triangleCoordinate = glm::vec3(0.0f);
+    v[k].triangleCoordinate[k] = 1.0f;
+    v[k].uv = vertex.uv;
+    v[k].occlusion = this->occlusion.empty() ? 1.0f : this->occlusion[triangle[k]];
+  }
+  // Along the ray, the object space barycentrics are the perspective
+  // correct ones
+  glm::vec3 b(1.0f - hit.u - hit.v, hit.u, hit.v);
+
+  // Ray differentials: the rays of the next pixels, on the plane of the
+  // triangle
+  glm::vec2 uvDx;
+  glm::vec2 uvDy;
+  if (this->shading.isDiffuseTextureActive || this->shading.isBumpMapActive)
+  {
+    glm::vec2 uv = b.x * v[0].uv + b.y * v[1].uv + b.z * v[2].uv;
+    Ray rayDx = this->getPrimaryRay(pixel.x + 1.0f, pixel.y);
+    Ray rayDy = this->getPrimaryRay(pixel.x, pixel.y + 1.0f);
+    glm::vec3 bDx = getPlaneBarycentrics(corners,
+                                         glm::vec3(d.inverseModel * glm::vec4(rayDx.origin, 1.0f)),
+                                         glm::vec3(d.inverseModel * glm::vec4(rayDx.direction, 0.0f)));
+    glm::vec3 bDy = getPlaneBarycentrics(corners,
+                                         glm::vec3(d.inverseModel * glm::vec4(rayDy.origin, 1.0f)),
+                                         glm::vec3(d.inverseModel * glm::vec4(rayDy.direction, 0.0f)));
+    uvDx = bDx.x * v[0].uv + bDx.y * v[1].uv + bDx.z * v[2].uv - uv;
+    uvDy = bDy.x * v[0].uv + bDy.y * v[1].uv + bDy.z * v[2].uv - uv;
+  }
+  return shadeSoftwareFragment(this->shading, this->diffuseTexture, this->bumpMap, v, b, uvDx, uvDy, d.instance.material, color);
+}
+
+int RayTracer::getWidth()
+{
+  return this->width;
+}
+
+int RayTracer::getHeight()
+{
+  return this->height;
+}
+
+int RayTracer::getNumThreads()
+{
+  return this->threadPool->getNumThreads();
+}
+
+unsigned long long RayTracer::getNumRays()
+{
+  unsigned long long numRays = 0;
+  for (unsigned int i = 0; i < this->tileRays.size(); i++)
+  {
+    numRays += this->tileRays[i];
+  }
+  return numRays;
+}
+
+const std::vector<unsigned char>& RayTracer::getColorBuffer()
+{
+  return this->colorBuffer;
+}
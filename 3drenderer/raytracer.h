@@ -0,0 +1,117 @@
+#ifndef RAYTRACER_H
+#define RAYTRACER_H
+
+#include "glm/glm.hpp"
+#include <map>
+#include <vector>
+
+#include "bvh.h"
+#include "raycaster.h"
+#include "scene.h"
+#include "softwarerenderer.h"
+#include "threadpool.h"
+#include "vertexpacker.h"
+
+// CPU reference renderer, ray tracing the same draws with the same camera,
+// shading and textures as SoftwareRenderer. The meshes get a ray caster
+// each, the instances a BVH over their world bounds. Tiles of pixels are
+// traced by parallel jobs, as packets of 2x2 rays. A pixel only depends on
+// its own rays, so the image is the same for any number of threads.
+class RayTracer
+{
+private:
+  struct Draw
+  {
+    unsigned int firstVertex;
+    unsigned int numVertices;
+    unsigned int firstIndex;
+    unsigned int numIndices;
+    InstanceData instance;
+    glm::mat4 inverseModel;
+    // View space varyings: modelView, and the normal matrix
+    glm::mat4 modelView;
+    glm::mat3 normalMatrix;
+    const RayCaster* rayCaster;
+  };
+
+  ThreadPool* threadPool;
+  bool isOwnThreadPool;
+
+  std::vector<InterleavedVertex> vertices;
+  std::vector<unsigned int> indices;
+  // One per vertex, empty when nothing is baked
+  std::vector<float> occlusion;
+  SoftwareTexture diffuseTexture;
+  SoftwareTexture bumpMap;
+  // By first index, kept until the geometry changes
+  std::map<unsigned int, RayCaster*> rayCasters;
+
+  int width;
+  int height;
+  int tilesX;
+  int tilesY;
+  glm::mat4 view;
+  glm::mat4 inverseViewProjection;
+  SoftwareShading shading;
+  bool isPacketTraversal;
+
+  std::vector<Draw> draws;
+  // Over the world bounds of the draws
+  BVH* instanceBVH;
+  // Traversal stack entries it can need
+  int stackCapacity;
+
+  std::vector<unsigned char> colorBuffer;
+  // Rays traced by every tile in the last frame, lanes of a packet count
+  // as rays
+  std::vector<unsigned int> tileRays;
+
+  void clearRayCasters();
+  const RayCaster* getRayCaster(const Draw& draw);
+  Ray getPrimaryRay(float x, float y);
+  // Closest hits of the four rays over all the draws, in world space.
+  // Returns the lanes hit, with their draw in draws.
+  int traceRays(const Ray* rays, RayHit* hits, int* draws, int activeMask);
+  void traceTile(int tile);
+  // False when the fragment is discarded, pixel is the hit pixel for the
+  // texture derivatives
+  bool shadeHit(const RayHit& hit, int draw, glm::vec2 pixel, glm::vec3& color);
+
+public:
+  static const int TILE_SIZE = 16;
+  // Discarded fragments a ray goes on through, as the depth test of the
+  // rasterizer would only see the fragments kept
+  static const int MAX_DISCARDS = 64;
+
+  // Without a thread pool, one is created
+  RayTracer(ThreadPool* threadPool = nullptr);
+  ~RayTracer();
+
+  // Same as SoftwareRenderer::setGeometry
+  void setGeometry(const std::vector<InterleavedVertex>& vertices,
+                   const std::vector<unsigned int>& indices,
+                   const std::vector<float>& occlusion = std::vector<float>());
+  void setDiffuseTexture(const unsigned char* texels, int width, int height);
+  void setBumpMap(const unsigned char* texels, int width, int height);
+  // Packets by default, single rays down the mesh BVHs otherwise
+  void setPacketTraversal(bool isPacketTraversal);
+
+  // Clears the frame and records the draws, traced by endFrame
+  void beginFrame(int width, int height, const glm::mat4& view, const glm::mat4& projection, const SoftwareShading& shading);
+  void draw(unsigned int firstVertex,
+            unsigned int numVertices,
+            unsigned int firstIndex,
+            unsigned int numIndices,
+            const InstanceData& instance);
+  void endFrame();
+
+  int getWidth();
+  int getHeight();
+  int getNumThreads();
+  // Over the last frame, the rays through discarded fragments included
+  unsigned long long getNumRays();
+  // RGBA8 bytes, the top row first
+  const std::vector<unsigned char>& getColorBuffer();
+};
+
+#endif // RAYTRACER_H
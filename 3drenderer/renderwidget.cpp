@@ -6,24 +6,99 @@
 #include <QGLWidget>
 #include <QMouseEvent>
 #include <QOpenGLTexture>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QImageReader>
+#include <QStandardPaths>
+#include <QSurfaceFormat>
+#include <QThread>
 #include <glm/ext.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "camera.h"
 #include "mesh.h"
+#include "tracer.h"
 #include "uvsphericalwrapper.h"
 #include "uvcubewrapper.h"
+#include "vertexpacker.h"
 
 #include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
 #ifndef M_PI
     #define M_PI 3.14159265358979323846
 #endif
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+    #define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+    #define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RG_RGTC2
+    #define GL_COMPRESSED_RG_RGTC2 0x8DBD
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+    #define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+
+const float RenderWidget::AO_MAX_DISTANCE = 0.25f;
+const float RenderWidget::NORMAL_BAKE_DISTANCE = 0.05f;
+
+// Hashes the source and cuts it into its page file, unless the cache has it
+class PageFileBuildThread : public QThread
+{
+private:
+  RenderWidget* widget;
+  // Of the last progress queued to the widget, in percent
+  int reportedProgress;
+
+  bool build();
+
+public:
+  QString sourcePath;
+  std::string pageFilePath;
+  std::atomic<float> progress;
+  std::atomic<bool> isCanceled;
+  std::atomic<bool> isDone;
+  // Read once isDone is set
+  bool isBuilt;
+
+  PageFileBuildThread(RenderWidget* widget, const QString& sourcePath)
+  {
+    this->widget = widget;
+    this->reportedProgress = -1;
+    this->sourcePath = sourcePath;
+    this->progress = 0.0f;
+    this->isCanceled = false;
+    this->isDone = false;
+    this->isBuilt = false;
+  }
+
+  void run()
+  {
+    this->isBuilt = this->build();
+    this->isDone = true;
+    QMetaObject::invokeMethod(this->widget, "updateVirtualTextureImport", Qt::QueuedConnection);
+  }
+};
 
 RenderWidget::RenderWidget(QWidget *parent)
     : QOpenGLWidget(parent)
-    , program(nullptr)
+    , shaderCache(nullptr)
+    , glCore(nullptr)
+    , isBaseVertexSupported(false)
+    , uploadManager(nullptr)
+    , frameUniformBuffer(nullptr)
+    , materialUniformBuffer(nullptr)
+    , camera(nullptr)
 {
   this->setFocusPolicy(Qt::StrongFocus);
+  this->scene = new Scene();
+  this->frameScheduler = new FrameScheduler(this);
   this->isArcballMovementActive = false;
   this->isPanMovementActive = false;
 
@@ -34,22 +109,95 @@ RenderWidget::RenderWidget(QWidget *parent)
   this->isFlatFaces = false;
   this->isDiffuseTextureActive = false;
   this->isBumpMapActive = false;
+  this->isBumpMapTwoChannel = false;
 
   this->diffuseColor = glm::vec3(0.0f, 0.0f, 0.0f);
   this->materialShininess = 24.0f;
   this->isSphericalMapping = true;
+  this->isPackedVertexFormat = false;
+  this->isSeparateVertexStreams = false;
+  this->lastUploadBytes = 0;
+
+  this->vertexRange = { 0, 0, 0, nullptr, -1 };
+  this->indexRange = { 0, 0, 0, nullptr, -1 };
+  for(int stream = 0; stream < NUM_VERTEX_STREAMS; stream++)
+  {
+    this->streamRanges[stream] = { 0, 0, 0, nullptr, -1 };
+  }
+  this->occlusionRange = { 0, 0, 0, nullptr, -1 };
+
+  this->instanceRange = { 0, 0, 0, nullptr, -1 };
+  this->visibleRange = { 0, 0, 0, nullptr, -1 };
+  this->indirectRange = { 0, 0, 0, nullptr, -1 };
+  this->storageAlignment = 16;
+  this->uploadedInstanceGeneration = this->scene->getInstanceGeneration();
+  this->isFrustumCulling = true;
+  this->isOcclusionCulling = false;
+  this->picker = new Picker(this->scene);
+  this->softwareRenderer = nullptr;
+  this->isSoftwareTexturesDirty = true;
+  this->rayTracer = nullptr;
+  this->isRayTracerTexturesDirty = true;
+  this->aoBaker = nullptr;
+  this->normalMapBaker = nullptr;
+  this->textureLoader = new TextureLoader(this);
+  this->diffuseTextureRequest = 0;
+  this->bumpMapRequest = 0;
+  this->atlasRequest = 0;
+  this->materialAtlasTexture = 0;
+  this->materialAtlasRequest = 0;
+  this->isMaterialAtlasLoaded = false;
+  this->texturePBO = 0;
+  this->virtualTexture = nullptr;
+  this->pageFileBuildThread = nullptr;
+  this->virtualTextureUniformBuffer = nullptr;
+  this->isDiffuseTextureVirtual = false;
+  this->isInstanceBoundsDirty = false;
+  this->isVisibilityDirty = false;
+  this->isDrawCommandsDirty = false;
 }
 
 
 RenderWidget::~RenderWidget()
 {
-  delete this->program;
+  this->makeCurrent();
+
+  if(this->pageFileBuildThread)
+  {
+    this->pageFileBuildThread->isCanceled = true;
+    this->pageFileBuildThread->wait();
+    delete this->pageFileBuildThread;
+  }
+  delete this->textureLoader;
+  delete this->virtualTexture;
+  delete this->uploadManager;
+  delete this->frameUniformBuffer;
+  delete this->materialUniformBuffer;
+  delete this->virtualTextureUniformBuffer;
+  delete this->shaderCache;
   delete this->camera;
-  delete this->mesh;
+  delete this->picker;
+  delete this->scene;
+  delete this->frameScheduler;
+  delete this->softwareRenderer;
+  delete this->rayTracer;
+  delete this->aoBaker;
+  delete this->normalMapBaker;
 
   this->glDeleteVertexArrays(1, &VAO);
   this->glDeleteBuffers(1, &VBO);
   this->glDeleteBuffers(1, &EBO);
+  this->glDeleteBuffers(NUM_VERTEX_STREAMS, this->streamVBOs);
+  this->glDeleteBuffers(1, &occlusionVBO);
+  this->glDeleteBuffers(1, &instanceBuffer);
+  this->glDeleteBuffers(1, &visibleBuffer);
+  this->glDeleteBuffers(1, &indirectBuffer);
+  this->glDeleteBuffers(1, &texturePBO);
+  for(unsigned int i = 0; i < this->materialTextures.size(); i++)
+  {
+    this->glDeleteTextures(1, &(this->materialTextures[i].texture));
+  }
+  this->glDeleteTextures(1, &(this->materialAtlasTexture));
 }
 
 
@@ -57,75 +205,611 @@ void RenderWidget::initializeGL()
 {
   this->initializeOpenGLFunctions();
 
+  this->glCore = this->context()->versionFunctions<QOpenGLFunctions_4_5_Core>();
+  if(this->glCore)
+  {
+    this->glCore->initializeOpenGLFunctions();
+    this->uploadManager = new GPUUploadManager(this->glCore);
+    if(!this->uploadManager->isValid())
+    {
+      // Without persistent mapping the meshes go to plain buffers
+      delete this->uploadManager;
+      this->uploadManager = nullptr;
+    }
+  }
+  // Core since GL 3.2 and GLES 3.2, through QOpenGLExtraFunctions
+  QSurfaceFormat format = this->context()->format();
+  this->isBaseVertexSupported = format.majorVersion() > 3 || (format.majorVersion() == 3 && format.minorVersion() >= 2);
+
   this->glEnable(GL_DEPTH_TEST);
 
   this->glClearColor(0, 0, 0, 1);
   this->glViewport(0, 0, width(), height());
 
-  this->program = new QOpenGLShaderProgram();
-  this->program->addShaderFromSourceFile(QOpenGLShader::Vertex, ":/shaders/vertexshader.glsl");
-  this->program->addShaderFromSourceFile(QOpenGLShader::Geometry, ":/shaders/geometryshader.glsl");
-  this->program->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/shaders/fragmentshader.glsl");
-  this->program->link();
+  // Variants are compiled lazily, the generic program is ready right away
+  this->shaderCache = new ShaderCache(this, this->context(), this);
+
+  // std140 blocks, re-uploaded only when their content changes
+  this->frameUniformBuffer = new UniformBuffer(this, FRAME_UNIFORM_BINDING, sizeof(FrameUniforms));
+  this->materialUniformBuffer = new UniformBuffer(this, MATERIAL_UNIFORM_BINDING, sizeof(MaterialUniforms));
+  this->virtualTextureUniformBuffer = new UniformBuffer(this, VIRTUAL_TEXTURE_UNIFORM_BINDING, sizeof(VirtualTextureUniforms));
+  // Not sampled before a virtual texture is imported
+  VirtualTextureUniforms virtualTextureUniforms;
+  virtualTextureUniforms.virtualSize = glm::ivec4(0);
+  virtualTextureUniforms.virtualLayout = glm::ivec4(0);
+  for(int level = 0; level < MAX_VIRTUAL_TEXTURE_LEVELS; level++)
+  {
+    virtualTextureUniforms.pageTableOffsets[level] = glm::ivec4(0);
+  }
+  this->virtualTextureUniformBuffer->set(&virtualTextureUniforms);
+
+  GLint alignment = 0;
+  this->glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  this->storageAlignment = std::max<size_t>(alignment, 16);
 
   this->createBuffers(&(this->VAO),
                       &(this->VBO),
                       &(this->EBO));
-  this->countElements = 0;        
   this->createTexture(&(this->DIFFUSE_TEXTURE_2D));
-  this->createTexture(&(this->BUMP_TEXTURE_2D));              
+  this->createTexture(&(this->BUMP_TEXTURE_2D));
+  this->createTexture(&(this->PHYSICAL_PAGES_2D));
+  this->createTexture(&(this->PAGE_TABLE_2D));
+  this->glGenBuffers(1, &(this->texturePBO));
 }
 
 
 void RenderWidget::paintGL()
 {
-  this->glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  TRACE_SCOPE("RenderWidget::paintGL");
+  this->frameScheduler->beginFrame();
+  this->frameScheduler->applyInput(this->camera);
 
-  this->glBindVertexArray(this->VAO);
-  this->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+  this->uploadLoadedTextures();
+  this->uploadVirtualTexturePages();
 
-  this->program->bind();
+  this->glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-  this->view = this->camera->getViewMatrix();
-  this->proj = this->camera->getProjectionMatrix();
-  this->model = glm::mat4();
-  //  this->model = glm::scale(this->model, glm::vec3(10.0f, 10.0f, 10.0f));
+  this->glBindVertexArray(this->VAO);
+  this->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->indexRange.buffer);
 
-  QMatrix4x4 m(glm::value_ptr(glm::transpose(this->model)));
-  QMatrix4x4 v(glm::value_ptr(glm::transpose(this->view)));
-  QMatrix4x4 p(glm::value_ptr(glm::transpose(this->proj)));
+  this->glUseProgram(this->shaderCache->getProgram(this->getShaderFeatures()));
 
-  QMatrix4x4 mv = v * m;
-  QMatrix4x4 mvp = p * mv;
-  this->program->setUniformValue("mv", mv);
-  this->program->setUniformValue("mv_ti", mv.inverted().transposed());
-  this->program->setUniformValue("mvp", mvp);
+  {
+    // The uniform blocks alone, without the culling of updateInstances
+    TRACE_SCOPE("RenderWidget::updateUniforms");
+    this->view = this->camera->getViewMatrix();
+    this->proj = this->camera->getProjectionMatrix();
+
+    this->frameUniforms.view = this->view;
+    this->frameUniforms.viewProjection = this->proj * this->view;
+    this->frameUniformBuffer->set(&(this->frameUniforms));
+    this->frameUniformBuffer->bind();
+
+    MaterialUniforms material = this->getFrameMaterialUniforms();
+    this->materialUniformBuffer->set(&material);
+    this->materialUniformBuffer->bind();
+    this->virtualTextureUniformBuffer->bind();
+  }
 
-  this->program->setUniformValue("isWireframeOverwrite", this->isWireframeOverwrite);
-  this->program->setUniformValue("isEdgesVisible", this->isEdgesVisible);
-  this->program->setUniformValue("isFlatFaces", this->isFlatFaces);
-  this->program->setUniformValue("isDiffuseTextureActive", this->isDiffuseTextureActive);
-  this->program->setUniformValue("isBumpMapActive", this->isBumpMapActive);
+  this->updateInstances();
 
-  
   this->glActiveTexture(GL_TEXTURE0);
   this->glBindTexture(GL_TEXTURE_2D, this->DIFFUSE_TEXTURE_2D);
-  this->program->setUniformValue("diffuseTextureSampler", 0);
 
   this->glActiveTexture(GL_TEXTURE1);
   this->glBindTexture(GL_TEXTURE_2D, this->BUMP_TEXTURE_2D);
-  this->program->setUniformValue("bumpMapSampler", 1);
 
-  this->program->setUniformValue("diffuseColor", QVector3D( this->diffuseColor[0],
-                                                            this->diffuseColor[1],
-                                                            this->diffuseColor[2]));
+  this->glActiveTexture(GL_TEXTURE2);
+  this->glBindTexture(GL_TEXTURE_2D, this->PHYSICAL_PAGES_2D);
+
+  this->glActiveTexture(GL_TEXTURE3);
+  this->glBindTexture(GL_TEXTURE_2D, this->PAGE_TABLE_2D);
+
+  this->drawInstances();
+
+  // The pages this frame sampled are loaded for the next ones
+  if(this->isDiffuseTextureVirtual && this->isDiffuseTextureActive)
+  {
+    this->updatePageFeedback(this->frameUniforms.viewProjection);
+  }
+
+  if(this->uploadManager)
+  {
+    this->uploadManager->endFrame();
+  }
+
+  this->frameScheduler->endFrame();
+}
+
+
+void RenderWidget::updateInstances()
+{
+  // Nothing is rebuilt for a still scene, the CPU cost of a frame does not
+  // depend on the number of instances
+  unsigned int generation = this->scene->getInstanceGeneration();
+  if(generation != this->uploadedInstanceGeneration)
+  {
+    this->scene->buildBatches(this->instanceBatches, this->instanceData);
+    if(!this->instanceData.empty())
+    {
+      this->storeBuffer(GL_SHADER_STORAGE_BUFFER,
+                        this->instanceBuffer,
+                        this->instanceRange,
+                        this->instanceData.data(),
+                        this->instanceData.size() * sizeof(InstanceData),
+                        this->storageAlignment);
+    }
+    this->uploadedInstanceGeneration = generation;
+    this->isInstanceBoundsDirty = true;
+  }
+
+  if(this->isInstanceBoundsDirty)
+  {
+    // World bounds of the instances, in instance data order
+    this->instanceBounds.clear();
+    for(unsigned int i = 0; i < this->instanceBatches.size(); i++)
+    {
+      const InstanceBatch& batch = this->instanceBatches[i];
+      BoundingBox meshBox = { glm::vec3(0.0f), glm::vec3(0.0f) };
+      if(batch.mesh < (int) this->meshBounds.size())
+      {
+        meshBox = this->meshBounds[batch.mesh];
+      }
+      for(unsigned int j = batch.firstInstance; j < batch.firstInstance + batch.instanceCount; j++)
+      {
+        this->instanceBounds.push_back(FrustumCuller::transformBounds(meshBox, this->instanceData[j].model));
+      }
+    }
+    this->frustumCuller.build(this->instanceBounds);
+    this->isInstanceBoundsDirty = false;
+    this->isVisibilityDirty = true;
+  }
+
+  glm::mat4 viewProjection = this->frameUniforms.viewProjection;
+  bool isCulling = this->isFrustumCulling || this->isOcclusionCulling;
+  if(this->isVisibilityDirty || (isCulling && viewProjection != this->culledViewProjection))
+  {
+    if(this->isFrustumCulling)
+    {
+      // Sorted back, the instances of a batch stay contiguous
+      this->frustumCuller.cull(viewProjection, this->visibleInstances);
+      std::sort(this->visibleInstances.begin(), this->visibleInstances.end());
+    }
+    else
+    {
+      this->visibleInstances.resize(this->instanceData.size());
+      for(unsigned int i = 0; i < this->visibleInstances.size(); i++)
+      {
+        this->visibleInstances[i] = i;
+      }
+    }
+    if(this->isOcclusionCulling)
+    {
+      this->cullOccludedInstances(viewProjection);
+    }
+    this->culledViewProjection = viewProjection;
+    this->isVisibilityDirty = false;
+    this->isDrawCommandsDirty = true;
+  }
 
-  this->program->setUniformValue("materialShininess", this->materialShininess);
+  if(this->isDrawCommandsDirty)
+  {
+    // One command per submesh and material range of every batch, all the
+    // visible instances of a mesh at once. Submeshes keep the order of the
+    // indices, a material range is cut where a submesh ends.
+    unsigned int indexSize = this->indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+    unsigned int visible = 0;
+    std::vector<std::vector<DrawCommand> > materialCommands(this->sceneMaterials.size() + 1);
+    for(unsigned int i = 0; i < this->instanceBatches.size(); i++)
+    {
+      const InstanceBatch& batch = this->instanceBatches[i];
+      unsigned int firstVisible = visible;
+      while(visible < this->visibleInstances.size() &&
+            this->visibleInstances[visible] < batch.firstInstance + batch.instanceCount)
+      {
+        visible++;
+      }
+      if(visible == firstVisible || batch.mesh + 1 >= (int) this->meshFirstSubmesh.size() ||
+         batch.mesh + 1 >= (int) this->meshFirstMaterialRange.size())
+      {
+        continue;
+      }
+      for(unsigned int r = this->meshFirstMaterialRange[batch.mesh]; r < this->meshFirstMaterialRange[batch.mesh + 1]; r++)
+      {
+        const MaterialRange& range = this->materialRanges[r];
+        std::vector<DrawCommand>& commands = materialCommands[range.material + 1];
+        for(unsigned int j = this->meshFirstSubmesh[batch.mesh]; j < this->meshFirstSubmesh[batch.mesh + 1]; j++)
+        {
+          const Submesh& submesh = this->submeshes[j];
+          unsigned int first = std::max(submesh.firstIndex, range.firstIndex);
+          unsigned int end = std::min(submesh.firstIndex + submesh.indexCount, range.firstIndex + range.numIndices);
+          if(first >= end)
+          {
+            continue;
+          }
+          commands.push_back({
+            end - first,
+            visible - firstVisible,
+            (unsigned int) (this->indexRange.offset / indexSize) + first,
+            submesh.baseVertex,
+            firstVisible
+          });
+        }
+      }
+    }
+
+    // Passes in state order, their commands one after the other
+    std::vector<std::pair<PassState, int> > states;
+    for(unsigned int m = 0; m < materialCommands.size(); m++)
+    {
+      if(!materialCommands[m].empty())
+      {
+        states.push_back(std::make_pair(PassState(), (int) m - 1));
+        this->getPassState((int) m - 1, states.back().first);
+      }
+    }
+    std::stable_sort(states.begin(), states.end(), [](const std::pair<PassState, int>& a, const std::pair<PassState, int>& b)
+    {
+      if(a.first.features != b.first.features)
+      {
+        return a.first.features < b.first.features;
+      }
+      if(a.first.diffuseTexture != b.first.diffuseTexture)
+      {
+        return a.first.diffuseTexture < b.first.diffuseTexture;
+      }
+      if(a.first.bumpTexture != b.first.bumpTexture)
+      {
+        return a.first.bumpTexture < b.first.bumpTexture;
+      }
+      return a.first.uniforms.isBumpMapTwoChannel < b.first.uniforms.isBumpMapTwoChannel;
+    });
+    this->drawCommands.clear();
+    this->drawPasses.clear();
+    for(unsigned int i = 0; i < states.size(); i++)
+    {
+      const std::vector<DrawCommand>& commands = materialCommands[states[i].second + 1];
+      this->drawPasses.push_back({ states[i].second, (unsigned int) this->drawCommands.size(), (unsigned int) commands.size() });
+      this->drawCommands.insert(this->drawCommands.end(), commands.begin(), commands.end());
+    }
+    if(!this->visibleInstances.empty())
+    {
+      this->storeBuffer(GL_SHADER_STORAGE_BUFFER,
+                        this->visibleBuffer,
+                        this->visibleRange,
+                        this->visibleInstances.data(),
+                        this->visibleInstances.size() * sizeof(unsigned int),
+                        this->storageAlignment);
+    }
+    if(this->glCore && !this->drawCommands.empty())
+    {
+      this->storeBuffer(GL_DRAW_INDIRECT_BUFFER,
+                        this->indirectBuffer,
+                        this->indirectRange,
+                        this->drawCommands.data(),
+                        this->drawCommands.size() * sizeof(DrawCommand));
+    }
+    this->isDrawCommandsDirty = false;
+  }
+
+  if(!this->drawCommands.empty())
+  {
+    this->glBindBufferRange(GL_SHADER_STORAGE_BUFFER,
+                            INSTANCE_STORAGE_BINDING,
+                            this->instanceRange.buffer,
+                            this->instanceRange.offset,
+                            this->instanceData.size() * sizeof(InstanceData));
+    this->glBindBufferRange(GL_SHADER_STORAGE_BUFFER,
+                            VISIBLE_INSTANCE_STORAGE_BINDING,
+                            this->visibleRange.buffer,
+                            this->visibleRange.offset,
+                            this->visibleInstances.size() * sizeof(unsigned int));
+  }
+}
 
-  this->glDrawElements( GL_TRIANGLES,
-                        (GLsizei) this->countElements,
-                        GL_UNSIGNED_INT,
-                        (void *) 0);
+void RenderWidget::cullOccludedInstances(const glm::mat4& viewProjection)
+{
+  // The nearest visible instances of the low poly meshes are the occluders
+  glm::vec3 eye = glm::vec3(glm::inverse(this->frameUniforms.view)[3]);
+  std::vector<std::pair<float, unsigned int> > candidates;
+  unsigned int visible = 0;
+  for(unsigned int i = 0; i < this->instanceBatches.size(); i++)
+  {
+    const InstanceBatch& batch = this->instanceBatches[i];
+    bool isOccluderMesh = batch.mesh < (int) this->occluderIndices.size() && !this->occluderIndices[batch.mesh].empty();
+    for(; visible < this->visibleInstances.size() &&
+          this->visibleInstances[visible] < batch.firstInstance + batch.instanceCount; visible++)
+    {
+      if(isOccluderMesh)
+      {
+        const BoundingBox& box = this->instanceBounds[this->visibleInstances[visible]];
+        glm::vec3 toCenter = (box.min + box.max) * 0.5f - eye;
+        candidates.push_back(std::make_pair(glm::dot(toCenter, toCenter), this->visibleInstances[visible]));
+      }
+    }
+  }
+  size_t numOccluders = std::min(candidates.size(), (size_t) MAX_OCCLUDERS);
+  std::partial_sort(candidates.begin(), candidates.begin() + numOccluders, candidates.end());
+
+  // Instance data is sorted by batch, so the mesh of an instance is found
+  // from its batch
+  this->occlusionCuller.clearOccluders();
+  for(size_t i = 0; i < numOccluders; i++)
+  {
+    unsigned int instance = candidates[i].second;
+    std::vector<InstanceBatch>::const_iterator batch = std::upper_bound(
+          this->instanceBatches.begin(),
+          this->instanceBatches.end(),
+          instance,
+          [](unsigned int value, const InstanceBatch& b) { return value < b.firstInstance; }) - 1;
+    this->occlusionCuller.addOccluder(this->occluderPositions[batch->mesh],
+                                      this->occluderIndices[batch->mesh],
+                                      this->instanceData[instance].model);
+  }
+  this->occlusionCuller.render(viewProjection);
+
+  std::vector<unsigned int> candidateInstances;
+  candidateInstances.swap(this->visibleInstances);
+  this->occlusionCuller.cull(this->instanceBounds, candidateInstances, this->visibleInstances);
+}
+
+void RenderWidget::drawInstances()
+{
+  if(this->drawCommands.empty())
+  {
+    return;
+  }
+
+  // Program, textures and material block are only changed between passes
+  // that differ, paintGL set up the frame state
+  unsigned int program = this->shaderCache->getProgram(this->getShaderFeatures());
+  unsigned int diffuseTexture = this->DIFFUSE_TEXTURE_2D;
+  unsigned int bumpTexture = this->BUMP_TEXTURE_2D;
+  unsigned int indexSize = this->indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+  if(this->glCore)
+  {
+    this->glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->indirectRange.buffer);
+  }
+  for(unsigned int p = 0; p < this->drawPasses.size(); p++)
+  {
+    const DrawPass& pass = this->drawPasses[p];
+    PassState state;
+    this->getPassState(pass.material, state);
+    unsigned int passProgram = this->shaderCache->getProgram(state.features);
+    if(passProgram != program)
+    {
+      this->glUseProgram(passProgram);
+      program = passProgram;
+    }
+    if(state.diffuseTexture != diffuseTexture)
+    {
+      this->glActiveTexture(GL_TEXTURE0);
+      this->glBindTexture(GL_TEXTURE_2D, state.diffuseTexture);
+      diffuseTexture = state.diffuseTexture;
+    }
+    if(state.bumpTexture != bumpTexture)
+    {
+      this->glActiveTexture(GL_TEXTURE1);
+      this->glBindTexture(GL_TEXTURE_2D, state.bumpTexture);
+      bumpTexture = state.bumpTexture;
+    }
+    // Re-uploaded only when it differs from the previous pass
+    this->materialUniformBuffer->set(&state.uniforms);
+    this->materialUniformBuffer->bind();
+    this->glUniform4fv(MATERIAL_OVERRIDE_LOCATION, 1, &state.materialOverride[0]);
+
+    if(this->glCore)
+    {
+      this->glCore->glMultiDrawElementsIndirect(GL_TRIANGLES,
+                                                this->indexType,
+                                                (void*) (this->indirectRange.offset + pass.firstCommand * sizeof(DrawCommand)),
+                                                (GLsizei) pass.numCommands,
+                                                0);
+      continue;
+    }
+
+    // Without indirect draws the first instance goes through a uniform, and
+    // without base vertex draws the base vertex is already in the indices
+    for(unsigned int i = pass.firstCommand; i < pass.firstCommand + pass.numCommands; i++)
+    {
+      const DrawCommand& command = this->drawCommands[i];
+      this->glUniform1i(INSTANCE_OFFSET_LOCATION, (GLint) command.baseInstance);
+      if(this->isBaseVertexSupported)
+      {
+        this->glDrawElementsInstancedBaseVertex(GL_TRIANGLES,
+                                                (GLsizei) command.indexCount,
+                                                this->indexType,
+                                                (void*) ((size_t) command.firstIndex * indexSize),
+                                                (GLsizei) command.instanceCount,
+                                                command.baseVertex);
+        continue;
+      }
+      this->glDrawElementsInstanced(GL_TRIANGLES,
+                                    (GLsizei) command.indexCount,
+                                    this->indexType,
+                                    (void*) ((size_t) command.firstIndex * indexSize),
+                                    (GLsizei) command.instanceCount);
+    }
+  }
+}
+
+MaterialUniforms RenderWidget::getFrameMaterialUniforms()
+{
+  MaterialUniforms material;
+  material.isWireframeOverwrite = this->isWireframeOverwrite;
+  material.isEdgesVisible = this->isEdgesVisible;
+  material.isFlatFaces = this->isFlatFaces;
+  material.isDiffuseTextureActive = this->isDiffuseTextureActive;
+  material.isBumpMapActive = this->isBumpMapActive;
+  material.isPackedVertexFormat = this->isPackedVertexFormat;
+  material.isBumpMapTwoChannel = this->isBumpMapTwoChannel;
+  material.isDiffuseTextureVirtual = this->isDiffuseTextureVirtual;
+  return material;
+}
+
+void RenderWidget::getPassState(int material, PassState& state)
+{
+  state.features = this->getShaderFeatures();
+  state.diffuseTexture = this->DIFFUSE_TEXTURE_2D;
+  state.bumpTexture = this->BUMP_TEXTURE_2D;
+  state.uniforms = this->getFrameMaterialUniforms();
+  state.materialOverride = glm::vec4(0.0f);
+  if(material < 0)
+  {
+    return;
+  }
+
+  // A material without a texture of its own, or before it is loaded, is
+  // drawn without one. The check boxes still turn the textures off.
+  const SceneMaterial& sceneMaterial = this->sceneMaterials[material];
+  bool isDiffuseTexture = this->isDiffuseTextureActive && sceneMaterial.diffuseTexture >= 0 &&
+                          this->isMaterialAtlasLoaded &&
+                          this->materialAtlasUVTransforms[sceneMaterial.diffuseTexture].x > 0.0f;
+  bool isBumpMap = this->isBumpMapActive && sceneMaterial.bumpTexture >= 0 &&
+                   this->materialTextures[sceneMaterial.bumpTexture].texture != 0;
+  state.features &= ~(ShaderCache::DIFFUSE_TEXTURE | ShaderCache::BUMP_MAP);
+  if(isDiffuseTexture)
+  {
+    state.features |= ShaderCache::DIFFUSE_TEXTURE;
+    state.diffuseTexture = this->materialAtlasTexture;
+  }
+  if(isBumpMap)
+  {
+    state.features |= ShaderCache::BUMP_MAP;
+    state.bumpTexture = this->materialTextures[sceneMaterial.bumpTexture].texture;
+  }
+  state.uniforms.isDiffuseTextureActive = isDiffuseTexture;
+  state.uniforms.isDiffuseTextureVirtual = false;
+  state.uniforms.isBumpMapActive = isBumpMap;
+  state.uniforms.isBumpMapTwoChannel = isBumpMap && this->materialTextures[sceneMaterial.bumpTexture].isTwoChannel;
+  state.materialOverride = sceneMaterial.material;
+}
+
+int RenderWidget::loadMaterialTexture(const std::string& path, bool isNormalMap)
+{
+  if(path.empty())
+  {
+    return -1;
+  }
+  // A texture used as a bump map is converted, it is another texture
+  std::string key = path + (isNormalMap ? "#bump" : "");
+  std::map<std::string, int>::iterator it = this->materialTextureIndexes.find(key);
+  if(it != this->materialTextureIndexes.end())
+  {
+    return it->second;
+  }
+  int index = (int) this->materialTextures.size();
+  this->materialTextures.push_back({ 0, false });
+  this->materialTextureIndexes[key] = index;
+  this->materialTextureRequests[this->textureLoader->load(QString::fromStdString(path), isNormalMap)] = index;
+  return index;
+}
+
+void RenderWidget::loadMaterialAtlas(const std::vector<std::string>& paths)
+{
+  if(paths == this->materialAtlasPaths)
+  {
+    return;
+  }
+  this->materialAtlasPaths = paths;
+  this->materialAtlasUVTransforms.assign(paths.size(), glm::vec4(0.0f));
+  this->materialAtlasRequest = 0;
+  this->isMaterialAtlasLoaded = false;
+  this->isDrawCommandsDirty = true;
+  if(paths.empty())
+  {
+    return;
+  }
+
+  // Composed by the loader threads like importDiffuseAtlas, the UVs of the
+  // textured materials are rewritten once it arrives
+  QStringList atlasPaths;
+  for(unsigned int i = 0; i < paths.size(); i++)
+  {
+    atlasPaths.push_back(QString::fromStdString(paths[i]));
+  }
+  this->materialAtlasRequest = this->textureLoader->loadAtlas(atlasPaths);
+}
+
+void RenderWidget::splitAtlasVertices( int firstMaterial,
+                                       const std::vector<MaterialRange>& materialRanges,
+                                       std::vector<glm::vec3>& positions,
+                                       std::vector<glm::vec3>& normals,
+                                       std::vector<float>& occlusion,
+                                       std::vector<unsigned int>& indices,
+                                       std::vector<int>& vertexTextures)
+{
+  // -2 until a face uses the vertex
+  vertexTextures.assign(positions.size(), -2);
+  bool isOcclusion = occlusion.size() == positions.size();
+  std::map<std::pair<unsigned int, int>, unsigned int> copies;
+  for(unsigned int r = 0; r < materialRanges.size(); r++)
+  {
+    const MaterialRange& range = materialRanges[r];
+    int material = range.material < 0 ? -1 : firstMaterial + range.material;
+    int texture = material < 0 || material >= (int) this->sceneMaterials.size() ? -1 : this->sceneMaterials[material].diffuseTexture;
+    for(unsigned int i = range.firstIndex; i < range.firstIndex + range.numIndices; i++)
+    {
+      unsigned int vertex = indices[i];
+      if(vertexTextures[vertex] == -2)
+      {
+        vertexTextures[vertex] = texture;
+      }
+      else if(vertexTextures[vertex] != texture)
+      {
+        // One copy of the vertex per texture around it
+        std::pair<unsigned int, int> key(vertex, texture);
+        std::map<std::pair<unsigned int, int>, unsigned int>::iterator it = copies.find(key);
+        if(it == copies.end())
+        {
+          unsigned int copy = (unsigned int) positions.size();
+          glm::vec3 position = positions[vertex];
+          glm::vec3 normal = normals[vertex];
+          positions.push_back(position);
+          normals.push_back(normal);
+          if(isOcclusion)
+          {
+            float vertexOcclusion = occlusion[vertex];
+            occlusion.push_back(vertexOcclusion);
+          }
+          vertexTextures.push_back(texture);
+          it = copies.insert(std::make_pair(key, copy)).first;
+        }
+        indices[i] = it->second;
+      }
+    }
+  }
+  for(unsigned int v = 0; v < vertexTextures.size(); v++)
+  {
+    vertexTextures[v] = std::max(vertexTextures[v], -1);
+  }
+}
+
+
+unsigned int RenderWidget::getShaderFeatures()
+{
+  unsigned int features = 0;
+  if(this->isWireframeOverwrite)
+  {
+    features |= ShaderCache::WIREFRAME_OVERWRITE;
+  }
+  if(this->isEdgesVisible)
+  {
+    features |= ShaderCache::EDGES_VISIBLE;
+  }
+  if(this->isDiffuseTextureActive)
+  {
+    features |= ShaderCache::DIFFUSE_TEXTURE;
+  }
+  if(this->isBumpMapActive)
+  {
+    features |= ShaderCache::BUMP_MAP;
+  }
+  if(this->isPackedVertexFormat)
+  {
+    features |= ShaderCache::PACKED_VERTEX_FORMAT;
+  }
+  return features;
 }
 
 
@@ -163,6 +847,10 @@ void RenderWidget::mousePressEvent(QMouseEvent *event)
     this->isPanMovementActive = true;
     this->lastPanScreenCoordinates = clickPosition;
   }
+  if(buttons & Qt::RightButton)
+  {
+    emit picked(this->pick(glm::vec2(event->x(), event->y())));
+  }
 }
 
 void RenderWidget::mouseReleaseEvent(QMouseEvent *event)
@@ -180,44 +868,552 @@ void RenderWidget::mouseReleaseEvent(QMouseEvent *event)
 
 void RenderWidget::mouseMoveEvent(QMouseEvent *event)
 {
+  // Only accumulated here, the camera is updated once per frame
   glm::vec2 clickPosition = glm::vec2(event->x(), -1.0f * event->y() + this->height());
   if(this->isArcballMovementActive)
   {
     glm::vec2 currentArcballScreenCoordinates = clickPosition;
-    this->camera->arcballMoveScreenCoordinates(this->lastArcballScreenCoordinates, currentArcballScreenCoordinates);
+    this->frameScheduler->addArcballMove(this->camera->getArcballRotation(this->lastArcballScreenCoordinates,
+                                                                          currentArcballScreenCoordinates));
     this->lastArcballScreenCoordinates = currentArcballScreenCoordinates;
-    this->update();
   }
   if(this->isPanMovementActive)
   {
     glm::vec2 currentPanScreenCoordinates = clickPosition;
-    this->camera->cameraPan(currentPanScreenCoordinates - this->lastPanScreenCoordinates);
+    this->frameScheduler->addPan(currentPanScreenCoordinates - this->lastPanScreenCoordinates);
     this->lastPanScreenCoordinates = currentPanScreenCoordinates;
-    this->update();
   }
 }
 
 void RenderWidget::wheelEvent(QWheelEvent *event)
 {
-  this->camera->zoomBy(event->delta());
-  this->update();
+  this->frameScheduler->addZoom(event->delta());
 }
 
 void RenderWidget::importOBJFromPath(char* path)
 {
-  this->mesh = new Mesh();
-  this->mesh->loadObj(path);
+  // Replaces the scene by a single instance of the mesh
+  this->scene->clear();
+  int mesh = this->scene->loadMesh(path);
+  this->scene->addInstance(mesh, glm::mat4(), this->diffuseColor, this->materialShininess);
   this->reloadMesh();
 }
 
+void RenderWidget::importOBJInstances(char* path, int count)
+{
+  int numMeshes = this->scene->getNumMeshes();
+  int mesh = this->scene->loadMesh(path);
+
+  // Laid out on a grid filling the default view, each with its own color
+  int side = (int) std::ceil(std::sqrt((float) count));
+  float cell = 2.0f / side;
+  for(int i = 0; i < count; i++)
+  {
+    glm::vec3 position( -1.0f + cell * (i % side + 0.5f),
+                        -1.0f + cell * (i / side + 0.5f),
+                        0.0f);
+    glm::mat4 model = glm::translate(glm::mat4(), position);
+    model = glm::rotate(model, 2.39996f * i, glm::vec3(0.0f, 1.0f, 0.0f));
+    model = glm::scale(model, glm::vec3(0.4f * cell));
+
+    float hue = (float) i / count;
+    glm::vec3 color = 0.5f + 0.5f * glm::cos(6.28318f * (hue + glm::vec3(0.0f, 0.33f, 0.67f)));
+    this->scene->addInstance(mesh, model, color, this->materialShininess);
+  }
+
+  // Instances of an already loaded mesh reuse its buffers
+  if(this->scene->getNumMeshes() != numMeshes)
+  {
+    this->reloadMesh();
+  }
+  else
+  {
+    this->frameScheduler->requestFrame();
+  }
+}
+
+void RenderWidget::importDiffuseTexture(QString path, const std::function<void(const QImage&)>& loaded)
+{
+  this->diffuseTextureRequest = this->textureLoader->load(path);
+  this->textureCallbacks[this->diffuseTextureRequest] = loaded;
+}
+
+void RenderWidget::importBumpMap(QString path, const std::function<void(const QImage&)>& loaded)
+{
+  this->bumpMapRequest = this->textureLoader->load(path, true);
+  this->textureCallbacks[this->bumpMapRequest] = loaded;
+}
+
 void RenderWidget::importDiffuseTexture(QImage img)
 {
-  this->loadTexture(this->DIFFUSE_TEXTURE_2D, img);
+  this->diffuseTextureRequest = this->textureLoader->load(img);
 }
 
 void RenderWidget::importBumpMap(QImage img)
 {
-  this->loadTexture(this->BUMP_TEXTURE_2D, img);
+  this->bumpMapRequest = this->textureLoader->load(img, true);
+}
+
+void RenderWidget::uploadLoadedTextures()
+{
+  std::vector<LoadedTexture> textures = this->textureLoader->takeFinished();
+  for(unsigned int i = 0; i < textures.size(); i++)
+  {
+    const LoadedTexture& texture = textures[i];
+    std::function<void(const QImage&)> loaded;
+    std::map<unsigned int, std::function<void(const QImage&)> >::iterator it = this->textureCallbacks.find(texture.request);
+    if(it != this->textureCallbacks.end())
+    {
+      loaded = it->second;
+      this->textureCallbacks.erase(it);
+    }
+    if(texture.image.isNull())
+    {
+      continue;
+    }
+
+    if(texture.request == this->diffuseTextureRequest)
+    {
+      this->loadTexture(this->DIFFUSE_TEXTURE_2D, texture);
+      this->diffuseImage = texture.image;
+      if(texture.request == this->atlasRequest)
+      {
+        this->setAtlasMaxLevel(this->DIFFUSE_TEXTURE_2D, texture);
+        this->atlasUVTransforms = texture.atlasUVTransforms;
+        this->atlasMeshTextures = this->pendingAtlasMeshTextures;
+        this->reloadUVs();
+      }
+      else if(!this->atlasUVTransforms.empty())
+      {
+        this->atlasUVTransforms.clear();
+        this->reloadUVs();
+      }
+      if(this->virtualTexture)
+      {
+        delete this->virtualTexture;
+        this->virtualTexture = nullptr;
+        this->isDiffuseTextureVirtual = false;
+        this->feedbackPositions.clear();
+        this->feedbackUVs.clear();
+        this->feedbackIndices.clear();
+      }
+    }
+    else if(texture.request == this->bumpMapRequest)
+    {
+      this->loadTexture(this->BUMP_TEXTURE_2D, texture);
+      this->bumpImage = texture.image;
+      this->isBumpMapTwoChannel = texture.isCompressed && texture.format == BlockCompressor::BC5;
+    }
+    else if(texture.request == this->materialAtlasRequest)
+    {
+      if(this->materialAtlasTexture == 0)
+      {
+        this->createTexture(&(this->materialAtlasTexture));
+      }
+      this->loadTexture(this->materialAtlasTexture, texture);
+      this->setAtlasMaxLevel(this->materialAtlasTexture, texture);
+      this->materialAtlasUVTransforms = texture.atlasUVTransforms;
+      this->isMaterialAtlasLoaded = true;
+      this->isDrawCommandsDirty = true;
+      this->reloadUVs();
+    }
+    else if(this->materialTextureRequests.count(texture.request))
+    {
+      MaterialTexture& materialTexture = this->materialTextures[this->materialTextureRequests[texture.request]];
+      this->materialTextureRequests.erase(texture.request);
+      if(materialTexture.texture == 0)
+      {
+        this->createTexture(&(materialTexture.texture));
+      }
+      this->loadTexture(materialTexture.texture, texture);
+      materialTexture.isTwoChannel = texture.isCompressed && texture.format == BlockCompressor::BC5;
+      // The passes using it change state
+      this->isDrawCommandsDirty = true;
+    }
+    else
+    {
+      continue;
+    }
+    this->isSoftwareTexturesDirty = true;
+    this->isRayTracerTexturesDirty = true;
+
+    if(loaded)
+    {
+      loaded(texture.image);
+    }
+  }
+}
+
+void RenderWidget::importDiffuseAtlas(const QStringList& paths,
+                                      const std::vector<int>& meshTextures,
+                                      const std::function<void(const QImage&)>& loaded)
+{
+  // Composed by the loader threads, the UVs are rewritten once it arrives
+  this->pendingAtlasMeshTextures = meshTextures;
+  this->diffuseTextureRequest = this->textureLoader->loadAtlas(paths);
+  this->atlasRequest = this->diffuseTextureRequest;
+  this->textureCallbacks[this->diffuseTextureRequest] = loaded;
+}
+
+void RenderWidget::setAtlasMaxLevel(unsigned int textureID, const LoadedTexture& texture)
+{
+  // Coarser levels would blend the textures with their neighbours. A block
+  // of 4x4 texels mixes them too, cells are aligned to whole blocks on as
+  // many levels as a gutter a quarter as wide.
+  int numLevels = texture.isCompressed ? (int) texture.compressedLevels.size() : (int) texture.levels.size() + 1;
+  int numSafeLevels = texture.isCompressed ? TextureAtlas::getNumSafeLevels(TextureAtlas::DEFAULT_GUTTER / 4) :
+                                             TextureAtlas::getNumSafeLevels(TextureAtlas::DEFAULT_GUTTER);
+  int maxLevel = std::min(numLevels, numSafeLevels) - 1;
+  this->glBindTexture(GL_TEXTURE_2D, textureID);
+  this->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, maxLevel);
+}
+
+bool PageFileBuildThread::build()
+{
+  TRACE_SCOPE("PageFileBuildThread::build");
+  // Page files are named after the content of the source, like the texture
+  // cache
+  QFile file(this->sourcePath);
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  if(!file.open(QIODevice::ReadOnly) || !hash.addData(&file))
+  {
+    return false;
+  }
+  file.close();
+  QString directory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/virtualtextures";
+  QDir().mkpath(directory);
+  this->pageFilePath = QFile::encodeName(directory + "/" + QString::fromLatin1(hash.result().toHex()) + ".vtp").toStdString();
+
+  PageFile pageFile;
+  if(pageFile.open(this->pageFilePath))
+  {
+    return true;
+  }
+
+  QImageReader reader(this->sourcePath);
+  QSize size = reader.size();
+  if(!size.isValid())
+  {
+    return false;
+  }
+
+  // A band of rows at a time when the decoder can read a part of the
+  // image, so the source is never in memory whole, otherwise decoded once
+  static const int BAND_ROWS = 1024;
+  bool isWhole = !reader.supportsOption(QImageIOHandler::ClipRect);
+  QImage band;
+  int bandY = -1;
+  bool isDecoded = true;
+  PageFile::RowReader rowReader = [&](int y, int numRows, unsigned char* texels)
+  {
+    for(int row = y; row < y + numRows; row++)
+    {
+      int firstRow = isWhole ? 0 : row / BAND_ROWS * BAND_ROWS;
+      if(firstRow != bandY)
+      {
+        QImageReader bandReader(this->sourcePath);
+        if(!isWhole)
+        {
+          bandReader.setClipRect(QRect(0, firstRow, size.width(), std::min(BAND_ROWS, size.height() - firstRow)));
+        }
+        band = bandReader.read().convertToFormat(QImage::Format_ARGB32);
+        bandY = firstRow;
+      }
+      unsigned char* output = texels + (size_t) (row - y) * size.width() * 4;
+      if(band.isNull() || row - bandY >= band.height() || band.width() != size.width())
+      {
+        memset(output, 0, (size_t) size.width() * 4);
+        isDecoded = false;
+        continue;
+      }
+      memcpy(output, band.constScanLine(row - bandY), (size_t) size.width() * 4);
+    }
+  };
+  // A decoding error stops the build like a cancel. The widget hears of
+  // each percent.
+  std::function<bool(float)> buildProgress = [&](float fraction)
+  {
+    this->progress = fraction;
+    if((int) (fraction * 100.0f) != this->reportedProgress)
+    {
+      this->reportedProgress = (int) (fraction * 100.0f);
+      QMetaObject::invokeMethod(this->widget, "updateVirtualTextureImport", Qt::QueuedConnection);
+    }
+    return isDecoded && !this->isCanceled;
+  };
+  return PageFile::build(this->pageFilePath, size.width(), size.height(), rowReader, buildProgress);
+}
+
+bool RenderWidget::importVirtualTexture(QString path,
+                                        const std::function<bool(float)>& progress,
+                                        const std::function<void(bool)>& imported)
+{
+  if(this->pageFileBuildThread)
+  {
+    return false;
+  }
+  this->virtualTextureProgress = progress;
+  this->virtualTextureImported = imported;
+  this->pageFileBuildThread = new PageFileBuildThread(this, path);
+  this->pageFileBuildThread->start();
+  return true;
+}
+
+void RenderWidget::updateVirtualTextureImport()
+{
+  PageFileBuildThread* thread = this->pageFileBuildThread;
+  if(!thread)
+  {
+    return;
+  }
+  if(!thread->isDone)
+  {
+    // The callback may run the event loop, and this slot again
+    if(this->virtualTextureProgress && !this->virtualTextureProgress(thread->progress) && this->pageFileBuildThread == thread)
+    {
+      thread->isCanceled = true;
+    }
+    return;
+  }
+
+  thread->wait();
+  bool isImported = thread->isBuilt && this->openVirtualTexture(thread->pageFilePath);
+  delete thread;
+  this->pageFileBuildThread = nullptr;
+  std::function<void(bool)> imported = this->virtualTextureImported;
+  this->virtualTextureProgress = nullptr;
+  this->virtualTextureImported = nullptr;
+  if(imported)
+  {
+    imported(isImported);
+  }
+}
+
+bool RenderWidget::openVirtualTexture(const std::string& pageFilePath)
+{
+  VirtualTexture* texture = new VirtualTexture(VIRTUAL_TEXTURE_SLOTS_WIDE);
+  texture->setPageLoadedCallback([this]()
+  {
+    QMetaObject::invokeMethod(this, "requestFrame", Qt::QueuedConnection);
+  });
+  if(!texture->open(pageFilePath) || texture->getNumLevels() > MAX_VIRTUAL_TEXTURE_LEVELS)
+  {
+    delete texture;
+    return false;
+  }
+
+  this->makeCurrent();
+  delete this->virtualTexture;
+  this->virtualTexture = texture;
+  // A regular texture still loading would replace it
+  this->diffuseTextureRequest = 0;
+  this->atlasUVTransforms.clear();
+
+  this->glBindTexture(GL_TEXTURE_2D, this->PHYSICAL_PAGES_2D);
+  this->glTexImage2D( GL_TEXTURE_2D,
+                      0,
+                      GL_RGBA,
+                      texture->getPhysicalSize(),
+                      texture->getPhysicalSize(),
+                      0,
+                      GL_RGBA,
+                      GL_UNSIGNED_BYTE,
+                      nullptr);
+  this->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+  this->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+  this->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  this->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  this->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  this->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  this->glBindTexture(GL_TEXTURE_2D, this->PAGE_TABLE_2D);
+  this->glTexImage2D( GL_TEXTURE_2D,
+                      0,
+                      GL_RGBA,
+                      texture->getPageTableWidth(),
+                      texture->getPageTableHeight(),
+                      0,
+                      GL_RGBA,
+                      GL_UNSIGNED_BYTE,
+                      nullptr);
+  this->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+  this->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+  this->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  this->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+  VirtualTextureUniforms uniforms;
+  uniforms.virtualSize = glm::ivec4(texture->getWidth(), texture->getHeight(), PageFile::TILE_SIZE, texture->getPageSize());
+  uniforms.virtualLayout = glm::ivec4(PageFile::BORDER, texture->getNumLevels(), texture->getPhysicalSize(), 0);
+  const std::vector<int>& levelOffsets = texture->getLevelOffsets();
+  for(int level = 0; level < MAX_VIRTUAL_TEXTURE_LEVELS; level++)
+  {
+    uniforms.pageTableOffsets[level] = level < texture->getNumLevels() ?
+                                       glm::ivec4(levelOffsets[2 * level], levelOffsets[2 * level + 1], 0, 0) :
+                                       glm::ivec4(0);
+  }
+  this->virtualTextureUniformBuffer->set(&uniforms);
+
+  this->isDiffuseTextureVirtual = true;
+
+  // For the feedback geometry
+  this->reloadMesh();
+  this->frameScheduler->requestFrame();
+  return true;
+}
+
+void RenderWidget::uploadVirtualTexturePages()
+{
+  if(!this->virtualTexture)
+  {
+    return;
+  }
+
+  std::vector<LoadedPage> pages = this->virtualTexture->takeLoadedPages();
+  if(!pages.empty())
+  {
+    int pageSize = this->virtualTexture->getPageSize();
+    int slotsWide = this->virtualTexture->getSlotsWide();
+    this->glBindTexture(GL_TEXTURE_2D, this->PHYSICAL_PAGES_2D);
+    this->glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    for(unsigned int i = 0; i < pages.size(); i++)
+    {
+      this->glTexSubImage2D(GL_TEXTURE_2D,
+                            0,
+                            (pages[i].slot % slotsWide) * pageSize,
+                            (pages[i].slot / slotsWide) * pageSize,
+                            pageSize,
+                            pageSize,
+                            GL_RGBA,
+                            GL_UNSIGNED_BYTE,
+                            pages[i].texels.data());
+    }
+  }
+
+  // The page table is small, it is sent whole
+  if(this->virtualTexture->takePageTableChange())
+  {
+    this->glBindTexture(GL_TEXTURE_2D, this->PAGE_TABLE_2D);
+    this->glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    this->glTexSubImage2D(GL_TEXTURE_2D,
+                          0,
+                          0,
+                          0,
+                          this->virtualTexture->getPageTableWidth(),
+                          this->virtualTexture->getPageTableHeight(),
+                          GL_RGBA,
+                          GL_UNSIGNED_BYTE,
+                          this->virtualTexture->getPageTable().data());
+  }
+}
+
+void RenderWidget::updatePageFeedback(const glm::mat4& viewProjection)
+{
+  if(!this->virtualTexture || this->feedbackIndices.empty())
+  {
+    return;
+  }
+
+  // The visible instances in batch order, up to a budget of triangles. The
+  // last one may be cut short.
+  this->pageFeedback.begin(this->virtualTexture, this->width(), this->height());
+  unsigned int visible = 0;
+  unsigned int numTriangles = 0;
+  for(unsigned int i = 0; i < this->instanceBatches.size(); i++)
+  {
+    const InstanceBatch& batch = this->instanceBatches[i];
+    for(; visible < this->visibleInstances.size() &&
+          this->visibleInstances[visible] < batch.firstInstance + batch.instanceCount; visible++)
+    {
+      if(batch.mesh >= (int) this->meshRanges.size() || numTriangles >= MAX_FEEDBACK_TRIANGLES)
+      {
+        continue;
+      }
+      const MeshRange& range = this->meshRanges[batch.mesh];
+      unsigned int numIndices = std::min(range.numIndices, 3 * (MAX_FEEDBACK_TRIANGLES - numTriangles));
+      this->pageFeedback.draw(this->feedbackPositions,
+                              this->feedbackUVs,
+                              this->feedbackIndices,
+                              range.firstIndex,
+                              numIndices,
+                              viewProjection * this->instanceData[this->visibleInstances[visible]].model);
+      numTriangles += numIndices / 3;
+    }
+  }
+
+  std::vector<unsigned int> requests;
+  this->pageFeedback.end(requests);
+  this->virtualTexture->update(requests);
+}
+
+QImage RenderWidget::renderSoftware(int width, int height)
+{
+  // The mesh is reloaded once to hand the geometry to the new renderer
+  if(!this->softwareRenderer)
+  {
+    this->softwareRenderer = new SoftwareRenderer();
+    this->makeCurrent();
+    this->reloadMesh();
+  }
+  return this->renderOnCPU(this->softwareRenderer, this->isSoftwareTexturesDirty, width, height);
+}
+
+QImage RenderWidget::renderRayTraced(int width, int height)
+{
+  if(!this->rayTracer)
+  {
+    this->rayTracer = new RayTracer();
+    this->makeCurrent();
+    this->reloadMesh();
+  }
+  return this->renderOnCPU(this->rayTracer, this->isRayTracerTexturesDirty, width, height);
+}
+
+template<class Renderer>
+QImage RenderWidget::renderOnCPU(Renderer* renderer, bool& isTexturesDirty, int width, int height)
+{
+  // Same texels as given to glTexImage2D
+  if(isTexturesDirty)
+  {
+    renderer->setDiffuseTexture(this->diffuseImage.isNull() ? nullptr : this->diffuseImage.constBits(),
+                                this->diffuseImage.width(),
+                                this->diffuseImage.height());
+    renderer->setBumpMap( this->bumpImage.isNull() ? nullptr : this->bumpImage.constBits(),
+                          this->bumpImage.width(),
+                          this->bumpImage.height());
+    isTexturesDirty = false;
+  }
+
+  Camera camera = *this->camera;
+  camera.updateWH(width, height);
+
+  SoftwareShading shading;
+  shading.isWireframeOverwrite = this->isWireframeOverwrite;
+  shading.isEdgesVisible = this->isEdgesVisible;
+  shading.isDiffuseTextureActive = this->isDiffuseTextureActive;
+  shading.isBumpMapActive = this->isBumpMapActive;
+
+  // Every instance, the renderer clips on its own
+  std::vector<InstanceBatch> batches;
+  std::vector<InstanceData> instances;
+  this->scene->buildBatches(batches, instances);
+
+  renderer->beginFrame(width, height, camera.getViewMatrix(), camera.getProjectionMatrix(), shading);
+  for(unsigned int i = 0; i < batches.size(); i++)
+  {
+    const InstanceBatch& batch = batches[i];
+    if(batch.mesh >= (int) this->meshRanges.size())
+    {
+      continue;
+    }
+    const MeshRange& range = this->meshRanges[batch.mesh];
+    for(unsigned int j = batch.firstInstance; j < batch.firstInstance + batch.instanceCount; j++)
+    {
+      renderer->draw(range.firstVertex, range.numVertices, range.firstIndex, range.numIndices, instances[j]);
+    }
+  }
+  renderer->endFrame();
+
+  return QImage(renderer->getColorBuffer().data(), width, height, QImage::Format_RGBA8888).copy();
 }
 
 void RenderWidget::createTexture(unsigned int* textureID)
@@ -225,24 +1421,133 @@ void RenderWidget::createTexture(unsigned int* textureID)
   this->glGenTextures(1, textureID);
 }
 
-void RenderWidget::loadTexture(unsigned int textureID, QImage img)
+void RenderWidget::loadTexture(unsigned int textureID, const LoadedTexture& texture)
 {
-  this->glBindTexture(GL_TEXTURE_2D, textureID);
+  TRACE_SCOPE("RenderWidget::loadTexture");
+  if(texture.isCompressed)
+  {
+    this->loadCompressedTexture(textureID, texture);
+    return;
+  }
 
+  // Every level is staged in the pixel buffer, the driver then copies them
+  // to the texture without stalling on client memory
+  size_t size = (size_t) texture.image.width() * texture.image.height() * 4;
+  for(unsigned int i = 0; i < texture.levels.size(); i++)
+  {
+    size += texture.levels[i].texels.size();
+  }
+  this->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, this->texturePBO);
+  this->glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+  unsigned char* pointer = (unsigned char*) this->glMapBufferRange(GL_PIXEL_UNPACK_BUFFER,
+                                                                   0,
+                                                                   size,
+                                                                   GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  if(!pointer)
+  {
+    this->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    return;
+  }
+  size_t offset = (size_t) texture.image.width() * texture.image.height() * 4;
+  memcpy(pointer, texture.image.constBits(), offset);
+  for(unsigned int i = 0; i < texture.levels.size(); i++)
+  {
+    memcpy(pointer + offset, texture.levels[i].texels.data(), texture.levels[i].texels.size());
+    offset += texture.levels[i].texels.size();
+  }
+  this->glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+  this->glBindTexture(GL_TEXTURE_2D, textureID);
+  this->glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
   this->glTexImage2D( GL_TEXTURE_2D,
                       0,
                       GL_RGBA,
-                      img.width(),
-                      img.height(),
+                      texture.image.width(),
+                      texture.image.height(),
                       0,
                       GL_RGBA,
                       GL_UNSIGNED_BYTE,
-                      img.bits());
+                      nullptr);
+  offset = (size_t) texture.image.width() * texture.image.height() * 4;
+  for(unsigned int i = 0; i < texture.levels.size(); i++)
+  {
+    const MipLevel& level = texture.levels[i];
+    this->glTexImage2D( GL_TEXTURE_2D,
+                        i + 1,
+                        GL_RGBA,
+                        level.width,
+                        level.height,
+                        0,
+                        GL_RGBA,
+                        GL_UNSIGNED_BYTE,
+                        (const void*) offset);
+    offset += level.texels.size();
+  }
+  this->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
-  this->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  this->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+  this->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint) texture.levels.size());
+  this->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   this->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+}
 
-  this->glGenerateMipmap(GL_TEXTURE_2D);
+void RenderWidget::loadCompressedTexture(unsigned int textureID, const LoadedTexture& texture)
+{
+  // BC5 and BC7 are core since GL 3.0 and 4.2, BC1 and BC3 come with every
+  // desktop driver
+  static const GLenum INTERNAL_FORMATS[] = {
+    GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+    GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+    GL_COMPRESSED_RG_RGTC2,
+    GL_COMPRESSED_RGBA_BPTC_UNORM
+  };
+
+  // Staged in the pixel buffer like the uncompressed levels
+  size_t size = 0;
+  for(unsigned int i = 0; i < texture.compressedLevels.size(); i++)
+  {
+    size += texture.compressedLevels[i].blocks.size();
+  }
+  this->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, this->texturePBO);
+  this->glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+  unsigned char* pointer = (unsigned char*) this->glMapBufferRange(GL_PIXEL_UNPACK_BUFFER,
+                                                                   0,
+                                                                   size,
+                                                                   GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  if(!pointer)
+  {
+    this->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    return;
+  }
+  size_t offset = 0;
+  for(unsigned int i = 0; i < texture.compressedLevels.size(); i++)
+  {
+    memcpy(pointer + offset, texture.compressedLevels[i].blocks.data(), texture.compressedLevels[i].blocks.size());
+    offset += texture.compressedLevels[i].blocks.size();
+  }
+  this->glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+  this->glBindTexture(GL_TEXTURE_2D, textureID);
+  offset = 0;
+  for(unsigned int i = 0; i < texture.compressedLevels.size(); i++)
+  {
+    const CompressedLevel& level = texture.compressedLevels[i];
+    this->glCompressedTexImage2D( GL_TEXTURE_2D,
+                                  i,
+                                  INTERNAL_FORMATS[texture.format],
+                                  level.width,
+                                  level.height,
+                                  0,
+                                  (GLsizei) level.blocks.size(),
+                                  (const void*) offset);
+    offset += level.blocks.size();
+  }
+  this->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  this->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+  this->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint) texture.compressedLevels.size() - 1);
+  this->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  this->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 }
 
 void RenderWidget::createBuffers( unsigned int* VAO,
@@ -250,9 +1555,14 @@ void RenderWidget::createBuffers( unsigned int* VAO,
                                   unsigned int* EBO)
 {
   this->glGenVertexArrays(1, (GLuint*) VAO);
-  this->glBindVertexArray((GLuint) VAO);
+  this->glBindVertexArray(*VAO);
   this->glGenBuffers(1, (GLuint*) VBO);
   this->glGenBuffers(1, (GLuint*) EBO);
+  this->glGenBuffers(NUM_VERTEX_STREAMS, (GLuint*) this->streamVBOs);
+  this->glGenBuffers(1, (GLuint*) &(this->occlusionVBO));
+  this->glGenBuffers(1, (GLuint*) &(this->instanceBuffer));
+  this->glGenBuffers(1, (GLuint*) &(this->visibleBuffer));
+  this->glGenBuffers(1, (GLuint*) &(this->indirectBuffer));
   
   std::vector<glm::vec3> positions;
   std::vector<glm::vec3> normals;
@@ -260,6 +1570,7 @@ void RenderWidget::createBuffers( unsigned int* VAO,
   std::vector<glm::vec3> bitangents;
   std::vector<glm::vec2> UVs;
   std::vector<unsigned int> indices;
+  std::vector<float> occlusion;
 
   this->loadBuffers(*VAO,
                     *VBO,
@@ -269,7 +1580,8 @@ void RenderWidget::createBuffers( unsigned int* VAO,
                     tangents,
                     bitangents,
                     UVs,
-                    indices);
+                    indices,
+                    occlusion);
 }
                     
 void RenderWidget::loadBuffers( unsigned int VAO,
@@ -280,48 +1592,211 @@ void RenderWidget::loadBuffers( unsigned int VAO,
                   std::vector<glm::vec3>& tangents,
                   std::vector<glm::vec3>& bitangents,
                   std::vector<glm::vec2>& UVs,
-                  std::vector<unsigned int>& indices)
+                  std::vector<unsigned int>& indices,
+                  std::vector<float>& occlusion)
 {
-  // Data structure to be stored in the VBO
-  struct Vertex
+  TRACE_SCOPE("RenderWidget::loadBuffers");
+  // Binds the Current VAO
+  this->glBindVertexArray(VAO);
+
+  this->lastUploadBytes = 0;
+
+  this->submeshes.clear();
+  this->vertexRemap.clear();
+  this->meshFirstSubmesh.clear();
+
+  // 16-bit indices, split in base vertex batches when a mesh is too big.
+  // Without base vertex draws only small scenes can use them.
+  if(this->isBaseVertexSupported || positions.size() <= IndexBatcher::MAX_BATCH_VERTICES)
   {
-      glm::vec3 pos;
-      glm::vec3 normal;
-      glm::vec3 tangent;
-      glm::vec3 bitangent;
-      glm::vec2 uv;
-  };
+    // Batched mesh by mesh, so a submesh never spans two meshes
+    IndexBatcher batcher;
+    std::vector<unsigned short> shortIndices;
+    std::vector<unsigned int> meshIndices;
+    std::vector<unsigned short> meshShortIndices;
+    std::vector<unsigned int> meshRemap;
+    std::vector<Submesh> meshSubmeshes;
+    bool isRemapped = false;
+
+    shortIndices.reserve(indices.size());
+    for(unsigned int m = 0; m < this->meshRanges.size(); m++)
+    {
+      const MeshRange& range = this->meshRanges[m];
+      meshIndices.assign( indices.begin() + range.firstIndex,
+                          indices.begin() + range.firstIndex + range.numIndices);
+      for(unsigned int i = 0; i < meshIndices.size(); i++)
+      {
+        meshIndices[i] -= range.firstVertex;
+      }
+      batcher.build(meshIndices, range.numVertices, meshShortIndices, meshRemap, meshSubmeshes);
+
+      unsigned int baseVertex = (unsigned int) this->vertexRemap.size();
+      if(meshRemap.empty())
+      {
+        for(unsigned int v = 0; v < range.numVertices; v++)
+        {
+          this->vertexRemap.push_back(range.firstVertex + v);
+        }
+      }
+      else
+      {
+        isRemapped = true;
+        for(unsigned int v = 0; v < meshRemap.size(); v++)
+        {
+          this->vertexRemap.push_back(range.firstVertex + meshRemap[v]);
+        }
+      }
+
+      // Without base vertex draws the offset goes in the indices
+      unsigned short indexBias = this->isBaseVertexSupported ? 0 : (unsigned short) baseVertex;
+      this->meshFirstSubmesh.push_back((unsigned int) this->submeshes.size());
+      for(unsigned int i = 0; i < meshSubmeshes.size(); i++)
+      {
+        Submesh submesh = meshSubmeshes[i];
+        submesh.firstIndex += (unsigned int) shortIndices.size();
+        submesh.baseVertex += this->isBaseVertexSupported ? (int) baseVertex : 0;
+        this->submeshes.push_back(submesh);
+      }
+      for(unsigned int i = 0; i < meshShortIndices.size(); i++)
+      {
+        shortIndices.push_back((unsigned short) (meshShortIndices[i] + indexBias));
+      }
+    }
+    this->meshFirstSubmesh.push_back((unsigned int) this->submeshes.size());
+
+    if(isRemapped)
+    {
+      IndexBatcher::remap(positions, this->vertexRemap);
+      IndexBatcher::remap(normals, this->vertexRemap);
+      IndexBatcher::remap(tangents, this->vertexRemap);
+      IndexBatcher::remap(bitangents, this->vertexRemap);
+      IndexBatcher::remap(UVs, this->vertexRemap);
+      if(!occlusion.empty())
+      {
+        IndexBatcher::remap(occlusion, this->vertexRemap);
+      }
+    }
+    else
+    {
+      this->vertexRemap.clear();
+    }
+
+    this->indexType = GL_UNSIGNED_SHORT;
+    this->storeBuffer(GL_ELEMENT_ARRAY_BUFFER,
+                      EBO,
+                      this->indexRange,
+                      shortIndices.data(),
+                      shortIndices.size() * sizeof(unsigned short));
+    this->lastUploadBytes += shortIndices.size() * sizeof(unsigned short);
+  }
+  else
+  {
+    this->indexType = GL_UNSIGNED_INT;
+    for(unsigned int m = 0; m < this->meshRanges.size(); m++)
+    {
+      const MeshRange& range = this->meshRanges[m];
+      this->meshFirstSubmesh.push_back(m);
+      this->submeshes.push_back({ range.firstIndex, range.numIndices, 0 });
+    }
+    this->meshFirstSubmesh.push_back((unsigned int) this->meshRanges.size());
+    this->storeBuffer(GL_ELEMENT_ARRAY_BUFFER,
+                      EBO,
+                      this->indexRange,
+                      indices.data(),
+                      indices.size() * sizeof(unsigned int));
+    this->lastUploadBytes += indices.size() * sizeof(unsigned int);
+  }
+  this->isDrawCommandsDirty = true;
 
-  // Intercalating Data in the VBO
-  std::vector<Vertex> vboDataArray;
+  this->uploadOcclusion(occlusion);
 
-  vboDataArray.reserve(positions.size());
-  for (unsigned int i = 0; i < positions.size(); i++)
+  if(this->isSeparateVertexStreams)
   {
-    vboDataArray.push_back({
-      positions[i],
-      normals[i],
-      tangents[i],
-      bitangents[i],
-      UVs[i]
-    });
+    this->releaseRange(this->vertexRange);
+    this->uploadVertexStreams(ALL_VERTEX_STREAMS,
+                              positions,
+                              normals,
+                              tangents,
+                              bitangents,
+                              UVs);
+    return;
   }
 
-  // Binds the Current VAO
-  this->glBindVertexArray(VAO);
+  for(int stream = 0; stream < NUM_VERTEX_STREAMS; stream++)
+  {
+    this->releaseRange(this->streamRanges[stream]);
+  }
+
+  if(this->isPackedVertexFormat)
+  {
+    VertexPacker packer;
+    std::vector<PackedVertex> vboDataArray;
+    packer.pack(positions, normals, tangents, bitangents, UVs, vboDataArray);
+
+    // Memory Allocation
+    size_t vertexOffset = this->storeBuffer(GL_ARRAY_BUFFER,
+                                            VBO,
+                                            this->vertexRange,
+                                            vboDataArray.data(),
+                                            vboDataArray.size() * sizeof(PackedVertex));
+    this->lastUploadBytes += vboDataArray.size() * sizeof(PackedVertex);
+
+    this->glDisableVertexAttribArray( 1 );
+    this->glDisableVertexAttribArray( 2 );
+    this->glDisableVertexAttribArray( 3 );
+
+    // Position Attribute
+    this->glEnableVertexAttribArray( 0 );
+    this->glVertexAttribPointer(  0,                                          // index
+                                  3,                                          // size
+                                  GL_FLOAT,                                   // type
+                                  GL_FALSE,                                   // normalized
+                                  sizeof(PackedVertex),                       // stride
+                                  (void*) (vertexOffset + offsetof(PackedVertex, pos)) ); // pointer
+
+    // UV Attribute
+    this->glEnableVertexAttribArray( 4 );
+    this->glVertexAttribPointer(  4,                                          // index
+                                  2,                                          // size
+                                  GL_HALF_FLOAT,                              // type
+                                  GL_FALSE,                                   // normalized
+                                  sizeof(PackedVertex),                       // stride
+                                  (void*) (vertexOffset + offsetof(PackedVertex, uv)) ); // pointer
+
+    // Octahedral Normal Attribute
+    this->glEnableVertexAttribArray( 5 );
+    this->glVertexAttribPointer(  5,                                          // index
+                                  2,                                          // size
+                                  GL_SHORT,                                   // type
+                                  GL_TRUE,                                    // normalized
+                                  sizeof(PackedVertex),                       // stride
+                                  (void*) (vertexOffset + offsetof(PackedVertex, normal)) ); // pointer
+
+    // Tangent Frame Quaternion Attribute
+    this->glEnableVertexAttribArray( 6 );
+    this->glVertexAttribPointer(  6,                                          // index
+                                  4,                                          // size
+                                  GL_SHORT,                                   // type
+                                  GL_TRUE,                                    // normalized
+                                  sizeof(PackedVertex),                       // stride
+                                  (void*) (vertexOffset + offsetof(PackedVertex, qtangent)) ); // pointer
+    return;
+  }
+
+  // Intercalating Data in the VBO
+  std::vector<InterleavedVertex> vboDataArray;
+  VertexPacker::interleave(positions, normals, tangents, bitangents, UVs, vboDataArray);
 
   // Memory Allocation
-  this->glBindBuffer(GL_ARRAY_BUFFER, VBO);
-  this->glBufferData( GL_ARRAY_BUFFER,
-                      vboDataArray.size() * sizeof(Vertex),
-                      &vboDataArray[0],
-                      GL_DYNAMIC_DRAW);
-
-  this->glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, EBO);
-  this->glBufferData( GL_ELEMENT_ARRAY_BUFFER,
-                      indices.size() * sizeof(unsigned int),
-                      &indices[0],
-                      GL_DYNAMIC_DRAW);
+  size_t vertexOffset = this->storeBuffer(GL_ARRAY_BUFFER,
+                                          VBO,
+                                          this->vertexRange,
+                                          vboDataArray.data(),
+                                          vboDataArray.size() * sizeof(InterleavedVertex));
+  this->lastUploadBytes += vboDataArray.size() * sizeof(InterleavedVertex);
+
+  this->glDisableVertexAttribArray( 5 );
+  this->glDisableVertexAttribArray( 6 );
 
   // Position Attribute
   this->glEnableVertexAttribArray( 0 );
@@ -329,8 +1804,8 @@ void RenderWidget::loadBuffers( unsigned int VAO,
                                 3,                            // size
                                 GL_FLOAT,                     // type
                                 GL_FALSE,                     // normalized
-                                sizeof(Vertex),               // stride
-                                (void*) 0 );                  // pointer
+                                sizeof(InterleavedVertex),    // stride
+                                (void*) vertexOffset );       // pointer
 
   // Normal Attribute
   this->glEnableVertexAttribArray( 1 );
@@ -338,8 +1813,8 @@ void RenderWidget::loadBuffers( unsigned int VAO,
                                 3,                            // size
                                 GL_FLOAT,                     // type
                                 GL_FALSE,                     // normalized
-                                sizeof(Vertex),               // stride
-                                (void*) sizeof(glm::vec3) );  // pointer
+                                sizeof(InterleavedVertex),    // stride
+                                (void*) (vertexOffset + sizeof(glm::vec3)) );  // pointer
 
   // Tangent Attribute
   this->glEnableVertexAttribArray( 2 );
@@ -347,8 +1822,8 @@ void RenderWidget::loadBuffers( unsigned int VAO,
                                 3,                            // size
                                 GL_FLOAT,                     // type
                                 GL_FALSE,                     // normalized
-                                sizeof(Vertex),               // stride
-                                (void*) (2 * sizeof(glm::vec3)) );  // pointer
+                                sizeof(InterleavedVertex),    // stride
+                                (void*) (vertexOffset + 2 * sizeof(glm::vec3)) );  // pointer
 
   // Bitangent Attribute
   this->glEnableVertexAttribArray( 3 );
@@ -356,8 +1831,8 @@ void RenderWidget::loadBuffers( unsigned int VAO,
                                 3,                            // size
                                 GL_FLOAT,                     // type
                                 GL_FALSE,                     // normalized
-                                sizeof(Vertex),               // stride
-                                (void*) (3 * sizeof(glm::vec3)) );  // pointer
+                                sizeof(InterleavedVertex),    // stride
+                                (void*) (vertexOffset + 3 * sizeof(glm::vec3)) );  // pointer
 
   // UV Attribute
   this->glEnableVertexAttribArray( 4 );
@@ -365,20 +1840,184 @@ void RenderWidget::loadBuffers( unsigned int VAO,
                                 2,                                  // size
                                 GL_FLOAT,                           // type
                                 GL_FALSE,                           // normalized
-                                sizeof(Vertex),                     // stride
-                                (void*) (4 * sizeof(glm::vec3)) );  // pointer
+                                sizeof(InterleavedVertex),          // stride
+                                (void*) (vertexOffset + 4 * sizeof(glm::vec3)) );  // pointer
+}
+
+void RenderWidget::uploadOcclusion(std::vector<float>& occlusion)
+{
+  if(occlusion.empty())
+  {
+    this->releaseRange(this->occlusionRange);
+    this->glDisableVertexAttribArray( OCCLUSION_ATTRIBUTE );
+    this->glVertexAttrib1f( OCCLUSION_ATTRIBUTE, 1.0f );
+    return;
+  }
+
+  size_t offset = this->storeBuffer(GL_ARRAY_BUFFER,
+                                    this->occlusionVBO,
+                                    this->occlusionRange,
+                                    occlusion.data(),
+                                    occlusion.size() * sizeof(float));
+  this->lastUploadBytes += occlusion.size() * sizeof(float);
+  this->glEnableVertexAttribArray( OCCLUSION_ATTRIBUTE );
+  this->glVertexAttribPointer( OCCLUSION_ATTRIBUTE, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*) offset );
+}
+
+void RenderWidget::uploadVertexStreams( unsigned int streamMask,
+                                        std::vector<glm::vec3>& positions,
+                                        std::vector<glm::vec3>& normals,
+                                        std::vector<glm::vec3>& tangents,
+                                        std::vector<glm::vec3>& bitangents,
+                                        std::vector<glm::vec2>& UVs)
+{
+  VertexPacker packer;
+  std::vector<unsigned char> streamData;
+
+  for(int stream = 0; stream < NUM_VERTEX_STREAMS; stream++)
+  {
+    if(!(streamMask & (1 << stream)))
+    {
+      continue;
+    }
+
+    packer.buildStream((VertexPacker::Stream) stream,
+                       this->isPackedVertexFormat,
+                       positions,
+                       normals,
+                       tangents,
+                       bitangents,
+                       UVs,
+                       streamData);
+
+    // Same vertex count: the storage is kept and written over
+    size_t offset = this->storeBuffer(GL_ARRAY_BUFFER,
+                                      this->streamVBOs[stream],
+                                      this->streamRanges[stream],
+                                      streamData.data(),
+                                      streamData.size());
+    this->lastUploadBytes += streamData.size();
+    this->setVertexStreamAttributes(stream, offset);
+  }
+}
+
+size_t RenderWidget::storeBuffer( unsigned int target,
+                                  unsigned int ownBuffer,
+                                  UploadRange& range,
+                                  const void* data,
+                                  size_t size,
+                                  size_t alignment)
+{
+  // Suballocated in the upload manager storage, nothing is reallocated.
+  // A range that already fell back to the own buffer stays there.
+  if(this->uploadManager && range.buffer != ownBuffer)
+  {
+    if(range.block >= 0 && range.size == size)
+    {
+      this->uploadManager->update(range, data, size);
+      this->glBindBuffer(target, range.buffer);
+      return range.offset;
+    }
+    this->uploadManager->release(range);
+    range = this->uploadManager->allocate(size, alignment);
+    if(range.block >= 0)
+    {
+      if(size > 0)
+      {
+        memcpy(range.pointer, data, size);
+      }
+      this->glBindBuffer(target, range.buffer);
+      return range.offset;
+    }
+    // No storage could be mapped, the own buffer takes the data
+  }
+
+  this->glBindBuffer(target, ownBuffer);
+  if(range.buffer == ownBuffer && range.size == size)
+  {
+    this->glBufferSubData(target, 0, size, data);
+  }
+  else
+  {
+    this->glBufferData(target, size, data, GL_DYNAMIC_DRAW);
+    range = { ownBuffer, 0, size, nullptr, -1 };
+  }
+  return 0;
+}
+
+void RenderWidget::releaseRange(UploadRange& range)
+{
+  if(this->uploadManager)
+  {
+    this->uploadManager->release(range);
+  }
+  range = { 0, 0, 0, nullptr, -1 };
+}
+
+void RenderWidget::setVertexStreamAttributes(int stream, size_t offset)
+{
+  // Assumes the VAO and the stream VBO are bound
+  switch(stream)
+  {
+    case POSITION_STREAM:
+      this->glEnableVertexAttribArray( 0 );
+      this->glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*) offset );
+      break;
+    case NORMAL_STREAM:
+      if(this->isPackedVertexFormat)
+      {
+        this->glDisableVertexAttribArray( 1 );
+        this->glEnableVertexAttribArray( 5 );
+        this->glVertexAttribPointer( 5, 2, GL_SHORT, GL_TRUE, sizeof(glm::i16vec2), (void*) offset );
+      }
+      else
+      {
+        this->glDisableVertexAttribArray( 5 );
+        this->glEnableVertexAttribArray( 1 );
+        this->glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*) offset );
+      }
+      break;
+    case TANGENT_STREAM:
+      if(this->isPackedVertexFormat)
+      {
+        this->glDisableVertexAttribArray( 2 );
+        this->glDisableVertexAttribArray( 3 );
+        this->glEnableVertexAttribArray( 6 );
+        this->glVertexAttribPointer( 6, 4, GL_SHORT, GL_TRUE, sizeof(glm::i16vec4), (void*) offset );
+      }
+      else
+      {
+        this->glDisableVertexAttribArray( 6 );
+        this->glEnableVertexAttribArray( 2 );
+        this->glVertexAttribPointer( 2, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec3), (void*) offset );
+        this->glEnableVertexAttribArray( 3 );
+        this->glVertexAttribPointer( 3, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec3), (void*) (offset + sizeof(glm::vec3)) );
+      }
+      break;
+    case UV_STREAM:
+      this->glEnableVertexAttribArray( 4 );
+      if(this->isPackedVertexFormat)
+      {
+        this->glVertexAttribPointer( 4, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(glm::u16vec2), (void*) offset );
+      }
+      else
+      {
+        this->glVertexAttribPointer( 4, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void*) offset );
+      }
+      break;
+  }
 }
 
 void RenderWidget::setWireframeOverwrite(bool value)
 {
   this->isWireframeOverwrite = value;
-  this->update();  
+  this->frameScheduler->requestFrame();  
 }
 
 void RenderWidget::setEdgesVisible(bool value)
 {
   this->isEdgesVisible = value;
-  this->update();  
+  this->frameScheduler->requestFrame();  
 }
 
 void RenderWidget::setFlatFaces(bool value)
@@ -390,48 +2029,181 @@ void RenderWidget::setFlatFaces(bool value)
 void RenderWidget::setDiffuseTextureActive(bool value)
 {
   this->isDiffuseTextureActive = value;
-  this->update();  
+  // The passes are sorted by state
+  this->isDrawCommandsDirty = true;
+  this->frameScheduler->requestFrame();  
 }
 
 void RenderWidget::setBumMapActive(bool value)
 {
   this->isBumpMapActive = value;
-  this->update();  
+  this->isDrawCommandsDirty = true;
+  this->frameScheduler->requestFrame();  
 }
 
 void RenderWidget::setDiffuseColor(float r, float g, float b)
 {
   this->diffuseColor = glm::vec3(r, g, b);
-  this->update();  
+  this->scene->setMaterial(this->diffuseColor, this->materialShininess);
+  this->frameScheduler->requestFrame();  
+}
+
+void RenderWidget::setPackedVertexFormat(bool value)
+{
+  this->isPackedVertexFormat = value;
+  this->reloadMesh();
 }
 
 void RenderWidget::reloadMesh()
 {
+  TRACE_SCOPE("RenderWidget::reloadMesh");
+  if(this->scene->getNumMeshes() == 0)
+  {
+    return;
+  }
+
   std::vector<glm::vec3> positions;
   std::vector<glm::vec3> normals;
   std::vector<glm::vec3> tangents;
   std::vector<glm::vec3> bitangents;
   std::vector<glm::vec2> UVs;
   std::vector<unsigned int> indices;
+  std::vector<float> occlusion;
+  bool isOcclusionBaked = false;
+
+  // Every mesh once, whatever its number of instances
+  this->meshRanges.clear();
+  this->meshBounds.clear();
+  this->occluderPositions.clear();
+  this->occluderIndices.clear();
+  this->sceneMaterials.clear();
+  this->materialRanges.clear();
+  this->meshFirstMaterialRange.clear();
+  this->vertexAtlasTextures.clear();
+  std::vector<std::string> atlasPaths;
+  for(int m = 0; m < this->scene->getNumMeshes(); m++)
+  {
+    std::vector<glm::vec3> localPositions;
+    std::vector<glm::vec3> localNormals;
+    std::vector<unsigned int> localIndices;
+    std::vector<float> localOcclusion;
+    std::vector<MaterialRange> localMaterialRanges;
+    Mesh* mesh = this->scene->getMesh(m);
+    mesh->getTriangles(&localPositions, &localNormals, &localIndices, this->isFlatFaces, &localOcclusion, &localMaterialRanges);
+    isOcclusionBaked = isOcclusionBaked || mesh->getOcclusionRays() > 0;
+
+    // Materials of the scene follow each other, their textures are shared
+    // between meshes
+    int firstMaterial = (int) this->sceneMaterials.size();
+    const std::vector<ObjMaterial>& materials = mesh->getMaterials();
+    for(unsigned int i = 0; i < materials.size(); i++)
+    {
+      SceneMaterial material;
+      material.material = glm::vec4(materials[i].diffuseColor, std::max(materials[i].shininess, 1.0f));
+      material.diffuseTexture = -1;
+      const std::string& diffusePath = materials[i].diffuseTexturePath;
+      if(!diffusePath.empty())
+      {
+        material.diffuseTexture = (int) (std::find(atlasPaths.begin(), atlasPaths.end(), diffusePath) - atlasPaths.begin());
+        if(material.diffuseTexture == (int) atlasPaths.size())
+        {
+          atlasPaths.push_back(diffusePath);
+        }
+      }
+      material.bumpTexture = this->loadMaterialTexture(materials[i].bumpTexturePath, true);
+      this->sceneMaterials.push_back(material);
+    }
+    std::vector<int> localAtlasTextures;
+    this->splitAtlasVertices(firstMaterial,
+                             localMaterialRanges,
+                             localPositions,
+                             localNormals,
+                             localOcclusion,
+                             localIndices,
+                             localAtlasTextures);
+    occlusion.insert(occlusion.end(), localOcclusion.begin(), localOcclusion.end());
+    this->vertexAtlasTextures.insert(this->vertexAtlasTextures.end(), localAtlasTextures.begin(), localAtlasTextures.end());
+
+    MeshRange range;
+    range.firstVertex = (unsigned int) positions.size();
+    range.numVertices = (unsigned int) localPositions.size();
+    range.firstIndex = (unsigned int) indices.size();
+    range.numIndices = (unsigned int) localIndices.size();
+    this->meshRanges.push_back(range);
+
+    this->meshFirstMaterialRange.push_back((unsigned int) this->materialRanges.size());
+    for(unsigned int i = 0; i < localMaterialRanges.size(); i++)
+    {
+      MaterialRange materialRange = localMaterialRanges[i];
+      materialRange.material = materialRange.material < 0 ? -1 : firstMaterial + materialRange.material;
+      materialRange.firstIndex += range.firstIndex;
+      this->materialRanges.push_back(materialRange);
+    }
+
+    BoundingBox box = { glm::vec3(0.0f), glm::vec3(0.0f) };
+    for(unsigned int i = 0; i < localPositions.size(); i++)
+    {
+      box.min = i == 0 ? localPositions[i] : glm::min(box.min, localPositions[i]);
+      box.max = i == 0 ? localPositions[i] : glm::max(box.max, localPositions[i]);
+    }
+    this->meshBounds.push_back(box);
+
+    // Only simple meshes are rasterized as occluders
+    bool isOccluder = localIndices.size() / 3 <= MAX_OCCLUDER_TRIANGLES;
+    this->occluderPositions.push_back(isOccluder ? localPositions : std::vector<glm::vec3>());
+    this->occluderIndices.push_back(isOccluder ? localIndices : std::vector<unsigned int>());
+
+    positions.insert(positions.end(), localPositions.begin(), localPositions.end());
+    normals.insert(normals.end(), localNormals.begin(), localNormals.end());
+    for(unsigned int i = 0; i < localIndices.size(); i++)
+    {
+      indices.push_back(range.firstVertex + localIndices[i]);
+    }
+  }
+  this->meshFirstMaterialRange.push_back((unsigned int) this->materialRanges.size());
+  this->loadMaterialAtlas(atlasPaths);
+  this->isInstanceBoundsDirty = true;
+  if(!isOcclusionBaked)
+  {
+    occlusion.clear();
+  }
 
-  this->mesh->getTriangles(&positions, &normals, &indices, this->isFlatFaces);
-  this->countElements = indices.size();
+  // The CPU renderers sample the diffuse texture alone, not the material
+  // atlas
+  std::vector<glm::vec2> offlineUVs;
+  this->computeUVs(positions, UVs, &offlineUVs);
 
-  UVSphericalWrapper uvSphericalWrapper;
-  UVCubeWrapper uvCubeWrapper;
-  uvCubeWrapper.runBoundingBox(positions);
-  for(int i=0; i<positions.size(); i++)
+  NormalMapBaker::computeTangentBasis(positions,
+                                      UVs,
+                                      indices,
+                                      tangents,
+                                      bitangents);
+
+  // Before loadBuffers remaps them for the 16-bit indices
+  this->setOfflineGeometry(positions, normals, tangents, bitangents, offlineUVs, indices, occlusion);
+
+  if(this->virtualTexture)
   {
-    glm::vec2 uv = this->isSphericalMapping ? uvSphericalWrapper.uv(positions[i]) : uvCubeWrapper.uv(positions[i]);
-    UVs.push_back(uv);
+    this->feedbackPositions = positions;
+    this->feedbackUVs = UVs;
+    this->feedbackIndices = indices;
   }
 
-  this->computeTangentBasis(  positions,
-                              normals,
-                              UVs,
-                              indices,
-                              tangents,
-                              bitangents);
+  // Kept to rebuild the UV and tangent streams alone
+  if(this->isSeparateVertexStreams)
+  {
+    this->meshPositions = positions;
+    this->meshNormals = normals;
+    this->meshIndices = indices;
+    this->meshOcclusion = occlusion;
+  }
+  else
+  {
+    this->meshPositions.clear();
+    this->meshNormals.clear();
+    this->meshIndices.clear();
+    this->meshOcclusion.clear();
+  }
 
   this->loadBuffers(  this->VAO,
                       this->VBO,
@@ -441,12 +2213,349 @@ void RenderWidget::reloadMesh()
                       tangents,
                       bitangents,
                       UVs,
-                      indices);
-  this->update();  
+                      indices,
+                      occlusion);
+  this->frameScheduler->requestFrame();  
+}
+
+void RenderWidget::reloadUVs()
+{
+  if(this->scene->getNumMeshes() == 0)
+  {
+    return;
+  }
+  if(!this->isSeparateVertexStreams || this->meshPositions.empty())
+  {
+    this->reloadMesh();
+    return;
+  }
+
+  // Positions, normals and indices did not change: only the UV and tangent
+  // streams are rebuilt and written over their current storage
+  std::vector<glm::vec3> normals = this->meshNormals;
+  std::vector<glm::vec3> tangents;
+  std::vector<glm::vec3> bitangents;
+  std::vector<glm::vec2> UVs;
+
+  std::vector<glm::vec2> offlineUVs;
+  this->computeUVs(this->meshPositions, UVs, &offlineUVs);
+  if(this->virtualTexture)
+  {
+    this->feedbackUVs = UVs;
+  }
+
+  NormalMapBaker::computeTangentBasis(this->meshPositions,
+                                      UVs,
+                                      this->meshIndices,
+                                      tangents,
+                                      bitangents);
+
+  this->setOfflineGeometry(this->meshPositions,
+                           this->meshNormals,
+                           tangents,
+                           bitangents,
+                           offlineUVs,
+                           this->meshIndices,
+                           this->meshOcclusion);
+
+  if(!this->vertexRemap.empty())
+  {
+    IndexBatcher::remap(normals, this->vertexRemap);
+    IndexBatcher::remap(tangents, this->vertexRemap);
+    IndexBatcher::remap(bitangents, this->vertexRemap);
+    IndexBatcher::remap(UVs, this->vertexRemap);
+  }
+
+  this->glBindVertexArray(this->VAO);
+  this->lastUploadBytes = 0;
+  this->uploadVertexStreams(UV_STREAM_BIT | TANGENT_STREAM_BIT,
+                            this->meshPositions,
+                            normals,
+                            tangents,
+                            bitangents,
+                            UVs);
+  this->frameScheduler->requestFrame();
+}
+
+void RenderWidget::setOfflineGeometry( std::vector<glm::vec3>& positions,
+                                       std::vector<glm::vec3>& normals,
+                                       std::vector<glm::vec3>& tangents,
+                                       std::vector<glm::vec3>& bitangents,
+                                       std::vector<glm::vec2>& UVs,
+                                       std::vector<unsigned int>& indices,
+                                       std::vector<float>& occlusion)
+{
+  if(!this->softwareRenderer && !this->rayTracer)
+  {
+    return;
+  }
+
+  std::vector<InterleavedVertex> vertices;
+  VertexPacker::interleave(positions, normals, tangents, bitangents, UVs, vertices);
+  if(this->softwareRenderer)
+  {
+    this->softwareRenderer->setGeometry(vertices, indices, occlusion);
+  }
+  if(this->rayTracer)
+  {
+    this->rayTracer->setGeometry(vertices, indices, occlusion);
+  }
+}
+
+void RenderWidget::computeUVs(std::vector<glm::vec3>& positions, std::vector<glm::vec2>& UVs, std::vector<glm::vec2>* offlineUVs)
+{
+  UVSphericalWrapper uvSphericalWrapper;
+  UVs.reserve(positions.size());
+  // Every mesh is mapped on its own bounding box
+  for(unsigned int m = 0; m < this->meshRanges.size(); m++)
+  {
+    const MeshRange& range = this->meshRanges[m];
+    std::vector<glm::vec3> rangePositions(positions.begin() + range.firstVertex,
+                                          positions.begin() + range.firstVertex + range.numVertices);
+    UVCubeWrapper uvCubeWrapper;
+    uvCubeWrapper.runBoundingBox(rangePositions);
+    unsigned int firstUV = (unsigned int) UVs.size();
+    for(int i=0; i<rangePositions.size(); i++)
+    {
+      glm::vec2 uv = this->isSphericalMapping ? uvSphericalWrapper.uv(rangePositions[i]) : uvCubeWrapper.uv(rangePositions[i]);
+      UVs.push_back(uv);
+    }
+    std::vector<glm::vec2> meshUVs(UVs.begin() + firstUV, UVs.end());
+    int texture = m < this->atlasMeshTextures.size() ? this->atlasMeshTextures[m] : -1;
+    if(texture >= 0 && texture < (int) this->atlasUVTransforms.size() && this->atlasUVTransforms[texture].x > 0.0f)
+    {
+      TextureAtlas::remapUVs(UVs, firstUV, range.numVertices, this->atlasUVTransforms[texture]);
+    }
+    if(offlineUVs)
+    {
+      offlineUVs->insert(offlineUVs->end(), UVs.begin() + firstUV, UVs.end());
+    }
+
+    // The vertices of textured materials into their texture of the
+    // material atlas instead
+    if(this->vertexAtlasTextures.size() != positions.size())
+    {
+      continue;
+    }
+    std::map<int, std::vector<unsigned int> > textureVertices;
+    for(unsigned int i = 0; i < range.numVertices; i++)
+    {
+      int materialTexture = this->vertexAtlasTextures[range.firstVertex + i];
+      if(materialTexture >= 0 && this->materialAtlasUVTransforms[materialTexture].x > 0.0f)
+      {
+        textureVertices[materialTexture].push_back(i);
+      }
+    }
+    for(std::map<int, std::vector<unsigned int> >::iterator it = textureVertices.begin(); it != textureVertices.end(); ++it)
+    {
+      const std::vector<unsigned int>& vertices = it->second;
+      std::vector<glm::vec2> textureUVs(vertices.size());
+      for(unsigned int i = 0; i < vertices.size(); i++)
+      {
+        textureUVs[i] = meshUVs[vertices[i]];
+      }
+      TextureAtlas::remapUVs(textureUVs, 0, (unsigned int) textureUVs.size(), this->materialAtlasUVTransforms[it->first]);
+      for(unsigned int i = 0; i < vertices.size(); i++)
+      {
+        UVs[firstUV + vertices[i]] = textureUVs[i];
+      }
+    }
+  }
+}
+
+size_t RenderWidget::getLastUploadBytes()
+{
+  return this->lastUploadBytes;
+}
+
+int RenderWidget::getVisibleInstanceCount()
+{
+  return (int) this->visibleInstances.size();
+}
+
+PickResult RenderWidget::pick(glm::vec2 widgetCoordinates)
+{
+  // Through the pixel center, from the bottom left corner as the camera
+  // expects
+  glm::vec3 origin;
+  glm::vec3 direction;
+  this->camera->getRay(glm::vec2(widgetCoordinates.x + 0.5f, this->height() - widgetCoordinates.y - 0.5f), origin, direction);
+  return this->picker->pick(origin, direction);
+}
+
+void RenderWidget::pick(const std::vector<glm::vec2>& widgetCoordinates, std::vector<PickResult>& results)
+{
+  std::vector<Ray> rays(widgetCoordinates.size());
+  for(unsigned int i = 0; i < widgetCoordinates.size(); i++)
+  {
+    glm::vec2 screenCoordinates(widgetCoordinates[i].x + 0.5f, this->height() - widgetCoordinates[i].y - 0.5f);
+    rays[i].tMin = 0.0f;
+    rays[i].tMax = FLT_MAX;
+    this->camera->getRay(screenCoordinates, rays[i].origin, rays[i].direction);
+  }
+  this->picker->pick(rays, results);
+}
+
+bool RenderWidget::bakeAmbientOcclusion(int numRays, const std::function<bool(float)>& progress)
+{
+  std::vector<Mesh*> meshes;
+  for(int m = 0; m < this->scene->getNumMeshes(); m++)
+  {
+    Mesh* mesh = this->scene->getMesh(m);
+    if(mesh->getOcclusionRays() != numRays)
+    {
+      meshes.push_back(mesh);
+    }
+  }
+  if(meshes.empty())
+  {
+    return true;
+  }
+  if(!this->aoBaker)
+  {
+    this->aoBaker = new AOBaker();
+  }
+
+  TRACE_SCOPE("RenderWidget::bakeAmbientOcclusion");
+  for(unsigned int i = 0; i < meshes.size(); i++)
+  {
+    // Over the mesh vertices, so every face around a vertex shares it
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<unsigned int> indices;
+    std::vector<int> triangleFaces;
+    meshes[i]->getFaceTriangles(&positions, &indices, &triangleFaces);
+    meshes[i]->getVertexNormals(&normals);
+
+    BoundingBox box = { glm::vec3(0.0f), glm::vec3(0.0f) };
+    for(unsigned int v = 0; v < positions.size(); v++)
+    {
+      box.min = v == 0 ? positions[v] : glm::min(box.min, positions[v]);
+      box.max = v == 0 ? positions[v] : glm::max(box.max, positions[v]);
+    }
+
+    std::vector<float> occlusion;
+    bool isBaked = this->aoBaker->bake(positions,
+                                       normals,
+                                       indices,
+                                       numRays,
+                                       AO_MAX_DISTANCE * glm::length(box.max - box.min),
+                                       occlusion,
+                                       [&progress, i, &meshes](float meshProgress)
+    {
+      return !progress || progress((i + meshProgress) / meshes.size());
+    });
+    if(!isBaked)
+    {
+      return false;
+    }
+    meshes[i]->setVertexOcclusion(occlusion, numRays);
+  }
+
+  this->makeCurrent();
+  this->reloadMesh();
+  return true;
+}
+
+QImage RenderWidget::bakeNormalMap(char* highPolyPath, int size, const std::function<bool(float)>& progress)
+{
+  if(this->scene->getNumMeshes() == 0)
+  {
+    return QImage();
+  }
+
+  // The low poly side as reloadMesh uploads it, so the texels line up with
+  // the UVs and tangents drawn
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec3> normals;
+  std::vector<unsigned int> indices;
+  std::vector<glm::vec2> UVs;
+  int firstMaterial = 0;
+  for(int m = 0; m < this->scene->getNumMeshes(); m++)
+  {
+    std::vector<glm::vec3> localPositions;
+    std::vector<glm::vec3> localNormals;
+    std::vector<unsigned int> localIndices;
+    std::vector<float> localOcclusion;
+    std::vector<MaterialRange> localMaterialRanges;
+    std::vector<int> localAtlasTextures;
+    Mesh* mesh = this->scene->getMesh(m);
+    mesh->getTriangles(&localPositions, &localNormals, &localIndices, this->isFlatFaces, nullptr, &localMaterialRanges);
+    this->splitAtlasVertices(firstMaterial,
+                             localMaterialRanges,
+                             localPositions,
+                             localNormals,
+                             localOcclusion,
+                             localIndices,
+                             localAtlasTextures);
+    firstMaterial += (int) mesh->getMaterials().size();
+    unsigned int firstVertex = (unsigned int) positions.size();
+    positions.insert(positions.end(), localPositions.begin(), localPositions.end());
+    normals.insert(normals.end(), localNormals.begin(), localNormals.end());
+    for(unsigned int i = 0; i < localIndices.size(); i++)
+    {
+      indices.push_back(firstVertex + localIndices[i]);
+    }
+  }
+  this->computeUVs(positions, UVs);
+
+  BoundingBox box = { glm::vec3(0.0f), glm::vec3(0.0f) };
+  for(unsigned int v = 0; v < positions.size(); v++)
+  {
+    box.min = v == 0 ? positions[v] : glm::min(box.min, positions[v]);
+    box.max = v == 0 ? positions[v] : glm::max(box.max, positions[v]);
+  }
+
+  Mesh highPoly;
+  highPoly.loadObj(highPolyPath);
+  std::vector<glm::vec3> highPositions;
+  std::vector<glm::vec3> highNormals;
+  std::vector<unsigned int> highIndices;
+  highPoly.getTriangles(&highPositions, &highNormals, &highIndices, false);
+
+  if(!this->normalMapBaker)
+  {
+    this->normalMapBaker = new NormalMapBaker();
+  }
+  TRACE_SCOPE("RenderWidget::bakeNormalMap");
+  this->normalMapBaker->setHighPolyMesh(highPositions, highNormals, highIndices);
+  std::vector<unsigned char> texels;
+  bool isBaked = this->normalMapBaker->bake(positions,
+                                            normals,
+                                            UVs,
+                                            indices,
+                                            size,
+                                            size,
+                                            NORMAL_BAKE_DISTANCE * glm::length(box.max - box.min),
+                                            texels,
+                                            progress);
+  if(!isBaked)
+  {
+    return QImage();
+  }
+
+  // Same byte order as the 32-bit QImage formats
+  QImage img(size, size, QImage::Format_ARGB32);
+  for(int y = 0; y < size; y++)
+  {
+    memcpy(img.scanLine(y), &texels[(size_t) y * size * 4], size * 4);
+  }
+  return img;
+}
+
+float RenderWidget::getFrameTimePercentile(float percentile)
+{
+  return this->frameScheduler->getFrameTimePercentile(percentile);
+}
+
+void RenderWidget::requestFrame()
+{
+  this->frameScheduler->requestFrame();
 }
 
 void RenderWidget::resetCamera()
 {
+  this->frameScheduler->clearInput();
   delete this->camera;
   this->camera = new Camera(
     glm::vec3(0.0f, 0.0f, 2.0f), // eye
@@ -458,81 +2567,53 @@ void RenderWidget::resetCamera()
     this->width(),                // width
     this->height()                // height
     );
-  this->update();
+  this->frameScheduler->requestFrame();
 }
 
 void RenderWidget::setShininess(float s)
 {
   this->materialShininess = s;
-  this->update();
+  this->scene->setMaterial(this->diffuseColor, this->materialShininess);
+  this->frameScheduler->requestFrame();
 }
 
 void RenderWidget::setSphericalMapping(bool v)
 {
    this->isSphericalMapping = v;
-   this->reloadMesh();
+   this->reloadUVs();
 }
 
-void RenderWidget::computeTangentBasis( std::vector<glm::vec3> & positions,
-                          std::vector<glm::vec3> & normals,
-                          std::vector<glm::vec2> & UVs,
-                          std::vector<unsigned int> & indices,
-                          std::vector<glm::vec3>& tangents,
-                          std::vector<glm::vec3>& bitangents){
-
-  // For averaging out
-  std::vector<int> numFacesInThatVertex(positions.size());
-
-  tangents.resize(positions.size());
-  bitangents.resize(positions.size());
-
-  for(int i=0; i < indices.size(); i++)
-  {
-    numFacesInThatVertex[indices[i]]++;
-  }
-
-  for (int i=0; i < indices.size(); i+=3)
-  {
-    // Shortcuts for positions indexes
-    int vi0 = indices[i+0];
-    int vi1 = indices[i+1];
-    int vi2 = indices[i+2];
-
-    // Shortcuts for positions
-    glm::vec3 & v0 = positions[vi0];
-    glm::vec3 & v1 = positions[vi1];
-    glm::vec3 & v2 = positions[vi2];
-
-    // Shortcuts for UVs
-    glm::vec2 & uv0 = UVs[vi0];
-    glm::vec2 & uv1 = UVs[vi1];
-    glm::vec2 & uv2 = UVs[vi2];
-
-    // Edges of the triangle : position delta
-    glm::vec3 deltaPos1 = v1-v0;
-    glm::vec3 deltaPos2 = v2-v0;
+void RenderWidget::setSeparateVertexStreams(bool value)
+{
+  this->isSeparateVertexStreams = value;
+  this->reloadMesh();
+}
 
-    // UV delta
-    glm::vec2 deltaUV1 = uv1-uv0;
-    glm::vec2 deltaUV2 = uv2-uv0;
+void RenderWidget::setFrustumCulling(bool value)
+{
+  this->isFrustumCulling = value;
+  this->isVisibilityDirty = true;
+  this->frameScheduler->requestFrame();
+}
 
-    float r = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV1.y * deltaUV2.x);
-    glm::vec3 tangent = (deltaPos1 * deltaUV2.y   - deltaPos2 * deltaUV1.y)*r;
-    glm::vec3 bitangent = (deltaPos2 * deltaUV1.x   - deltaPos1 * deltaUV2.x)*r;
+void RenderWidget::setOcclusionCulling(bool value)
+{
+  this->isOcclusionCulling = value;
+  this->isVisibilityDirty = true;
+  this->frameScheduler->requestFrame();
+}
 
-    tangent = glm::normalize(tangent);
-    bitangent = glm::normalize(bitangent);
-    // bitangent = glm::cross(glm::normalize(glm::cross(v1 - v0, v2 - v0)), tangent);
+void RenderWidget::setHeightMapStrength(float strength)
+{
+  this->textureLoader->setHeightMapStrength(strength);
+}
 
-    // Set the same tangent for all three positions of the triangle.
-    // They will be merged later, in vboindexer.cpp
-    tangents[vi0] += (tangent / numFacesInThatVertex[vi0]);
-    tangents[vi1] += (tangent / numFacesInThatVertex[vi1]);
-    tangents[vi2] += (tangent / numFacesInThatVertex[vi2]);
+void RenderWidget::setTextureMipFilter(MipChain::Filter filter)
+{
+  this->textureLoader->setMipFilter(filter);
+}
 
-    // Same thing for bitangents
-    bitangents[vi0] += (bitangent / numFacesInThatVertex[vi0]);
-    bitangents[vi1] += (bitangent / numFacesInThatVertex[vi1]);
-    bitangents[vi2] += (bitangent / numFacesInThatVertex[vi2]);
-  }
+void RenderWidget::setTextureCompression(TextureLoader::Compression compression, BlockCompressor::Quality quality)
+{
+  this->textureLoader->setCompression(compression, quality);
 }
@@ -3,31 +3,129 @@
 
 #include <QOpenGLWidget>
 #include <QImage>
+#include <QStringList>
 #include <QOpenGLExtraFunctions>
-#include <QOpenGLShaderProgram>
+#include <QOpenGLFunctions_4_5_Core>
 #include <QVector3D>
 #include <QMatrix4x4>
 
 #include <vector>
+#include <map>
+#include <functional>
 
 #include "glm/glm.hpp"
 #include "camera.h"
 #include "mesh.h"
+#include "scene.h"
+#include "frustumculler.h"
+#include "occlusionculler.h"
+#include "aobaker.h"
+#include "normalmapbaker.h"
+#include "picker.h"
+#include "raytracer.h"
+#include "softwarerenderer.h"
+#include "indexbatcher.h"
+#include "vertexpacker.h"
+#include "gpuuploadmanager.h"
+#include "uniformbuffer.h"
+#include "framescheduler.h"
+#include "shadercache.h"
+#include "textureloader.h"
+#include "virtualtexture.h"
+#include "pagefeedback.h"
+#include "textureatlas.h"
+
+class PageFileBuildThread;
+
+// std140 layout of the FrameBlock uniform block
+struct FrameUniforms
+{
+  glm::mat4 view;
+  glm::mat4 viewProjection;
+};
+
+// std140 layout of the MaterialBlock uniform block (bools are 4 bytes).
+// Diffuse color and shininess are per instance.
+struct MaterialUniforms
+{
+  int isWireframeOverwrite;
+  int isEdgesVisible;
+  int isFlatFaces;
+  int isDiffuseTextureActive;
+  int isBumpMapActive;
+  int isPackedVertexFormat;
+  // BC5 normal maps, the third component is rebuilt
+  int isBumpMapTwoChannel;
+  // Diffuse texels through the page table of a virtual texture
+  int isDiffuseTextureVirtual;
+};
+
+// std140 layout of the VirtualTextureBlock uniform block
+struct VirtualTextureUniforms
+{
+  // width, height, tile size, page size
+  glm::ivec4 virtualSize;
+  // border, levels, physical texture size, unused
+  glm::ivec4 virtualLayout;
+  // xy: first page table entry of each level
+  glm::ivec4 pageTableOffsets[16];
+};
+
+// Layout of the glMultiDrawElementsIndirect commands
+struct DrawCommand
+{
+  unsigned int indexCount;
+  unsigned int instanceCount;
+  unsigned int firstIndex;
+  int baseVertex;
+  unsigned int baseInstance;
+};
 
 class RenderWidget
         : public QOpenGLWidget
         , protected QOpenGLExtraFunctions
 {
+    Q_OBJECT
+
 public:
     RenderWidget(QWidget* parent);
     virtual ~RenderWidget();
 
     void importOBJFromPath(char* path);
+    void importOBJInstances(char* path, int count);
+    // Decoded and mipmapped in the background, then uploaded by the next
+    // frame. loaded runs on the GUI thread with the full size image, once
+    // the texture is in use; a later import of the same texture drops it.
+    void importDiffuseTexture(QString path, const std::function<void(const QImage&)>& loaded = std::function<void(const QImage&)>());
+    void importBumpMap(QString path, const std::function<void(const QImage&)>& loaded = std::function<void(const QImage&)>());
     void importDiffuseTexture(QImage img);
     void importBumpMap(QImage img);
+    // Diffuse texture too large for a single GL texture: it is cut into
+    // a page file in the cache once, then only the pages the frames sample
+    // are loaded. The file is hashed and cut on a worker thread; progress
+    // gets the fraction of the page file written on the GUI thread, false
+    // cancels it, and imported runs there at the end. False when another
+    // import is still running. A later import of a regular diffuse texture
+    // replaces it.
+    bool importVirtualTexture(QString path,
+                              const std::function<bool(float)>& progress,
+                              const std::function<void(bool)>& imported);
+    // Several diffuse textures packed into one atlas by the texture loader.
+    // Scene mesh m samples paths[meshTextures[m]] through its UVs, rewritten
+    // once the atlas is loaded; the meshes without one (-1, past the end, or
+    // a file that cannot be read) keep their UVs over the whole atlas.
+    // Textures are halved until they all fit.
+    void importDiffuseAtlas(const QStringList& paths,
+                            const std::vector<int>& meshTextures,
+                            const std::function<void(const QImage&)>& loaded = std::function<void(const QImage&)>());
 
     void resetCamera();
 
+    // Renders the current view on the CPU, the same as paintGL would
+    QImage renderSoftware(int width, int height);
+    // Same view and shading, ray traced as a reference
+    QImage renderRayTraced(int width, int height);
+
     void setWireframeOverwrite(bool value);
     void setEdgesVisible(bool value);
     void setFlatFaces(bool value);
@@ -36,8 +134,159 @@ public:
     void setDiffuseColor(float r, float g, float b);
     void setShininess(float s);
     void setSphericalMapping(bool v);
+    void setPackedVertexFormat(bool value);
+    void setSeparateVertexStreams(bool value);
+    void setFrustumCulling(bool value);
+    void setOcclusionCulling(bool value);
+    // Of the bump maps imported next from grayscale height maps
+    void setHeightMapStrength(float strength);
+    // Mip chain filter of the textures imported next
+    void setTextureMipFilter(MipChain::Filter filter);
+    // Of the color textures imported next, normal maps are BC5 when compressed
+    void setTextureCompression(TextureLoader::Compression compression, BlockCompressor::Quality quality);
+
+    // Bytes sent to the GPU by the last mesh reload or UV update
+    size_t getLastUploadBytes();
+
+    // CPU frame time percentile over the last frames, in milliseconds
+    float getFrameTimePercentile(float percentile);
+
+    // Instances drawn by the last frame
+    int getVisibleInstanceCount();
+
+    // Face, vertex and halfedge under a point of the widget, in pixels from
+    // its top left corner like the mouse events
+    PickResult pick(glm::vec2 widgetCoordinates);
+    void pick(const std::vector<glm::vec2>& widgetCoordinates, std::vector<PickResult>& results);
+
+    // Bakes the ambient occlusion of the scene meshes not baked yet with
+    // this number of rays, then uploads it. The progress callback gets the
+    // fraction done, false cancels the bake and keeps the previous values.
+    bool bakeAmbientOcclusion(int numRays, const std::function<bool(float)>& progress);
+    // Bakes the normals of a high poly OBJ, in the same space as the scene
+    // meshes, over their current UV layout into a size x size normal map
+    // for importBumpMap. Null when cancelled or without a scene mesh.
+    QImage bakeNormalMap(char* highPolyPath, int size, const std::function<bool(float)>& progress);
+
+public slots:
+    // Repaint through the frame scheduler, queued by the texture loader,
+    // shader compiler and page loader threads
+    void requestFrame();
+    // Queued by the page file build thread, on progress and when done
+    void updateVirtualTextureImport();
+
+signals:
+    // Right click, instance -1 when nothing is under the mouse
+    void picked(const PickResult& result);
 
 private:
+    // Vertex streams of the separate streams layout, one VBO each
+    enum VertexStream
+    {
+      POSITION_STREAM = VertexPacker::POSITION_STREAM,
+      NORMAL_STREAM = VertexPacker::NORMAL_STREAM,
+      TANGENT_STREAM = VertexPacker::TANGENT_STREAM,
+      UV_STREAM = VertexPacker::UV_STREAM,
+      NUM_VERTEX_STREAMS = VertexPacker::NUM_STREAMS
+    };
+
+    enum VertexStreamBit
+    {
+      POSITION_STREAM_BIT = 1 << POSITION_STREAM,
+      NORMAL_STREAM_BIT = 1 << NORMAL_STREAM,
+      TANGENT_STREAM_BIT = 1 << TANGENT_STREAM,
+      UV_STREAM_BIT = 1 << UV_STREAM,
+      ALL_VERTEX_STREAMS = (1 << NUM_VERTEX_STREAMS) - 1
+    };
+
+    // Uniform block binding points, as declared in the shaders
+    enum UniformBinding
+    {
+      FRAME_UNIFORM_BINDING = 0,
+      MATERIAL_UNIFORM_BINDING = 1,
+      VIRTUAL_TEXTURE_UNIFORM_BINDING = 2
+    };
+
+    // Shader storage block binding points
+    enum StorageBinding
+    {
+      INSTANCE_STORAGE_BINDING = 0,
+      VISIBLE_INSTANCE_STORAGE_BINDING = 1
+    };
+
+    // Explicit uniform locations
+    enum UniformLocation
+    {
+      INSTANCE_OFFSET_LOCATION = 0,
+      MATERIAL_OVERRIDE_LOCATION = 1
+    };
+
+    // Occluders rasterized per frame, and the largest mesh used as one
+    static const int MAX_OCCLUDERS = 64;
+    static const unsigned int MAX_OCCLUDER_TRIANGLES = 2000;
+
+    // Vertex attribute of the baked ambient occlusion, in every layout
+    static const int OCCLUSION_ATTRIBUTE = 7;
+    // Occluders farther than this fraction of the mesh bounds diagonal are
+    // ignored by the bake
+    static const float AO_MAX_DISTANCE;
+    // Distance on both sides of the low poly surface searched for the high
+    // poly one, as a fraction of the mesh bounds diagonal
+    static const float NORMAL_BAKE_DISTANCE;
+    // Physical texture of the virtual texture, in pages on each side
+    static const int VIRTUAL_TEXTURE_SLOTS_WIDE = 24;
+    // Levels the VirtualTextureBlock has page table offsets for
+    static const int MAX_VIRTUAL_TEXTURE_LEVELS = 16;
+    // Triangles rasterized per frame by the page feedback, whatever the
+    // size of the instances
+    static const unsigned int MAX_FEEDBACK_TRIANGLES = 65536;
+
+    // OBJ material of a scene mesh, its diffuse texture an index in
+    // materialAtlasPaths and its bump texture one in materialTextures, or -1
+    struct SceneMaterial
+    {
+      // rgb: diffuse color, a: shininess
+      glm::vec4 material;
+      int diffuseTexture;
+      int bumpTexture;
+    };
+
+    // Bump texture of the OBJ materials, 0 until it is loaded
+    struct MaterialTexture
+    {
+      unsigned int texture;
+      bool isTwoChannel;
+    };
+
+    // Draw commands [firstCommand, firstCommand + numCommands) of the
+    // ranges of a scene material, -1 for the meshes without one
+    struct DrawPass
+    {
+      int material;
+      unsigned int firstCommand;
+      unsigned int numCommands;
+    };
+
+    // What a pass binds before its draws
+    struct PassState
+    {
+      unsigned int features;
+      unsigned int diffuseTexture;
+      unsigned int bumpTexture;
+      MaterialUniforms uniforms;
+      // Over the instance material when its shininess is positive
+      glm::vec4 materialOverride;
+    };
+
+    // Where a scene mesh lives in the concatenated vertex and index arrays
+    struct MeshRange
+    {
+      unsigned int firstVertex;
+      unsigned int numVertices;
+      unsigned int firstIndex;
+      unsigned int numIndices;
+    };
+
     virtual void initializeGL();
     virtual void paintGL();
     virtual void resizeGL(int w, int h);
@@ -61,33 +310,237 @@ private:
                       std::vector<glm::vec3>& tangents,
                       std::vector<glm::vec3>& bitangents,
                       std::vector<glm::vec2>& UVs,
-                      std::vector<unsigned int>& indices);
+                      std::vector<unsigned int>& indices,
+                      std::vector<float>& occlusion);
+    // Own buffer for every layout, a constant 1 when nothing is baked
+    void uploadOcclusion(std::vector<float>& occlusion);
+
+    void uploadVertexStreams( unsigned int streamMask,
+                              std::vector<glm::vec3>& positions,
+                              std::vector<glm::vec3>& normals,
+                              std::vector<glm::vec3>& tangents,
+                              std::vector<glm::vec3>& bitangents,
+                              std::vector<glm::vec2>& UVs);
+
+    void setVertexStreamAttributes(int stream, size_t offset);
+
+    // Software renderer and ray tracer geometry, unbatched
+    void setOfflineGeometry(std::vector<glm::vec3>& positions,
+                            std::vector<glm::vec3>& normals,
+                            std::vector<glm::vec3>& tangents,
+                            std::vector<glm::vec3>& bitangents,
+                            std::vector<glm::vec2>& UVs,
+                            std::vector<unsigned int>& indices,
+                            std::vector<float>& occlusion);
+
+    size_t storeBuffer( unsigned int target,
+                        unsigned int ownBuffer,
+                        UploadRange& range,
+                        const void* data,
+                        size_t size,
+                        size_t alignment = 16);
+
+    void releaseRange(UploadRange& range);
 
     void createTexture(unsigned int* textureID);
 
-    void loadTexture(unsigned int textureID, QImage img);
+    // Every level of the texture, through the pixel buffer
+    void loadTexture(unsigned int textureID, const LoadedTexture& texture);
+    void loadCompressedTexture(unsigned int textureID, const LoadedTexture& texture);
+    void uploadLoadedTextures();
+    // The textures of a built page file, replacing the virtual texture
+    bool openVirtualTexture(const std::string& pageFilePath);
+    // Pages loaded since the last frame and the page table changes
+    void uploadVirtualTexturePages();
+    // The pages the visible instances sample, then queues the missing ones
+    void updatePageFeedback(const glm::mat4& viewProjection);
+
+    unsigned int getShaderFeatures();
+
+    void updateInstances();
+    void cullOccludedInstances(const glm::mat4& viewProjection);
+    void drawInstances();
+    MaterialUniforms getFrameMaterialUniforms();
+    // Materials use their own textures and color, the frame state
+    // otherwise
+    void getPassState(int material, PassState& state);
+    // Index in materialTextures, loaded on first use. -1 without a path.
+    int loadMaterialTexture(const std::string& path, bool isNormalMap);
+    // Packs the diffuse textures of the materials into one atlas, unless
+    // they are the ones already packed
+    void loadMaterialAtlas(const std::vector<std::string>& paths);
+    // Vertices shared by faces of different material atlas textures are
+    // copied, so that each one takes the UVs of a single texture. The
+    // material ranges are those of getTriangles, from firstMaterial in
+    // sceneMaterials. vertexTextures gets the atlas texture of every
+    // vertex, -1 outside of it.
+    void splitAtlasVertices(int firstMaterial,
+                            const std::vector<MaterialRange>& materialRanges,
+                            std::vector<glm::vec3>& positions,
+                            std::vector<glm::vec3>& normals,
+                            std::vector<float>& occlusion,
+                            std::vector<unsigned int>& indices,
+                            std::vector<int>& vertexTextures);
+    // Levels of an atlas texture that keep its textures apart
+    void setAtlasMaxLevel(unsigned int textureID, const LoadedTexture& texture);
 
     void reloadMesh();
+    void reloadUVs();
 
-    void computeTangentBasis( std::vector<glm::vec3> & positions,
-                            std::vector<glm::vec3> & normals,
-                            std::vector<glm::vec2> & UVs,
-                            std::vector<unsigned int> & indices,
-                            std::vector<glm::vec3>& tangents,
-                            std::vector<glm::vec3>& bitangents);
+    // offlineUVs, when given, get the UVs without the material atlas
+    void computeUVs(std::vector<glm::vec3>& positions, std::vector<glm::vec2>& UVs, std::vector<glm::vec2>* offlineUVs = nullptr);
+
+    ShaderCache* shaderCache;
+
+    UniformBuffer* frameUniformBuffer;
+    UniformBuffer* materialUniformBuffer;
+    FrameUniforms frameUniforms;
 
-    QOpenGLShaderProgram* program;
+    // Desktop only entry points (indirect draws)
+    QOpenGLFunctions_4_5_Core* glCore;
+    // GL 3.2, 16-bit batches of large meshes then keep their base vertex
+    // out of the indices
+    bool isBaseVertexSupported;
+
+    // Persistent mapped storage, only with GL 4.4+
+    GPUUploadManager* uploadManager;
 
     unsigned int VAO;
     unsigned int VBO;
     unsigned int EBO;
-    unsigned int countElements;
+    unsigned int streamVBOs[NUM_VERTEX_STREAMS];
+    // Where the current mesh data lives, either in the buffers above or
+    // suballocated by the upload manager
+    UploadRange vertexRange;
+    UploadRange indexRange;
+    UploadRange streamRanges[NUM_VERTEX_STREAMS];
+    unsigned int occlusionVBO;
+    UploadRange occlusionRange;
+    unsigned int indexType;
+    std::vector<Submesh> submeshes;
+    std::vector<unsigned int> vertexRemap;
+    size_t lastUploadBytes;
+
+    // Scene meshes share the buffers above, one after the other. The
+    // submeshes of mesh m are [meshFirstSubmesh[m], meshFirstSubmesh[m + 1]).
+    std::vector<MeshRange> meshRanges;
+    std::vector<unsigned int> meshFirstSubmesh;
+
+    // Materials of the scene meshes one after the other, and the ranges of
+    // the index buffer drawn with each one. The material ranges of mesh m
+    // are [meshFirstMaterialRange[m], meshFirstMaterialRange[m + 1]).
+    std::vector<SceneMaterial> sceneMaterials;
+    std::vector<MaterialRange> materialRanges;
+    std::vector<unsigned int> meshFirstMaterialRange;
+    std::vector<MaterialTexture> materialTextures;
+    // Keyed by path, and by request while they load
+    std::map<std::string, int> materialTextureIndexes;
+    std::map<unsigned int, int> materialTextureRequests;
+    // Diffuse textures of the materials in one atlas, each path once; the
+    // ones that could not be read have a zero UV transform. The atlas
+    // texture of every scene vertex is in vertexAtlasTextures.
+    std::vector<std::string> materialAtlasPaths;
+    std::vector<glm::vec4> materialAtlasUVTransforms;
+    std::vector<int> vertexAtlasTextures;
+    unsigned int materialAtlasTexture;
+    unsigned int materialAtlasRequest;
+    bool isMaterialAtlasLoaded;
+
+    // Per instance data (shader storage), rebuilt only when the scene changed
+    unsigned int instanceBuffer;
+    UploadRange instanceRange;
+    size_t storageAlignment;
+    std::vector<InstanceBatch> instanceBatches;
+    std::vector<InstanceData> instanceData;
+    unsigned int uploadedInstanceGeneration;
+
+    // Frustum culling of the instance bounds. The visible list and the
+    // indirect draw commands are only rebuilt when the camera moved.
+    FrustumCuller frustumCuller;
+    std::vector<BoundingBox> meshBounds;
+    std::vector<BoundingBox> instanceBounds;
+    std::vector<unsigned int> visibleInstances;
+    glm::mat4 culledViewProjection;
+    bool isFrustumCulling;
+    bool isInstanceBoundsDirty;
+    bool isVisibilityDirty;
+    unsigned int visibleBuffer;
+    UploadRange visibleRange;
+
+    // Occlusion culling of the frustum visible instances, against the
+    // nearest instances of the meshes simple enough to be occluders
+    OcclusionCuller occlusionCuller;
+    std::vector<std::vector<glm::vec3> > occluderPositions;
+    std::vector<std::vector<unsigned int> > occluderIndices;
+    bool isOcclusionCulling;
+
+    // Ray queries against the scene meshes, their BVHs are built by the
+    // first pick after a mesh change
+    Picker* picker;
+
+    // CPU backend, created on first use. It keeps its own copy of the
+    // geometry and of the texture images.
+    SoftwareRenderer* softwareRenderer;
+    QImage diffuseImage;
+    QImage bumpImage;
+    bool isSoftwareTexturesDirty;
+    RayTracer* rayTracer;
+    bool isRayTracerTexturesDirty;
+
+    // Created by the first bake
+    AOBaker* aoBaker;
+    NormalMapBaker* normalMapBaker;
+
+    // Hands the textures if they changed and the current view to a CPU
+    // backend, as RGBA8 of the given size
+    template<class Renderer>
+    QImage renderOnCPU(Renderer* renderer, bool& isTexturesDirty, int width, int height);
+
+    unsigned int indirectBuffer;
+    UploadRange indirectRange;
+    std::vector<DrawCommand> drawCommands;
+    // Sorted by shader variant then textures, so consecutive passes mostly
+    // share their program and bindings
+    std::vector<DrawPass> drawPasses;
+    bool isDrawCommandsDirty;
 
     unsigned int DIFFUSE_TEXTURE_2D;
     unsigned int BUMP_TEXTURE_2D;
 
+    TextureLoader* textureLoader;
+    // Latest request of each texture, older ones finishing later are
+    // dropped
+    unsigned int diffuseTextureRequest;
+    unsigned int bumpMapRequest;
+    std::map<unsigned int, std::function<void(const QImage&)> > textureCallbacks;
+
+    // UV transform of each atlas texture (see TextureAtlas::getUVTransform),
+    // empty for a regular diffuse texture, and the atlas texture of each
+    // scene mesh. Both are replaced once an atlas is uploaded.
+    std::vector<glm::vec4> atlasUVTransforms;
+    std::vector<int> atlasMeshTextures;
+    std::vector<int> pendingAtlasMeshTextures;
+    unsigned int atlasRequest;
+    unsigned int texturePBO;
+
+    // Sparse diffuse texture, its pages resident in the physical texture
+    VirtualTexture* virtualTexture;
+    PageFeedback pageFeedback;
+    // Of the virtual texture being imported
+    PageFileBuildThread* pageFileBuildThread;
+    std::function<bool(float)> virtualTextureProgress;
+    std::function<void(bool)> virtualTextureImported;
+    unsigned int PHYSICAL_PAGES_2D;
+    unsigned int PAGE_TABLE_2D;
+    UniformBuffer* virtualTextureUniformBuffer;
+    bool isDiffuseTextureVirtual;
+    // Unbatched geometry rasterized by the feedback, kept while it is used
+    std::vector<glm::vec3> feedbackPositions;
+    std::vector<glm::vec2> feedbackUVs;
+    std::vector<unsigned int> feedbackIndices;
+
     Camera* camera;
-    glm::mat4x4 model;
+    FrameScheduler* frameScheduler;
     glm::mat4x4 view;
     glm::mat4x4 proj;
 
@@ -101,12 +554,21 @@ private:
     bool isFlatFaces;
     bool isDiffuseTextureActive;
     bool isBumpMapActive;
+    bool isBumpMapTwoChannel;
 
     glm::vec3 diffuseColor;
     float materialShininess;
     bool isSphericalMapping;
+    bool isPackedVertexFormat;
+    bool isSeparateVertexStreams;
+
+    Scene* scene;
 
-    Mesh* mesh;
+    // Unbatched mesh data, kept while the separate streams layout is active
+    std::vector<glm::vec3> meshPositions;
+    std::vector<glm::vec3> meshNormals;
+    std::vector<unsigned int> meshIndices;
+    std::vector<float> meshOcclusion;
 };
 
 #endif // RENDERWIDGET_H
@@ -0,0 +1,135 @@
+#include "scene.h"
+
+Scene::Scene()
+{
+  this->meshGeneration = 0;
+  this->instanceGeneration = 0;
+}
+
+Scene::~Scene()
+{
+  this->clear();
+}
+
+int Scene::loadMesh(const std::string& path)
+{
+  std::map<std::string, int>::iterator it = this->meshIndexes.find(path);
+  if (it != this->meshIndexes.end())
+  {
+    return it->second;
+  }
+
+  Mesh* mesh = new Mesh();
+  mesh->loadObj(path);
+  int index = (int) this->meshes.size();
+  this->meshes.push_back(mesh);
+  this->meshIndexes[path] = index;
+  this->meshGeneration++;
+  return index;
+}
+
+int Scene::addInstance(int mesh, const glm::mat4& model, glm::vec3 diffuseColor, float shininess)
+{
+  this->instances.push_back({ mesh, model, diffuseColor, shininess });
+  this->instanceGeneration++;
+  return (int) this->instances.size() - 1;
+}
+
+void Scene::setInstanceTransform(int instance, const glm::mat4& model)
+{
+  this->instances[instance].model = model;
+  this->instanceGeneration++;
+}
+
+void Scene::setInstanceMaterial(int instance, glm::vec3 diffuseColor, float shininess)
+{
+  this->instances[instance].diffuseColor = diffuseColor;
+  this->instances[instance].shininess = shininess;
+  this->instanceGeneration++;
+}
+
+void Scene::setMaterial(glm::vec3 diffuseColor, float shininess)
+{
+  for (unsigned int i = 0; i < this->instances.size(); i++)
+  {
+    this->instances[i].diffuseColor = diffuseColor;
+    this->instances[i].shininess = shininess;
+  }
+  this->instanceGeneration++;
+}
+
+void Scene::clear()
+{
+  for (unsigned int i = 0; i < this->meshes.size(); i++)
+  {
+    delete this->meshes[i];
+  }
+  this->meshes.clear();
+  this->meshIndexes.clear();
+  this->instances.clear();
+  this->meshGeneration++;
+  this->instanceGeneration++;
+}
+
+int Scene::getNumMeshes()
+{
+  return (int) this->meshes.size();
+}
+
+Mesh* Scene::getMesh(int mesh)
+{
+  return this->meshes[mesh];
+}
+
+int Scene::getNumInstances()
+{
+  return (int) this->instances.size();
+}
+
+const SceneInstance& Scene::getInstance(int instance)
+{
+  return this->instances[instance];
+}
+
+unsigned int Scene::getMeshGeneration()
+{
+  return this->meshGeneration;
+}
+
+unsigned int Scene::getInstanceGeneration()
+{
+  return this->instanceGeneration;
+}
+
+void Scene::buildBatches(std::vector<InstanceBatch>& batches, std::vector<InstanceData>& instanceData)
+{
+  batches.clear();
+  instanceData.clear();
+  instanceData.reserve(this->instances.size());
+
+  // Counting sort by mesh
+  std::vector<unsigned int> firstInstance(this->meshes.size() + 1, 0);
+  for (unsigned int i = 0; i < this->instances.size(); i++)
+  {
+    firstInstance[this->instances[i].mesh + 1]++;
+  }
+  for (unsigned int m = 0; m < this->meshes.size(); m++)
+  {
+    firstInstance[m + 1] += firstInstance[m];
+    unsigned int count = firstInstance[m + 1] - firstInstance[m];
+    if (count > 0)
+    {
+      batches.push_back({ (int) m, firstInstance[m], count });
+    }
+  }
+
+  instanceData.resize(this->instances.size());
+  for (unsigned int i = 0; i < this->instances.size(); i++)
+  {
+    const SceneInstance& instance = this->instances[i];
+    InstanceData& data = instanceData[firstInstance[instance.mesh]++];
+    data.model = instance.model;
+    data.normalModel = glm::mat4(glm::transpose(glm::inverse(glm::mat3(instance.model))));
+    data.material = glm::vec4(instance.diffuseColor, instance.shininess);
+  }
+}
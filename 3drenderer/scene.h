@@ -0,0 +1,76 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "glm/glm.hpp"
+#include <vector>
+#include <string>
+#include <map>
+
+#include "mesh.h"
+
+// std430 layout of an InstanceBlock entry
+struct InstanceData
+{
+  glm::mat4 model;
+  // transpose(inverse()) of the linear part of the model, computed on the CPU
+  // when the instances change. Without the translation, directions keep w = 0.
+  glm::mat4 normalModel;
+  // rgb: diffuse color, a: shininess
+  glm::vec4 material;
+};
+
+struct SceneInstance
+{
+  int mesh;
+  glm::mat4 model;
+  glm::vec3 diffuseColor;
+  float shininess;
+};
+
+// Consecutive instances of the same mesh in the instance data
+struct InstanceBatch
+{
+  int mesh;
+  unsigned int firstInstance;
+  unsigned int instanceCount;
+};
+
+// Meshes and their instances. A mesh loaded twice from the same file is
+// stored once, so all of its instances share its GPU buffers.
+class Scene
+{
+private:
+  std::vector<Mesh*> meshes;
+  std::map<std::string, int> meshIndexes;
+  std::vector<SceneInstance> instances;
+
+  // Bumped on every change, so the renderer knows what to re-upload
+  unsigned int meshGeneration;
+  unsigned int instanceGeneration;
+
+public:
+  Scene();
+  ~Scene();
+
+  // Returns the index of the mesh, loading it only if needed
+  int loadMesh(const std::string& path);
+
+  int addInstance(int mesh, const glm::mat4& model, glm::vec3 diffuseColor, float shininess);
+  void setInstanceTransform(int instance, const glm::mat4& model);
+  void setInstanceMaterial(int instance, glm::vec3 diffuseColor, float shininess);
+  void setMaterial(glm::vec3 diffuseColor, float shininess);
+
+  void clear();
+
+  int getNumMeshes();
+  Mesh* getMesh(int mesh);
+  int getNumInstances();
+  const SceneInstance& getInstance(int instance);
+  unsigned int getMeshGeneration();
+  unsigned int getInstanceGeneration();
+
+  // Instance data sorted by mesh, one batch per mesh with instances
+  void buildBatches(std::vector<InstanceBatch>& batches, std::vector<InstanceData>& instanceData);
+};
+
+#endif // SCENE_H
@@ -0,0 +1,406 @@
+#include "shadercache.h"
+#include "tracer.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QMetaObject>
+#include <QCryptographicHash>
+#include <QStandardPaths>
+#include <QSaveFile>
+#include <QDir>
+
+#include <cstring>
+
+// Header of the program binary files
+struct ProgramBinaryHeader
+{
+  char magic[4];
+  unsigned int format;
+  unsigned int length;
+};
+
+class ShaderCompileThread : public QThread
+{
+private:
+  ShaderCache* cache;
+public:
+  ShaderCompileThread(ShaderCache* cache)
+  {
+    this->cache = cache;
+  }
+
+  void run()
+  {
+    this->cache->runBackgroundCompiles();
+  }
+};
+
+ShaderCache::ShaderCache(QOpenGLExtraFunctions* gl, QOpenGLContext* shareContext, QWidget* widget)
+{
+  this->gl = gl;
+  this->widget = widget;
+  this->isStopping = false;
+  this->backgroundContext = nullptr;
+  this->backgroundSurface = nullptr;
+  this->compileThread = nullptr;
+
+  this->vertexSource = this->loadSource(":/shaders/vertexshader.glsl");
+  this->geometrySource = this->loadSource(":/shaders/geometryshader.glsl");
+  this->fragmentSource = this->loadSource(":/shaders/fragmentshader.glsl");
+
+  this->binaryCacheDirectory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/shaders";
+  QDir().mkpath(this->binaryCacheDirectory);
+
+  GLint numBinaryFormats = 0;
+  this->gl->glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numBinaryFormats);
+  if(numBinaryFormats > 0)
+  {
+    // Binaries are only valid for the driver that produced them
+    this->driverString += (const char*) this->gl->glGetString(GL_VENDOR);
+    this->driverString += '\n';
+    this->driverString += (const char*) this->gl->glGetString(GL_RENDERER);
+    this->driverString += '\n';
+    this->driverString += (const char*) this->gl->glGetString(GL_VERSION);
+  }
+
+  this->genericProgram = this->compileVariant(this->gl, 0, true);
+
+  // Context and surface are created here, in the GUI thread, and the
+  // context is then handed to the compile thread
+  this->backgroundSurface = new QOffscreenSurface();
+  this->backgroundSurface->setFormat(shareContext->format());
+  this->backgroundSurface->create();
+
+  this->backgroundContext = new QOpenGLContext();
+  this->backgroundContext->setFormat(shareContext->format());
+  this->backgroundContext->setShareContext(shareContext);
+  if(this->backgroundContext->create())
+  {
+    this->compileThread = new ShaderCompileThread(this);
+    this->backgroundContext->moveToThread(this->compileThread);
+    this->compileThread->start();
+  }
+  else
+  {
+    qDebug() << "ShaderCache: no background context, variants are compiled on demand";
+    delete this->backgroundContext;
+    this->backgroundContext = nullptr;
+  }
+}
+
+ShaderCache::~ShaderCache()
+{
+  if(this->compileThread)
+  {
+    this->mutex.lock();
+    this->isStopping = true;
+    this->jobAvailable.wakeAll();
+    this->mutex.unlock();
+    this->compileThread->wait();
+    delete this->compileThread;
+  }
+  delete this->backgroundContext;
+  delete this->backgroundSurface;
+
+  this->collectFinishedPrograms();
+  for(std::map<unsigned int, unsigned int>::iterator it = this->programs.begin(); it != this->programs.end(); ++it)
+  {
+    this->gl->glDeleteProgram(it->second);
+  }
+  this->gl->glDeleteProgram(this->genericProgram);
+}
+
+QByteArray ShaderCache::loadSource(const QString& path)
+{
+  QFile file(path);
+  if(!file.open(QIODevice::ReadOnly))
+  {
+    qDebug() << "ShaderCache: could not read" << path;
+    return QByteArray();
+  }
+  return file.readAll();
+}
+
+QByteArray ShaderCache::getDefines(unsigned int features)
+{
+  static const char* names[NUM_FEATURES] = {
+    "WIREFRAME_OVERWRITE",
+    "EDGES_VISIBLE",
+    "DIFFUSE_TEXTURE",
+    "BUMP_MAP",
+    "PACKED_VERTEX_FORMAT"
+  };
+
+  QByteArray defines;
+  for(int i = 0; i < NUM_FEATURES; i++)
+  {
+    defines += "#define ";
+    defines += names[i];
+    defines += (features & (1 << i)) ? " true\n" : " false\n";
+  }
+  return defines;
+}
+
+QByteArray ShaderCache::insertDefines(const QByteArray& source, const QByteArray& defines)
+{
+  // Right after the #version line, which must stay first
+  int versionEnd = source.indexOf('\n');
+  if(versionEnd < 0)
+  {
+    return source;
+  }
+  QByteArray result = source.left(versionEnd + 1);
+  result += defines;
+  result += source.mid(versionEnd + 1);
+  return result;
+}
+
+unsigned int ShaderCache::compileVariant(QOpenGLExtraFunctions* gl, unsigned int features, bool isGeneric)
+{
+  QByteArray defines = isGeneric ? QByteArray() : this->getDefines(features);
+  QByteArray vertexSource = ShaderCache::insertDefines(this->vertexSource, defines);
+  QByteArray geometrySource = ShaderCache::insertDefines(this->geometrySource, defines);
+  QByteArray fragmentSource = ShaderCache::insertDefines(this->fragmentSource, defines);
+
+  QString binaryPath = this->getBinaryCachePath(vertexSource, geometrySource, fragmentSource);
+  unsigned int program = this->loadProgramBinary(gl, binaryPath);
+  if(!program)
+  {
+    program = ShaderCache::compileProgram(gl, vertexSource, geometrySource, fragmentSource);
+    this->saveProgramBinary(gl, program, binaryPath);
+  }
+
+  ShaderCache::setSamplerUnits(gl, program);
+  return program;
+}
+
+QString ShaderCache::getBinaryCachePath( const QByteArray& vertexSource,
+                                         const QByteArray& geometrySource,
+                                         const QByteArray& fragmentSource)
+{
+  if(this->driverString.isEmpty())
+  {
+    return QString();
+  }
+
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  hash.addData(this->driverString);
+  hash.addData(vertexSource);
+  hash.addData(geometrySource);
+  hash.addData(fragmentSource);
+  return this->binaryCacheDirectory + "/" + QString::fromLatin1(hash.result().toHex()) + ".bin";
+}
+
+unsigned int ShaderCache::loadProgramBinary(QOpenGLExtraFunctions* gl, const QString& path)
+{
+  if(path.isEmpty())
+  {
+    return 0;
+  }
+
+  TRACE_SCOPE("ShaderCache::loadProgramBinary");
+  unsigned int program = 0;
+  QFile file(path);
+  if(file.open(QIODevice::ReadOnly))
+  {
+    QByteArray data = file.readAll();
+    file.close();
+
+    ProgramBinaryHeader header;
+    if(data.size() >= (int) sizeof(header))
+    {
+      memcpy(&header, data.constData(), sizeof(header));
+    }
+    if( data.size() >= (int) sizeof(header) &&
+        memcmp(header.magic, "SPB1", 4) == 0 &&
+        header.length == data.size() - sizeof(header))
+    {
+      program = gl->glCreateProgram();
+      gl->glProgramBinary(program, header.format, data.constData() + sizeof(header), header.length);
+
+      // Drivers can refuse a binary at any time (e.g. after an update)
+      GLint status = 0;
+      gl->glGetProgramiv(program, GL_LINK_STATUS, &status);
+      if(!status)
+      {
+        gl->glDeleteProgram(program);
+        program = 0;
+      }
+    }
+    if(!program)
+    {
+      QFile::remove(path);
+    }
+  }
+  return program;
+}
+
+void ShaderCache::saveProgramBinary(QOpenGLExtraFunctions* gl, unsigned int program, const QString& path)
+{
+  if(path.isEmpty())
+  {
+    return;
+  }
+
+  GLint length = 0;
+  gl->glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if(length <= 0)
+  {
+    return;
+  }
+
+  ProgramBinaryHeader header;
+  memcpy(header.magic, "SPB1", 4);
+  QByteArray data(sizeof(header) + length, 0);
+  GLenum format = 0;
+  gl->glGetProgramBinary(program, length, &length, &format, data.data() + sizeof(header));
+  header.format = format;
+  header.length = length;
+  memcpy(data.data(), &header, sizeof(header));
+  data.resize(sizeof(header) + length);
+
+  QSaveFile file(path);
+  if(file.open(QIODevice::WriteOnly))
+  {
+    file.write(data);
+    file.commit();
+  }
+}
+
+unsigned int ShaderCache::compileProgram( QOpenGLExtraFunctions* gl,
+                                          const QByteArray& vertexSource,
+                                          const QByteArray& geometrySource,
+                                          const QByteArray& fragmentSource)
+{
+  TRACE_SCOPE("ShaderCache::compileProgram");
+  const QByteArray* sources[3] = { &vertexSource, &geometrySource, &fragmentSource };
+  const GLenum types[3] = { GL_VERTEX_SHADER, GL_GEOMETRY_SHADER, GL_FRAGMENT_SHADER };
+
+  unsigned int program = gl->glCreateProgram();
+  unsigned int shaders[3];
+  for(int i = 0; i < 3; i++)
+  {
+    const char* source = sources[i]->constData();
+    GLint length = sources[i]->size();
+
+    shaders[i] = gl->glCreateShader(types[i]);
+    gl->glShaderSource(shaders[i], 1, &source, &length);
+    gl->glCompileShader(shaders[i]);
+
+    GLint status = 0;
+    gl->glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &status);
+    if(!status)
+    {
+      char log[4096];
+      gl->glGetShaderInfoLog(shaders[i], sizeof(log), nullptr, log);
+      qDebug() << "ShaderCache: compile error" << log;
+    }
+    gl->glAttachShader(program, shaders[i]);
+  }
+
+  gl->glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  gl->glLinkProgram(program);
+
+  GLint status = 0;
+  gl->glGetProgramiv(program, GL_LINK_STATUS, &status);
+  if(!status)
+  {
+    char log[4096];
+    gl->glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+    qDebug() << "ShaderCache: link error" << log;
+  }
+
+  for(int i = 0; i < 3; i++)
+  {
+    gl->glDetachShader(program, shaders[i]);
+    gl->glDeleteShader(shaders[i]);
+  }
+
+  return program;
+}
+
+void ShaderCache::setSamplerUnits(QOpenGLExtraFunctions* gl, unsigned int program)
+{
+  // Samplers never change unit. Uniforms are not part of program binaries,
+  // so this runs for loaded programs as well.
+  gl->glProgramUniform1i(program, gl->glGetUniformLocation(program, "diffuseTextureSampler"), 0);
+  gl->glProgramUniform1i(program, gl->glGetUniformLocation(program, "bumpMapSampler"), 1);
+  gl->glProgramUniform1i(program, gl->glGetUniformLocation(program, "physicalPageSampler"), 2);
+  gl->glProgramUniform1i(program, gl->glGetUniformLocation(program, "pageTableSampler"), 3);
+}
+
+unsigned int ShaderCache::getProgram(unsigned int features)
+{
+  this->collectFinishedPrograms();
+
+  std::map<unsigned int, unsigned int>::iterator it = this->programs.find(features);
+  if(it != this->programs.end())
+  {
+    return it->second;
+  }
+
+  if(this->requestedPrograms.insert(features).second)
+  {
+    if(!this->compileThread)
+    {
+      unsigned int program = this->compileVariant(this->gl, features, false);
+      this->programs[features] = program;
+      return program;
+    }
+
+    this->mutex.lock();
+    this->jobs.push_back(features);
+    this->jobAvailable.wakeOne();
+    this->mutex.unlock();
+  }
+
+  return this->genericProgram;
+}
+
+void ShaderCache::collectFinishedPrograms()
+{
+  this->mutex.lock();
+  for(unsigned int i = 0; i < this->finishedPrograms.size(); i++)
+  {
+    this->programs[this->finishedPrograms[i].first] = this->finishedPrograms[i].second;
+  }
+  this->finishedPrograms.clear();
+  this->mutex.unlock();
+}
+
+void ShaderCache::runBackgroundCompiles()
+{
+  this->backgroundContext->makeCurrent(this->backgroundSurface);
+  QOpenGLExtraFunctions* gl = this->backgroundContext->extraFunctions();
+
+  for(;;)
+  {
+    this->mutex.lock();
+    while(this->jobs.empty() && !this->isStopping)
+    {
+      this->jobAvailable.wait(&(this->mutex));
+    }
+    if(this->isStopping)
+    {
+      this->mutex.unlock();
+      break;
+    }
+    unsigned int features = this->jobs.front();
+    this->jobs.pop_front();
+    this->mutex.unlock();
+
+    unsigned int program = this->compileVariant(gl, features, false);
+    // The program must be complete before the other context uses it
+    gl->glFinish();
+
+    this->mutex.lock();
+    this->finishedPrograms.push_back(std::make_pair(features, program));
+    this->mutex.unlock();
+
+    QMetaObject::invokeMethod(this->widget, "requestFrame", Qt::QueuedConnection);
+  }
+
+  this->backgroundContext->doneCurrent();
+  // Back to the GUI thread, where it is destroyed
+  this->backgroundContext->moveToThread(this->widget->thread());
+}
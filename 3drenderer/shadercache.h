@@ -0,0 +1,98 @@
+#ifndef SHADERCACHE_H
+#define SHADERCACHE_H
+
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLContext>
+#include <QOffscreenSurface>
+#include <QByteArray>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThread>
+#include <QWidget>
+
+#include <map>
+#include <set>
+#include <deque>
+#include <vector>
+
+class ShaderCompileThread;
+
+// Shader programs specialized by feature bitmask. Each variant is compiled
+// from the same GLSL sources with the feature macros defined as constants,
+// so the disabled branches and their texture fetches are compiled out.
+// The generic program (no macros, the features read from the uniforms) is
+// compiled up front and drawn with while a missing variant is compiled on a
+// background context sharing objects with the widget's one.
+// Linked programs are saved as driver binaries, keyed by their sources and
+// the driver strings, so later launches skip the compilation; a binary the
+// driver refuses falls back to a full compile.
+class ShaderCache
+{
+  friend class ShaderCompileThread;
+public:
+  enum Feature
+  {
+    WIREFRAME_OVERWRITE = 1 << 0,
+    EDGES_VISIBLE = 1 << 1,
+    DIFFUSE_TEXTURE = 1 << 2,
+    BUMP_MAP = 1 << 3,
+    PACKED_VERTEX_FORMAT = 1 << 4,
+    NUM_FEATURES = 5
+  };
+
+private:
+  QOpenGLExtraFunctions* gl;
+  QWidget* widget;
+
+  QByteArray vertexSource;
+  QByteArray geometrySource;
+  QByteArray fragmentSource;
+
+  unsigned int genericProgram;
+  // Only touched by the GUI thread
+  std::map<unsigned int, unsigned int> programs;
+  std::set<unsigned int> requestedPrograms;
+
+  // Shared with the compile thread
+  QMutex mutex;
+  QWaitCondition jobAvailable;
+  std::deque<unsigned int> jobs;
+  std::vector<std::pair<unsigned int, unsigned int> > finishedPrograms;
+  bool isStopping;
+
+  QString binaryCacheDirectory;
+  QByteArray driverString;
+
+  QOpenGLContext* backgroundContext;
+  QOffscreenSurface* backgroundSurface;
+  ShaderCompileThread* compileThread;
+
+  QByteArray loadSource(const QString& path);
+  QByteArray getDefines(unsigned int features);
+  unsigned int compileVariant(QOpenGLExtraFunctions* gl, unsigned int features, bool isGeneric);
+  QString getBinaryCachePath( const QByteArray& vertexSource,
+                              const QByteArray& geometrySource,
+                              const QByteArray& fragmentSource);
+  unsigned int loadProgramBinary(QOpenGLExtraFunctions* gl, const QString& path);
+  void saveProgramBinary(QOpenGLExtraFunctions* gl, unsigned int program, const QString& path);
+  void runBackgroundCompiles();
+  void collectFinishedPrograms();
+public:
+  // Must be created with the widget's context current. The widget's
+  // requestFrame() slot is queued when a variant is ready.
+  ShaderCache(QOpenGLExtraFunctions* gl, QOpenGLContext* shareContext, QWidget* widget);
+  ~ShaderCache();
+
+  // Program specialized for the features when ready, the generic one
+  // otherwise. The widget is repainted when the variant becomes available.
+  unsigned int getProgram(unsigned int features);
+
+  static unsigned int compileProgram( QOpenGLExtraFunctions* gl,
+                                      const QByteArray& vertexSource,
+                                      const QByteArray& geometrySource,
+                                      const QByteArray& fragmentSource);
+  static void setSamplerUnits(QOpenGLExtraFunctions* gl, unsigned int program);
+  static QByteArray insertDefines(const QByteArray& source, const QByteArray& defines);
+};
+
+#endif // SHADERCACHE_H
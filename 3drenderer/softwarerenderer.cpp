@@ -0,0 +1,733 @@
+#include "softwarerenderer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define SOFTWARERENDERER_SSE2
+#endif
+
+// Vertices transformed by a single job
+static const unsigned int VERTEX_BATCH = 4096;
+
+// Bound to a reference by std::min, needs a definition without optimizations
+const unsigned int SoftwareRenderer::SETUP_BATCH_TRIANGLES;
+
+static inline int wrapCoordinate(int i, int size)
+{
+  i %= size;
+  return i < 0 ? i + size : i;
+}
+
+static inline glm::vec4 fetchTexel(const unsigned char* texel)
+{
+  return glm::vec4(texel[0], texel[1], texel[2], texel[3]) * (1.0f / 255.0f);
+}
+
+static SoftwareVaryings mixVaryings(const SoftwareVaryings& a, const SoftwareVaryings& b, float t)
+{
+  SoftwareVaryings v;
+  v.positionVSpace = a.positionVSpace + (b.positionVSpace - a.positionVSpace) * t;
+  v.normalVSpace = a.normalVSpace + (b.normalVSpace - a.normalVSpace) * t;
+  v.tangentVSpace = a.tangentVSpace + (b.tangentVSpace - a.tangentVSpace) * t;
+  v.bitangentVSpace = a.bitangentVSpace + (b.bitangentVSpace - a.bitangentVSpace) * t;
+  v.triangleCoordinate = a.triangleCoordinate + (b.triangleCoordinate - a.triangleCoordinate) * t;
+  v.uv = a.uv + (b.uv - a.uv) * t;
+  v.occlusion = a.occlusion + (b.occlusion - a.occlusion) * t;
+  return v;
+}
+
+// Keeps the side where w + zSign * z >= 0: zSign 1 is the near plane, -1
+// the far one
+static int clipPolygon( const SoftwareClipVertex* input,
+                        int numInput,
+                        float zSign,
+                        SoftwareClipVertex* output)
+{
+  int numOutput = 0;
+  for (int i = 0; i < numInput; i++)
+  {
+    const SoftwareClipVertex& a = input[i];
+    const SoftwareClipVertex& b = input[(i + 1) % numInput];
+    float da = a.clip.w + zSign * a.clip.z;
+    float db = b.clip.w + zSign * b.clip.z;
+    if (da >= 0.0f)
+    {
+      output[numOutput++] = a;
+    }
+    if ((da >= 0.0f) != (db >= 0.0f))
+    {
+      float t = da / (da - db);
+      SoftwareClipVertex& v = output[numOutput++];
+      v.clip = a.clip + (b.clip - a.clip) * t;
+      v.varyings = mixVaryings(a.varyings, b.varyings, t);
+    }
+  }
+  return numOutput;
+}
+
+SoftwareTexture::SoftwareTexture()
+{
+}
+
+void SoftwareTexture::setImage(const unsigned char* texels, int width, int height)
+{
+  this->levels.clear();
+  this->sizes.clear();
+  if (texels == nullptr || width <= 0 || height <= 0)
+  {
+    return;
+  }
+
+  this->levels.push_back(std::vector<unsigned char>(texels, texels + 4 * width * height));
+  this->sizes.push_back(glm::ivec2(width, height));
+
+  // Box filtered chain, as glGenerateMipmap
+  while (width > 1 || height > 1)
+  {
+    const std::vector<unsigned char>& source = this->levels.back();
+    int levelWidth = std::max(width / 2, 1);
+    int levelHeight = std::max(height / 2, 1);
+    std::vector<unsigned char> level(4 * levelWidth * levelHeight);
+    for (int y = 0; y < levelHeight; y++)
+    {
+      int sy0 = std::min(2 * y, height - 1);
+      int sy1 = std::min(2 * y + 1, height - 1);
+      for (int x = 0; x < levelWidth; x++)
+      {
+        int sx0 = std::min(2 * x, width - 1);
+        int sx1 = std::min(2 * x + 1, width - 1);
+        for (int c = 0; c < 4; c++)
+        {
+          int sum = source[4 * (sy0 * width + sx0) + c] + source[4 * (sy0 * width + sx1) + c] +
+                    source[4 * (sy1 * width + sx0) + c] + source[4 * (sy1 * width + sx1) + c];
+          level[4 * (y * levelWidth + x) + c] = (unsigned char) ((sum + 2) / 4);
+        }
+      }
+    }
+    this->levels.push_back(level);
+    this->sizes.push_back(glm::ivec2(levelWidth, levelHeight));
+    width = levelWidth;
+    height = levelHeight;
+  }
+}
+
+bool SoftwareTexture::isEmpty() const
+{
+  return this->levels.empty();
+}
+
+glm::vec4 SoftwareTexture::sampleLevel(int level, glm::vec2 uv) const
+{
+  glm::ivec2 size = this->sizes[level];
+  const unsigned char* texels = this->levels[level].data();
+
+  float x = uv.x * size.x - 0.5f;
+  float y = uv.y * size.y - 0.5f;
+  float floorX = std::floor(x);
+  float floorY = std::floor(y);
+  float fx = x - floorX;
+  float fy = y - floorY;
+  int x0 = wrapCoordinate((int) floorX, size.x);
+  int y0 = wrapCoordinate((int) floorY, size.y);
+  int x1 = x0 + 1 == size.x ? 0 : x0 + 1;
+  int y1 = y0 + 1 == size.y ? 0 : y0 + 1;
+
+  glm::vec4 t00 = fetchTexel(texels + 4 * (y0 * size.x + x0));
+  glm::vec4 t10 = fetchTexel(texels + 4 * (y0 * size.x + x1));
+  glm::vec4 t01 = fetchTexel(texels + 4 * (y1 * size.x + x0));
+  glm::vec4 t11 = fetchTexel(texels + 4 * (y1 * size.x + x1));
+  return glm::mix(glm::mix(t00, t10, fx), glm::mix(t01, t11, fx), fy);
+}
+
+glm::vec4 SoftwareTexture::sample(glm::vec2 uv, glm::vec2 uvDx, glm::vec2 uvDy) const
+{
+  if (this->levels.empty())
+  {
+    return glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+  }
+
+  // Magnified (lod <= 0) falls back to the linear filter of level 0
+  glm::vec2 size = glm::vec2(this->sizes[0]);
+  glm::vec2 texelDx = uvDx * size;
+  glm::vec2 texelDy = uvDy * size;
+  float rho2 = std::max(glm::dot(texelDx, texelDx), glm::dot(texelDy, texelDy));
+  float lod = rho2 > 1.0f ? 0.5f * std::log2(rho2) : 0.0f;
+
+  int maxLevel = (int) this->levels.size() - 1;
+  if (lod <= 0.0f)
+  {
+    return this->sampleLevel(0, uv);
+  }
+  if (lod >= (float) maxLevel)
+  {
+    return this->sampleLevel(maxLevel, uv);
+  }
+  int level = (int) lod;
+  return glm::mix(this->sampleLevel(level, uv), this->sampleLevel(level + 1, uv), lod - level);
+}
+
+SoftwareRenderer::SoftwareRenderer(ThreadPool* threadPool)
+{
+  this->isOwnThreadPool = threadPool == nullptr;
+  this->threadPool = this->isOwnThreadPool ? new ThreadPool() : threadPool;
+
+  this->width = 0;
+  this->height = 0;
+  this->depthStride = 0;
+  this->tilesX = 0;
+  this->tilesY = 0;
+  this->shading = { false, false, false, false };
+}
+
+SoftwareRenderer::~SoftwareRenderer()
+{
+  if (this->isOwnThreadPool)
+  {
+    delete this->threadPool;
+  }
+}
+
+void SoftwareRenderer::setGeometry(const std::vector<InterleavedVertex>& vertices,
+                                   const std::vector<unsigned int>& indices,
+                                   const std::vector<float>& occlusion)
+{
+  this->vertices = vertices;
+  this->indices = indices;
+  this->occlusion = occlusion;
+}
+
+void SoftwareRenderer::setDiffuseTexture(const unsigned char* texels, int width, int height)
+{
+  this->diffuseTexture.setImage(texels, width, height);
+}
+
+void SoftwareRenderer::setBumpMap(const unsigned char* texels, int width, int height)
+{
+  this->bumpMap.setImage(texels, width, height);
+}
+
+void SoftwareRenderer::beginFrame(int width, int height, const glm::mat4& view, const glm::mat4& projection, const SoftwareShading& shading)
+{
+  if (width != this->width || height != this->height)
+  {
+    this->width = width;
+    this->height = height;
+    this->depthStride = (width + 3) & ~3;
+    this->tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    this->tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    this->colorBuffer.resize(4 * width * height);
+    this->depthBuffer.resize(this->depthStride * height);
+  }
+  this->view = view;
+  this->viewProjection = projection * view;
+  this->shading = shading;
+  this->draws.clear();
+}
+
+void SoftwareRenderer::draw( unsigned int firstVertex,
+                             unsigned int numVertices,
+                             unsigned int firstIndex,
+                             unsigned int numIndices,
+                             const InstanceData& instance)
+{
+  if (numIndices < 3 || numVertices == 0)
+  {
+    return;
+  }
+  this->draws.push_back({ firstVertex, numVertices, firstIndex, numIndices, instance, 0 });
+}
+
+void SoftwareRenderer::endFrame()
+{
+  // Vertex stage: every draw transforms its own copy of its vertex range
+  struct VertexJob
+  {
+    unsigned int draw;
+    unsigned int first;
+    unsigned int count;
+  };
+  std::vector<VertexJob> vertexJobs;
+  unsigned int numTransformed = 0;
+  for (unsigned int d = 0; d < this->draws.size(); d++)
+  {
+    Draw& draw = this->draws[d];
+    draw.firstTransformed = numTransformed;
+    numTransformed += draw.numVertices;
+    for (unsigned int first = 0; first < draw.numVertices; first += VERTEX_BATCH)
+    {
+      vertexJobs.push_back({ d, first, std::min(VERTEX_BATCH, draw.numVertices - first) });
+    }
+  }
+  this->transformed.resize(numTransformed);
+  this->threadPool->parallelFor((int) vertexJobs.size(), [this, &vertexJobs](int job)
+  {
+    const VertexJob& vertexJob = vertexJobs[job];
+    this->transformVertices(this->draws[vertexJob.draw], vertexJob.first, vertexJob.count);
+  });
+
+  // Setup and binning, in submission order
+  unsigned int numSetupJobs = 0;
+  for (unsigned int d = 0; d < this->draws.size(); d++)
+  {
+    unsigned int numTriangles = this->draws[d].numIndices / 3;
+    for (unsigned int first = 0; first < numTriangles; first += SETUP_BATCH_TRIANGLES)
+    {
+      if (numSetupJobs == this->setupJobs.size())
+      {
+        this->setupJobs.push_back(SetupJob());
+      }
+      SetupJob& job = this->setupJobs[numSetupJobs++];
+      job.draw = d;
+      job.firstTriangle = first;
+      job.numTriangles = std::min(SETUP_BATCH_TRIANGLES, numTriangles - first);
+    }
+  }
+  // Storage of the unused jobs is kept for the next frames, their stale
+  // bins are skipped by the tiles
+  for (unsigned int j = numSetupJobs; j < this->setupJobs.size(); j++)
+  {
+    this->setupJobs[j].numTriangles = 0;
+  }
+  this->threadPool->parallelFor((int) numSetupJobs, [this](int job)
+  {
+    this->setupTriangles(this->setupJobs[job]);
+  });
+
+  this->threadPool->parallelFor(this->tilesX * this->tilesY, [this](int tile)
+  {
+    this->rasterizeTile(tile);
+  });
+}
+
+void SoftwareRenderer::transformVertices(const Draw& draw, unsigned int first, unsigned int count)
+{
+  const InstanceData& instance = draw.instance;
+  glm::mat4 modelViewProjection = this->viewProjection * instance.model;
+  glm::mat4 modelView = this->view * instance.model;
+  // The view matrix is rigid, it transforms normals as is
+  glm::mat3 normalMatrix = glm::mat3(this->view * instance.normalModel);
+
+  for (unsigned int i = first; i < first + count; i++)
+  {
+    const InterleavedVertex& vertex = this->vertices[draw.firstVertex + i];
+    SoftwareClipVertex& output = this->transformed[draw.firstTransformed + i];
+    glm::vec4 position = glm::vec4(vertex.pos, 1.0f);
+    output.clip = modelViewProjection * position;
+    output.varyings.positionVSpace = glm::vec3(modelView * position);
+    output.varyings.normalVSpace = normalMatrix * vertex.normal;
+    output.varyings.tangentVSpace = normalMatrix * vertex.tangent;
+    output.varyings.bitangentVSpace = normalMatrix * vertex.bitangent;
+    output.varyings.triangleCoordinate = glm::vec3(0.0f);
+    output.varyings.uv = vertex.uv;
+    output.varyings.occlusion = this->occlusion.empty() ? 1.0f : this->occlusion[draw.firstVertex + i];
+  }
+}
+
+void SoftwareRenderer::setupTriangles(SetupJob& job)
+{
+  job.triangles.clear();
+  job.bins.resize(this->tilesX * this->tilesY);
+  for (unsigned int i = 0; i < job.bins.size(); i++)
+  {
+    job.bins[i].clear();
+  }
+
+  const Draw& draw = this->draws[job.draw];
+  const SoftwareClipVertex* drawVertices = this->transformed.data() + draw.firstTransformed;
+  for (unsigned int t = job.firstTriangle; t < job.firstTriangle + job.numTriangles; t++)
+  {
+    const unsigned int* triangle = this->indices.data() + draw.firstIndex + 3 * t;
+    SoftwareClipVertex corners[3];
+    for (int k = 0; k < 3; k++)
+    {
+      corners[k] = drawVertices[triangle[k] - draw.firstVertex];
+      // As emitted by the geometry shader
+      corners[k].varyings.triangleCoordinate[k] = 1.0f;
+    }
+    this->addTriangle(corners, draw.instance.material, job);
+  }
+}
+
+void SoftwareRenderer::addTriangle(const SoftwareClipVertex* corners, const glm::vec4& material, SetupJob& job)
+{
+  // Entirely outside one of the frustum planes
+  bool isCrossingDepthRange = false;
+  for (int axis = 0; axis < 3; axis++)
+  {
+    bool isBelow = true;
+    bool isAbove = true;
+    for (int k = 0; k < 3; k++)
+    {
+      const glm::vec4& clip = corners[k].clip;
+      isBelow = isBelow && clip[axis] < -clip.w;
+      isAbove = isAbove && clip[axis] > clip.w;
+      isCrossingDepthRange = isCrossingDepthRange || (axis == 2 && (clip.z < -clip.w || clip.z > clip.w));
+    }
+    if (isBelow || isAbove)
+    {
+      return;
+    }
+  }
+
+  // Clipped against the near and far planes only, the other planes are
+  // handled by the screen bounds
+  const SoftwareClipVertex* polygon = corners;
+  int numVertices = 3;
+  SoftwareClipVertex nearClipped[4];
+  SoftwareClipVertex clipped[5];
+  if (isCrossingDepthRange)
+  {
+    numVertices = clipPolygon(corners, 3, 1.0f, nearClipped);
+    numVertices = clipPolygon(nearClipped, numVertices, -1.0f, clipped);
+    polygon = clipped;
+    if (numVertices < 3)
+    {
+      return;
+    }
+  }
+
+  glm::vec2 screen[5];
+  float depth[5];
+  float invW[5];
+  for (int i = 0; i < numVertices; i++)
+  {
+    invW[i] = 1.0f / polygon[i].clip.w;
+    glm::vec3 ndc = glm::vec3(polygon[i].clip) * invW[i];
+    // Window rows go down, image rows are stored top first
+    screen[i] = glm::vec2((ndc.x * 0.5f + 0.5f) * this->width, (0.5f - ndc.y * 0.5f) * this->height);
+    depth[i] = ndc.z * 0.5f + 0.5f;
+  }
+
+  for (int f = 1; f + 1 < numVertices; f++)
+  {
+    int corner[3] = { 0, f, f + 1 };
+    glm::vec2 p[3] = { screen[0], screen[f], screen[f + 1] };
+    float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[1].y - p[0].y) * (p[2].x - p[0].x);
+    if (std::abs(area) < 1e-8f)
+    {
+      continue;
+    }
+
+    RasterTriangle t;
+    glm::vec2 minCorner = glm::min(glm::min(p[0], p[1]), p[2]);
+    glm::vec2 maxCorner = glm::max(glm::max(p[0], p[1]), p[2]);
+    t.minX = std::max((int) std::floor(minCorner.x), 0);
+    t.minY = std::max((int) std::floor(minCorner.y), 0);
+    t.maxX = std::min((int) std::ceil(maxCorner.x), this->width - 1);
+    t.maxY = std::min((int) std::ceil(maxCorner.y), this->height - 1);
+    if (t.minX > t.maxX || t.minY > t.maxY)
+    {
+      continue;
+    }
+
+    // Edge i is the one opposite to vertex i. Divided by the signed area,
+    // the barycentrics are positive inside whatever the winding.
+    for (int i = 0; i < 3; i++)
+    {
+      const glm::vec2& a = p[(i + 1) % 3];
+      const glm::vec2& b = p[(i + 2) % 3];
+      const glm::vec2& c = p[i];
+      t.edge[i] = glm::vec3(a.y - b.y, b.x - a.x, (b.y - a.y) * a.x - (b.x - a.x) * a.y) / area;
+      if (a.y == b.y)
+      {
+        t.isTopLeft[i] = c.y > a.y;
+      }
+      else
+      {
+        t.isTopLeft[i] = c.x > a.x + (c.y - a.y) * (b.x - a.x) / (b.y - a.y);
+      }
+      t.z[i] = depth[corner[i]];
+      t.invW[i] = invW[corner[i]];
+      t.varyings[i] = polygon[corner[i]].varyings;
+    }
+    t.material = material;
+
+    unsigned int index = (unsigned int) job.triangles.size();
+    job.triangles.push_back(t);
+    for (int ty = t.minY / TILE_SIZE; ty <= t.maxY / TILE_SIZE; ty++)
+    {
+      for (int tx = t.minX / TILE_SIZE; tx <= t.maxX / TILE_SIZE; tx++)
+      {
+        job.bins[ty * this->tilesX + tx].push_back(index);
+      }
+    }
+  }
+}
+
+void SoftwareRenderer::rasterizeTile(int tile)
+{
+  int x0 = (tile % this->tilesX) * TILE_SIZE;
+  int y0 = (tile / this->tilesX) * TILE_SIZE;
+  int x1 = std::min(x0 + TILE_SIZE, this->width) - 1;
+  int y1 = std::min(y0 + TILE_SIZE, this->height) - 1;
+
+  for (int y = y0; y <= y1; y++)
+  {
+    unsigned char* color = this->colorBuffer.data() + 4 * (y * this->width + x0);
+    for (int x = x0; x <= x1; x++, color += 4)
+    {
+      color[0] = 0;
+      color[1] = 0;
+      color[2] = 0;
+      color[3] = 255;
+    }
+    std::fill(this->depthBuffer.begin() + y * this->depthStride + x0,
+              this->depthBuffer.begin() + y * this->depthStride + x1 + 1,
+              1.0f);
+  }
+
+  for (unsigned int j = 0; j < this->setupJobs.size(); j++)
+  {
+    const SetupJob& job = this->setupJobs[j];
+    if (job.numTriangles == 0)
+    {
+      continue;
+    }
+    const std::vector<unsigned int>& bin = job.bins[tile];
+    for (unsigned int i = 0; i < bin.size(); i++)
+    {
+      const RasterTriangle& t = job.triangles[bin[i]];
+      this->rasterizeTriangle(t,
+                              std::max(t.minX, x0),
+                              std::max(t.minY, y0),
+                              std::min(t.maxX, x1),
+                              std::min(t.maxY, y1));
+    }
+  }
+}
+
+void SoftwareRenderer::rasterizeTriangle(const RasterTriangle& t, int x0, int y0, int x1, int y1)
+{
+  if (x0 > x1 || y0 > y1)
+  {
+    return;
+  }
+
+  glm::vec3 color;
+#ifdef SOFTWARERENDERER_SSE2
+  // Four pixels of a row at once, from an aligned x so the depth loads stay
+  // in the padded row
+  const __m128 laneCenters = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+  const __m128 zero = _mm_setzero_ps();
+  __m128 edgeA[3];
+  __m128 topLeft[3];
+  for (int i = 0; i < 3; i++)
+  {
+    edgeA[i] = _mm_set1_ps(t.edge[i].x);
+    topLeft[i] = _mm_castsi128_ps(_mm_set1_epi32(t.isTopLeft[i] ? -1 : 0));
+  }
+  __m128 minCenter = _mm_set1_ps(x0 + 0.5f);
+  __m128 maxCenter = _mm_set1_ps(x1 + 0.5f);
+  float l[3][4];
+  float z[4];
+
+  for (int y = y0; y <= y1; y++)
+  {
+    float py = y + 0.5f;
+    __m128 rowBase[3];
+    for (int i = 0; i < 3; i++)
+    {
+      rowBase[i] = _mm_set1_ps(t.edge[i].y * py + t.edge[i].z);
+    }
+    float* depthRow = this->depthBuffer.data() + y * this->depthStride;
+    unsigned char* colorRow = this->colorBuffer.data() + 4 * y * this->width;
+
+    for (int x = x0 & ~3; x <= x1; x += 4)
+    {
+      __m128 px = _mm_add_ps(_mm_set1_ps((float) x), laneCenters);
+      __m128 covered = _mm_and_ps(_mm_cmpge_ps(px, minCenter), _mm_cmple_ps(px, maxCenter));
+      __m128 barycentrics[3];
+      for (int i = 0; i < 3; i++)
+      {
+        barycentrics[i] = _mm_add_ps(_mm_mul_ps(edgeA[i], px), rowBase[i]);
+        __m128 inside = _mm_or_ps(_mm_cmpgt_ps(barycentrics[i], zero),
+                                  _mm_and_ps(_mm_cmpeq_ps(barycentrics[i], zero), topLeft[i]));
+        covered = _mm_and_ps(covered, inside);
+      }
+      if (_mm_movemask_ps(covered) == 0)
+      {
+        continue;
+      }
+
+      __m128 depth = _mm_add_ps(_mm_add_ps(_mm_mul_ps(barycentrics[0], _mm_set1_ps(t.z.x)),
+                                           _mm_mul_ps(barycentrics[1], _mm_set1_ps(t.z.y))),
+                                _mm_mul_ps(barycentrics[2], _mm_set1_ps(t.z.z)));
+      int mask = _mm_movemask_ps(_mm_and_ps(covered, _mm_cmplt_ps(depth, _mm_loadu_ps(depthRow + x))));
+      if (mask == 0)
+      {
+        continue;
+      }
+      for (int i = 0; i < 3; i++)
+      {
+        _mm_storeu_ps(l[i], barycentrics[i]);
+      }
+      _mm_storeu_ps(z, depth);
+
+      // Discarded fragments write neither depth nor color
+      for (int lane = 0; lane < 4; lane++)
+      {
+        if ((mask & (1 << lane)) && this->shadeFragment(t, l[0][lane], l[1][lane], l[2][lane], color))
+        {
+          depthRow[x + lane] = z[lane];
+          unsigned char* pixel = colorRow + 4 * (x + lane);
+          pixel[0] = (unsigned char) (glm::clamp(color.r, 0.0f, 1.0f) * 255.0f + 0.5f);
+          pixel[1] = (unsigned char) (glm::clamp(color.g, 0.0f, 1.0f) * 255.0f + 0.5f);
+          pixel[2] = (unsigned char) (glm::clamp(color.b, 0.0f, 1.0f) * 255.0f + 0.5f);
+        }
+      }
+    }
+  }
+#else
+  for (int y = y0; y <= y1; y++)
+  {
+    float* depthRow = this->depthBuffer.data() + y * this->depthStride;
+    unsigned char* colorRow = this->colorBuffer.data() + 4 * y * this->width;
+    for (int x = x0; x <= x1; x++)
+    {
+      glm::vec3 p(x + 0.5f, y + 0.5f, 1.0f);
+      float l[3];
+      bool isCovered = true;
+      for (int i = 0; i < 3; i++)
+      {
+        l[i] = glm::dot(t.edge[i], p);
+        isCovered = isCovered && (l[i] > 0.0f || (l[i] == 0.0f && t.isTopLeft[i]));
+      }
+      if (!isCovered)
+      {
+        continue;
+      }
+      float depth = l[0] * t.z.x + l[1] * t.z.y + l[2] * t.z.z;
+      if (depth < depthRow[x] && this->shadeFragment(t, l[0], l[1], l[2], color))
+      {
+        depthRow[x] = depth;
+        unsigned char* pixel = colorRow + 4 * x;
+        pixel[0] = (unsigned char) (glm::clamp(color.r, 0.0f, 1.0f) * 255.0f + 0.5f);
+        pixel[1] = (unsigned char) (glm::clamp(color.g, 0.0f, 1.0f) * 255.0f + 0.5f);
+        pixel[2] = (unsigned char) (glm::clamp(color.b, 0.0f, 1.0f) * 255.0f + 0.5f);
+      }
+    }
+  }
+#endif
+}
+
+bool SoftwareRenderer::shadeFragment(const RasterTriangle& t, float l0, float l1, float l2, glm::vec3& color)
+{
+  // Perspective correct barycentrics, from the screen space ones
+  float q0 = l0 * t.invW.x;
+  float q1 = l1 * t.invW.y;
+  float q2 = l2 * t.invW.z;
+  float q = q0 + q1 + q2;
+  glm::vec3 b(q0 / q, q1 / q, q2 / q);
+  const SoftwareVaryings* v = t.varyings;
+
+  glm::vec2 uvDx;
+  glm::vec2 uvDy;
+  if (this->shading.isDiffuseTextureActive || this->shading.isBumpMapActive)
+  {
+    glm::vec2 uv = b.x * v[0].uv + b.y * v[1].uv + b.z * v[2].uv;
+    // Analytic screen derivatives of uv = sum(l * invW * uv) / sum(l * invW)
+    glm::vec3 qDx = glm::vec3(t.edge[0].x, t.edge[1].x, t.edge[2].x) * t.invW;
+    glm::vec3 qDy = glm::vec3(t.edge[0].y, t.edge[1].y, t.edge[2].y) * t.invW;
+    uvDx = (qDx.x * v[0].uv + qDx.y * v[1].uv + qDx.z * v[2].uv - uv * (qDx.x + qDx.y + qDx.z)) / q;
+    uvDy = (qDy.x * v[0].uv + qDy.y * v[1].uv + qDy.z * v[2].uv - uv * (qDy.x + qDy.y + qDy.z)) / q;
+  }
+  return shadeSoftwareFragment(this->shading, this->diffuseTexture, this->bumpMap, v, b, uvDx, uvDy, t.material, color);
+}
+
+bool shadeSoftwareFragment(const SoftwareShading& shading,
+                           const SoftwareTexture& diffuseTexture,
+                           const SoftwareTexture& bumpMap,
+                           const SoftwareVaryings* v,
+                           const glm::vec3& b,
+                           glm::vec2 uvDx,
+                           glm::vec2 uvDy,
+                           const glm::vec4& material,
+                           glm::vec3& color)
+{
+  glm::vec3 triangleCoordinate = b.x * v[0].triangleCoordinate + b.y * v[1].triangleCoordinate + b.z * v[2].triangleCoordinate;
+  if ((shading.isWireframeOverwrite || shading.isEdgesVisible) &&
+      (triangleCoordinate.x < 0.01f || triangleCoordinate.y < 0.01f || triangleCoordinate.z < 0.01f))
+  {
+    color = glm::vec3(1.0f, 1.0f, 1.0f);
+    return true;
+  }
+  if (shading.isWireframeOverwrite)
+  {
+    return false;
+  }
+
+  glm::vec3 positionVSpace = b.x * v[0].positionVSpace + b.y * v[1].positionVSpace + b.z * v[2].positionVSpace;
+  glm::vec3 normalVSpace = b.x * v[0].normalVSpace + b.y * v[1].normalVSpace + b.z * v[2].normalVSpace;
+
+  glm::vec3 materialAmbient = glm::vec3(material);
+  glm::vec3 materialDiffuse = glm::vec3(material);
+  glm::vec3 materialSpecular = glm::vec3(1.0f, 1.0f, 1.0f);
+
+  glm::vec2 uv;
+  if (shading.isDiffuseTextureActive || shading.isBumpMapActive)
+  {
+    uv = b.x * v[0].uv + b.y * v[1].uv + b.z * v[2].uv;
+  }
+
+  if (shading.isDiffuseTextureActive)
+  {
+    glm::vec4 texel = diffuseTexture.sample(uv, uvDx, uvDy);
+    materialAmbient = glm::vec3(texel.b, texel.g, texel.r);
+    materialDiffuse = materialAmbient;
+  }
+
+  glm::vec3 N = glm::normalize(normalVSpace);
+  glm::vec3 realN = N;
+  glm::vec3 L = glm::normalize(-positionVSpace);
+
+  if (shading.isBumpMapActive)
+  {
+    glm::vec4 texel = bumpMap.sample(uv, uvDx, uvDy);
+    glm::vec3 bump = glm::vec3(texel.b, texel.g, texel.r) * 2.0f - 1.0f;
+    glm::vec3 tangentVSpace = b.x * v[0].tangentVSpace + b.y * v[1].tangentVSpace + b.z * v[2].tangentVSpace;
+    glm::vec3 bitangentVSpace = b.x * v[0].bitangentVSpace + b.y * v[1].bitangentVSpace + b.z * v[2].bitangentVSpace;
+    N = bump.r * tangentVSpace + bump.g * bitangentVSpace + bump.b * normalVSpace;
+  }
+
+  float realIncidence = glm::dot(L, realN);
+  float incidence = glm::dot(L, N);
+  if (realIncidence < 0.0f)
+  {
+    return false;
+  }
+
+  float occlusion = b.x * v[0].occlusion + b.y * v[1].occlusion + b.z * v[2].occlusion;
+  glm::vec3 ambient = glm::vec3(0.1f, 0.1f, 0.1f) * materialAmbient * occlusion;
+  glm::vec3 diffuse = incidence * materialDiffuse;
+
+  // The light is at the eye, so V and the half vector are L
+  glm::vec3 H = L;
+  float specularFactor = std::pow(std::max(glm::dot(N, H), 0.0f), material.a);
+  glm::vec3 specular = specularFactor * materialSpecular;
+
+  color = ambient + diffuse + specular;
+  return true;
+}
+
+int SoftwareRenderer::getWidth()
+{
+  return this->width;
+}
+
+int SoftwareRenderer::getHeight()
+{
+  return this->height;
+}
+
+int SoftwareRenderer::getNumThreads()
+{
+  return this->threadPool->getNumThreads();
+}
+
+const std::vector<unsigned char>& SoftwareRenderer::getColorBuffer()
+{
+  return this->colorBuffer;
+}
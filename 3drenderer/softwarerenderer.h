@@ -0,0 +1,191 @@
+#ifndef SOFTWARERENDERER_H
+#define SOFTWARERENDERER_H
+
+#include "glm/glm.hpp"
+#include <vector>
+
+#include "scene.h"
+#include "threadpool.h"
+#include "vertexpacker.h"
+
+// Shader features, as in the MaterialBlock uniform block
+struct SoftwareShading
+{
+  bool isWireframeOverwrite;
+  bool isEdgesVisible;
+  bool isDiffuseTextureActive;
+  bool isBumpMapActive;
+};
+
+// RGBA8 texture with its mipmap chain, sampled like a GL_REPEAT,
+// GL_LINEAR_MIPMAP_LINEAR texture. An empty texture samples as black, like
+// an incomplete one.
+class SoftwareTexture
+{
+private:
+  // Four bytes per texel
+  std::vector<std::vector<unsigned char> > levels;
+  std::vector<glm::ivec2> sizes;
+
+  glm::vec4 sampleLevel(int level, glm::vec2 uv) const;
+
+public:
+  SoftwareTexture();
+
+  // Texels in the byte order given to glTexImage2D as GL_RGBA
+  void setImage(const unsigned char* texels, int width, int height);
+  bool isEmpty() const;
+
+  // The level of detail comes from the UV derivatives along x and y
+  glm::vec4 sample(glm::vec2 uv, glm::vec2 uvDx, glm::vec2 uvDy) const;
+};
+
+// Fragment shader inputs, interpolated across the triangle
+struct SoftwareVaryings
+{
+  glm::vec3 positionVSpace;
+  glm::vec3 normalVSpace;
+  glm::vec3 tangentVSpace;
+  glm::vec3 bitangentVSpace;
+  glm::vec3 triangleCoordinate;
+  glm::vec2 uv;
+  // Baked ambient visibility, scales the ambient term
+  float occlusion;
+};
+
+struct SoftwareClipVertex
+{
+  glm::vec4 clip;
+  SoftwareVaryings varyings;
+};
+
+// The fragment shader, for the perspective correct barycentrics b of a
+// triangle with the varyings v. The UV derivatives along x and y are only
+// read by the texture lookups. False when the fragment is discarded.
+bool shadeSoftwareFragment(const SoftwareShading& shading,
+                           const SoftwareTexture& diffuseTexture,
+                           const SoftwareTexture& bumpMap,
+                           const SoftwareVaryings* v,
+                           const glm::vec3& b,
+                           glm::vec2 uvDx,
+                           glm::vec2 uvDy,
+                           const glm::vec4& material,
+                           glm::vec3& color);
+
+// Triangle after clipping and projection, in pixels
+struct RasterTriangle
+{
+  // Screen space barycentrics: l[i] = dot(edge[i], (x, y, 1))
+  glm::vec3 edge[3];
+  // Pixels exactly on an edge are only covered by top and left edges
+  bool isTopLeft[3];
+  // Window depth and 1 / w of the vertices
+  glm::vec3 z;
+  glm::vec3 invW;
+  SoftwareVaryings varyings[3];
+  glm::vec4 material;
+  int minX;
+  int minY;
+  int maxX;
+  int maxY;
+};
+
+// CPU rendering backend reproducing the vertex, geometry and fragment
+// shaders. Triangles are set up and binned into tiles in parallel, then
+// every tile is rasterized and shaded by a single job, in submission order.
+class SoftwareRenderer
+{
+private:
+  struct Draw
+  {
+    unsigned int firstVertex;
+    unsigned int numVertices;
+    unsigned int firstIndex;
+    unsigned int numIndices;
+    InstanceData instance;
+    // In the transformed vertices
+    unsigned int firstTransformed;
+  };
+
+  // A range of triangles of one draw, set up by a single job into its own
+  // triangle list and tile bins
+  struct SetupJob
+  {
+    unsigned int draw;
+    unsigned int firstTriangle;
+    unsigned int numTriangles;
+    std::vector<RasterTriangle> triangles;
+    std::vector<std::vector<unsigned int> > bins;
+  };
+
+  ThreadPool* threadPool;
+  bool isOwnThreadPool;
+
+  std::vector<InterleavedVertex> vertices;
+  std::vector<unsigned int> indices;
+  // One per vertex, empty when nothing is baked
+  std::vector<float> occlusion;
+  SoftwareTexture diffuseTexture;
+  SoftwareTexture bumpMap;
+
+  int width;
+  int height;
+  int depthStride;
+  int tilesX;
+  int tilesY;
+  glm::mat4 view;
+  glm::mat4 viewProjection;
+  SoftwareShading shading;
+
+  std::vector<Draw> draws;
+  std::vector<SoftwareClipVertex> transformed;
+  std::vector<SetupJob> setupJobs;
+
+  std::vector<unsigned char> colorBuffer;
+  // Rows padded to a multiple of four pixels
+  std::vector<float> depthBuffer;
+
+  void transformVertices(const Draw& draw, unsigned int first, unsigned int count);
+  void setupTriangles(SetupJob& job);
+  // Clips, projects and bins the triangle of the three corners
+  void addTriangle(const SoftwareClipVertex* corners, const glm::vec4& material, SetupJob& job);
+  void rasterizeTile(int tile);
+  void rasterizeTriangle(const RasterTriangle& t, int x0, int y0, int x1, int y1);
+  // False when the fragment is discarded
+  bool shadeFragment(const RasterTriangle& t, float l0, float l1, float l2, glm::vec3& color);
+
+public:
+  static const int TILE_SIZE = 64;
+  // Triangles set up by a single job
+  static const unsigned int SETUP_BATCH_TRIANGLES = 1024;
+
+  // Without a thread pool, one is created
+  SoftwareRenderer(ThreadPool* threadPool = nullptr);
+  ~SoftwareRenderer();
+
+  // The vertex and index data uploaded by RenderWidget::loadBuffers, with
+  // 32-bit indices into the whole vertex array, and the ambient occlusion
+  // attribute if any
+  void setGeometry(const std::vector<InterleavedVertex>& vertices,
+                   const std::vector<unsigned int>& indices,
+                   const std::vector<float>& occlusion = std::vector<float>());
+  void setDiffuseTexture(const unsigned char* texels, int width, int height);
+  void setBumpMap(const unsigned char* texels, int width, int height);
+
+  // Clears the frame and records the draws, rendered by endFrame
+  void beginFrame(int width, int height, const glm::mat4& view, const glm::mat4& projection, const SoftwareShading& shading);
+  void draw(unsigned int firstVertex,
+            unsigned int numVertices,
+            unsigned int firstIndex,
+            unsigned int numIndices,
+            const InstanceData& instance);
+  void endFrame();
+
+  int getWidth();
+  int getHeight();
+  int getNumThreads();
+  // RGBA8 bytes, the top row first
+  const std::vector<unsigned char>& getColorBuffer();
+};
+
+#endif // SOFTWARERENDERER_H
@@ -0,0 +1,244 @@
+#include "textureatlas.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+const int TextureAtlas::DEFAULT_GUTTER;
+
+static inline int wrap(int a, int size)
+{
+  a %= size;
+  return a < 0 ? a + size : a;
+}
+
+static inline int roundUp(int a, int multiple)
+{
+  return multiple > 1 ? (a + multiple - 1) / multiple * multiple : a;
+}
+
+// Texture and gutters, rounded up so the next cell starts on a multiple of
+// the gutter
+static inline glm::ivec2 getCellSize(const glm::ivec2& size, int gutter)
+{
+  return glm::ivec2(roundUp(size.x + 2 * gutter, gutter), roundUp(size.y + 2 * gutter, gutter));
+}
+
+SkylinePacker::SkylinePacker(int width, int height)
+{
+  this->width = width;
+  this->height = height;
+  Segment floor = { 0, 0, width };
+  this->skyline.push_back(floor);
+}
+
+int SkylinePacker::getFitY(unsigned int segment, int width, int height)
+{
+  int x = this->skyline[segment].x;
+  if (x + width > this->width)
+  {
+    return -1;
+  }
+  // Resting on the highest segment under it
+  int y = 0;
+  int remaining = width;
+  for (unsigned int i = segment; remaining > 0 && i < this->skyline.size(); i++)
+  {
+    y = std::max(y, this->skyline[i].y);
+    remaining -= this->skyline[i].width;
+  }
+  return y + height <= this->height ? y : -1;
+}
+
+bool SkylinePacker::insert(int width, int height, int& x, int& y)
+{
+  int best = -1;
+  int bestTop = 0;
+  for (unsigned int i = 0; i < this->skyline.size(); i++)
+  {
+    int fitY = this->getFitY(i, width, height);
+    if (fitY >= 0 && (best < 0 || fitY + height < bestTop))
+    {
+      best = (int) i;
+      bestTop = fitY + height;
+    }
+  }
+  if (best < 0)
+  {
+    return false;
+  }
+  x = this->skyline[best].x;
+  y = bestTop - height;
+
+  // The new top replaces the segments it covers, the last one partly
+  Segment top = { x, bestTop, width };
+  this->skyline.insert(this->skyline.begin() + best, top);
+  for (unsigned int i = best + 1; i < this->skyline.size();)
+  {
+    Segment& segment = this->skyline[i];
+    int right = x + width;
+    if (segment.x >= right)
+    {
+      break;
+    }
+    if (segment.x + segment.width <= right)
+    {
+      this->skyline.erase(this->skyline.begin() + i);
+      continue;
+    }
+    segment.width -= right - segment.x;
+    segment.x = right;
+    break;
+  }
+  // Neighbours at the same height become one
+  for (unsigned int i = 0; i + 1 < this->skyline.size();)
+  {
+    if (this->skyline[i].y == this->skyline[i + 1].y)
+    {
+      this->skyline[i].width += this->skyline[i + 1].width;
+      this->skyline.erase(this->skyline.begin() + i + 1);
+      continue;
+    }
+    i++;
+  }
+  return true;
+}
+
+bool TextureAtlas::pack(const std::vector<glm::ivec2>& sizes,
+                        int maxSize,
+                        int gutter,
+                        std::vector<AtlasRect>& rects,
+                        int& width,
+                        int& height)
+{
+  rects.resize(sizes.size());
+  if (sizes.empty())
+  {
+    width = 0;
+    height = 0;
+    return true;
+  }
+
+  // Tallest first, the skyline then stays flat
+  std::vector<unsigned int> order(sizes.size());
+  double area = 0.0;
+  glm::ivec2 largest(0);
+  for (unsigned int i = 0; i < sizes.size(); i++)
+  {
+    order[i] = i;
+    glm::ivec2 cell = getCellSize(sizes[i], gutter);
+    area += (double) cell.x * cell.y;
+    largest = glm::max(largest, cell);
+  }
+  std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b)
+  {
+    return sizes[a].y != sizes[b].y ? sizes[a].y > sizes[b].y : sizes[a].x > sizes[b].x;
+  });
+
+  // Square or twice as wide, from the largest square not above the area
+  // of the cells, growing until everything fits
+  int side = 1;
+  while ((double) side * side * 4.0 <= area || side < largest.x || side < largest.y)
+  {
+    side *= 2;
+  }
+  width = side;
+  height = side;
+  while (width <= maxSize && height <= maxSize)
+  {
+    SkylinePacker packer(width, height);
+    bool isPacked = true;
+    for (unsigned int i = 0; i < order.size() && isPacked; i++)
+    {
+      const glm::ivec2& size = sizes[order[i]];
+      glm::ivec2 cell = getCellSize(size, gutter);
+      AtlasRect& rect = rects[order[i]];
+      isPacked = packer.insert(cell.x, cell.y, rect.x, rect.y);
+      rect.x += gutter;
+      rect.y += gutter;
+      rect.width = size.x;
+      rect.height = size.y;
+    }
+    if (isPacked)
+    {
+      return true;
+    }
+    if (width == height)
+    {
+      width *= 2;
+    }
+    else
+    {
+      height *= 2;
+    }
+  }
+  return false;
+}
+
+void TextureAtlas::compose(const std::vector<const unsigned char*>& textures,
+                           const std::vector<AtlasRect>& rects,
+                           int width,
+                           int height,
+                           int gutter,
+                           std::vector<unsigned char>& atlas)
+{
+  atlas.assign((size_t) width * height * 4, 0);
+  for (unsigned int t = 0; t < textures.size(); t++)
+  {
+    const AtlasRect& rect = rects[t];
+    const unsigned char* texels = textures[t];
+    for (int y = -gutter; y < rect.height + gutter; y++)
+    {
+      // In runs of consecutive texels, the gutters wrap around
+      const unsigned char* sourceRow = texels + (size_t) wrap(y, rect.height) * rect.width * 4;
+      unsigned char* row = &atlas[((size_t) (rect.y + y) * width + rect.x) * 4];
+      for (int x = -gutter; x < rect.width + gutter;)
+      {
+        int sourceX = wrap(x, rect.width);
+        int count = std::min(rect.width + gutter - x, rect.width - sourceX);
+        memcpy(row + (ptrdiff_t) x * 4, sourceRow + (size_t) sourceX * 4, (size_t) count * 4);
+        x += count;
+      }
+    }
+  }
+}
+
+int TextureAtlas::getNumSafeLevels(int gutter)
+{
+  // Level k halves the gutter k times, it must stay a whole texel wide
+  int levels = 1;
+  while (gutter > 1 && gutter % 2 == 0)
+  {
+    gutter /= 2;
+    levels++;
+  }
+  return levels;
+}
+
+glm::vec4 TextureAtlas::getUVTransform(const AtlasRect& rect, int width, int height)
+{
+  return glm::vec4((float) rect.width / width,
+                   (float) rect.height / height,
+                   (float) rect.x / width,
+                   (float) rect.y / height);
+}
+
+void TextureAtlas::remapUVs(std::vector<glm::vec2>& UVs, unsigned int first, unsigned int count, const glm::vec4& transform)
+{
+  if (count == 0)
+  {
+    return;
+  }
+  glm::vec2 minUV = UVs[first];
+  for (unsigned int i = first; i < first + count; i++)
+  {
+    minUV = glm::min(minUV, UVs[i]);
+  }
+  // Tolerance for UVs a rounding error below a whole number
+  glm::vec2 tile = glm::floor(minUV + glm::vec2(1e-4f));
+  for (unsigned int i = first; i < first + count; i++)
+  {
+    glm::vec2 uv = glm::clamp(UVs[i] - tile, glm::vec2(0.0f), glm::vec2(1.0f));
+    UVs[i] = glm::vec2(transform.z, transform.w) + uv * glm::vec2(transform.x, transform.y);
+  }
+}
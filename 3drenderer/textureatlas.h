@@ -0,0 +1,87 @@
+#ifndef TEXTUREATLAS_H
+#define TEXTUREATLAS_H
+
+#include "glm/glm.hpp"
+#include <vector>
+
+// Where a texture lies in its atlas, without its gutter, in texels
+struct AtlasRect
+{
+  int x;
+  int y;
+  int width;
+  int height;
+};
+
+// Skyline bottom-left packing of rectangles into a fixed area: the top
+// edge of the packed ones is kept as a list of horizontal segments, and a
+// new rectangle goes where its top would be the lowest.
+class SkylinePacker
+{
+private:
+  struct Segment
+  {
+    int x;
+    int y;
+    int width;
+  };
+
+  int width;
+  int height;
+  std::vector<Segment> skyline;
+
+  // Top of a rectangle starting at the segment, -1 when it does not fit
+  int getFitY(unsigned int segment, int width, int height);
+
+public:
+  SkylinePacker(int width, int height);
+
+  // False when there is no room left for it
+  bool insert(int width, int height, int& x, int& y);
+};
+
+// Many small textures packed into a single one, so the meshes using them
+// are drawn with one binding. Each texture gets a gutter of its own texels
+// wrapping around its edges, the repeating texture filtered across its
+// edge. Cells start on multiples of the gutter, so the first mip levels
+// never mix two textures (see getNumSafeLevels). Texels are RGBA8 bytes,
+// whatever their channel order.
+class TextureAtlas
+{
+public:
+  static const int DEFAULT_GUTTER = 8;
+
+  // The rects of textures of the given sizes in the smallest power of two
+  // atlas up to maxSize on a side. Larger textures are packed first. False
+  // when they do not fit.
+  static bool pack(const std::vector<glm::ivec2>& sizes,
+                   int maxSize,
+                   int gutter,
+                   std::vector<AtlasRect>& rects,
+                   int& width,
+                   int& height);
+
+  // Copies the textures and their gutters into the atlas, transparent
+  // black between the cells
+  static void compose(const std::vector<const unsigned char*>& textures,
+                      const std::vector<AtlasRect>& rects,
+                      int width,
+                      int height,
+                      int gutter,
+                      std::vector<unsigned char>& atlas);
+
+  // Mip levels, the full size one included, where every texel of a cell
+  // still comes from its own texture
+  static int getNumSafeLevels(int gutter);
+
+  // UV of the atlas = offset + UV of the texture * scale: xy scale, zw
+  // offset
+  static glm::vec4 getUVTransform(const AtlasRect& rect, int width, int height);
+
+  // UVs [first, first + count) into the rect of their texture. They are
+  // shifted by whole tiles down to [0, 1] first, a mesh sampling more than
+  // one tile of a repeating texture is clamped to a single one.
+  static void remapUVs(std::vector<glm::vec2>& UVs, unsigned int first, unsigned int count, const glm::vec4& transform);
+};
+
+#endif // TEXTUREATLAS_H
@@ -0,0 +1,492 @@
+#include "textureloader.h"
+#include "textureatlas.h"
+#include "tracer.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QMetaObject>
+#include <QCryptographicHash>
+#include <QStandardPaths>
+#include <QSaveFile>
+#include <QDir>
+
+#include <algorithm>
+#include <cstring>
+
+// Header of the mip chain files, followed by the full size level and the
+// ones below it, each of its halved size, uncompressed or in blocks. The
+// filter and the compression asked for are in the file name.
+struct TextureCacheHeader
+{
+  char magic[4];
+  int width;
+  int height;
+  int numLevels;
+  // Block format, -1 when uncompressed
+  int format;
+};
+
+// The alpha bytes of Format_ARGB32 texels all 255
+static bool isOpaque(const QImage& image)
+{
+  const unsigned char* texels = image.constBits();
+  size_t numTexels = (size_t) image.width() * image.height();
+  for(size_t i = 0; i < numTexels; i++)
+  {
+    if(texels[4 * i + 3] != 255)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+class TextureLoadThread : public QThread
+{
+private:
+  TextureLoader* loader;
+public:
+  TextureLoadThread(TextureLoader* loader)
+  {
+    this->loader = loader;
+  }
+
+  void run()
+  {
+    this->loader->runJobs();
+  }
+};
+
+TextureLoader::TextureLoader(QWidget* widget, int numThreads)
+{
+  this->widget = widget;
+  this->filter = MipChain::BOX_FILTER;
+  this->compression = BC1_BC3_COMPRESSION;
+  this->quality = BlockCompressor::NORMAL_QUALITY;
+  this->heightMapStrength = 4.0f;
+  this->nextRequest = 1;
+  this->compressor = new BlockCompressor();
+  this->heightMapConverter = new HeightMapConverter();
+  this->isStopping = false;
+
+  this->cacheDirectory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/textures";
+  QDir().mkpath(this->cacheDirectory);
+
+  if(numThreads <= 0)
+  {
+    numThreads = std::min(std::max(QThread::idealThreadCount(), 1), 4);
+  }
+  for(int i = 0; i < numThreads; i++)
+  {
+    this->threads.push_back(new TextureLoadThread(this));
+    this->threads.back()->start();
+  }
+}
+
+TextureLoader::~TextureLoader()
+{
+  this->mutex.lock();
+  this->isStopping = true;
+  this->jobAvailable.wakeAll();
+  this->mutex.unlock();
+  for(unsigned int i = 0; i < this->threads.size(); i++)
+  {
+    this->threads[i]->wait();
+    delete this->threads[i];
+  }
+  delete this->compressor;
+  delete this->heightMapConverter;
+}
+
+void TextureLoader::setMipFilter(MipChain::Filter filter)
+{
+  this->filter = filter;
+}
+
+void TextureLoader::setCompression(Compression compression, BlockCompressor::Quality quality)
+{
+  this->compression = compression;
+  this->quality = quality;
+}
+
+void TextureLoader::setHeightMapStrength(float strength)
+{
+  this->heightMapStrength = strength;
+}
+
+unsigned int TextureLoader::load(const QString& path, bool isNormalMap)
+{
+  Job job;
+  job.path = path;
+  job.isNormalMap = isNormalMap;
+  return this->queue(job);
+}
+
+unsigned int TextureLoader::load(const QImage& image, bool isNormalMap)
+{
+  Job job;
+  job.image = image;
+  job.isNormalMap = isNormalMap;
+  return this->queue(job);
+}
+
+unsigned int TextureLoader::loadAtlas(const QStringList& paths)
+{
+  Job job;
+  job.atlasPaths = paths;
+  job.isNormalMap = false;
+  return this->queue(job);
+}
+
+unsigned int TextureLoader::queue(Job& job)
+{
+  job.request = this->nextRequest++;
+  job.filter = this->filter;
+  job.compression = this->compression;
+  job.quality = this->quality;
+  job.heightMapStrength = this->heightMapStrength;
+
+  this->mutex.lock();
+  this->jobs.push_back(job);
+  this->jobAvailable.wakeOne();
+  this->mutex.unlock();
+  return job.request;
+}
+
+std::vector<LoadedTexture> TextureLoader::takeFinished()
+{
+  std::vector<LoadedTexture> textures;
+  this->mutex.lock();
+  textures.swap(this->finishedTextures);
+  this->mutex.unlock();
+  return textures;
+}
+
+void TextureLoader::runJobs()
+{
+  for(;;)
+  {
+    this->mutex.lock();
+    while(this->jobs.empty() && !this->isStopping)
+    {
+      this->jobAvailable.wait(&(this->mutex));
+    }
+    if(this->isStopping)
+    {
+      this->mutex.unlock();
+      break;
+    }
+    Job job = this->jobs.front();
+    this->jobs.pop_front();
+    this->mutex.unlock();
+
+    LoadedTexture texture;
+    this->loadTexture(job, texture);
+
+    this->mutex.lock();
+    this->finishedTextures.push_back(texture);
+    this->mutex.unlock();
+
+    QMetaObject::invokeMethod(this->widget, "requestFrame", Qt::QueuedConnection);
+  }
+}
+
+void TextureLoader::loadTexture(const Job& job, LoadedTexture& texture)
+{
+  TRACE_SCOPE("TextureLoader::loadTexture");
+  texture.request = job.request;
+  texture.path = job.path;
+  texture.isCompressed = false;
+  texture.format = BlockCompressor::BC1;
+
+  QImage image = job.image;
+  if(!job.atlasPaths.isEmpty())
+  {
+    image = TextureLoader::composeAtlas(job.atlasPaths, texture.atlasUVTransforms);
+  }
+  QString cachePath;
+  if(!job.path.isEmpty())
+  {
+    QFile file(job.path);
+    if(!file.open(QIODevice::ReadOnly))
+    {
+      qDebug() << "TextureLoader: could not read" << job.path;
+      return;
+    }
+    QByteArray data = file.readAll();
+    file.close();
+
+    cachePath = this->getCachePath(data, job);
+    if(TextureLoader::readCache(cachePath, texture))
+    {
+      return;
+    }
+    image = QImage::fromData(data);
+  }
+  if(image.isNull())
+  {
+    qDebug() << "TextureLoader: could not decode" << job.path;
+    return;
+  }
+
+  // Converted once, here: paletted and grayscale files are otherwise
+  // uploaded as if they were 32-bit
+  if(image.format() != QImage::Format_ARGB32)
+  {
+    image = image.convertToFormat(QImage::Format_ARGB32);
+  }
+  // The shader reads normals, grayscale bump textures are heights
+  if(job.isNormalMap && HeightMapConverter::isHeightMap(image.constBits(), image.width(), image.height()))
+  {
+    std::vector<unsigned char> normals;
+    this->heightMapConverter->convert(image.constBits(),
+                                      image.width(),
+                                      image.height(),
+                                      job.heightMapStrength,
+                                      HeightMapConverter::SCHARR_KERNEL,
+                                      normals);
+    QImage normalMap(image.width(), image.height(), QImage::Format_ARGB32);
+    for(int y = 0; y < image.height(); y++)
+    {
+      memcpy(normalMap.scanLine(y), &normals[(size_t) y * image.width() * 4], (size_t) image.width() * 4);
+    }
+    image = normalMap;
+  }
+  MipChain::build(image.constBits(), image.width(), image.height(), job.filter, texture.levels);
+  texture.image = image;
+  if(job.compression != NO_COMPRESSION)
+  {
+    this->compressTexture(job, texture);
+  }
+
+  if(!cachePath.isEmpty())
+  {
+    TextureLoader::writeCache(cachePath, texture);
+  }
+}
+
+void TextureLoader::compressTexture(const Job& job, LoadedTexture& texture)
+{
+  if(job.isNormalMap)
+  {
+    texture.format = BlockCompressor::BC5;
+  }
+  else if(job.compression == BC7_COMPRESSION)
+  {
+    texture.format = BlockCompressor::BC7;
+  }
+  else
+  {
+    texture.format = isOpaque(texture.image) ? BlockCompressor::BC1 : BlockCompressor::BC3;
+  }
+
+  texture.compressedLevels.resize(texture.levels.size() + 1);
+  this->compressor->compress(texture.image.constBits(),
+                             texture.image.width(),
+                             texture.image.height(),
+                             texture.format,
+                             job.quality,
+                             texture.compressedLevels[0]);
+  for(unsigned int i = 0; i < texture.levels.size(); i++)
+  {
+    const MipLevel& level = texture.levels[i];
+    this->compressor->compress(level.texels.data(), level.width, level.height, texture.format, job.quality, texture.compressedLevels[i + 1]);
+  }
+  texture.levels.clear();
+  texture.isCompressed = true;
+}
+
+QImage TextureLoader::composeAtlas(const QStringList& paths, std::vector<glm::vec4>& UVTransforms)
+{
+  TRACE_SCOPE("TextureLoader::composeAtlas");
+  UVTransforms.assign(paths.size(), glm::vec4(0.0f));
+  std::vector<QImage> images;
+  std::vector<int> imagePaths;
+  for(int i = 0; i < paths.size(); i++)
+  {
+    QImage image = QImage(paths[i]).convertToFormat(QImage::Format_ARGB32);
+    if(image.isNull())
+    {
+      qDebug() << "TextureLoader: could not decode" << paths[i];
+      continue;
+    }
+    images.push_back(image);
+    imagePaths.push_back(i);
+  }
+  if(images.empty())
+  {
+    return QImage();
+  }
+
+  std::vector<glm::ivec2> sizes(images.size());
+  std::vector<AtlasRect> rects;
+  int width = 0;
+  int height = 0;
+  while(true)
+  {
+    for(unsigned int i = 0; i < images.size(); i++)
+    {
+      sizes[i] = glm::ivec2(images[i].width(), images[i].height());
+    }
+    if(TextureAtlas::pack(sizes, MAX_ATLAS_SIZE, TextureAtlas::DEFAULT_GUTTER, rects, width, height))
+    {
+      break;
+    }
+    bool isHalved = false;
+    for(unsigned int i = 0; i < images.size(); i++)
+    {
+      if(sizes[i].x > 1 || sizes[i].y > 1)
+      {
+        images[i] = images[i].scaled(std::max(1, sizes[i].x / 2),
+                                     std::max(1, sizes[i].y / 2),
+                                     Qt::IgnoreAspectRatio,
+                                     Qt::SmoothTransformation).convertToFormat(QImage::Format_ARGB32);
+        isHalved = true;
+      }
+    }
+    if(!isHalved)
+    {
+      return QImage();
+    }
+  }
+
+  std::vector<const unsigned char*> textures(images.size());
+  for(unsigned int i = 0; i < images.size(); i++)
+  {
+    textures[i] = images[i].constBits();
+  }
+  std::vector<unsigned char> texels;
+  TextureAtlas::compose(textures, rects, width, height, TextureAtlas::DEFAULT_GUTTER, texels);
+  QImage atlas(width, height, QImage::Format_ARGB32);
+  memcpy(atlas.bits(), texels.data(), texels.size());
+
+  for(unsigned int i = 0; i < rects.size(); i++)
+  {
+    UVTransforms[imagePaths[i]] = TextureAtlas::getUVTransform(rects[i], width, height);
+  }
+  return atlas;
+}
+
+QString TextureLoader::getCachePath(const QByteArray& fileData, const Job& job)
+{
+  static const char* const QUALITY_NAMES[] = { "fast", "normal", "slow" };
+  QString compression = "rgba";
+  if(job.compression != NO_COMPRESSION && job.isNormalMap)
+  {
+    compression = "bc5";
+  }
+  else if(job.compression == BC1_BC3_COMPRESSION)
+  {
+    compression = "bc1-bc3";
+  }
+  else if(job.compression == BC7_COMPRESSION)
+  {
+    compression = QString("bc7-") + QUALITY_NAMES[job.quality];
+  }
+
+  // Normal maps depend on the strength, in case they are height maps
+  if(job.isNormalMap)
+  {
+    compression += QString(".height-") + QString::number(job.heightMapStrength);
+  }
+
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  hash.addData(fileData);
+  return this->cacheDirectory + "/" + QString::fromLatin1(hash.result().toHex()) +
+         (job.filter == MipChain::KAISER_FILTER ? ".kaiser." : ".box.") + compression + ".mip";
+}
+
+bool TextureLoader::readCache(const QString& path, LoadedTexture& texture)
+{
+  QFile file(path);
+  if(!file.open(QIODevice::ReadOnly))
+  {
+    return false;
+  }
+
+  TextureCacheHeader header;
+  if( file.read((char*) &header, sizeof(header)) != (qint64) sizeof(header) ||
+      memcmp(header.magic, "TMC3", 4) != 0 ||
+      header.width <= 0 ||
+      header.height <= 0 ||
+      header.numLevels != MipChain::getNumLevels(header.width, header.height) ||
+      header.format < -1 ||
+      header.format > BlockCompressor::BC7)
+  {
+    file.close();
+    QFile::remove(path);
+    return false;
+  }
+
+  // 32-bit rows are never padded, the levels are read in place
+  QImage image(header.width, header.height, QImage::Format_ARGB32);
+  qint64 size = (qint64) header.width * header.height * 4;
+  bool isComplete = file.read((char*) image.bits(), size) == size;
+  bool isCompressed = header.format >= 0;
+  BlockCompressor::Format format = isCompressed ? (BlockCompressor::Format) header.format : BlockCompressor::BC1;
+  std::vector<MipLevel> levels(isCompressed ? 0 : header.numLevels - 1);
+  std::vector<CompressedLevel> compressedLevels(isCompressed ? header.numLevels : 0);
+  int width = header.width;
+  int height = header.height;
+  for(unsigned int i = 0; i < levels.size() && isComplete; i++)
+  {
+    width = std::max(width / 2, 1);
+    height = std::max(height / 2, 1);
+    levels[i].width = width;
+    levels[i].height = height;
+    levels[i].texels.resize((size_t) width * height * 4);
+    size = (qint64) levels[i].texels.size();
+    isComplete = file.read((char*) levels[i].texels.data(), size) == size;
+  }
+  width = header.width;
+  height = header.height;
+  for(unsigned int i = 0; i < compressedLevels.size() && isComplete; i++)
+  {
+    compressedLevels[i].width = width;
+    compressedLevels[i].height = height;
+    compressedLevels[i].blocks.resize(BlockCompressor::getCompressedSize(format, width, height));
+    size = (qint64) compressedLevels[i].blocks.size();
+    isComplete = file.read((char*) compressedLevels[i].blocks.data(), size) == size;
+    width = std::max(width / 2, 1);
+    height = std::max(height / 2, 1);
+  }
+  file.close();
+  if(!isComplete)
+  {
+    QFile::remove(path);
+    return false;
+  }
+
+  texture.image = image;
+  texture.levels.swap(levels);
+  texture.isCompressed = isCompressed;
+  texture.format = format;
+  texture.compressedLevels.swap(compressedLevels);
+  return true;
+}
+
+void TextureLoader::writeCache(const QString& path, const LoadedTexture& texture)
+{
+  TextureCacheHeader header;
+  memcpy(header.magic, "TMC3", 4);
+  header.width = texture.image.width();
+  header.height = texture.image.height();
+  header.numLevels = texture.isCompressed ? (int) texture.compressedLevels.size() : (int) texture.levels.size() + 1;
+  header.format = texture.isCompressed ? (int) texture.format : -1;
+
+  QSaveFile file(path);
+  if(file.open(QIODevice::WriteOnly))
+  {
+    file.write((const char*) &header, sizeof(header));
+    file.write((const char*) texture.image.constBits(), (qint64) header.width * header.height * 4);
+    for(unsigned int i = 0; i < texture.levels.size(); i++)
+    {
+      file.write((const char*) texture.levels[i].texels.data(), (qint64) texture.levels[i].texels.size());
+    }
+    for(unsigned int i = 0; i < texture.compressedLevels.size(); i++)
+    {
+      file.write((const char*) texture.compressedLevels[i].blocks.data(), (qint64) texture.compressedLevels[i].blocks.size());
+    }
+    file.commit();
+  }
+}
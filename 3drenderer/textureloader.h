@@ -0,0 +1,137 @@
+#ifndef TEXTURELOADER_H
+#define TEXTURELOADER_H
+
+#include <QImage>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThread>
+#include <QWidget>
+
+#include <deque>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "blockcompressor.h"
+#include "heightmapconverter.h"
+#include "mipchain.h"
+
+class TextureLoadThread;
+
+// A texture ready for upload: the full size level as a 32-bit QImage
+// (Format_ARGB32, the byte order the shaders and the CPU renderers
+// swizzle), and the levels below it. Compressed, the GPU gets every level
+// in blocks instead, the image stays for the CPU renderers.
+struct LoadedTexture
+{
+  unsigned int request;
+  QString path;
+  QImage image;
+  std::vector<MipLevel> levels;
+  bool isCompressed;
+  BlockCompressor::Format format;
+  std::vector<CompressedLevel> compressedLevels;
+  // Of an atlas, the UV transform of each of its paths (see
+  // TextureAtlas::getUVTransform), zero for the ones that could not be read
+  std::vector<glm::vec4> atlasUVTransforms;
+};
+
+// Textures decoded, converted, mipmapped and block compressed on a pool of
+// worker threads, so importing one never blocks the GUI thread. Files are
+// keyed by their content: the first load of a file writes its whole mip
+// chain to the disk cache, and the next ones read it back instead of
+// decoding and compressing it again. Finished
+// textures are collected by the GUI thread, which is woken through the
+// widget's requestFrame() slot, and uploaded by it.
+class TextureLoader
+{
+  friend class TextureLoadThread;
+public:
+  enum Compression
+  {
+    NO_COMPRESSION,
+    // BC1 for opaque textures, BC3 with alpha
+    BC1_BC3_COMPRESSION,
+    BC7_COMPRESSION
+  };
+
+private:
+  struct Job
+  {
+    unsigned int request;
+    QString path;
+    QImage image;
+    QStringList atlasPaths;
+    MipChain::Filter filter;
+    Compression compression;
+    BlockCompressor::Quality quality;
+    bool isNormalMap;
+    float heightMapStrength;
+  };
+
+  QWidget* widget;
+  MipChain::Filter filter;
+  Compression compression;
+  BlockCompressor::Quality quality;
+  float heightMapStrength;
+  unsigned int nextRequest;
+  // Shared by the load threads, one texture is compressed at a time on all
+  // the cores
+  BlockCompressor* compressor;
+  HeightMapConverter* heightMapConverter;
+
+  // Shared with the load threads
+  QMutex mutex;
+  QWaitCondition jobAvailable;
+  std::deque<Job> jobs;
+  std::vector<LoadedTexture> finishedTextures;
+  bool isStopping;
+
+  QString cacheDirectory;
+  std::vector<TextureLoadThread*> threads;
+
+  void runJobs();
+  void loadTexture(const Job& job, LoadedTexture& texture);
+  void compressTexture(const Job& job, LoadedTexture& texture);
+  QString getCachePath(const QByteArray& fileData, const Job& job);
+  unsigned int queue(Job& job);
+
+  // Textures halved until they all fit, null when none can be read
+  static QImage composeAtlas(const QStringList& paths, std::vector<glm::vec4>& UVTransforms);
+public:
+  // Largest side of an atlas, supported by every GL 4 driver
+  static const int MAX_ATLAS_SIZE = 8192;
+
+  // Without a number of threads, one per hardware thread up to 4
+  TextureLoader(QWidget* widget, int numThreads = 0);
+  ~TextureLoader();
+
+  // Filter of the mip chains of the next requests
+  void setMipFilter(MipChain::Filter filter);
+  // Compression of the color textures of the next requests, normal maps are
+  // BC5 whenever it is on. The quality is the one of BC7.
+  void setCompression(Compression compression, BlockCompressor::Quality quality = BlockCompressor::NORMAL_QUALITY);
+  // Normal maps loaded from grayscale files are height maps, converted with
+  // this strength (see HeightMapConverter)
+  void setHeightMapStrength(float strength);
+
+  // Queued loads, returning the request id the finished texture carries
+  unsigned int load(const QString& path, bool isNormalMap = false);
+  // An image already in memory (not cached)
+  unsigned int load(const QImage& image, bool isNormalMap = false);
+  // Color textures decoded and packed into one atlas by the load threads
+  // (see TextureAtlas), then mipmapped and compressed like an image. The
+  // files that cannot be read are left out.
+  unsigned int loadAtlas(const QStringList& paths);
+
+  // Textures finished since the last call, from the GUI thread
+  std::vector<LoadedTexture> takeFinished();
+
+  // The mip chain container of the disk cache
+  static bool readCache(const QString& path, LoadedTexture& texture);
+  static void writeCache(const QString& path, const LoadedTexture& texture);
+};
+
+#endif // TEXTURELOADER_H
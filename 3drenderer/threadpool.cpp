@@ -0,0 +1,108 @@
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(int numThreads)
+{
+  this->job = nullptr;
+  this->jobCount = 0;
+  this->nextIndex = 0;
+  this->activeWorkers = 0;
+  this->jobGeneration = 0;
+  this->isStopping = false;
+
+  if (numThreads <= 0)
+  {
+    numThreads = (int) std::thread::hardware_concurrency();
+  }
+  // The calling thread is one of them
+  for (int i = 1; i < numThreads; i++)
+  {
+    this->workers.push_back(std::thread(&ThreadPool::runWorker, this));
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->isStopping = true;
+  }
+  this->jobAvailable.notify_all();
+  for (unsigned int i = 0; i < this->workers.size(); i++)
+  {
+    this->workers[i].join();
+  }
+}
+
+int ThreadPool::getNumThreads()
+{
+  return (int) this->workers.size() + 1;
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)>& job)
+{
+  if (count <= 0)
+  {
+    return;
+  }
+  if (this->workers.empty() || count == 1)
+  {
+    for (int i = 0; i < count; i++)
+    {
+      job(i);
+    }
+    return;
+  }
+
+  std::lock_guard<std::mutex> loopLock(this->loopMutex);
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->job = &job;
+    this->jobCount = count;
+    this->nextIndex = 0;
+    this->activeWorkers = (int) this->workers.size();
+    this->jobGeneration++;
+  }
+  this->jobAvailable.notify_all();
+
+  this->runJobs();
+
+  std::unique_lock<std::mutex> lock(this->mutex);
+  this->jobFinished.wait(lock, [this] { return this->activeWorkers == 0; });
+  this->job = nullptr;
+}
+
+void ThreadPool::runWorker()
+{
+  unsigned int seenGeneration = 0;
+  for (;;)
+  {
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      this->jobAvailable.wait(lock, [this, seenGeneration]
+      {
+        return this->isStopping || this->jobGeneration != seenGeneration;
+      });
+      if (this->isStopping)
+      {
+        return;
+      }
+      seenGeneration = this->jobGeneration;
+    }
+
+    this->runJobs();
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (--this->activeWorkers == 0)
+    {
+      this->jobFinished.notify_all();
+    }
+  }
+}
+
+void ThreadPool::runJobs()
+{
+  for (int i = this->nextIndex.fetch_add(1); i < this->jobCount; i = this->nextIndex.fetch_add(1))
+  {
+    (*this->job)(i);
+  }
+}
@@ -0,0 +1,45 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+// Fixed set of worker threads running parallel loops. The calling thread
+// takes part in the loop, and one loop runs at a time (parallelFor must not
+// be called from inside a job).
+class ThreadPool
+{
+private:
+  std::vector<std::thread> workers;
+
+  std::mutex loopMutex;
+  std::mutex mutex;
+  std::condition_variable jobAvailable;
+  std::condition_variable jobFinished;
+  const std::function<void(int)>* job;
+  int jobCount;
+  std::atomic<int> nextIndex;
+  int activeWorkers;
+  unsigned int jobGeneration;
+  bool isStopping;
+
+  void runWorker();
+  void runJobs();
+
+public:
+  // 0 threads: one per hardware thread
+  ThreadPool(int numThreads = 0);
+  ~ThreadPool();
+
+  // Workers plus the calling thread
+  int getNumThreads();
+
+  // Runs job(i) for every i in [0, count) and waits for all of them
+  void parallelFor(int count, const std::function<void(int)>& job);
+};
+
+#endif // THREADPOOL_H
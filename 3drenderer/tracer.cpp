@@ -0,0 +1,155 @@
+#include "tracer.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+const int Tracer::BUFFER_SIZE;
+
+struct TraceEvent
+{
+  const char* name;
+  uint64_t start;
+  uint64_t end;
+};
+
+// Relaxed atomics, the dump may copy a slot while its thread overwrites it
+struct TraceSlot
+{
+  std::atomic<const char*> name;
+  std::atomic<uint64_t> start;
+  std::atomic<uint64_t> end;
+};
+
+// Written by its thread only. The count of recorded events is published
+// after each one, the dump reads it before and after its copy to drop the
+// events overwritten meanwhile.
+struct ThreadBuffer
+{
+  int thread;
+  std::unique_ptr<TraceSlot[]> events;
+  std::atomic<uint64_t> count;
+};
+
+// Buffers outlive their thread, its last scopes stay in the dump
+struct Registry
+{
+  std::mutex mutex;
+  std::vector<std::unique_ptr<ThreadBuffer> > buffers;
+};
+
+static Registry& getRegistry()
+{
+  static Registry registry;
+  return registry;
+}
+
+static const std::chrono::steady_clock::time_point& getEpoch()
+{
+  static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+  return epoch;
+}
+
+static thread_local ThreadBuffer* threadBuffer = nullptr;
+
+static ThreadBuffer* getThreadBuffer()
+{
+  if (!threadBuffer)
+  {
+    std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer());
+    buffer->events.reset(new TraceSlot[Tracer::BUFFER_SIZE]);
+    buffer->count.store(0);
+    Registry& registry = getRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    buffer->thread = (int) registry.buffers.size() + 1;
+    threadBuffer = buffer.get();
+    registry.buffers.push_back(std::move(buffer));
+  }
+  return threadBuffer;
+}
+
+static void writeEscaped(FILE* file, const char* text)
+{
+  for (; *text; text++)
+  {
+    if (*text == '"' || *text == '\\')
+    {
+      fputc('\\', file);
+    }
+    fputc(*text, file);
+  }
+}
+
+uint64_t Tracer::now()
+{
+  return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - getEpoch()).count();
+}
+
+void Tracer::record(const char* name, uint64_t start, uint64_t end)
+{
+  ThreadBuffer* buffer = getThreadBuffer();
+  uint64_t count = buffer->count.load(std::memory_order_relaxed);
+  TraceSlot& slot = buffer->events[count % BUFFER_SIZE];
+  // Pairs with the fence of the dump: if it copies any of these stores,
+  // its second count load sees at least this count
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.name.store(name, std::memory_order_relaxed);
+  slot.start.store(start, std::memory_order_relaxed);
+  slot.end.store(end, std::memory_order_relaxed);
+  buffer->count.store(count + 1, std::memory_order_release);
+}
+
+bool Tracer::writeChromeTrace(const std::string& path)
+{
+  FILE* file = fopen(path.c_str(), "w");
+  if (!file)
+  {
+    return false;
+  }
+
+  Registry& registry = getRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"3drenderer\"}}");
+  std::vector<TraceEvent> events;
+  for (const std::unique_ptr<ThreadBuffer>& buffer : registry.buffers)
+  {
+    uint64_t last = buffer->count.load(std::memory_order_acquire);
+    uint64_t first = last > (uint64_t) BUFFER_SIZE ? last - BUFFER_SIZE : 0;
+    events.clear();
+    for (uint64_t i = first; i < last; i++)
+    {
+      const TraceSlot& slot = buffer->events[i % BUFFER_SIZE];
+      TraceEvent event;
+      event.name = slot.name.load(std::memory_order_relaxed);
+      event.start = slot.start.load(std::memory_order_relaxed);
+      event.end = slot.end.load(std::memory_order_relaxed);
+      events.push_back(event);
+    }
+    // The thread may be writing over the oldest of them meanwhile. The fence
+    // keeps the copy above from moving past the count load.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t written = buffer->count.load(std::memory_order_relaxed);
+    uint64_t skipped = written + 1 > first + BUFFER_SIZE ? written + 1 - first - BUFFER_SIZE : 0;
+
+    fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+            buffer->thread,
+            buffer->thread);
+    for (uint64_t i = skipped; i < events.size(); i++)
+    {
+      const TraceEvent& event = events[i];
+      // Microseconds, to the nanosecond
+      fprintf(file, ",\n{\"name\":\"");
+      writeEscaped(file, event.name);
+      fprintf(file, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+              buffer->thread,
+              event.start / 1000.0,
+              (event.end - event.start) / 1000.0);
+    }
+  }
+  fprintf(file, "\n]}\n");
+  return fclose(file) == 0;
+}
@@ -0,0 +1,58 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <string>
+#include <cstdint>
+
+// Timed scopes of the import and render phases, for when one of them
+// stalls. Each thread records into a ring buffer of its own, without
+// locking, and keeps its last BUFFER_SIZE scopes; the dump writes them all
+// as a Chrome trace (chrome://tracing, ui.perfetto.dev). Without
+// ENABLE_TRACING (3drenderer.pro), TRACE_SCOPE compiles to nothing.
+class Tracer
+{
+public:
+  static const int BUFFER_SIZE = 16384;
+
+  // Nanoseconds since the first call, on a steady clock
+  static uint64_t now();
+
+  // A finished scope of the calling thread. The name is kept as a pointer,
+  // it must be a string literal.
+  static void record(const char* name, uint64_t start, uint64_t end);
+
+  // Every thread's buffer as Chrome trace event JSON. Scopes recorded while
+  // it runs may be missing. False when the file cannot be written.
+  static bool writeChromeTrace(const std::string& path);
+};
+
+class TraceScope
+{
+private:
+  const char* name;
+  uint64_t start;
+
+public:
+  TraceScope(const char* name)
+  {
+    this->name = name;
+    this->start = Tracer::now();
+  }
+
+  ~TraceScope()
+  {
+    Tracer::record(this->name, this->start, Tracer::now());
+  }
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+// Times the rest of the enclosing scope
+#ifdef ENABLE_TRACING
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name) do {} while (0)
+#endif
+
+#endif // TRACER_H
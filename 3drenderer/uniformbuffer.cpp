@@ -0,0 +1,47 @@
+#include "uniformbuffer.h"
+
+#include <cstring>
+
+UniformBuffer::UniformBuffer(QOpenGLExtraFunctions* gl, unsigned int binding, size_t size)
+{
+  this->gl = gl;
+  this->binding = binding;
+  this->shadow.resize(size);
+  this->isDirty = false;
+  this->uploadCount = 0;
+
+  this->gl->glGenBuffers(1, &(this->buffer));
+  this->gl->glBindBuffer(GL_UNIFORM_BUFFER, this->buffer);
+  this->gl->glBufferData(GL_UNIFORM_BUFFER, size, this->shadow.data(), GL_DYNAMIC_DRAW);
+}
+
+UniformBuffer::~UniformBuffer()
+{
+  this->gl->glDeleteBuffers(1, &(this->buffer));
+}
+
+void UniformBuffer::set(const void* data)
+{
+  if(memcmp(this->shadow.data(), data, this->shadow.size()) != 0)
+  {
+    memcpy(this->shadow.data(), data, this->shadow.size());
+    this->isDirty = true;
+  }
+}
+
+void UniformBuffer::bind()
+{
+  if(this->isDirty)
+  {
+    this->gl->glBindBuffer(GL_UNIFORM_BUFFER, this->buffer);
+    this->gl->glBufferSubData(GL_UNIFORM_BUFFER, 0, this->shadow.size(), this->shadow.data());
+    this->isDirty = false;
+    this->uploadCount++;
+  }
+  this->gl->glBindBufferBase(GL_UNIFORM_BUFFER, this->binding, this->buffer);
+}
+
+unsigned int UniformBuffer::getUploadCount()
+{
+  return this->uploadCount;
+}
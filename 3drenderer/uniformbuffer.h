@@ -0,0 +1,31 @@
+#ifndef UNIFORMBUFFER_H
+#define UNIFORMBUFFER_H
+
+#include <QOpenGLExtraFunctions>
+
+#include <vector>
+
+// Uniform buffer bound to a fixed block binding point. The last content is
+// shadowed on the CPU and the buffer is only re-uploaded when it changes.
+class UniformBuffer
+{
+private:
+  QOpenGLExtraFunctions* gl;
+  unsigned int buffer;
+  unsigned int binding;
+  std::vector<unsigned char> shadow;
+  bool isDirty;
+  unsigned int uploadCount;
+public:
+  UniformBuffer(QOpenGLExtraFunctions* gl, unsigned int binding, size_t size);
+  ~UniformBuffer();
+
+  // data must follow the std140 layout of the block
+  void set(const void* data);
+  // Uploads if dirty and binds the buffer to its binding point
+  void bind();
+
+  unsigned int getUploadCount();
+};
+
+#endif // UNIFORMBUFFER_H
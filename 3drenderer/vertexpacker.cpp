@@ -0,0 +1,369 @@
+#include "vertexpacker.h"
+
+#include "glm/gtc/packing.hpp"
+#include "glm/gtc/quaternion.hpp"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define VERTEXPACKER_SSE2
+#endif
+#if defined(__F16C__)
+  #include <immintrin.h>
+#endif
+
+VertexPacker::VertexPacker()
+{
+
+}
+
+// Clamps with the comparisons of _mm_max_ps and _mm_min_ps (NaN gives the
+// bound) and rounds to nearest even as _mm_cvtps_epi32
+static inline float quantizeSnorm16(float x)
+{
+  x = x > -1.0f ? x : -1.0f;
+  x = x < 1.0f ? x : 1.0f;
+  return std::nearbyint(x * 32767.0f);
+}
+
+glm::i16vec2 VertexPacker::encodeOctahedral(glm::vec3 n)
+{
+  // Follows the SSE2 path of packNormals step by step, so both give the
+  // same bits for degenerate normals and -0 components too
+  const float tiny = 1e-20f;
+  float l1 = glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+  bool isValid = l1 > tiny;
+  float invL1 = 1.0f / (l1 > tiny ? l1 : tiny);
+  float x = isValid ? n.x * invL1 : 0.0f;
+  float y = isValid ? n.y * invL1 : 0.0f;
+  float z = n.z * invL1;
+
+  // Lower hemisphere is folded over the diagonals, the sign comes from the
+  // sign bit so -0 folds like a negative component
+  if (z < 0.0f)
+  {
+    float foldX = (1.0f - glm::abs(y)) * std::copysign(1.0f, x);
+    float foldY = (1.0f - glm::abs(x)) * std::copysign(1.0f, y);
+    x = foldX;
+    y = foldY;
+  }
+  return glm::i16vec2((short) quantizeSnorm16(x), (short) quantizeSnorm16(y));
+}
+
+glm::i16vec4 VertexPacker::encodeTangentFrame(glm::vec3 n, glm::vec3 t, glm::vec3 b)
+{
+  // Orthonormal frame around the normal (Gram-Schmidt)
+  n = glm::dot(n, n) > 1e-20f ? glm::normalize(n) : glm::vec3(0.0f, 0.0f, 1.0f);
+  t = t - n * glm::dot(n, t);
+  if (!(glm::dot(t, t) > 1e-20f))
+  {
+    // Degenerated UVs: any tangent perpendicular to the normal will do
+    t = glm::abs(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    t = t - n * glm::dot(n, t);
+  }
+  t = glm::normalize(t);
+  glm::vec3 orthoB = glm::cross(n, t);
+  float handedness = glm::dot(orthoB, b) < 0.0f ? -1.0f : 1.0f;
+
+  glm::quat q = glm::quat_cast(glm::mat3(t, orthoB, n));
+  q = glm::normalize(q);
+  if (q.w < 0.0f)
+  {
+    q = -q;
+  }
+
+  // w must never quantize to zero, otherwise the handedness sign is lost
+  const float bias = 1.0f / 32767.0f;
+  if (q.w < bias)
+  {
+    float s = glm::sqrt(1.0f - bias * bias);
+    q = glm::quat(bias, q.x * s, q.y * s, q.z * s);
+  }
+  if (handedness < 0.0f)
+  {
+    q = -q;
+  }
+
+  glm::vec4 v = glm::round(glm::clamp(glm::vec4(q.x, q.y, q.z, q.w), -1.0f, 1.0f) * 32767.0f);
+  return glm::i16vec4((short) v.x, (short) v.y, (short) v.z, (short) v.w);
+}
+
+glm::u16vec2 VertexPacker::encodeHalf(glm::vec2 uv)
+{
+  return glm::u16vec2(glm::packHalf1x16(uv.x), glm::packHalf1x16(uv.y));
+}
+
+#ifdef VERTEXPACKER_SSE2
+// Four float to half conversions at once, round to nearest even.
+// Returns the halves sign extended in 32 bits lanes, ready for _mm_packs_epi32.
+static inline __m128i floatToHalf4(__m128 f)
+{
+#if defined(__F16C__)
+  __m128i h = _mm_cvtps_ph(f, 0);
+  return _mm_srai_epi32(_mm_unpacklo_epi16(h, h), 16);
+#else
+  const __m128i signMask = _mm_set1_epi32(0x80000000);
+  const __m128i f16Max = _mm_set1_epi32((127 + 16) << 23);
+  const __m128i nanBit = _mm_set1_epi32(0x200);
+  const __m128i infinity = _mm_set1_epi32(0x7c00);
+  const __m128i minNormal = _mm_set1_epi32((127 - 14) << 23);
+  const __m128i subnormalMagic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+  const __m128i normalBias = _mm_set1_epi32(0xfff - ((127 - 15) << 23));
+
+  __m128 sign = _mm_and_ps(f, _mm_castsi128_ps(signMask));
+  __m128 absF = _mm_xor_ps(f, sign);
+  __m128i absI = _mm_castps_si128(absF);
+
+  __m128i isNaN = _mm_castps_si128(_mm_cmpunord_ps(absF, absF));
+  __m128i isRegular = _mm_cmpgt_epi32(f16Max, absI);
+  __m128i infOrNaN = _mm_or_si128(_mm_and_si128(isNaN, nanBit), infinity);
+  __m128i isSubnormal = _mm_cmpgt_epi32(minNormal, absI);
+
+  // Subnormal results: let the FPU do the rounding
+  __m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absF, _mm_castsi128_ps(subnormalMagic))),
+                                    subnormalMagic);
+
+  // Normal results: rebias the exponent and round the mantissa
+  __m128i mantissaOdd = _mm_srai_epi32(_mm_slli_epi32(absI, 31 - 13), 31);
+  __m128i normal = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(absI, normalBias), mantissaOdd), 13);
+
+  __m128i finite = _mm_or_si128(_mm_and_si128(isSubnormal, subnormal), _mm_andnot_si128(isSubnormal, normal));
+  __m128i h = _mm_or_si128(_mm_and_si128(isRegular, finite), _mm_andnot_si128(isRegular, infOrNaN));
+  h = _mm_or_si128(h, _mm_srli_epi32(_mm_castps_si128(sign), 16));
+  return _mm_srai_epi32(_mm_slli_epi32(h, 16), 16);
+#endif
+}
+
+static inline __m128 abs4(__m128 v)
+{
+  return _mm_andnot_ps(_mm_set1_ps(-0.0f), v);
+}
+
+// +1.0 or -1.0 following the sign bit of v
+static inline __m128 signNotZero4(__m128 v)
+{
+  return _mm_or_ps(_mm_and_ps(v, _mm_set1_ps(-0.0f)), _mm_set1_ps(1.0f));
+}
+
+static inline __m128 select4(__m128 mask, __m128 a, __m128 b)
+{
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+#endif
+
+void VertexPacker::packNormals( const std::vector<glm::vec3>& normals,
+                                void* output,
+                                size_t stride)
+{
+  unsigned char* out = (unsigned char*) output;
+  size_t i = 0;
+
+#ifdef VERTEXPACKER_SSE2
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 scale = _mm_set1_ps(32767.0f);
+  const __m128 tiny = _mm_set1_ps(1e-20f);
+  for (; i + 4 <= normals.size(); i += 4)
+  {
+    const glm::vec3* n = &normals[i];
+    __m128 x = _mm_setr_ps(n[0].x, n[1].x, n[2].x, n[3].x);
+    __m128 y = _mm_setr_ps(n[0].y, n[1].y, n[2].y, n[3].y);
+    __m128 z = _mm_setr_ps(n[0].z, n[1].z, n[2].z, n[3].z);
+
+    __m128 l1 = _mm_add_ps(_mm_add_ps(abs4(x), abs4(y)), abs4(z));
+    __m128 valid = _mm_cmpgt_ps(l1, tiny);
+    __m128 invL1 = _mm_div_ps(one, _mm_max_ps(l1, tiny));
+    x = _mm_and_ps(valid, _mm_mul_ps(x, invL1));
+    y = _mm_and_ps(valid, _mm_mul_ps(y, invL1));
+    z = _mm_mul_ps(z, invL1);
+
+    // Lower hemisphere is folded over the diagonals
+    __m128 lower = _mm_cmplt_ps(z, _mm_setzero_ps());
+    __m128 foldX = _mm_mul_ps(_mm_sub_ps(one, abs4(y)), signNotZero4(x));
+    __m128 foldY = _mm_mul_ps(_mm_sub_ps(one, abs4(x)), signNotZero4(y));
+    x = select4(lower, foldX, x);
+    y = select4(lower, foldY, y);
+
+    __m128i xi = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(x, _mm_sub_ps(_mm_setzero_ps(), one)), one), scale));
+    __m128i yi = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(y, _mm_sub_ps(_mm_setzero_ps(), one)), one), scale));
+
+    // x0 y0 x1 y1 x2 y2 x3 y3
+    __m128i packed = _mm_packs_epi32(_mm_unpacklo_epi32(xi, yi), _mm_unpackhi_epi32(xi, yi));
+    if (stride == 4)
+    {
+      _mm_storeu_si128((__m128i*) (out + i * 4), packed);
+    }
+    else
+    {
+      alignas(16) int lanes[4];
+      _mm_store_si128((__m128i*) lanes, packed);
+      for (int k = 0; k < 4; k++)
+      {
+        memcpy(out + (i + k) * stride, &lanes[k], 4);
+      }
+    }
+  }
+#endif
+
+  for (; i < normals.size(); i++)
+  {
+    glm::i16vec2 e = encodeOctahedral(normals[i]);
+    memcpy(out + i * stride, &e, sizeof(e));
+  }
+}
+
+void VertexPacker::packTangentFrames( const std::vector<glm::vec3>& normals,
+                                      const std::vector<glm::vec3>& tangents,
+                                      const std::vector<glm::vec3>& bitangents,
+                                      void* output,
+                                      size_t stride)
+{
+  // The matrix to quaternion conversion is branchy, the scalar path is kept here
+  unsigned char* out = (unsigned char*) output;
+  for (size_t i = 0; i < normals.size(); i++)
+  {
+    glm::i16vec4 q = encodeTangentFrame(normals[i], tangents[i], bitangents[i]);
+    memcpy(out + i * stride, &q, sizeof(q));
+  }
+}
+
+void VertexPacker::packUVs( const std::vector<glm::vec2>& UVs,
+                            void* output,
+                            size_t stride)
+{
+  unsigned char* out = (unsigned char*) output;
+  size_t i = 0;
+
+#ifdef VERTEXPACKER_SSE2
+  const float* uv = (const float*) UVs.data();
+  for (; i + 4 <= UVs.size(); i += 4)
+  {
+    // u0 v0 u1 v1 | u2 v2 u3 v3
+    __m128i lo = floatToHalf4(_mm_loadu_ps(uv + 2 * i));
+    __m128i hi = floatToHalf4(_mm_loadu_ps(uv + 2 * i + 4));
+    __m128i packed = _mm_packs_epi32(lo, hi);
+    if (stride == 4)
+    {
+      _mm_storeu_si128((__m128i*) (out + i * 4), packed);
+    }
+    else
+    {
+      alignas(16) int lanes[4];
+      _mm_store_si128((__m128i*) lanes, packed);
+      for (int k = 0; k < 4; k++)
+      {
+        memcpy(out + (i + k) * stride, &lanes[k], 4);
+      }
+    }
+  }
+#endif
+
+  for (; i < UVs.size(); i++)
+  {
+    glm::u16vec2 h = encodeHalf(UVs[i]);
+    memcpy(out + i * stride, &h, sizeof(h));
+  }
+}
+
+void VertexPacker::pack(  const std::vector<glm::vec3>& positions,
+                          const std::vector<glm::vec3>& normals,
+                          const std::vector<glm::vec3>& tangents,
+                          const std::vector<glm::vec3>& bitangents,
+                          const std::vector<glm::vec2>& UVs,
+                          std::vector<PackedVertex>& output)
+{
+  output.resize(positions.size());
+  if (output.empty())
+  {
+    return;
+  }
+  for (size_t i = 0; i < positions.size(); i++)
+  {
+    output[i].pos = positions[i];
+  }
+  this->packNormals(normals, &output[0].normal, sizeof(PackedVertex));
+  this->packTangentFrames(normals, tangents, bitangents, &output[0].qtangent, sizeof(PackedVertex));
+  this->packUVs(UVs, &output[0].uv, sizeof(PackedVertex));
+}
+
+void VertexPacker::buildStream( Stream stream,
+                                bool isPacked,
+                                const std::vector<glm::vec3>& positions,
+                                const std::vector<glm::vec3>& normals,
+                                const std::vector<glm::vec3>& tangents,
+                                const std::vector<glm::vec3>& bitangents,
+                                const std::vector<glm::vec2>& UVs,
+                                std::vector<unsigned char>& output)
+{
+  size_t numVertices = positions.size();
+  switch (stream)
+  {
+    case POSITION_STREAM:
+      output.resize(numVertices * sizeof(glm::vec3));
+      memcpy(output.data(), positions.data(), output.size());
+      break;
+    case NORMAL_STREAM:
+      if (isPacked)
+      {
+        output.resize(numVertices * sizeof(glm::i16vec2));
+        this->packNormals(normals, output.data(), sizeof(glm::i16vec2));
+      }
+      else
+      {
+        output.resize(numVertices * sizeof(glm::vec3));
+        memcpy(output.data(), normals.data(), output.size());
+      }
+      break;
+    case TANGENT_STREAM:
+      if (isPacked)
+      {
+        output.resize(numVertices * sizeof(glm::i16vec4));
+        this->packTangentFrames(normals, tangents, bitangents, output.data(), sizeof(glm::i16vec4));
+      }
+      else
+      {
+        output.resize(numVertices * 2 * sizeof(glm::vec3));
+        glm::vec3* frames = (glm::vec3*) output.data();
+        for (size_t i = 0; i < numVertices; i++)
+        {
+          frames[2 * i + 0] = tangents[i];
+          frames[2 * i + 1] = bitangents[i];
+        }
+      }
+      break;
+    case UV_STREAM:
+      if (isPacked)
+      {
+        output.resize(numVertices * sizeof(glm::u16vec2));
+        this->packUVs(UVs, output.data(), sizeof(glm::u16vec2));
+      }
+      else
+      {
+        output.resize(numVertices * sizeof(glm::vec2));
+        memcpy(output.data(), UVs.data(), output.size());
+      }
+      break;
+    default:
+      output.clear();
+      break;
+  }
+}
+
+void VertexPacker::interleave(const std::vector<glm::vec3>& positions,
+                              const std::vector<glm::vec3>& normals,
+                              const std::vector<glm::vec3>& tangents,
+                              const std::vector<glm::vec3>& bitangents,
+                              const std::vector<glm::vec2>& UVs,
+                              std::vector<InterleavedVertex>& output)
+{
+  output.resize(positions.size());
+  for (size_t i = 0; i < positions.size(); i++)
+  {
+    output[i].pos = positions[i];
+    output[i].normal = normals[i];
+    output[i].tangent = tangents[i];
+    output[i].bitangent = bitangents[i];
+    output[i].uv = UVs[i];
+  }
+}
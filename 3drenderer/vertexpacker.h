@@ -0,0 +1,96 @@
+#ifndef VERTEXPACKER_H
+#define VERTEXPACKER_H
+
+#include "glm/glm.hpp"
+#include "glm/gtc/type_precision.hpp"
+#include <vector>
+#include <cstddef>
+
+// Data structure stored in the VBO with the full float layout
+struct InterleavedVertex
+{
+  glm::vec3 pos;
+  glm::vec3 normal;
+  glm::vec3 tangent;
+  glm::vec3 bitangent;
+  glm::vec2 uv;
+};
+
+// Data structure stored in the VBO when the packed vertex format is active
+// (28 bytes against the 56 bytes of the full float layout)
+struct PackedVertex
+{
+  glm::vec3 pos;
+  // octahedral encoded normal, snorm16
+  glm::i16vec2 normal;
+  // tangent frame quaternion, snorm16, sign of w holds the bitangent handedness
+  glm::i16vec4 qtangent;
+  // half floats
+  glm::u16vec2 uv;
+};
+
+class VertexPacker
+{
+public:
+  // Attributes of the separate streams layout, one buffer each
+  enum Stream
+  {
+    POSITION_STREAM,
+    NORMAL_STREAM,
+    // tangent and bitangent, or their packed frame
+    TANGENT_STREAM,
+    UV_STREAM,
+    NUM_STREAMS
+  };
+
+  VertexPacker();
+
+  // All the encoders write to a strided output, so they can fill either an
+  // interleaved PackedVertex array or a tightly packed attribute array.
+  void packNormals( const std::vector<glm::vec3>& normals,
+                    void* output,
+                    size_t stride);
+
+  void packTangentFrames( const std::vector<glm::vec3>& normals,
+                          const std::vector<glm::vec3>& tangents,
+                          const std::vector<glm::vec3>& bitangents,
+                          void* output,
+                          size_t stride);
+
+  void packUVs( const std::vector<glm::vec2>& UVs,
+                void* output,
+                size_t stride);
+
+  void pack(  const std::vector<glm::vec3>& positions,
+              const std::vector<glm::vec3>& normals,
+              const std::vector<glm::vec3>& tangents,
+              const std::vector<glm::vec3>& bitangents,
+              const std::vector<glm::vec2>& UVs,
+              std::vector<PackedVertex>& output);
+
+  // Tightly packed content of one stream, in the packed or the full float
+  // format
+  void buildStream( Stream stream,
+                    bool isPacked,
+                    const std::vector<glm::vec3>& positions,
+                    const std::vector<glm::vec3>& normals,
+                    const std::vector<glm::vec3>& tangents,
+                    const std::vector<glm::vec3>& bitangents,
+                    const std::vector<glm::vec2>& UVs,
+                    std::vector<unsigned char>& output);
+
+  // Full float layout, for the unpacked VBO and the software renderer
+  static void interleave( const std::vector<glm::vec3>& positions,
+                          const std::vector<glm::vec3>& normals,
+                          const std::vector<glm::vec3>& tangents,
+                          const std::vector<glm::vec3>& bitangents,
+                          const std::vector<glm::vec2>& UVs,
+                          std::vector<InterleavedVertex>& output);
+
+  // Scalar reference versions, also used for the tails of the SIMD loops
+  static glm::i16vec2 encodeOctahedral(glm::vec3 n);
+  static glm::i16vec4 encodeTangentFrame(glm::vec3 n, glm::vec3 t, glm::vec3 b);
+  static glm::u16vec2 encodeHalf(glm::vec2 uv);
+};
+
+#endif // VERTEXPACKER_H
@@ -5,26 +5,109 @@ layout( location = 1 ) in vec3 vertexNormalMSpace;
 layout( location = 2 ) in vec3 vertexTangentMSpace;
 layout( location = 3 ) in vec3 vertexBitangentMSpace;
 layout( location = 4 ) in vec2 vertexTextureCoord;
+layout( location = 5 ) in vec2 vertexNormalOctahedral;
+layout( location = 6 ) in vec4 vertexTangentFrame;
+// Baked ambient visibility, a constant 1 when the array is disabled
+layout( location = 7 ) in float vertexAmbientOcclusion;
 
-uniform mat4 mvp;
-uniform mat4 mv;
-uniform mat4 mv_ti;
+layout( std140, binding = 0 ) uniform FrameBlock
+{
+  mat4 view;
+  mat4 viewProjection;
+};
+
+layout( std140, binding = 1 ) uniform MaterialBlock
+{
+  bool isWireframeOverwrite;
+  bool isEdgesVisible;
+  bool isFlatFaces;
+  bool isDiffuseTextureActive;
+  bool isBumpMapActive;
+  bool isPackedVertexFormat;
+  bool isBumpMapTwoChannel;
+  bool isDiffuseTextureVirtual;
+};
+
+struct Instance
+{
+  mat4 model;
+  mat4 normalModel;
+  vec4 material;
+};
+
+layout( std430, binding = 0 ) readonly buffer InstanceBlock
+{
+  Instance instances[];
+};
+
+// Instances left by the frustum culling, grouped by mesh
+layout( std430, binding = 1 ) readonly buffer VisibleInstanceBlock
+{
+  uint visibleInstances[];
+};
+
+// First instance of the draw, for draws without a base instance
+layout( location = 0 ) uniform int instanceOffset;
+// Diffuse color and shininess of the OBJ material of the draw, used
+// instead of the instance ones when the shininess is positive
+layout( location = 1 ) uniform vec4 materialOverride;
+
+// Defined as a constant by the shader variants
+#ifndef PACKED_VERTEX_FORMAT
+  #define PACKED_VERTEX_FORMAT isPackedVertexFormat
+#endif
 
 out vec3 vertexPositionVSpace;
 out vec3 vertexNormalVSpace;
 out vec3 vertexTangentVSpace;
 out vec3 vertexBitangentVSpace;
 out vec2 vertexTextureVSpace;
+out float vertexOcclusion;
+flat out vec4 vertexMaterial;
+
+vec3 decodeOctahedral(vec2 e)
+{
+  vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+  if(n.z < 0.0)
+  {
+    n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+  }
+  return normalize(n);
+}
+
+vec3 quaternionRotate(vec4 q, vec3 v)
+{
+  return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
 
 void main()
 {
-  gl_Position = mvp * vec4(vertexPositionMSpace, 1.0);
+  vec3 normalMSpace = vertexNormalMSpace;
+  vec3 tangentMSpace = vertexTangentMSpace;
+  vec3 bitangentMSpace = vertexBitangentMSpace;
+
+  if(PACKED_VERTEX_FORMAT)
+  {
+    vec4 q = normalize(vertexTangentFrame);
+    normalMSpace = decodeOctahedral(vertexNormalOctahedral);
+    tangentMSpace = quaternionRotate(q, vec3(1.0, 0.0, 0.0));
+    bitangentMSpace = quaternionRotate(q, vec3(0.0, 1.0, 0.0)) * (q.w < 0.0 ? -1.0 : 1.0);
+  }
+
+  Instance instance = instances[visibleInstances[instanceOffset + gl_BaseInstance + gl_InstanceID]];
+  vec4 positionWSpace = instance.model * vec4(vertexPositionMSpace, 1.0);
+
+  gl_Position = viewProjection * positionWSpace;
 
-  vertexPositionVSpace = ( mv * vec4(vertexPositionMSpace, 1.0) ).xyz;
+  vertexPositionVSpace = ( view * positionWSpace ).xyz;
 
-  vertexNormalVSpace = ( mv_ti * vec4(vertexNormalMSpace, 0.0) ).xyz;
-  vertexTangentVSpace = ( mv_ti * vec4(vertexTangentMSpace, 0.0) ).xyz;
-  vertexBitangentVSpace = ( mv_ti * vec4(vertexBitangentMSpace, 0.0) ).xyz;
+  // The view matrix is rigid, it transforms normals as is
+  mat4 normalMatrix = view * instance.normalModel;
+  vertexNormalVSpace = ( normalMatrix * vec4(normalMSpace, 0.0) ).xyz;
+  vertexTangentVSpace = ( normalMatrix * vec4(tangentMSpace, 0.0) ).xyz;
+  vertexBitangentVSpace = ( normalMatrix * vec4(bitangentMSpace, 0.0) ).xyz;
 
   vertexTextureVSpace = vertexTextureCoord;
+  vertexOcclusion = vertexAmbientOcclusion;
+  vertexMaterial = materialOverride.a > 0.0 ? materialOverride : instance.material;
 }
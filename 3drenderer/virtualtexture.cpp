@@ -0,0 +1,428 @@
+#include "virtualtexture.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+const unsigned int VirtualTexture::NO_PAGE;
+const int VirtualTexture::MAX_LOADS_PER_UPDATE;
+
+// Slot of the coarsest page, never evicted
+static const int PINNED_SLOT = 0;
+
+unsigned int VirtualTexture::packPage(int level, int x, int y)
+{
+  return ((unsigned int) level << 24) | ((unsigned int) y << 12) | (unsigned int) x;
+}
+
+void VirtualTexture::unpackPage(unsigned int page, int& level, int& x, int& y)
+{
+  level = (int) (page >> 24);
+  y = (int) ((page >> 12) & 0xfff);
+  x = (int) (page & 0xfff);
+}
+
+VirtualTexture::VirtualTexture(int slotsWide, int numThreads)
+{
+  this->slotsWide = slotsWide;
+  this->numSlots = slotsWide * slotsWide;
+  this->numThreads = std::max(numThreads, 1);
+  this->slotPages.assign(this->numSlots, NO_PAGE);
+  this->slotFrames.assign(this->numSlots, 0);
+  this->frame = 0;
+  this->pageTableWidth = 0;
+  this->pageTableHeight = 0;
+  this->isPageTableChanged = false;
+  this->isStopping = false;
+}
+
+VirtualTexture::~VirtualTexture()
+{
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->isStopping = true;
+  }
+  this->jobAvailable.notify_all();
+  for (unsigned int i = 0; i < this->threads.size(); i++)
+  {
+    this->threads[i].join();
+  }
+}
+
+void VirtualTexture::setPageLoadedCallback(const std::function<void()>& pageLoaded)
+{
+  this->pageLoaded = pageLoaded;
+}
+
+bool VirtualTexture::open(const std::string& path)
+{
+  if (!this->threads.empty() || !this->pageFile.open(path))
+  {
+    return false;
+  }
+  this->path = path;
+  int numLevels = this->pageFile.getNumLevels();
+
+  // The first level on the left, the next ones stacked on its right
+  this->levelOffsets.assign(2 * numLevels, 0);
+  this->pageTableWidth = this->pageFile.getTilesWide(0);
+  this->pageTableHeight = this->pageFile.getTilesHigh(0);
+  int y = 0;
+  for (int level = 1; level < numLevels; level++)
+  {
+    this->levelOffsets[2 * level] = this->pageFile.getTilesWide(0);
+    this->levelOffsets[2 * level + 1] = y;
+    y += this->pageFile.getTilesHigh(level);
+  }
+  if (numLevels > 1)
+  {
+    this->pageTableWidth += this->pageFile.getTilesWide(1);
+    this->pageTableHeight = std::max(this->pageTableHeight, y);
+  }
+
+  // Everything samples the coarsest page until the finer ones come
+  LoadedPage coarsest;
+  coarsest.page = packPage(numLevels - 1, 0, 0);
+  coarsest.slot = PINNED_SLOT;
+  coarsest.texels.resize(this->pageFile.getPageBytes());
+  if (!this->pageFile.readPage(numLevels - 1, 0, 0, coarsest.texels.data()))
+  {
+    this->pageFile.close();
+    return false;
+  }
+  this->pageTable.assign((size_t) this->pageTableWidth * this->pageTableHeight * 4, 0);
+  for (size_t i = 0; i < this->pageTable.size(); i += 4)
+  {
+    this->pageTable[i + 2] = (unsigned char) (numLevels - 1);
+    this->pageTable[i + 3] = 255;
+  }
+  this->isPageTableChanged = true;
+  this->slotPages[PINNED_SLOT] = coarsest.page;
+  this->loadingPages.insert(coarsest.page);
+  this->loadedPages.push_back(coarsest);
+
+  for (int i = 0; i < this->numThreads; i++)
+  {
+    this->threads.push_back(std::thread(&VirtualTexture::runLoads, this));
+  }
+  return true;
+}
+
+unsigned int VirtualTexture::getPage(float u, float v, float lod)
+{
+  int level = std::min(std::max((int) std::floor(lod), 0), this->pageFile.getNumLevels() - 1);
+  u -= std::floor(u);
+  v -= std::floor(v);
+  int x = std::min((int) (u * this->pageFile.getLevelWidth(level)) / PageFile::TILE_SIZE, this->pageFile.getTilesWide(level) - 1);
+  int y = std::min((int) (v * this->pageFile.getLevelHeight(level)) / PageFile::TILE_SIZE, this->pageFile.getTilesHigh(level) - 1);
+  return packPage(level, x, y);
+}
+
+void VirtualTexture::update(const std::vector<unsigned int>& pages)
+{
+  if (!this->pageFile.isOpen())
+  {
+    return;
+  }
+  this->frame++;
+
+  // The coarser pages under a requested one come along, so the one shown
+  // while it loads, or after it is evicted, is close to it
+  std::vector<unsigned int> requested;
+  for (unsigned int i = 0; i < pages.size(); i++)
+  {
+    int level;
+    int x;
+    int y;
+    unpackPage(pages[i], level, x, y);
+    for (int parentLevel = level; parentLevel < this->pageFile.getNumLevels(); parentLevel++)
+    {
+      requested.push_back(this->getParent(level, x, y, parentLevel));
+    }
+  }
+  std::sort(requested.begin(), requested.end());
+  requested.erase(std::unique(requested.begin(), requested.end()), requested.end());
+
+  std::vector<unsigned int> missing;
+  for (unsigned int i = 0; i < requested.size(); i++)
+  {
+    std::unordered_map<unsigned int, int>::iterator it = this->residentPages.find(requested[i]);
+    if (it != this->residentPages.end())
+    {
+      this->slotFrames[it->second] = this->frame;
+    }
+    else if (this->loadingPages.count(requested[i]) == 0)
+    {
+      missing.push_back(requested[i]);
+    }
+  }
+  // The level is in the top bits
+  std::sort(missing.begin(), missing.end(), std::greater<unsigned int>());
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  for (unsigned int i = 0; i < missing.size() && (int) i < MAX_LOADS_PER_UPDATE; i++)
+  {
+    int slot = this->allocateSlot();
+    if (slot < 0)
+    {
+      break;
+    }
+    if (this->slotPages[slot] != NO_PAGE)
+    {
+      this->unmapPage(this->slotPages[slot], slot);
+    }
+    this->slotPages[slot] = missing[i];
+    this->slotFrames[slot] = this->frame;
+    this->loadingPages.insert(missing[i]);
+    Job job = { missing[i], slot };
+    this->jobs.push_back(job);
+    this->jobAvailable.notify_one();
+  }
+}
+
+std::vector<LoadedPage> VirtualTexture::takeLoadedPages()
+{
+  std::vector<LoadedPage> pages;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    pages.swap(this->loadedPages);
+  }
+  for (unsigned int i = 0; i < pages.size(); i++)
+  {
+    this->loadingPages.erase(pages[i].page);
+    if (pages[i].texels.empty())
+    {
+      // Not read, the slot is free again
+      this->slotPages[pages[i].slot] = NO_PAGE;
+      continue;
+    }
+    this->mapPage(pages[i].page, pages[i].slot);
+  }
+  // Failed reads are left out
+  pages.erase(std::remove_if(pages.begin(), pages.end(), [](const LoadedPage& page) { return page.texels.empty(); }), pages.end());
+  return pages;
+}
+
+bool VirtualTexture::takePageTableChange()
+{
+  bool isChanged = this->isPageTableChanged;
+  this->isPageTableChanged = false;
+  return isChanged;
+}
+
+void VirtualTexture::runLoads()
+{
+  // Its own file, reads of the threads do not share a position
+  PageFile file;
+  bool isOpen = file.open(this->path);
+  for (;;)
+  {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      this->jobAvailable.wait(lock, [this] { return this->isStopping || !this->jobs.empty(); });
+      if (this->isStopping)
+      {
+        break;
+      }
+      job = this->jobs.front();
+      this->jobs.pop_front();
+    }
+
+    LoadedPage loaded;
+    loaded.page = job.page;
+    loaded.slot = job.slot;
+    loaded.texels.resize(file.getPageBytes());
+    int level;
+    int x;
+    int y;
+    unpackPage(job.page, level, x, y);
+    if (!isOpen || !file.readPage(level, x, y, loaded.texels.data()))
+    {
+      loaded.texels.clear();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->loadedPages.push_back(std::move(loaded));
+    }
+    if (this->pageLoaded)
+    {
+      this->pageLoaded();
+    }
+  }
+}
+
+int VirtualTexture::allocateSlot()
+{
+  // A free slot, or the least recently used one not requested this frame
+  int oldest = -1;
+  for (int slot = 0; slot < this->numSlots; slot++)
+  {
+    if (slot == PINNED_SLOT)
+    {
+      continue;
+    }
+    if (this->slotPages[slot] == NO_PAGE)
+    {
+      return slot;
+    }
+    if (this->slotFrames[slot] < this->frame &&
+        this->loadingPages.count(this->slotPages[slot]) == 0 &&
+        (oldest < 0 || this->slotFrames[slot] < this->slotFrames[oldest]))
+    {
+      oldest = slot;
+    }
+  }
+  return oldest;
+}
+
+unsigned int VirtualTexture::getParent(int level, int x, int y, int parentLevel)
+{
+  // Levels round down, the last texels of odd sizes go to the last page
+  int shift = parentLevel - level;
+  return packPage(parentLevel,
+                  std::min(x >> shift, this->pageFile.getTilesWide(parentLevel) - 1),
+                  std::min(y >> shift, this->pageFile.getTilesHigh(parentLevel) - 1));
+}
+
+unsigned char* VirtualTexture::getEntry(int level, int x, int y)
+{
+  return &this->pageTable[((size_t) (this->levelOffsets[2 * level + 1] + y) * this->pageTableWidth + this->levelOffsets[2 * level] + x) * 4];
+}
+
+void VirtualTexture::mapPage(unsigned int page, int slot)
+{
+  this->residentPages[page] = slot;
+  int pageLevel;
+  int pageX;
+  int pageY;
+  unpackPage(page, pageLevel, pageX, pageY);
+
+  // The entries under the page take it, unless a finer one is resident
+  for (int level = pageLevel; level >= 0; level--)
+  {
+    int shift = pageLevel - level;
+    int tilesWide = this->pageFile.getTilesWide(level);
+    int tilesHigh = this->pageFile.getTilesHigh(level);
+    int lastX = pageX == this->pageFile.getTilesWide(pageLevel) - 1 ? tilesWide : std::min((pageX + 1) << shift, tilesWide);
+    int lastY = pageY == this->pageFile.getTilesHigh(pageLevel) - 1 ? tilesHigh : std::min((pageY + 1) << shift, tilesHigh);
+    for (int y = pageY << shift; y < lastY; y++)
+    {
+      for (int x = pageX << shift; x < lastX; x++)
+      {
+        unsigned char* entry = this->getEntry(level, x, y);
+        if (entry[2] >= pageLevel)
+        {
+          entry[0] = (unsigned char) (slot % this->slotsWide);
+          entry[1] = (unsigned char) (slot / this->slotsWide);
+          entry[2] = (unsigned char) pageLevel;
+        }
+      }
+    }
+  }
+  this->isPageTableChanged = true;
+}
+
+void VirtualTexture::unmapPage(unsigned int page, int slot)
+{
+  this->residentPages.erase(page);
+  int pageLevel;
+  int pageX;
+  int pageY;
+  unpackPage(page, pageLevel, pageX, pageY);
+
+  // The entries pointing at it fall back to the finest coarser page,
+  // there is always the coarsest one
+  for (int level = pageLevel; level >= 0; level--)
+  {
+    int shift = pageLevel - level;
+    int tilesWide = this->pageFile.getTilesWide(level);
+    int tilesHigh = this->pageFile.getTilesHigh(level);
+    int lastX = pageX == this->pageFile.getTilesWide(pageLevel) - 1 ? tilesWide : std::min((pageX + 1) << shift, tilesWide);
+    int lastY = pageY == this->pageFile.getTilesHigh(pageLevel) - 1 ? tilesHigh : std::min((pageY + 1) << shift, tilesHigh);
+    for (int y = pageY << shift; y < lastY; y++)
+    {
+      for (int x = pageX << shift; x < lastX; x++)
+      {
+        unsigned char* entry = this->getEntry(level, x, y);
+        if (entry[2] != pageLevel || entry[0] + entry[1] * this->slotsWide != slot)
+        {
+          continue;
+        }
+        for (int parentLevel = pageLevel + 1; parentLevel < this->pageFile.getNumLevels(); parentLevel++)
+        {
+          std::unordered_map<unsigned int, int>::iterator it = this->residentPages.find(this->getParent(level, x, y, parentLevel));
+          if (it != this->residentPages.end())
+          {
+            entry[0] = (unsigned char) (it->second % this->slotsWide);
+            entry[1] = (unsigned char) (it->second / this->slotsWide);
+            entry[2] = (unsigned char) parentLevel;
+            break;
+          }
+        }
+      }
+    }
+  }
+  this->isPageTableChanged = true;
+}
+
+int VirtualTexture::getWidth()
+{
+  return this->pageFile.getWidth();
+}
+
+int VirtualTexture::getHeight()
+{
+  return this->pageFile.getHeight();
+}
+
+int VirtualTexture::getNumLevels()
+{
+  return this->pageFile.getNumLevels();
+}
+
+int VirtualTexture::getSlotsWide()
+{
+  return this->slotsWide;
+}
+
+int VirtualTexture::getPageSize()
+{
+  return this->pageFile.getPageSize();
+}
+
+int VirtualTexture::getPhysicalSize()
+{
+  return this->slotsWide * this->pageFile.getPageSize();
+}
+
+const std::vector<unsigned char>& VirtualTexture::getPageTable()
+{
+  return this->pageTable;
+}
+
+int VirtualTexture::getPageTableWidth()
+{
+  return this->pageTableWidth;
+}
+
+int VirtualTexture::getPageTableHeight()
+{
+  return this->pageTableHeight;
+}
+
+const std::vector<int>& VirtualTexture::getLevelOffsets()
+{
+  return this->levelOffsets;
+}
+
+int VirtualTexture::getNumResidentPages()
+{
+  return (int) this->residentPages.size();
+}
+
+int VirtualTexture::getNumLoadingPages()
+{
+  return (int) this->loadingPages.size();
+}
@@ -0,0 +1,127 @@
+#ifndef VIRTUALTEXTURE_H
+#define VIRTUALTEXTURE_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "pagefile.h"
+
+// A page read from the page file, to be copied into its slot of the
+// physical texture
+struct LoadedPage
+{
+  unsigned int page;
+  int slot;
+  std::vector<unsigned char> texels;
+};
+
+// Residency of a texture sampled through a page table: a fixed physical
+// texture of page slots holds the pages the last frames sampled, and the
+// least recently used one makes room for a missing one. The page table has
+// an entry for every page of every level, pointing at the finest resident
+// page under it, so sampling always finds one: the single page of the
+// coarsest level is loaded first and never evicted. Missing pages are read
+// from the page file by background threads; everything else runs on the
+// thread owning the virtual texture.
+class VirtualTexture
+{
+private:
+  struct Job
+  {
+    unsigned int page;
+    int slot;
+  };
+
+  PageFile pageFile;
+  std::string path;
+  int slotsWide;
+  int numSlots;
+  int numThreads;
+
+  std::unordered_map<unsigned int, int> residentPages;
+  std::unordered_set<unsigned int> loadingPages;
+  // Page in or loading into each slot, and the frame it was last requested
+  std::vector<unsigned int> slotPages;
+  std::vector<unsigned int> slotFrames;
+  unsigned int frame;
+
+  // RGBA8 entries of every level side by side: slot x, slot y, level of the
+  // resident page, 255
+  std::vector<unsigned char> pageTable;
+  int pageTableWidth;
+  int pageTableHeight;
+  std::vector<int> levelOffsets;
+  bool isPageTableChanged;
+
+  // Shared with the load threads
+  std::mutex mutex;
+  std::condition_variable jobAvailable;
+  std::deque<Job> jobs;
+  std::vector<LoadedPage> loadedPages;
+  bool isStopping;
+  std::vector<std::thread> threads;
+  std::function<void()> pageLoaded;
+
+  void runLoads();
+  int allocateSlot();
+  void mapPage(unsigned int page, int slot);
+  void unmapPage(unsigned int page, int slot);
+  unsigned int getParent(int level, int x, int y, int parentLevel);
+  unsigned char* getEntry(int level, int x, int y);
+
+public:
+  static const unsigned int NO_PAGE = 0xffffffffu;
+  // Loads queued by a single update, the coarsest pages first
+  static const int MAX_LOADS_PER_UPDATE = 64;
+
+  // Level in the top 8 bits, then the tile row and column in 12 bits each
+  static unsigned int packPage(int level, int x, int y);
+  static void unpackPage(unsigned int page, int& level, int& x, int& y);
+
+  // A physical texture of slotsWide x slotsWide pages
+  VirtualTexture(int slotsWide = 16, int numThreads = 2);
+  ~VirtualTexture();
+
+  // Called by the load threads after each page, set before open
+  void setPageLoadedCallback(const std::function<void()>& pageLoaded);
+  // Reads the coarsest page right away, it is the first one taken
+  bool open(const std::string& path);
+
+  // The page the fragment shader samples at the UV, for a level of detail
+  // in log2 of the full size texels per pixel
+  unsigned int getPage(float u, float v, float lod);
+
+  // The pages a frame sampled, from its feedback. The resident ones are
+  // marked used, the missing ones and the coarser pages under them are
+  // queued for loading into the least recently used slots.
+  void update(const std::vector<unsigned int>& pages);
+  // Pages loaded since the last call, already in the page table: their
+  // texels go to their slot before the next frame samples it
+  std::vector<LoadedPage> takeLoadedPages();
+  // True once after the page table changed
+  bool takePageTableChange();
+
+  int getWidth();
+  int getHeight();
+  int getNumLevels();
+  int getSlotsWide();
+  int getPageSize();
+  // Side of the physical texture in texels
+  int getPhysicalSize();
+  const std::vector<unsigned char>& getPageTable();
+  int getPageTableWidth();
+  int getPageTableHeight();
+  // Texel of the first entry of each level in the page table, x then y
+  const std::vector<int>& getLevelOffsets();
+  int getNumResidentPages();
+  int getNumLoadingPages();
+};
+
+#endif // VIRTUALTEXTURE_H
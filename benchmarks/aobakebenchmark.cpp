@@ -0,0 +1,97 @@
+#include "benchmarks.h"
+#include "aobaker.h"
+#include "threadpool.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static const int NUM_RAYS = 64;
+// Of the bounds diagonal
+static const float MAX_DISTANCE = 0.25f;
+// Threads of the second bake compared against the first one
+static const int DETERMINISM_THREADS = 4;
+
+static void runModel(const std::string& name, ThreadPool& threadPool)
+{
+  std::vector<glm::vec3> positions;
+  std::vector<unsigned int> indices;
+  std::vector<glm::vec3> normals;
+  if (!loadModel(name, positions, indices) || positions.empty())
+  {
+    return;
+  }
+  computeVertexNormals(positions, indices, normals);
+  glm::vec3 min = positions[0];
+  glm::vec3 max = positions[0];
+  for (unsigned int v = 0; v < positions.size(); v++)
+  {
+    min = glm::min(min, positions[v]);
+    max = glm::max(max, positions[v]);
+  }
+  float maxDistance = MAX_DISTANCE * glm::length(max - min);
+
+  AOBaker baker(&threadPool);
+  std::vector<float> visibility;
+  int numReports = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  baker.bake(positions, normals, indices, NUM_RAYS, maxDistance, visibility, [&numReports](float)
+  {
+    numReports++;
+    return true;
+  });
+  double time = elapsedMilliseconds(start);
+  unsigned long long numRays = baker.getNumRays();
+  double mean = 0.0;
+  for (unsigned int v = 0; v < visibility.size(); v++)
+  {
+    mean += visibility[v];
+  }
+  mean /= visibility.size();
+
+  ThreadPool otherThreadPool(DETERMINISM_THREADS);
+  AOBaker otherBaker(&otherThreadPool);
+  std::vector<float> otherVisibility;
+  otherBaker.bake(positions, normals, indices, NUM_RAYS, maxDistance, otherVisibility);
+  bool isDeterministic = otherVisibility.size() == visibility.size() &&
+                         memcmp(otherVisibility.data(), visibility.data(), visibility.size() * sizeof(float)) == 0;
+
+  // Cancelled half way, the time it takes to return
+  std::chrono::steady_clock::time_point cancelTime;
+  std::vector<float> cancelled;
+  bool isCompleted = baker.bake(positions, normals, indices, NUM_RAYS, maxDistance, cancelled, [&cancelTime](float progress)
+  {
+    if (progress < 0.5f)
+    {
+      return true;
+    }
+    cancelTime = std::chrono::steady_clock::now();
+    return false;
+  });
+  double cancelLatency = elapsedMilliseconds(cancelTime);
+
+  printf("%-14s vertices %7d  triangles %7d  %8.2f ms  %6.2f MRays/s  %6.2f MRays/s/thread  mean %.3f  reports %d  %s with %d threads  cancel %s in %.2f ms\n",
+         name.c_str(),
+         (int) positions.size(),
+         (int) indices.size() / 3,
+         time,
+         (double) numRays / (time * 1000.0),
+         (double) numRays / (time * 1000.0) / threadPool.getNumThreads(),
+         mean,
+         numReports,
+         isDeterministic ? "same" : "DIFFERENT",
+         DETERMINISM_THREADS,
+         isCompleted ? "ignored" : "done",
+         cancelLatency);
+}
+
+void runAOBakeBenchmark()
+{
+  ThreadPool hardware;
+  printf("rays %d  max distance %.2f of the diagonal  threads %d\n", NUM_RAYS, MAX_DISTANCE, hardware.getNumThreads());
+  const std::vector<std::string>& models = getBundledModels();
+  for (unsigned int m = 0; m < models.size(); m++)
+  {
+    runModel(models[m], hardware);
+  }
+}
@@ -0,0 +1,138 @@
+#include "benchmarks.h"
+#include "textureatlas.h"
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+static const int MAX_ATLAS_SIZE = 16384;
+
+static inline unsigned char getTexel(unsigned int texture, int x, int y, int channel)
+{
+  return (unsigned char) (texture * 131u + x * 7u + y * 13u + channel * 61u);
+}
+
+// Cells with their gutters inside the atlas, apart, and aligned for the
+// safe mip levels
+static bool isLayoutValid(const std::vector<AtlasRect>& rects, int width, int height, int gutter)
+{
+  int alignment = 1 << (TextureAtlas::getNumSafeLevels(gutter) - 1);
+  for (unsigned int i = 0; i < rects.size(); i++)
+  {
+    const AtlasRect& a = rects[i];
+    if (a.x - gutter < 0 || a.y - gutter < 0 || a.x + a.width + gutter > width || a.y + a.height + gutter > height ||
+        (a.x - gutter) % alignment != 0 || (a.y - gutter) % alignment != 0)
+    {
+      return false;
+    }
+    for (unsigned int j = i + 1; j < rects.size(); j++)
+    {
+      const AtlasRect& b = rects[j];
+      if (a.x - gutter < b.x + b.width + gutter && b.x - gutter < a.x + a.width + gutter &&
+          a.y - gutter < b.y + b.height + gutter && b.y - gutter < a.y + a.height + gutter)
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static void runCount(int count)
+{
+  std::mt19937 random(count);
+  std::uniform_int_distribution<int> side(16, 256);
+  std::vector<glm::ivec2> sizes(count);
+  double textureArea = 0.0;
+  for (int i = 0; i < count; i++)
+  {
+    sizes[i] = glm::ivec2(side(random), side(random));
+    textureArea += (double) sizes[i].x * sizes[i].y;
+  }
+
+  const int gutter = TextureAtlas::DEFAULT_GUTTER;
+  std::vector<AtlasRect> rects;
+  int width = 0;
+  int height = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  bool isPacked = TextureAtlas::pack(sizes, MAX_ATLAS_SIZE, gutter, rects, width, height);
+  double packTime = elapsedMilliseconds(start);
+  if (!isPacked)
+  {
+    printf("%5d textures do not fit in %d x %d\n", count, MAX_ATLAS_SIZE, MAX_ATLAS_SIZE);
+    return;
+  }
+
+  std::vector<std::vector<unsigned char> > textures(count);
+  std::vector<const unsigned char*> pointers(count);
+  for (int i = 0; i < count; i++)
+  {
+    textures[i].resize((size_t) sizes[i].x * sizes[i].y * 4);
+    for (int y = 0; y < sizes[i].y; y++)
+    {
+      for (int x = 0; x < sizes[i].x; x++)
+      {
+        for (int c = 0; c < 4; c++)
+        {
+          textures[i][((size_t) y * sizes[i].x + x) * 4 + c] = getTexel(i, x, y, c);
+        }
+      }
+    }
+    pointers[i] = textures[i].data();
+  }
+  std::vector<unsigned char> atlas;
+  start = std::chrono::steady_clock::now();
+  TextureAtlas::compose(pointers, rects, width, height, gutter, atlas);
+  double composeTime = elapsedMilliseconds(start);
+
+  // Every texel of a cell, gutters included, wraps back into its texture
+  bool isComposed = true;
+  for (int i = 0; i < count && isComposed; i++)
+  {
+    const AtlasRect& rect = rects[i];
+    for (int y = -gutter; y < rect.height + gutter && isComposed; y++)
+    {
+      for (int x = -gutter; x < rect.width + gutter && isComposed; x++)
+      {
+        const unsigned char* texel = &atlas[((size_t) (rect.y + y) * width + rect.x + x) * 4];
+        int sourceX = (x + rect.width) % rect.width;
+        int sourceY = (y + rect.height) % rect.height;
+        for (int c = 0; c < 4; c++)
+        {
+          isComposed = isComposed && texel[c] == getTexel(i, sourceX, sourceY, c);
+        }
+      }
+    }
+  }
+
+  // A UV range over one tile lands in the rect
+  std::vector<glm::vec2> UVs;
+  UVs.push_back(glm::vec2(2.0f, -1.0f));
+  UVs.push_back(glm::vec2(3.0f, 0.0f));
+  TextureAtlas::remapUVs(UVs, 0, 2, TextureAtlas::getUVTransform(rects[0], width, height));
+  glm::vec2 low = UVs[0] * glm::vec2(width, height);
+  glm::vec2 high = UVs[1] * glm::vec2(width, height);
+  bool isRemapped = glm::all(glm::lessThan(glm::abs(low - glm::vec2(rects[0].x, rects[0].y)), glm::vec2(1e-2f))) &&
+                    glm::all(glm::lessThan(glm::abs(high - glm::vec2(rects[0].x + rects[0].width, rects[0].y + rects[0].height)), glm::vec2(1e-2f)));
+
+  printf("%5d textures  pack %8.2f ms  %5d x %-5d %5.1f%% textures  compose %7.2f ms %7.1f MTexels/s  %s %s %s\n",
+         count,
+         packTime,
+         width,
+         height,
+         100.0 * textureArea / ((double) width * height),
+         composeTime,
+         (double) width * height / (composeTime * 1000.0),
+         isLayoutValid(rects, width, height, gutter) ? "layout ok" : "LAYOUT OVERLAPS",
+         isComposed ? "texels ok" : "TEXELS WRONG",
+         isRemapped ? "UVs ok" : "UVS WRONG");
+}
+
+void runAtlasBenchmark()
+{
+  printf("gutter %d, %d safe mip levels\n", TextureAtlas::DEFAULT_GUTTER, TextureAtlas::getNumSafeLevels(TextureAtlas::DEFAULT_GUTTER));
+  runCount(16);
+  runCount(64);
+  runCount(256);
+  runCount(1024);
+}
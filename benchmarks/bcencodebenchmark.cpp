@@ -0,0 +1,143 @@
+#include "benchmarks.h"
+#include "blockcompressor.h"
+
+#include <QDir>
+#include <QImage>
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#ifndef TEXTURES_DIR
+#define TEXTURES_DIR "../3drenderer/textures"
+#endif
+
+static const int SIZE = 1024;
+static const int NUM_RUNS = 3;
+
+static void runFormat(BlockCompressor& compressor,
+                      const char* name,
+                      const std::vector<unsigned char>& texels,
+                      BlockCompressor::Format format,
+                      BlockCompressor::Quality quality)
+{
+  CompressedLevel level;
+  double time = 0.0;
+  for (int run = 0; run < NUM_RUNS; run++)
+  {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    compressor.compress(texels.data(), SIZE, SIZE, format, quality, level);
+    time += elapsedMilliseconds(start);
+  }
+  time /= NUM_RUNS;
+
+  std::vector<unsigned char> decoded;
+  BlockCompressor::decompress(level, format, decoded);
+  double psnr = BlockCompressor::computePSNR(texels.data(), decoded.data(), SIZE, SIZE, format);
+  printf("%-20s %8.2f ms %8.1f MTexels/s  PSNR %6.2f dB  %.0fx smaller than RGBA8\n",
+         name,
+         time,
+         (double) SIZE * SIZE / (time * 1000.0),
+         psnr,
+         (double) SIZE * SIZE * 4 / level.blocks.size());
+}
+
+// The settings of the texture compression box, as TextureLoader encodes the
+// color textures with them. Files named like normal maps are BC5 instead.
+static void runBundledTexture(BlockCompressor& compressor, const QString& fileName)
+{
+  QImage image(QString(TEXTURES_DIR) + "/" + fileName);
+  if (image.isNull())
+  {
+    printf("cannot load %s\n", fileName.toStdString().c_str());
+    reportFailure();
+    return;
+  }
+  image = image.convertToFormat(QImage::Format_ARGB32);
+  int width = image.width();
+  int height = image.height();
+  // Without the padding of the scan lines
+  std::vector<unsigned char> texels((size_t) width * height * 4);
+  for (int y = 0; y < height; y++)
+  {
+    memcpy(&texels[(size_t) y * width * 4], image.constScanLine(y), (size_t) width * 4);
+  }
+
+  bool isOpaque = true;
+  for (size_t i = 0; i < texels.size(); i += 4)
+  {
+    isOpaque &= texels[i + 3] == 255;
+  }
+
+  struct Setting
+  {
+    const char* name;
+    BlockCompressor::Format format;
+    BlockCompressor::Quality quality;
+  };
+  std::vector<Setting> settings;
+  if (fileName.contains("normal"))
+  {
+    settings.push_back({ "BC5", BlockCompressor::BC5, BlockCompressor::NORMAL_QUALITY });
+  }
+  else
+  {
+    settings.push_back({ isOpaque ? "BC1" : "BC3", isOpaque ? BlockCompressor::BC1 : BlockCompressor::BC3, BlockCompressor::NORMAL_QUALITY });
+    settings.push_back({ "BC7 fast", BlockCompressor::BC7, BlockCompressor::FAST_QUALITY });
+    settings.push_back({ "BC7 normal", BlockCompressor::BC7, BlockCompressor::NORMAL_QUALITY });
+    settings.push_back({ "BC7 slow", BlockCompressor::BC7, BlockCompressor::SLOW_QUALITY });
+  }
+
+  printf("%s %dx%d, %.0f KB as RGBA8\n", fileName.toStdString().c_str(), width, height, texels.size() / 1024.0);
+  for (const Setting& setting : settings)
+  {
+    CompressedLevel level;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    compressor.compress(texels.data(), width, height, setting.format, setting.quality, level);
+    double time = elapsedMilliseconds(start);
+
+    std::vector<unsigned char> decoded;
+    BlockCompressor::decompress(level, setting.format, decoded);
+    double psnr = BlockCompressor::computePSNR(texels.data(), decoded.data(), width, height, setting.format);
+    printf("  %-12s %8.2f ms  PSNR %6.2f dB  %6.0f KB\n", setting.name, time, psnr, level.blocks.size() / 1024.0);
+  }
+}
+
+void runBlockCompressionBenchmark()
+{
+  BlockCompressor compressor;
+
+  std::vector<unsigned char> checker;
+  buildCheckerTexture(SIZE, 64, checker);
+  std::vector<unsigned char> noise;
+  buildNoiseTexture(SIZE, noise);
+  std::vector<unsigned char> opaqueNoise = noise;
+  for (int i = 0; i < SIZE * SIZE; i++)
+  {
+    opaqueNoise[4 * i + 3] = 255;
+  }
+  std::vector<unsigned char> bumps;
+  buildBumpTexture(SIZE, 16, bumps);
+
+  printf("%dx%d\n", SIZE, SIZE);
+  runFormat(compressor, "checker BC1", checker, BlockCompressor::BC1, BlockCompressor::NORMAL_QUALITY);
+  runFormat(compressor, "noise BC1", opaqueNoise, BlockCompressor::BC1, BlockCompressor::NORMAL_QUALITY);
+  runFormat(compressor, "noise+alpha BC3", noise, BlockCompressor::BC3, BlockCompressor::NORMAL_QUALITY);
+  runFormat(compressor, "bumps BC5", bumps, BlockCompressor::BC5, BlockCompressor::NORMAL_QUALITY);
+  runFormat(compressor, "noise BC7 fast", opaqueNoise, BlockCompressor::BC7, BlockCompressor::FAST_QUALITY);
+  runFormat(compressor, "noise BC7 normal", opaqueNoise, BlockCompressor::BC7, BlockCompressor::NORMAL_QUALITY);
+  runFormat(compressor, "noise BC7 slow", opaqueNoise, BlockCompressor::BC7, BlockCompressor::SLOW_QUALITY);
+  runFormat(compressor, "noise+alpha BC7", noise, BlockCompressor::BC7, BlockCompressor::NORMAL_QUALITY);
+
+  printf("\nbundled textures\n");
+  QStringList fileNames = QDir(TEXTURES_DIR).entryList({ "*.jpg", "*.png" }, QDir::Files);
+  if (fileNames.isEmpty())
+  {
+    printf("no textures in %s\n", TEXTURES_DIR);
+    reportFailure();
+  }
+  for (const QString& fileName : fileNames)
+  {
+    runBundledTexture(compressor, fileName);
+  }
+}
@@ -0,0 +1,75 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "frustumculler.h"
+#include "vertexpacker.h"
+
+// Command line options (main.cpp)
+struct BenchmarkOptions
+{
+  // The import benchmark writes its results there as JSON
+  std::string jsonPath;
+  // and compares them to the ones of a previous run
+  std::string baselinePath;
+  // Slowdown flagged as a regression, a fraction of the baseline minimum
+  // and median
+  double regressionThreshold;
+};
+const BenchmarkOptions& getBenchmarkOptions();
+// The benchmarks then exit with 1, for scripts
+void reportRegression();
+// and with 2 when one of them could not run as asked
+void reportFailure();
+
+// Milliseconds since start
+inline double elapsedMilliseconds(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Synthetic scenes (syntheticscenes.cpp)
+static const int SYNTHETIC_SCENE_OBJECTS = 100000;
+void buildVolumeScene(std::vector<BoundingBox>& bounds, int numObjects);
+void buildGroundScene(std::vector<BoundingBox>& bounds, int numObjects);
+glm::mat4 getFrameViewProjection(int frame, float eyeHeight);
+// Unit sphere with its tangent frame, UVs wrap once around it
+void buildSphereMesh(int slices, int stacks, std::vector<InterleavedVertex>& vertices, std::vector<unsigned int>& indices);
+// RGBA8 texels: a checkerboard, and a normal map of bumps in the swizzled
+// byte order the fragment shader reads
+void buildCheckerTexture(int size, int squares, std::vector<unsigned char>& texels);
+void buildBumpTexture(int size, int bumps, std::vector<unsigned char>& texels);
+// Smooth colors with fine detail in every channel, alpha too, closer to a
+// photograph than the checkerboard
+void buildNoiseTexture(int size, std::vector<unsigned char>& texels);
+
+// Bundled OBJ models of the renderer (models.cpp), the files of the models
+// directory by name without the extension, triangulated
+const std::vector<std::string>& getBundledModels();
+std::string getModelPath(const std::string& name);
+bool loadModel(const std::string& name, std::vector<glm::vec3>& positions, std::vector<unsigned int>& indices);
+// Area weighted, +z for vertices without a face
+void computeVertexNormals(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices, std::vector<glm::vec3>& normals);
+
+void runFrustumCullingBenchmark();
+void runOcclusionCullingBenchmark();
+void runSoftwareRasterBenchmark();
+void runBVHBenchmark();
+void runRayCastBenchmark();
+void runRayTraceBenchmark();
+void runAOBakeBenchmark();
+void runNormalBakeBenchmark();
+void runMipChainBenchmark();
+void runBlockCompressionBenchmark();
+void runVirtualTextureBenchmark();
+void runHeightMapBenchmark();
+void runAtlasBenchmark();
+void runImportBenchmark();
+void runUploadBenchmark();
+void runUniformBenchmark();
+
+#endif // BENCHMARKS_H
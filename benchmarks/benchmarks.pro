@@ -0,0 +1,87 @@
+#-------------------------------------------------
+#
+# CPU side benchmarks of the renderer modules
+#
+#-------------------------------------------------
+
+TARGET = benchmarks
+TEMPLATE = app
+
+CONFIG += console c++14
+CONFIG -= app_bundle
+# Mesh logs through QtCore, the uniforms benchmark needs an OpenGL context
+QT = core gui
+unix: LIBS += -lpthread
+
+INCLUDEPATH += ../3drenderer
+DEFINES += MODELS_DIR=\\\"$$PWD/../3drenderer/models\\\"
+
+HEADERS += \
+    benchmarks.h \
+    ../3drenderer/aobaker.h \
+    ../3drenderer/blockcompressor.h \
+    ../3drenderer/bvh.h \
+    ../3drenderer/frustumculler.h \
+    ../3drenderer/heightmapconverter.h \
+    ../3drenderer/indexbatcher.h \
+    ../3drenderer/mesh.h \
+    ../3drenderer/mipchain.h \
+    ../3drenderer/normalmapbaker.h \
+    ../3drenderer/occlusionculler.h \
+    ../3drenderer/pagefeedback.h \
+    ../3drenderer/pagefile.h \
+    ../3drenderer/raycaster.h \
+    ../3drenderer/raytracer.h \
+    ../3drenderer/softwarerenderer.h \
+    ../3drenderer/textureatlas.h \
+    ../3drenderer/threadpool.h \
+    ../3drenderer/uniformbuffer.h \
+    ../3drenderer/uvwrapper.h \
+    ../3drenderer/uvcubewrapper.h \
+    ../3drenderer/uvsphericalwrapper.h \
+    ../3drenderer/vertexpacker.h \
+    ../3drenderer/virtualtexture.h
+
+SOURCES += \
+    main.cpp \
+    syntheticscenes.cpp \
+    frustumcullingbenchmark.cpp \
+    occlusioncullingbenchmark.cpp \
+    softwarerasterbenchmark.cpp \
+    bvhbenchmark.cpp \
+    raycastbenchmark.cpp \
+    raytracebenchmark.cpp \
+    aobakebenchmark.cpp \
+    normalbakebenchmark.cpp \
+    mipchainbenchmark.cpp \
+    bcencodebenchmark.cpp \
+    virtualtexturebenchmark.cpp \
+    heightmapbenchmark.cpp \
+    atlasbenchmark.cpp \
+    importbenchmark.cpp \
+    uploadbenchmark.cpp \
+    uniformbenchmark.cpp \
+    models.cpp \
+    ../3drenderer/aobaker.cpp \
+    ../3drenderer/blockcompressor.cpp \
+    ../3drenderer/bvh.cpp \
+    ../3drenderer/frustumculler.cpp \
+    ../3drenderer/heightmapconverter.cpp \
+    ../3drenderer/indexbatcher.cpp \
+    ../3drenderer/mesh.cpp \
+    ../3drenderer/mipchain.cpp \
+    ../3drenderer/normalmapbaker.cpp \
+    ../3drenderer/occlusionculler.cpp \
+    ../3drenderer/pagefeedback.cpp \
+    ../3drenderer/pagefile.cpp \
+    ../3drenderer/raycaster.cpp \
+    ../3drenderer/raytracer.cpp \
+    ../3drenderer/softwarerenderer.cpp \
+    ../3drenderer/textureatlas.cpp \
+    ../3drenderer/threadpool.cpp \
+    ../3drenderer/uniformbuffer.cpp \
+    ../3drenderer/uvwrapper.cpp \
+    ../3drenderer/uvcubewrapper.cpp \
+    ../3drenderer/uvsphericalwrapper.cpp \
+    ../3drenderer/vertexpacker.cpp \
+    ../3drenderer/virtualtexture.cpp
@@ -0,0 +1,113 @@
+#include "benchmarks.h"
+#include "bvh.h"
+#include "threadpool.h"
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+static const int NUM_BUILDS = 10;
+
+static double timeBuild(BVH& bvh, const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int i = 0; i < NUM_BUILDS; i++)
+  {
+    bvh.build(positions, indices);
+  }
+  return elapsedMilliseconds(start) / NUM_BUILDS;
+}
+
+// Every triangle in exactly one leaf, every child inside its parent
+static bool isValid(const BVH& bvh, int numTriangles)
+{
+  const std::vector<BVHNode>& nodes = bvh.getNodes();
+  const std::vector<unsigned int>& order = bvh.getTriangleOrder();
+  std::vector<int> seen(numTriangles, 0);
+  int numEntries = 0;
+  for (unsigned int n = 0; n < nodes.size(); n++)
+  {
+    const BVHNode& node = nodes[n];
+    if (node.numTriangles > 0)
+    {
+      for (int i = node.first; i < node.first + node.numTriangles; i++)
+      {
+        seen[order[i]]++;
+      }
+      numEntries += node.numTriangles;
+      continue;
+    }
+    for (int c = node.first; c < node.first + 2; c++)
+    {
+      if (c <= (int) n || glm::any(glm::lessThan(nodes[c].min, node.min)) || glm::any(glm::greaterThan(nodes[c].max, node.max)))
+      {
+        return false;
+      }
+    }
+  }
+  for (int t = 0; t < numTriangles; t++)
+  {
+    if (seen[t] != 1)
+    {
+      return false;
+    }
+  }
+  return numEntries == numTriangles;
+}
+
+template<int WIDTH>
+static void runCollapse(const BVH& bvh)
+{
+  std::vector<WideBVHNode<WIDTH> > wideNodes;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  bvh.collapse<WIDTH>(wideNodes);
+  double time = elapsedMilliseconds(start);
+  printf("  %d-wide  %zu nodes (%zu bytes)  %.2f ms\n", WIDTH, wideNodes.size(), wideNodes.size() * sizeof(WideBVHNode<WIDTH>), time);
+}
+
+void runBVHBenchmark()
+{
+  ThreadPool singleThread(1);
+  ThreadPool allThreads;
+  BVH singleBVH(&singleThread);
+  BVH bvh(&allThreads);
+
+  for (const std::string& name : getBundledModels())
+  {
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned int> indices;
+    if (!loadModel(name, positions, indices))
+    {
+      continue;
+    }
+    int numTriangles = (int) indices.size() / 3;
+
+    double singleTime = timeBuild(singleBVH, positions, indices);
+    double time = timeBuild(bvh, positions, indices);
+    printf("%-13s %7d tris  %6zu nodes  %5d leaves  depth %2d  SAH %.1f%s\n",
+           name.c_str(),
+           numTriangles,
+           bvh.getNodes().size(),
+           bvh.getNumLeaves(),
+           bvh.getDepth(),
+           bvh.getSAHCost(),
+           isValid(bvh, numTriangles) ? "" : "  INVALID");
+    printf("  build  %.2f ms (1 thread)  %.2f ms (%d threads)  %.1f MTri/s\n",
+           singleTime,
+           time,
+           allThreads.getNumThreads(),
+           numTriangles / (time * 1000.0));
+    runCollapse<4>(bvh);
+    runCollapse<8>(bvh);
+
+    // A wave through the vertices, then the bounds follow
+    for (unsigned int v = 0; v < positions.size(); v++)
+    {
+      positions[v] += glm::vec3(0.0f, 0.05f * std::sin(10.0f * positions[v].x), 0.0f);
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bvh.refit(positions, indices);
+    double refitTime = elapsedMilliseconds(start);
+    printf("  refit  %.2f ms  SAH %.1f%s\n", refitTime, bvh.getSAHCost(), isValid(bvh, numTriangles) ? "" : "  INVALID");
+  }
+}
@@ -0,0 +1,63 @@
+#include "benchmarks.h"
+#include "frustumculler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+static const int NUM_FRAMES = 200;
+
+static void runScene(const char* name, const std::vector<BoundingBox>& bounds, float eyeHeight)
+{
+  FrustumCuller culler;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  culler.build(bounds);
+  double buildTime = elapsedMilliseconds(start);
+
+  std::vector<unsigned int> visible;
+  std::vector<unsigned int> reference;
+  double bvhTime = 0.0;
+  double linearTime = 0.0;
+  size_t totalVisible = 0;
+  int mismatches = 0;
+  for (int frame = 0; frame < NUM_FRAMES; frame++)
+  {
+    glm::mat4 viewProjection = getFrameViewProjection(frame, eyeHeight);
+
+    start = std::chrono::steady_clock::now();
+    culler.cull(viewProjection, visible);
+    bvhTime += elapsedMilliseconds(start);
+
+    start = std::chrono::steady_clock::now();
+    FrustumCuller::cullLinear(bounds, viewProjection, reference);
+    linearTime += elapsedMilliseconds(start);
+
+    std::sort(visible.begin(), visible.end());
+    mismatches += visible != reference;
+    totalVisible += visible.size();
+  }
+
+  printf("%-8s objects %d  nodes %d  build %.2f ms  visible %.1f%%\n",
+         name,
+         (int) bounds.size(),
+         culler.getNumNodes(),
+         buildTime,
+         100.0 * totalVisible / ((double) NUM_FRAMES * bounds.size()));
+  printf("%-8s bvh %.3f ms/frame  linear %.3f ms/frame  speedup %.1fx  mismatching frames %d\n",
+         name,
+         bvhTime / NUM_FRAMES,
+         linearTime / NUM_FRAMES,
+         linearTime / bvhTime,
+         mismatches);
+}
+
+void runFrustumCullingBenchmark()
+{
+  std::vector<BoundingBox> bounds;
+
+  buildVolumeScene(bounds, SYNTHETIC_SCENE_OBJECTS);
+  runScene("volume", bounds, 0.0f);
+
+  buildGroundScene(bounds, SYNTHETIC_SCENE_OBJECTS);
+  runScene("ground", bounds, 2.0f);
+}
@@ -0,0 +1,106 @@
+#include "benchmarks.h"
+#include "heightmapconverter.h"
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+static const int NUM_RUNS = 3;
+
+// One texel at a time on a single thread, for the speedup and exactness of
+// the SIMD bands
+static void convertReference(const unsigned char* texels, int width, int height, float strength, std::vector<unsigned char>& normals)
+{
+  const float side = 3.0f;
+  const float center = 10.0f;
+  float scale = -strength / (765.0f * 2.0f * (2.0f * side + center));
+  normals.resize((size_t) width * height * 4);
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      float h[3][3];
+      for (int j = 0; j < 3; j++)
+      {
+        for (int i = 0; i < 3; i++)
+        {
+          const unsigned char* texel = texels + ((size_t) ((y + j - 1 + height) % height) * width + (x + i - 1 + width) % width) * 4;
+          h[j][i] = (float) (texel[0] + texel[1] + texel[2]);
+        }
+      }
+      float gx = side * (h[0][2] - h[0][0]) + center * (h[1][2] - h[1][0]) + side * (h[2][2] - h[2][0]);
+      float gy = side * (h[2][0] - h[0][0]) + center * (h[2][1] - h[0][1]) + side * (h[2][2] - h[0][2]);
+      float nx = gx * scale;
+      float ny = gy * scale;
+      float inverseLength = 1.0f / std::sqrt(nx * nx + ny * ny + 1.0f);
+      unsigned char* output = &normals[((size_t) y * width + x) * 4];
+      output[0] = (unsigned char) (int) (inverseLength * 127.5f + 128.0f);
+      output[1] = (unsigned char) (int) (ny * inverseLength * 127.5f + 128.0f);
+      output[2] = (unsigned char) (int) (nx * inverseLength * 127.5f + 128.0f);
+      output[3] = 255;
+    }
+  }
+}
+
+static void runSize(HeightMapConverter& converter, int size)
+{
+  // The noise texture made gray, as heights
+  std::vector<unsigned char> texels;
+  buildNoiseTexture(size, texels);
+  for (size_t i = 0; i < texels.size(); i += 4)
+  {
+    unsigned char gray = (unsigned char) ((texels[i] + texels[i + 1] + texels[i + 2]) / 3);
+    texels[i] = gray;
+    texels[i + 1] = gray;
+    texels[i + 2] = gray;
+    texels[i + 3] = 255;
+  }
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  bool isHeightMap = HeightMapConverter::isHeightMap(texels.data(), size, size);
+  double detectTime = elapsedMilliseconds(start);
+
+  std::vector<unsigned char> normals;
+  double sobelTime = 0.0;
+  double scharrTime = 0.0;
+  for (int run = 0; run < NUM_RUNS; run++)
+  {
+    start = std::chrono::steady_clock::now();
+    converter.convert(texels.data(), size, size, 4.0f, HeightMapConverter::SOBEL_KERNEL, normals);
+    sobelTime += elapsedMilliseconds(start);
+    start = std::chrono::steady_clock::now();
+    converter.convert(texels.data(), size, size, 4.0f, HeightMapConverter::SCHARR_KERNEL, normals);
+    scharrTime += elapsedMilliseconds(start);
+  }
+  sobelTime /= NUM_RUNS;
+  scharrTime /= NUM_RUNS;
+
+  std::vector<unsigned char> reference;
+  start = std::chrono::steady_clock::now();
+  convertReference(texels.data(), size, size, 4.0f, reference);
+  double referenceTime = elapsedMilliseconds(start);
+
+  printf("%5dx%-5d detect %6.2f ms (%s)  sobel %8.2f ms  scharr %8.2f ms %7.1f MTexels/s (%.1fx per texel, %s)\n",
+         size,
+         size,
+         detectTime,
+         isHeightMap ? "height map" : "NOT DETECTED",
+         sobelTime,
+         scharrTime,
+         (double) size * size / (scharrTime * 1000.0),
+         referenceTime / scharrTime,
+         normals == reference ? "exact" : "DIFFERENT");
+}
+
+void runHeightMapBenchmark()
+{
+  HeightMapConverter converter;
+  runSize(converter, 1024);
+  runSize(converter, 4096);
+  runSize(converter, 8192);
+
+  // A normal map must not be taken for a height map
+  std::vector<unsigned char> bumps;
+  buildBumpTexture(1024, 16, bumps);
+  printf("bump normal map detected as a height map: %s\n", HeightMapConverter::isHeightMap(bumps.data(), 1024, 1024) ? "YES" : "no");
+}
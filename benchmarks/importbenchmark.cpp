@@ -0,0 +1,342 @@
+#include "benchmarks.h"
+#include "mesh.h"
+#include "normalmapbaker.h"
+#include "uvsphericalwrapper.h"
+#include "vertexpacker.h"
+
+#include "tiny_obj_loader.h"
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+  #include <sys/resource.h>
+#endif
+
+// The first runs warm the caches and the allocator, their times are
+// dropped
+static const int NUM_WARMUP_RUNS = 1;
+static const int NUM_RUNS = 11;
+// Differences below this are timer and scheduler noise, whatever their
+// fraction of the stage
+static const double MIN_REGRESSION_MILLISECONDS = 0.05;
+
+// Every stage of an import, from the OBJ file to the vertex buffer
+// contents, in order
+enum Stage
+{
+  PARSE_STAGE,
+  LOAD_OBJ_STAGE,
+  FLAT_TRIANGLES_STAGE,
+  SMOOTH_TRIANGLES_STAGE,
+  UV_STAGE,
+  TANGENT_BASIS_STAGE,
+  INTERLEAVE_STAGE,
+  PACK_STAGE,
+  NUM_STAGES
+};
+
+static const char* const STAGE_NAMES[NUM_STAGES] = {
+  "parse",
+  "loadObj",
+  "getTriangles flat",
+  "getTriangles smooth",
+  "UVs",
+  "computeTangentBasis",
+  "interleave",
+  "pack"
+};
+
+struct StageResult
+{
+  double medianMilliseconds;
+  double minMilliseconds;
+  double trianglesPerSecond;
+  size_t peakMemoryBytes;
+};
+
+struct BaselineResult
+{
+  double medianMilliseconds;
+  double minMilliseconds;
+};
+
+// Peak resident memory of the process. Linux resets it before each stage,
+// elsewhere it is the peak since the start.
+static void resetPeakMemory()
+{
+#ifdef __linux__
+  FILE* file = fopen("/proc/self/clear_refs", "w");
+  if (file)
+  {
+    fputs("5", file);
+    fclose(file);
+  }
+#endif
+}
+
+static size_t getPeakMemory()
+{
+#ifdef __linux__
+  FILE* file = fopen("/proc/self/status", "r");
+  if (file)
+  {
+    char line[256];
+    size_t kilobytes = 0;
+    while (fgets(line, sizeof(line), file))
+    {
+      if (sscanf(line, "VmHWM: %zu kB", &kilobytes) == 1)
+      {
+        break;
+      }
+    }
+    fclose(file);
+    return kilobytes * 1024;
+  }
+  return 0;
+#elif defined(__APPLE__)
+  struct rusage usage;
+  return getrusage(RUSAGE_SELF, &usage) == 0 ? (size_t) usage.ru_maxrss : 0;
+#elif defined(__unix__)
+  struct rusage usage;
+  return getrusage(RUSAGE_SELF, &usage) == 0 ? (size_t) usage.ru_maxrss * 1024 : 0;
+#else
+  return 0;
+#endif
+}
+
+// Keyed by model and stage, the results a --json run wrote. Empty when the
+// file cannot be read or holds no such result.
+static std::map<std::string, BaselineResult> readBaseline(const std::string& path)
+{
+  std::map<std::string, BaselineResult> baseline;
+  QFile file(QString::fromStdString(path));
+  if (!file.open(QIODevice::ReadOnly))
+  {
+    printf("cannot read the baseline %s\n", path.c_str());
+    return baseline;
+  }
+  QJsonParseError error;
+  QJsonDocument document = QJsonDocument::fromJson(file.readAll(), &error);
+  if (error.error != QJsonParseError::NoError || !document.isObject())
+  {
+    printf("the baseline %s is not valid JSON\n", path.c_str());
+    return baseline;
+  }
+  QJsonArray results = document.object().value("results").toArray();
+  for (int i = 0; i < results.size(); i++)
+  {
+    QJsonObject result = results[i].toObject();
+    if (result.value("model").isString() &&
+        result.value("stage").isString() &&
+        result.value("median_ms").isDouble() &&
+        result.value("min_ms").isDouble())
+    {
+      BaselineResult baselineResult = { result.value("median_ms").toDouble(), result.value("min_ms").toDouble() };
+      baseline[result.value("model").toString().toStdString() + "/" + result.value("stage").toString().toStdString()] = baselineResult;
+    }
+  }
+  return baseline;
+}
+
+// Each stage is timed on the output of the previous ones, as the renderer
+// runs them on an import
+static void runModel(const std::string& name, StageResult* results, unsigned int& numTriangles)
+{
+  std::string path = getModelPath(name);
+  std::vector<double> times[NUM_STAGES];
+  size_t peaks[NUM_STAGES] = {};
+  numTriangles = 0;
+  for (int run = 0; run < NUM_WARMUP_RUNS + NUM_RUNS; run++)
+  {
+    std::chrono::steady_clock::time_point start;
+    auto beginStage = [&]()
+    {
+      resetPeakMemory();
+      start = std::chrono::steady_clock::now();
+    };
+    auto endStage = [&](Stage stage)
+    {
+      double time = elapsedMilliseconds(start);
+      if (run >= NUM_WARMUP_RUNS)
+      {
+        times[stage].push_back(time);
+        peaks[stage] = std::max(peaks[stage], getPeakMemory());
+      }
+    };
+
+    beginStage();
+    {
+      tinyobj::attrib_t attrib;
+      std::vector<tinyobj::shape_t> shapes;
+      std::vector<tinyobj::material_t> materials;
+      std::string err;
+      if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, path.c_str()))
+      {
+        printf("cannot load %s: %s\n", path.c_str(), err.c_str());
+        return;
+      }
+    }
+    endStage(PARSE_STAGE);
+
+    beginStage();
+    Mesh mesh;
+    mesh.loadObj(path);
+    endStage(LOAD_OBJ_STAGE);
+
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<unsigned int> indices;
+    beginStage();
+    mesh.getTriangles(&positions, &normals, &indices, true);
+    endStage(FLAT_TRIANGLES_STAGE);
+
+    positions.clear();
+    normals.clear();
+    indices.clear();
+    beginStage();
+    mesh.getTriangles(&positions, &normals, &indices, false);
+    endStage(SMOOTH_TRIANGLES_STAGE);
+    numTriangles = (unsigned int) indices.size() / 3;
+
+    // Spherical, the default mapping of the renderer
+    std::vector<glm::vec2> UVs;
+    beginStage();
+    UVSphericalWrapper wrapper;
+    UVs.reserve(positions.size());
+    for (unsigned int v = 0; v < positions.size(); v++)
+    {
+      UVs.push_back(wrapper.uv(positions[v]));
+    }
+    endStage(UV_STAGE);
+
+    std::vector<glm::vec3> tangents;
+    std::vector<glm::vec3> bitangents;
+    beginStage();
+    NormalMapBaker::computeTangentBasis(positions, UVs, indices, tangents, bitangents);
+    endStage(TANGENT_BASIS_STAGE);
+
+    std::vector<InterleavedVertex> vertices;
+    beginStage();
+    VertexPacker::interleave(positions, normals, tangents, bitangents, UVs, vertices);
+    endStage(INTERLEAVE_STAGE);
+
+    std::vector<PackedVertex> packed;
+    VertexPacker packer;
+    beginStage();
+    packer.pack(positions, normals, tangents, bitangents, UVs, packed);
+    endStage(PACK_STAGE);
+  }
+
+  // Medians and minimums, the outliers of a busy machine move neither
+  for (int stage = 0; stage < NUM_STAGES; stage++)
+  {
+    std::vector<double>& stageTimes = times[stage];
+    std::sort(stageTimes.begin(), stageTimes.end());
+    size_t middle = stageTimes.size() / 2;
+    double median = stageTimes.size() % 2 == 1 ? stageTimes[middle] : (stageTimes[middle - 1] + stageTimes[middle]) / 2.0;
+    results[stage].medianMilliseconds = median;
+    results[stage].minMilliseconds = stageTimes[0];
+    results[stage].trianglesPerSecond = median > 0.0 ? numTriangles / (median / 1000.0) : 0.0;
+    results[stage].peakMemoryBytes = peaks[stage];
+  }
+}
+
+void runImportBenchmark()
+{
+  const BenchmarkOptions& options = getBenchmarkOptions();
+  std::map<std::string, BaselineResult> baseline;
+  if (!options.baselinePath.empty())
+  {
+    baseline = readBaseline(options.baselinePath);
+    if (baseline.empty())
+    {
+      // Nothing to compare to, the run would pass whatever its timings
+      printf("no usable results in the baseline %s\n", options.baselinePath.c_str());
+      reportFailure();
+      return;
+    }
+  }
+
+  QJsonArray jsonResults;
+  int numRegressions = 0;
+  for (const std::string& name : getBundledModels())
+  {
+    StageResult results[NUM_STAGES];
+    unsigned int numTriangles = 0;
+    runModel(name, results, numTriangles);
+    if (numTriangles == 0)
+    {
+      continue;
+    }
+    printf("%s, %u triangles\n", name.c_str(), numTriangles);
+    for (int stage = 0; stage < NUM_STAGES; stage++)
+    {
+      const StageResult& result = results[stage];
+      printf("  %-20s median %9.3f ms  min %9.3f ms  %8.2f Mtris/s  peak %7.1f MiB",
+             STAGE_NAMES[stage],
+             result.medianMilliseconds,
+             result.minMilliseconds,
+             result.trianglesPerSecond / 1e6,
+             result.peakMemoryBytes / (1024.0 * 1024.0));
+
+      // The fastest run and the typical one both slower by more than the
+      // threshold, and by more than the noise floor
+      std::map<std::string, BaselineResult>::const_iterator it = baseline.find(name + "/" + STAGE_NAMES[stage]);
+      if (it != baseline.end() && it->second.minMilliseconds > 0.0 && it->second.medianMilliseconds > 0.0)
+      {
+        double minChange = result.minMilliseconds / it->second.minMilliseconds - 1.0;
+        double medianChange = result.medianMilliseconds / it->second.medianMilliseconds - 1.0;
+        bool isRegression = minChange > options.regressionThreshold &&
+                            medianChange > options.regressionThreshold &&
+                            result.minMilliseconds - it->second.minMilliseconds > MIN_REGRESSION_MILLISECONDS;
+        printf("  min %+6.1f%% median %+6.1f%%%s", 100.0 * minChange, 100.0 * medianChange, isRegression ? "  REGRESSION" : "");
+        numRegressions += isRegression ? 1 : 0;
+      }
+      printf("\n");
+
+      QJsonObject jsonResult;
+      jsonResult["model"] = QString::fromStdString(name);
+      jsonResult["stage"] = STAGE_NAMES[stage];
+      jsonResult["triangles"] = (double) numTriangles;
+      jsonResult["median_ms"] = result.medianMilliseconds;
+      jsonResult["min_ms"] = result.minMilliseconds;
+      jsonResult["triangles_per_second"] = result.trianglesPerSecond;
+      jsonResult["peak_memory_bytes"] = (double) result.peakMemoryBytes;
+      jsonResults.append(jsonResult);
+    }
+  }
+
+  if (!options.jsonPath.empty())
+  {
+    QJsonObject root;
+    root["benchmark"] = "import";
+    root["warmup_runs"] = NUM_WARMUP_RUNS;
+    root["runs"] = NUM_RUNS;
+    root["results"] = jsonResults;
+    QFile json(QString::fromStdString(options.jsonPath));
+    if (json.open(QIODevice::WriteOnly | QIODevice::Truncate) && json.write(QJsonDocument(root).toJson()) >= 0)
+    {
+      printf("results written to %s\n", options.jsonPath.c_str());
+    }
+    else
+    {
+      printf("cannot write %s\n", options.jsonPath.c_str());
+    }
+  }
+  if (!baseline.empty())
+  {
+    printf("%d regressions over %.0f%% against %s\n", numRegressions, 100.0 * options.regressionThreshold, options.baselinePath.c_str());
+  }
+  if (numRegressions > 0)
+  {
+    reportRegression();
+  }
+}
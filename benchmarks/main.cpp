@@ -0,0 +1,89 @@
+#include "benchmarks.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static BenchmarkOptions options = { "", "", 0.1 };
+static bool isRegression = false;
+static bool isFailed = false;
+
+const BenchmarkOptions& getBenchmarkOptions()
+{
+  return options;
+}
+
+void reportRegression()
+{
+  isRegression = true;
+}
+
+void reportFailure()
+{
+  isFailed = true;
+}
+
+int main(int argc, char *argv[])
+{
+  // Runs every benchmark, or only the ones named on the command line.
+  // Options: --json <path>, --baseline <path>, --threshold <fraction>.
+  struct Benchmark
+  {
+    const char* name;
+    void (*run)();
+  };
+  const Benchmark benchmarks[] = {
+    { "frustumculling", runFrustumCullingBenchmark },
+    { "occlusionculling", runOcclusionCullingBenchmark },
+    { "softwareraster", runSoftwareRasterBenchmark },
+    { "bvh", runBVHBenchmark },
+    { "raycast", runRayCastBenchmark },
+    { "raytrace", runRayTraceBenchmark },
+    { "aobake", runAOBakeBenchmark },
+    { "normalbake", runNormalBakeBenchmark },
+    { "mipchain", runMipChainBenchmark },
+    { "bcencode", runBlockCompressionBenchmark },
+    { "virtualtexture", runVirtualTextureBenchmark },
+    { "heightmap", runHeightMapBenchmark },
+    { "atlas", runAtlasBenchmark },
+    { "import", runImportBenchmark },
+    { "upload", runUploadBenchmark },
+    { "uniforms", runUniformBenchmark }
+  };
+
+  std::vector<const char*> names;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+    {
+      options.jsonPath = argv[++i];
+    }
+    else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+    {
+      options.baselinePath = argv[++i];
+    }
+    else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+    {
+      options.regressionThreshold = atof(argv[++i]);
+    }
+    else
+    {
+      names.push_back(argv[i]);
+    }
+  }
+
+  for (const Benchmark& benchmark : benchmarks)
+  {
+    bool isSelected = names.empty();
+    for (const char* name : names)
+    {
+      isSelected |= strcmp(name, benchmark.name) == 0;
+    }
+    if (isSelected)
+    {
+      printf("== %s\n", benchmark.name);
+      benchmark.run();
+    }
+  }
+  return isFailed ? 2 : isRegression ? 1 : 0;
+}
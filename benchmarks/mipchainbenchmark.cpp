@@ -0,0 +1,111 @@
+#include "benchmarks.h"
+#include "mipchain.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+static const int NUM_RUNS = 3;
+
+// Plain 2x2 average, for the speedup and exactness of the SIMD one
+static void downsampleBoxReference(const unsigned char* texels, int width, int height, MipLevel& level)
+{
+  level.width = std::max(width / 2, 1);
+  level.height = std::max(height / 2, 1);
+  level.texels.resize((size_t) level.width * level.height * 4);
+  for (int y = 0; y < level.height; y++)
+  {
+    const unsigned char* row0 = texels + (size_t) std::min(2 * y, height - 1) * width * 4;
+    const unsigned char* row1 = texels + (size_t) std::min(2 * y + 1, height - 1) * width * 4;
+    for (int x = 0; x < level.width; x++)
+    {
+      int x0 = std::min(2 * x, width - 1) * 4;
+      int x1 = std::min(2 * x + 1, width - 1) * 4;
+      for (int c = 0; c < 4; c++)
+      {
+        level.texels[((size_t) y * level.width + x) * 4 + c] = (unsigned char) ((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+      }
+    }
+  }
+}
+
+static void runSize(int width, int height)
+{
+  std::vector<unsigned char> checker;
+  buildCheckerTexture(std::max(width, height), 64, checker);
+  // Rows of the square checker, cropped
+  std::vector<unsigned char> texels((size_t) width * height * 4);
+  for (int y = 0; y < height; y++)
+  {
+    std::copy(checker.begin() + (size_t) y * std::max(width, height) * 4,
+              checker.begin() + ((size_t) y * std::max(width, height) + width) * 4,
+              texels.begin() + (size_t) y * width * 4);
+  }
+
+  // Source texels of every level, the full size one and those below it
+  double chainTexels = 0.0;
+  std::vector<MipLevel> levels;
+  MipChain::build(texels.data(), width, height, MipChain::BOX_FILTER, levels);
+  chainTexels += (double) width * height;
+  for (unsigned int i = 0; i + 1 < levels.size(); i++)
+  {
+    chainTexels += (double) levels[i].width * levels[i].height;
+  }
+
+  double boxTime = 0.0;
+  double kaiserTime = 0.0;
+  double referenceTime = 0.0;
+  bool isExact = true;
+  for (int run = 0; run < NUM_RUNS; run++)
+  {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    MipChain::build(texels.data(), width, height, MipChain::BOX_FILTER, levels);
+    boxTime += elapsedMilliseconds(start);
+
+    std::vector<MipLevel> kaiserLevels;
+    start = std::chrono::steady_clock::now();
+    MipChain::build(texels.data(), width, height, MipChain::KAISER_FILTER, kaiserLevels);
+    kaiserTime += elapsedMilliseconds(start);
+
+    std::vector<MipLevel> referenceLevels(levels.size());
+    start = std::chrono::steady_clock::now();
+    const unsigned char* source = texels.data();
+    int sourceWidth = width;
+    int sourceHeight = height;
+    for (unsigned int i = 0; i < referenceLevels.size(); i++)
+    {
+      downsampleBoxReference(source, sourceWidth, sourceHeight, referenceLevels[i]);
+      source = referenceLevels[i].texels.data();
+      sourceWidth = referenceLevels[i].width;
+      sourceHeight = referenceLevels[i].height;
+    }
+    referenceTime += elapsedMilliseconds(start);
+    for (unsigned int i = 0; i < levels.size(); i++)
+    {
+      isExact = isExact && levels[i].texels == referenceLevels[i].texels;
+    }
+  }
+  boxTime /= NUM_RUNS;
+  kaiserTime /= NUM_RUNS;
+  referenceTime /= NUM_RUNS;
+
+  printf("%5dx%-5d levels %2d  box %8.2f ms %7.1f MTexels/s (%.1fx scalar, %s)  kaiser %8.2f ms %7.1f MTexels/s\n",
+         width,
+         height,
+         (int) levels.size() + 1,
+         boxTime,
+         chainTexels / (boxTime * 1000.0),
+         referenceTime / boxTime,
+         isExact ? "exact" : "DIFFERENT",
+         kaiserTime,
+         chainTexels / (kaiserTime * 1000.0));
+}
+
+void runMipChainBenchmark()
+{
+  runSize(1024, 1024);
+  runSize(2048, 2048);
+  runSize(4096, 4096);
+  // Not a power of two, odd sizes round down
+  runSize(1000, 601);
+}
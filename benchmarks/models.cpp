@@ -0,0 +1,82 @@
+#include "benchmarks.h"
+
+#include <QDir>
+
+#include <cstdio>
+
+// Implemented by mesh.cpp
+#include "tiny_obj_loader.h"
+
+#ifndef MODELS_DIR
+#define MODELS_DIR "../3drenderer/models"
+#endif
+
+const std::vector<std::string>& getBundledModels()
+{
+  // Every OBJ file of the directory, listed once, in name order
+  static std::vector<std::string> models;
+  static bool isListed = false;
+  if (!isListed)
+  {
+    QStringList fileNames = QDir(MODELS_DIR).entryList({ "*.obj" }, QDir::Files);
+    for (const QString& fileName : fileNames)
+    {
+      std::string name = fileName.toStdString();
+      models.push_back(name.substr(0, name.size() - 4));
+    }
+    isListed = true;
+  }
+  return models;
+}
+
+std::string getModelPath(const std::string& name)
+{
+  return std::string(MODELS_DIR) + "/" + name + ".obj";
+}
+
+// Triangulated like Mesh::loadObj, without the halfedges
+bool loadModel(const std::string& name, std::vector<glm::vec3>& positions, std::vector<unsigned int>& indices)
+{
+  tinyobj::attrib_t attrib;
+  std::vector<tinyobj::shape_t> shapes;
+  std::vector<tinyobj::material_t> materials;
+  std::string err;
+  std::string path = getModelPath(name);
+  if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, path.c_str()))
+  {
+    printf("cannot load %s: %s\n", path.c_str(), err.c_str());
+    return false;
+  }
+
+  positions.clear();
+  indices.clear();
+  for (size_t v = 0; v < attrib.vertices.size() / 3; v++)
+  {
+    positions.push_back(glm::vec3(attrib.vertices[3 * v], attrib.vertices[3 * v + 1], attrib.vertices[3 * v + 2]));
+  }
+  for (size_t s = 0; s < shapes.size(); s++)
+  {
+    for (size_t i = 0; i < shapes[s].mesh.indices.size(); i++)
+    {
+      indices.push_back(shapes[s].mesh.indices[i].vertex_index);
+    }
+  }
+  return true;
+}
+
+void computeVertexNormals(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices, std::vector<glm::vec3>& normals)
+{
+  normals.assign(positions.size(), glm::vec3(0.0f));
+  for (unsigned int i = 0; i + 2 < indices.size(); i += 3)
+  {
+    glm::vec3 n = glm::cross(positions[indices[i + 1]] - positions[indices[i]], positions[indices[i + 2]] - positions[indices[i]]);
+    for (int k = 0; k < 3; k++)
+    {
+      normals[indices[i + k]] += n;
+    }
+  }
+  for (unsigned int v = 0; v < normals.size(); v++)
+  {
+    normals[v] = glm::length(normals[v]) > 0.0f ? glm::normalize(normals[v]) : glm::vec3(0.0f, 0.0f, 1.0f);
+  }
+}
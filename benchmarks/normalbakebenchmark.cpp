@@ -0,0 +1,84 @@
+#include "benchmarks.h"
+#include "normalmapbaker.h"
+#include "threadpool.h"
+#include "uvsphericalwrapper.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static const int SIZE = 1024;
+// Of the low poly bounds diagonal
+static const float MAX_DISTANCE = 0.05f;
+// Threads of the second bake compared against the first one
+static const int DETERMINISM_THREADS = 4;
+
+static void runPair(const std::string& lowName, const std::string& highName, ThreadPool& threadPool)
+{
+  std::vector<glm::vec3> positions;
+  std::vector<unsigned int> indices;
+  std::vector<glm::vec3> normals;
+  std::vector<glm::vec3> highPositions;
+  std::vector<unsigned int> highIndices;
+  std::vector<glm::vec3> highNormals;
+  if (!loadModel(lowName, positions, indices) || positions.empty() ||
+      !loadModel(highName, highPositions, highIndices) || highPositions.empty())
+  {
+    return;
+  }
+  computeVertexNormals(positions, indices, normals);
+  computeVertexNormals(highPositions, highIndices, highNormals);
+
+  // Spherical UVs, as the renderer maps them by default
+  UVSphericalWrapper wrapper;
+  std::vector<glm::vec2> UVs;
+  glm::vec3 min = positions[0];
+  glm::vec3 max = positions[0];
+  for (unsigned int v = 0; v < positions.size(); v++)
+  {
+    UVs.push_back(wrapper.uv(positions[v]));
+    min = glm::min(min, positions[v]);
+    max = glm::max(max, positions[v]);
+  }
+  float maxDistance = MAX_DISTANCE * glm::length(max - min);
+
+  NormalMapBaker baker(&threadPool);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  baker.setHighPolyMesh(highPositions, highNormals, highIndices);
+  double buildTime = elapsedMilliseconds(start);
+
+  std::vector<unsigned char> texels;
+  start = std::chrono::steady_clock::now();
+  baker.bake(positions, normals, UVs, indices, SIZE, SIZE, maxDistance, texels);
+  double time = elapsedMilliseconds(start);
+  int coveredTexels = baker.getCoveredTexels();
+
+  ThreadPool otherThreadPool(DETERMINISM_THREADS);
+  NormalMapBaker otherBaker(&otherThreadPool);
+  otherBaker.setHighPolyMesh(highPositions, highNormals, highIndices);
+  std::vector<unsigned char> otherTexels;
+  otherBaker.bake(positions, normals, UVs, indices, SIZE, SIZE, maxDistance, otherTexels);
+  bool isDeterministic = otherTexels.size() == texels.size() &&
+                         memcmp(otherTexels.data(), texels.data(), texels.size()) == 0;
+
+  printf("%-12s on %-14s %dx%d  build %7.2f ms  bake %8.2f ms  %6.2f MTexels/s  covered %5.1f%%  %s with %d threads\n",
+         lowName.c_str(),
+         highName.c_str(),
+         SIZE,
+         SIZE,
+         buildTime,
+         time,
+         coveredTexels / (time * 1000.0),
+         100.0 * coveredTexels / (SIZE * SIZE),
+         isDeterministic ? "same" : "DIFFERENT",
+         DETERMINISM_THREADS);
+}
+
+void runNormalBakeBenchmark()
+{
+  ThreadPool hardware;
+  printf("max distance %.2f of the diagonal  threads %d\n", MAX_DISTANCE, hardware.getNumThreads());
+  runPair("sphere_32", "sphere_2000", hardware);
+  runPair("sphere_2000", "sphere_2000", hardware);
+  runPair("cow_2904", "cow_2904", hardware);
+}
@@ -0,0 +1,111 @@
+#include "benchmarks.h"
+#include "frustumculler.h"
+#include "occlusionculler.h"
+#include "threadpool.h"
+
+#include "glm/gtc/matrix_transform.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+static const int NUM_FRAMES = 100;
+static const int MAX_OCCLUDERS = 512;
+
+// Unit cube, counter clockwise faces
+static void buildCubeMesh(std::vector<glm::vec3>& positions, std::vector<unsigned int>& indices)
+{
+  positions.clear();
+  for (int corner = 0; corner < 8; corner++)
+  {
+    positions.push_back(glm::vec3(corner & 1 ? 1.0f : 0.0f, corner & 2 ? 1.0f : 0.0f, corner & 4 ? 1.0f : 0.0f));
+  }
+  indices = {
+    0, 4, 6,  0, 6, 2,
+    1, 3, 7,  1, 7, 5,
+    0, 1, 5,  0, 5, 4,
+    2, 6, 7,  2, 7, 3,
+    0, 2, 3,  0, 3, 1,
+    4, 5, 7,  4, 7, 6
+  };
+}
+
+void runOcclusionCullingBenchmark()
+{
+  std::vector<BoundingBox> bounds;
+  buildGroundScene(bounds, SYNTHETIC_SCENE_OBJECTS);
+
+  std::vector<glm::vec3> cubePositions;
+  std::vector<unsigned int> cubeIndices;
+  buildCubeMesh(cubePositions, cubeIndices);
+
+  FrustumCuller frustumCuller;
+  frustumCuller.build(bounds);
+
+  ThreadPool threadPool;
+  OcclusionCuller occlusionCuller(256, 128, &threadPool);
+
+  std::vector<unsigned int> frustumVisible;
+  std::vector<unsigned int> visible;
+  std::vector<std::pair<float, unsigned int> > occluderCandidates;
+  double frustumTime = 0.0;
+  double occluderTime = 0.0;
+  double testTime = 0.0;
+  size_t totalFrustumVisible = 0;
+  size_t totalVisible = 0;
+  float eyeHeight = 2.0f;
+  for (int frame = 0; frame < NUM_FRAMES; frame++)
+  {
+    glm::mat4 viewProjection = getFrameViewProjection(frame, eyeHeight);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    frustumCuller.cull(viewProjection, frustumVisible);
+    frustumTime += elapsedMilliseconds(start);
+
+    // The nearest objects make the occluders
+    start = std::chrono::steady_clock::now();
+    occluderCandidates.clear();
+    for (unsigned int i = 0; i < frustumVisible.size(); i++)
+    {
+      const BoundingBox& box = bounds[frustumVisible[i]];
+      glm::vec3 center = (box.min + box.max) * 0.5f;
+      glm::vec3 toCenter = center - glm::vec3(3.0f, eyeHeight, 3.0f);
+      occluderCandidates.push_back(std::make_pair(glm::dot(toCenter, toCenter), frustumVisible[i]));
+    }
+    size_t numOccluders = std::min(occluderCandidates.size(), (size_t) MAX_OCCLUDERS);
+    std::partial_sort(occluderCandidates.begin(), occluderCandidates.begin() + numOccluders, occluderCandidates.end());
+
+    occlusionCuller.clearOccluders();
+    for (size_t i = 0; i < numOccluders; i++)
+    {
+      const BoundingBox& box = bounds[occluderCandidates[i].second];
+      glm::mat4 model = glm::scale(glm::translate(glm::mat4(), box.min), box.max - box.min);
+      occlusionCuller.addOccluder(cubePositions, cubeIndices, model);
+    }
+    occlusionCuller.render(viewProjection);
+    occluderTime += elapsedMilliseconds(start);
+
+    start = std::chrono::steady_clock::now();
+    occlusionCuller.cull(bounds, frustumVisible, visible);
+    testTime += elapsedMilliseconds(start);
+
+    totalFrustumVisible += frustumVisible.size();
+    totalVisible += visible.size();
+  }
+
+  printf("ground   objects %d  threads %d  depth buffer %dx%d  occluders %d\n",
+         (int) bounds.size(),
+         threadPool.getNumThreads(),
+         occlusionCuller.getWidth(),
+         occlusionCuller.getHeight(),
+         MAX_OCCLUDERS);
+  printf("ground   frustum visible %.1f%%  occlusion culled %.1f%% of them  visible %.1f%%\n",
+         100.0 * totalFrustumVisible / ((double) NUM_FRAMES * bounds.size()),
+         100.0 * (totalFrustumVisible - totalVisible) / (double) std::max(totalFrustumVisible, (size_t) 1),
+         100.0 * totalVisible / ((double) NUM_FRAMES * bounds.size()));
+  printf("ground   frustum %.3f ms  occluders %.3f ms  tests %.3f ms  total %.3f ms/frame\n",
+         frustumTime / NUM_FRAMES,
+         occluderTime / NUM_FRAMES,
+         testTime / NUM_FRAMES,
+         (frustumTime + occluderTime + testTime) / NUM_FRAMES);
+}
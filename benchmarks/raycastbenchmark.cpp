@@ -0,0 +1,118 @@
+#include "benchmarks.h"
+#include "raycaster.h"
+#include "threadpool.h"
+
+#include "glm/gtc/matrix_transform.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+static const int VIEW_SIZE = 512;
+static const int NUM_LATENCY_RAYS = 2000;
+
+// Primary rays of a square view framing the bounds, as Camera::getRay
+// builds them
+static void buildViewRays(const BoundingBox& bounds, std::vector<Ray>& rays)
+{
+  glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+  float radius = glm::length(bounds.max - bounds.min) * 0.5f;
+  glm::vec3 eye = center + radius * glm::vec3(0.6f, 0.5f, 2.2f);
+  glm::mat4 view = glm::lookAt(eye, center, glm::vec3(0.0f, 1.0f, 0.0f));
+  glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.01f * radius, 10.0f * radius);
+  glm::mat4 inverseViewProjection = glm::inverse(projection * view);
+
+  rays.resize(VIEW_SIZE * VIEW_SIZE);
+  for (int y = 0; y < VIEW_SIZE; y++)
+  {
+    for (int x = 0; x < VIEW_SIZE; x++)
+    {
+      glm::vec2 ndc = 2.0f * glm::vec2(x + 0.5f, y + 0.5f) / (float) VIEW_SIZE - 1.0f;
+      glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndc, -1.0f, 1.0f);
+      glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndc, 1.0f, 1.0f);
+      Ray& ray = rays[y * VIEW_SIZE + x];
+      ray.origin = glm::vec3(nearPoint) / nearPoint.w;
+      ray.direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - ray.origin);
+      ray.tMin = 0.0f;
+      ray.tMax = 1e30f;
+    }
+  }
+}
+
+static void runModel(const char* name, const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices, ThreadPool& threadPool)
+{
+  RayCaster rayCaster(&threadPool);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  rayCaster.build(positions, indices);
+  double buildTime = elapsedMilliseconds(start);
+
+  BoundingBox bounds = { positions[0], positions[0] };
+  for (unsigned int v = 0; v < positions.size(); v++)
+  {
+    bounds.min = glm::min(bounds.min, positions[v]);
+    bounds.max = glm::max(bounds.max, positions[v]);
+  }
+  std::vector<Ray> rays;
+  buildViewRays(bounds, rays);
+
+  // One at a time like mouse picks, spread over the view
+  double worstLatency = 0.0;
+  double totalLatency = 0.0;
+  for (int i = 0; i < NUM_LATENCY_RAYS; i++)
+  {
+    const Ray& ray = rays[(i * 7919) % rays.size()];
+    RayHit hit;
+    std::chrono::steady_clock::time_point rayStart = std::chrono::steady_clock::now();
+    rayCaster.intersect(ray, hit);
+    double latency = elapsedMilliseconds(rayStart) * 1000.0;
+    worstLatency = std::max(worstLatency, latency);
+    totalLatency += latency;
+  }
+
+  std::vector<RayHit> hits;
+  start = std::chrono::steady_clock::now();
+  rayCaster.intersect(rays, hits);
+  double batchTime = elapsedMilliseconds(start);
+  int numHits = 0;
+  for (unsigned int i = 0; i < hits.size(); i++)
+  {
+    numHits += hits[i].triangle >= 0;
+  }
+
+  printf("%-13s %8zu tris  build %7.1f ms  pick %5.2f us (worst %6.2f)  batch %6.2f Mrays/s  hits %.1f%%\n",
+         name,
+         indices.size() / 3,
+         buildTime,
+         totalLatency / NUM_LATENCY_RAYS,
+         worstLatency,
+         rays.size() / (batchTime * 1000.0),
+         100.0 * numHits / rays.size());
+}
+
+void runRayCastBenchmark()
+{
+  ThreadPool threadPool;
+  printf("threads %d\n", threadPool.getNumThreads());
+  for (const std::string& name : getBundledModels())
+  {
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned int> indices;
+    if (loadModel(name, positions, indices))
+    {
+      runModel(name.c_str(), positions, indices, threadPool);
+    }
+  }
+
+  // A million triangles, with bumps so the tree is not a plain sphere one
+  std::vector<InterleavedVertex> vertices;
+  std::vector<unsigned int> indices;
+  buildSphereMesh(1000, 500, vertices, indices);
+  std::vector<glm::vec3> positions(vertices.size());
+  for (unsigned int v = 0; v < vertices.size(); v++)
+  {
+    glm::vec3 p = vertices[v].pos;
+    positions[v] = p * (1.0f + 0.05f * std::sin(40.0f * p.x) * std::sin(40.0f * p.y) * std::sin(40.0f * p.z));
+  }
+  runModel("bumpy_sphere", positions, indices, threadPool);
+}
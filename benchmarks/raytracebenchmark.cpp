@@ -0,0 +1,186 @@
+#include "benchmarks.h"
+#include "raytracer.h"
+#include "threadpool.h"
+
+#include "glm/gtc/matrix_transform.hpp"
+
+#include <cstdio>
+#include <vector>
+
+static const int NUM_FRAMES = 3;
+static const int WIDTH = 1280;
+static const int HEIGHT = 720;
+static const int GRID_SIDE = 6;
+// Threads of the second render compared against the first one
+static const int DETERMINISM_THREADS = 4;
+
+struct TraceScene
+{
+  std::vector<InterleavedVertex> vertices;
+  std::vector<unsigned int> indices;
+  glm::mat4 view;
+  // The mesh once, or as a grid of instances
+  bool isGrid;
+};
+
+// FNV-1a over the pixels
+static unsigned long long hashImage(const std::vector<unsigned char>& color)
+{
+  unsigned long long hash = 14695981039346656037ull;
+  for (unsigned int i = 0; i < color.size(); i++)
+  {
+    hash = (hash ^ color[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+static void renderFrame(RayTracer& rayTracer, const TraceScene& scene, const SoftwareShading& shading, int frame)
+{
+  glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float) WIDTH / HEIGHT, 0.1f, 100.0f);
+  unsigned int numIndices = (unsigned int) scene.indices.size();
+  unsigned int numVertices = (unsigned int) scene.vertices.size();
+  rayTracer.beginFrame(WIDTH, HEIGHT, scene.view, projection, shading);
+  int numInstances = scene.isGrid ? GRID_SIDE * GRID_SIDE : 1;
+  for (int i = 0; i < numInstances; i++)
+  {
+    // Same grid as the software raster benchmark
+    glm::vec3 position(0.0f);
+    if (scene.isGrid)
+    {
+      position = glm::vec3((i % GRID_SIDE - (GRID_SIDE - 1) * 0.5f) * 1.6f, (i / GRID_SIDE - (GRID_SIDE - 1) * 0.5f) * 1.0f, 0.0f);
+    }
+    InstanceData instance;
+    instance.model = glm::rotate(glm::translate(glm::mat4(), position), 0.05f * frame + i, glm::vec3(0.0f, 1.0f, 0.0f));
+    instance.model = glm::scale(instance.model, glm::vec3(0.75f));
+    instance.normalModel = glm::mat4(glm::transpose(glm::inverse(glm::mat3(instance.model))));
+    instance.material = glm::vec4(0.2f + 0.6f * (i % 3) / 2.0f, 0.5f, 0.8f, 32.0f);
+    rayTracer.draw(0, numVertices, 0, numIndices, instance);
+  }
+  rayTracer.endFrame();
+}
+
+static void runShading(const char* name, const TraceScene& scene, const SoftwareShading& shading, bool isPacketTraversal, ThreadPool& threadPool)
+{
+  std::vector<unsigned char> checker;
+  std::vector<unsigned char> bumps;
+  buildCheckerTexture(512, 16, checker);
+  buildBumpTexture(512, 32, bumps);
+
+  RayTracer rayTracer(&threadPool);
+  rayTracer.setGeometry(scene.vertices, scene.indices);
+  rayTracer.setDiffuseTexture(checker.data(), 512, 512);
+  rayTracer.setBumpMap(bumps.data(), 512, 512);
+  rayTracer.setPacketTraversal(isPacketTraversal);
+
+  // The first frame builds the mesh BVH, kept by the next ones
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  renderFrame(rayTracer, scene, shading, 0);
+  double firstTime = elapsedMilliseconds(start);
+
+  unsigned long long numRays = 0;
+  start = std::chrono::steady_clock::now();
+  for (int frame = 0; frame < NUM_FRAMES; frame++)
+  {
+    renderFrame(rayTracer, scene, shading, frame);
+    numRays += rayTracer.getNumRays();
+  }
+  double time = elapsedMilliseconds(start);
+  unsigned long long hash = hashImage(rayTracer.getColorBuffer());
+
+  // The same frame again, over another number of threads
+  ThreadPool otherThreadPool(DETERMINISM_THREADS);
+  RayTracer otherRayTracer(&otherThreadPool);
+  otherRayTracer.setGeometry(scene.vertices, scene.indices);
+  otherRayTracer.setDiffuseTexture(checker.data(), 512, 512);
+  otherRayTracer.setBumpMap(bumps.data(), 512, 512);
+  otherRayTracer.setPacketTraversal(isPacketTraversal);
+  renderFrame(otherRayTracer, scene, shading, NUM_FRAMES - 1);
+  bool isDeterministic = hashImage(otherRayTracer.getColorBuffer()) == hash;
+
+  printf("%-10s %-7s threads %d  first %.2f ms  %.2f ms/frame  %.2f MRays/s  hash %016llx  %s with %d threads\n",
+         name,
+         isPacketTraversal ? "packet" : "single",
+         rayTracer.getNumThreads(),
+         firstTime,
+         time / NUM_FRAMES,
+         (double) numRays / (time * 1000.0),
+         hash,
+         isDeterministic ? "same" : "DIFFERENT",
+         DETERMINISM_THREADS);
+}
+
+static void runScene(const TraceScene& scene, ThreadPool& threadPool)
+{
+  runShading("plain", scene, { false, false, false, false }, true, threadPool);
+  runShading("plain", scene, { false, false, false, false }, false, threadPool);
+  runShading("edges", scene, { false, true, false, false }, true, threadPool);
+  runShading("textured", scene, { false, false, true, true }, true, threadPool);
+  runShading("wireframe", scene, { true, false, false, false }, true, threadPool);
+}
+
+// Any tangent frame around the smooth normals
+static void buildModelVertices(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices, std::vector<InterleavedVertex>& vertices)
+{
+  std::vector<glm::vec3> normals;
+  computeVertexNormals(positions, indices, normals);
+  vertices.resize(positions.size());
+  for (unsigned int v = 0; v < positions.size(); v++)
+  {
+    glm::vec3 n = normals[v];
+    glm::vec3 t = glm::normalize(glm::cross(std::abs(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f), n));
+    InterleavedVertex& vertex = vertices[v];
+    vertex.pos = positions[v];
+    vertex.normal = n;
+    vertex.tangent = t;
+    vertex.bitangent = glm::cross(n, t);
+    vertex.uv = glm::vec2(positions[v].x, positions[v].y);
+  }
+}
+
+void runRayTraceBenchmark()
+{
+  std::vector<TraceScene> scenes(1);
+  std::vector<std::string> names(1, "spheres");
+  buildSphereMesh(64, 32, scenes[0].vertices, scenes[0].indices);
+  scenes[0].view = glm::lookAt(glm::vec3(0.0f, 0.0f, 9.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+  scenes[0].isGrid = true;
+
+  // The largest bundled model, framed
+  std::vector<glm::vec3> positions;
+  std::vector<unsigned int> indices;
+  if (loadModel("dragon_50000", positions, indices) && !positions.empty())
+  {
+    TraceScene scene;
+    glm::vec3 min = positions[0];
+    glm::vec3 max = positions[0];
+    for (unsigned int v = 0; v < positions.size(); v++)
+    {
+      min = glm::min(min, positions[v]);
+      max = glm::max(max, positions[v]);
+    }
+    float scale = 2.0f / glm::length(max - min);
+    for (unsigned int v = 0; v < positions.size(); v++)
+    {
+      positions[v] = (positions[v] - (min + max) * 0.5f) * scale;
+    }
+    buildModelVertices(positions, indices, scene.vertices);
+    scene.indices = indices;
+    scene.view = glm::lookAt(glm::vec3(0.3f, 0.4f, 2.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    scene.isGrid = false;
+    scenes.push_back(scene);
+    names.push_back("dragon_50000");
+  }
+
+  ThreadPool hardware;
+  for (unsigned int s = 0; s < scenes.size(); s++)
+  {
+    int numInstances = scenes[s].isGrid ? GRID_SIDE * GRID_SIDE : 1;
+    printf("%s  instances %d  triangles %d  %dx%d\n",
+           names[s].c_str(),
+           numInstances,
+           (int) scenes[s].indices.size() / 3 * numInstances,
+           WIDTH,
+           HEIGHT);
+    runScene(scenes[s], hardware);
+  }
+}
@@ -0,0 +1,90 @@
+#include "benchmarks.h"
+#include "softwarerenderer.h"
+#include "threadpool.h"
+
+#include "glm/gtc/matrix_transform.hpp"
+
+#include <cstdio>
+#include <vector>
+
+static const int NUM_FRAMES = 30;
+static const int WIDTH = 1280;
+static const int HEIGHT = 720;
+static const int GRID_SIDE = 6;
+
+static void runShading(const char* name, SoftwareRenderer& renderer, const SoftwareShading& shading, unsigned int numIndices, unsigned int numVertices)
+{
+  glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float) WIDTH / HEIGHT, 0.1f, 100.0f);
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int frame = 0; frame < NUM_FRAMES; frame++)
+  {
+    // A grid of spheres filling the view, turning a little every frame
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 9.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    renderer.beginFrame(WIDTH, HEIGHT, view, projection, shading);
+    for (int i = 0; i < GRID_SIDE * GRID_SIDE; i++)
+    {
+      glm::vec3 position((i % GRID_SIDE - (GRID_SIDE - 1) * 0.5f) * 1.6f, (i / GRID_SIDE - (GRID_SIDE - 1) * 0.5f) * 1.0f, 0.0f);
+      InstanceData instance;
+      instance.model = glm::rotate(glm::translate(glm::mat4(), position), 0.05f * frame + i, glm::vec3(0.0f, 1.0f, 0.0f));
+      instance.model = glm::scale(instance.model, glm::vec3(0.75f));
+      instance.normalModel = glm::mat4(glm::transpose(glm::inverse(glm::mat3(instance.model))));
+      instance.material = glm::vec4(0.2f + 0.6f * (i % 3) / 2.0f, 0.5f, 0.8f, 32.0f);
+      renderer.draw(0, numVertices, 0, numIndices, instance);
+    }
+    renderer.endFrame();
+  }
+  double time = elapsedMilliseconds(start);
+
+  // Coverage of the last frame, to make sense of the fill rate
+  const std::vector<unsigned char>& color = renderer.getColorBuffer();
+  int covered = 0;
+  for (int i = 0; i < WIDTH * HEIGHT; i++)
+  {
+    covered += color[4 * i] != 0 || color[4 * i + 1] != 0 || color[4 * i + 2] != 0;
+  }
+
+  printf("%-10s threads %d  %.2f ms/frame  %.1f MPix/s  %.2f MTri/s  covered %.1f%%\n",
+         name,
+         renderer.getNumThreads(),
+         time / NUM_FRAMES,
+         (double) WIDTH * HEIGHT * NUM_FRAMES / (time * 1000.0),
+         (double) numIndices / 3 * GRID_SIDE * GRID_SIDE * NUM_FRAMES / (time * 1000.0),
+         100.0 * covered / (WIDTH * HEIGHT));
+}
+
+static void runThreads(int numThreads, const std::vector<InterleavedVertex>& vertices, const std::vector<unsigned int>& indices)
+{
+  std::vector<unsigned char> checker;
+  std::vector<unsigned char> bumps;
+  buildCheckerTexture(512, 16, checker);
+  buildBumpTexture(512, 32, bumps);
+
+  ThreadPool threadPool(numThreads);
+  SoftwareRenderer renderer(&threadPool);
+  renderer.setGeometry(vertices, indices);
+  renderer.setDiffuseTexture(checker.data(), 512, 512);
+  renderer.setBumpMap(bumps.data(), 512, 512);
+
+  unsigned int numIndices = (unsigned int) indices.size();
+  unsigned int numVertices = (unsigned int) vertices.size();
+  runShading("plain", renderer, { false, false, false, false }, numIndices, numVertices);
+  runShading("edges", renderer, { false, true, false, false }, numIndices, numVertices);
+  runShading("textured", renderer, { false, false, true, true }, numIndices, numVertices);
+  runShading("wireframe", renderer, { true, false, false, false }, numIndices, numVertices);
+}
+
+void runSoftwareRasterBenchmark()
+{
+  std::vector<InterleavedVertex> vertices;
+  std::vector<unsigned int> indices;
+  buildSphereMesh(64, 32, vertices, indices);
+  printf("spheres %d  triangles %d  %dx%d\n", GRID_SIDE * GRID_SIDE, (int) indices.size() / 3 * GRID_SIDE * GRID_SIDE, WIDTH, HEIGHT);
+
+  runThreads(1, vertices, indices);
+  ThreadPool hardware;
+  if (hardware.getNumThreads() > 1)
+  {
+    runThreads(hardware.getNumThreads(), vertices, indices);
+  }
+}
@@ -0,0 +1,162 @@
+#include "benchmarks.h"
+
+#include "glm/gtc/matrix_transform.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+// Objects spread in a cube around the camera
+void buildVolumeScene(std::vector<BoundingBox>& bounds, int numObjects)
+{
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+  std::uniform_real_distribution<float> size(0.5f, 5.0f);
+  bounds.resize(numObjects);
+  for (int i = 0; i < numObjects; i++)
+  {
+    glm::vec3 center(position(random), position(random), position(random));
+    glm::vec3 halfExtent(size(random), size(random), size(random));
+    bounds[i] = { center - halfExtent, center + halfExtent };
+  }
+}
+
+// City blocks on a ground plane, 6 units apart with streets in between
+void buildGroundScene(std::vector<BoundingBox>& bounds, int numObjects)
+{
+  std::mt19937 random(2);
+  std::uniform_real_distribution<float> jitter(-1.0f, 1.0f);
+  std::uniform_real_distribution<float> height(1.0f, 20.0f);
+  int side = (int) std::ceil(std::sqrt((float) numObjects));
+  bounds.resize(numObjects);
+  for (int i = 0; i < numObjects; i++)
+  {
+    glm::vec3 base(((i % side) - side / 2) * 6.0f + jitter(random), 0.0f, ((i / side) - side / 2) * 6.0f + jitter(random));
+    bounds[i] = { base - glm::vec3(1.5f, 0.0f, 1.5f), base + glm::vec3(1.5f, height(random), 1.5f) };
+  }
+}
+
+// The camera stands at a crossing and turns a little every frame, as it
+// would under user input
+glm::mat4 getFrameViewProjection(int frame, float eyeHeight)
+{
+  float angle = frame * 0.03f;
+  glm::vec3 eye(3.0f, eyeHeight, 3.0f);
+  glm::vec3 at = eye + glm::vec3(glm::cos(angle), -0.1f, glm::sin(angle));
+  glm::mat4 view = glm::lookAt(eye, at, glm::vec3(0.0f, 1.0f, 0.0f));
+  glm::mat4 proj = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+  return proj * view;
+}
+
+void buildSphereMesh(int slices, int stacks, std::vector<InterleavedVertex>& vertices, std::vector<unsigned int>& indices)
+{
+  const float pi = 3.14159265f;
+  vertices.clear();
+  indices.clear();
+  for (int j = 0; j <= stacks; j++)
+  {
+    float v = (float) j / stacks;
+    float theta = v * pi;
+    for (int i = 0; i <= slices; i++)
+    {
+      float u = (float) i / slices;
+      float phi = u * 2.0f * pi;
+      glm::vec3 normal(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+      glm::vec3 tangent(-std::sin(phi), 0.0f, std::cos(phi));
+      vertices.push_back({ normal, normal, tangent, glm::cross(normal, tangent), glm::vec2(u, v) });
+    }
+  }
+  for (int j = 0; j < stacks; j++)
+  {
+    for (int i = 0; i < slices; i++)
+    {
+      unsigned int a = j * (slices + 1) + i;
+      unsigned int b = a + slices + 1;
+      indices.insert(indices.end(), { a, b, a + 1, a + 1, b, b + 1 });
+    }
+  }
+}
+
+void buildCheckerTexture(int size, int squares, std::vector<unsigned char>& texels)
+{
+  texels.resize(4 * size * size);
+  int squareSize = std::max(size / squares, 1);
+  for (int y = 0; y < size; y++)
+  {
+    for (int x = 0; x < size; x++)
+    {
+      bool isLight = ((x / squareSize) + (y / squareSize)) % 2 == 0;
+      unsigned char* texel = &texels[4 * (y * size + x)];
+      texel[0] = isLight ? 230 : 40;
+      texel[1] = isLight ? 200 : 60;
+      texel[2] = isLight ? 120 : 160;
+      texel[3] = 255;
+    }
+  }
+}
+
+void buildBumpTexture(int size, int bumps, std::vector<unsigned char>& texels)
+{
+  const float pi = 3.14159265f;
+  texels.resize(4 * size * size);
+  for (int y = 0; y < size; y++)
+  {
+    for (int x = 0; x < size; x++)
+    {
+      float dx = 0.5f * std::cos(2.0f * pi * bumps * x / size);
+      float dy = 0.5f * std::cos(2.0f * pi * bumps * y / size);
+      glm::vec3 normal = glm::normalize(glm::vec3(-dx, -dy, 1.0f)) * 0.5f + 0.5f;
+      // Read back as .bgr
+      unsigned char* texel = &texels[4 * (y * size + x)];
+      texel[0] = (unsigned char) (normal.z * 255.0f);
+      texel[1] = (unsigned char) (normal.y * 255.0f);
+      texel[2] = (unsigned char) (normal.x * 255.0f);
+      texel[3] = 255;
+    }
+  }
+}
+
+// Bilinear value noise of random lattice values, smoothstep interpolated
+static void addValueNoise(int size, int cells, float amplitude, std::mt19937& random, std::vector<float>& values)
+{
+  std::uniform_real_distribution<float> value(-amplitude, amplitude);
+  std::vector<float> lattice(cells * cells);
+  for (float& v : lattice)
+  {
+    v = value(random);
+  }
+  for (int y = 0; y < size; y++)
+  {
+    float fy = (float) y * cells / size;
+    int y0 = (int) fy;
+    float ty = fy - y0;
+    ty = ty * ty * (3.0f - 2.0f * ty);
+    for (int x = 0; x < size; x++)
+    {
+      float fx = (float) x * cells / size;
+      int x0 = (int) fx;
+      float tx = fx - x0;
+      tx = tx * tx * (3.0f - 2.0f * tx);
+      float a = lattice[y0 * cells + x0] * (1.0f - tx) + lattice[y0 * cells + (x0 + 1) % cells] * tx;
+      float b = lattice[((y0 + 1) % cells) * cells + x0] * (1.0f - tx) + lattice[((y0 + 1) % cells) * cells + (x0 + 1) % cells] * tx;
+      values[y * size + x] += a * (1.0f - ty) + b * ty;
+    }
+  }
+}
+
+void buildNoiseTexture(int size, std::vector<unsigned char>& texels)
+{
+  std::mt19937 random(1);
+  texels.resize(4 * size * size);
+  for (int c = 0; c < 4; c++)
+  {
+    std::vector<float> values(size * size, 128.0f);
+    addValueNoise(size, 4, 80.0f, random, values);
+    addValueNoise(size, 32, 30.0f, random, values);
+    addValueNoise(size, 256, 12.0f, random, values);
+    for (int i = 0; i < size * size; i++)
+    {
+      texels[4 * i + c] = (unsigned char) std::min(std::max(values[i] + 0.5f, 0.0f), 255.0f);
+    }
+  }
+}
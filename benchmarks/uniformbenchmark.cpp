@@ -0,0 +1,276 @@
+#include "benchmarks.h"
+#include "uniformbuffer.h"
+
+#include <QGuiApplication>
+#include <QMatrix4x4>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QSurfaceFormat>
+#include <QVector3D>
+
+#include "glm/gtc/matrix_transform.hpp"
+#include "glm/gtc/type_ptr.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+// CPU time of the per-frame state update of RenderWidget::paintGL, before
+// and after the std140 uniform blocks. Before: 13 uniforms set by name
+// through QOpenGLShaderProgram and the normal matrix inverted every frame.
+// After: the FrameBlock, MaterialBlock and VirtualTextureBlock buffers,
+// re-uploaded only when their bytes change. Nothing is drawn, both
+// programs only declare the state the renderer shaders read.
+
+static const int FRAMES = 200000;
+
+static const char* NAME_LOOKUP_VERTEX_SHADER =
+  "#version 420 core\n"
+  "layout( location = 0 ) in vec3 vertexPositionMSpace;\n"
+  "layout( location = 1 ) in vec3 vertexNormalMSpace;\n"
+  "uniform mat4 mv;\n"
+  "uniform mat4 mv_ti;\n"
+  "uniform mat4 mvp;\n"
+  "uniform bool isPackedVertexFormat;\n"
+  "out vec3 normalCSpace;\n"
+  "out vec3 positionCSpace;\n"
+  "void main()\n"
+  "{\n"
+  "  vec3 normal = isPackedVertexFormat ? -vertexNormalMSpace : vertexNormalMSpace;\n"
+  "  normalCSpace = mat3(mv_ti) * normal;\n"
+  "  positionCSpace = vec3(mv * vec4(vertexPositionMSpace, 1.0));\n"
+  "  gl_Position = mvp * vec4(vertexPositionMSpace, 1.0);\n"
+  "}\n";
+
+static const char* NAME_LOOKUP_FRAGMENT_SHADER =
+  "#version 420 core\n"
+  "in vec3 normalCSpace;\n"
+  "in vec3 positionCSpace;\n"
+  "uniform bool isWireframeOverwrite;\n"
+  "uniform bool isEdgesVisible;\n"
+  "uniform bool isFlatFaces;\n"
+  "uniform bool isDiffuseTextureActive;\n"
+  "uniform bool isBumpMapActive;\n"
+  "uniform sampler2D diffuseTextureSampler;\n"
+  "uniform sampler2D bumpMapSampler;\n"
+  "uniform vec3 diffuseColor;\n"
+  "uniform float materialShininess;\n"
+  "out vec4 color;\n"
+  "void main()\n"
+  "{\n"
+  "  vec3 diffuse = diffuseColor;\n"
+  "  if(isDiffuseTextureActive) diffuse *= texture(diffuseTextureSampler, positionCSpace.xy).bgr;\n"
+  "  if(isBumpMapActive) diffuse *= texture(bumpMapSampler, positionCSpace.xy).rgb;\n"
+  "  if(isWireframeOverwrite || isEdgesVisible || isFlatFaces) diffuse = 1.0 - diffuse;\n"
+  "  float lambert = max(dot(normalize(normalCSpace), vec3(0.0, 0.0, 1.0)), 0.0);\n"
+  "  color = vec4(diffuse * lambert + pow(lambert, materialShininess), 1.0);\n"
+  "}\n";
+
+static const char* BLOCK_VERTEX_SHADER =
+  "#version 420 core\n"
+  "layout( location = 0 ) in vec3 vertexPositionMSpace;\n"
+  "layout( location = 1 ) in vec3 vertexNormalMSpace;\n"
+  "layout( std140, binding = 0 ) uniform FrameBlock\n"
+  "{\n"
+  "  mat4 view;\n"
+  "  mat4 viewProjection;\n"
+  "};\n"
+  "layout( std140, binding = 1 ) uniform MaterialBlock\n"
+  "{\n"
+  "  bool isWireframeOverwrite;\n"
+  "  bool isEdgesVisible;\n"
+  "  bool isFlatFaces;\n"
+  "  bool isDiffuseTextureActive;\n"
+  "  bool isBumpMapActive;\n"
+  "  bool isPackedVertexFormat;\n"
+  "  bool isBumpMapTwoChannel;\n"
+  "  bool isDiffuseTextureVirtual;\n"
+  "};\n"
+  "out vec3 normalCSpace;\n"
+  "out vec3 positionCSpace;\n"
+  "void main()\n"
+  "{\n"
+  "  vec3 normal = isPackedVertexFormat ? -vertexNormalMSpace : vertexNormalMSpace;\n"
+  "  normalCSpace = mat3(view) * normal;\n"
+  "  positionCSpace = vec3(view * vec4(vertexPositionMSpace, 1.0));\n"
+  "  gl_Position = viewProjection * vec4(vertexPositionMSpace, 1.0);\n"
+  "}\n";
+
+static const char* BLOCK_FRAGMENT_SHADER =
+  "#version 420 core\n"
+  "in vec3 normalCSpace;\n"
+  "in vec3 positionCSpace;\n"
+  "layout( std140, binding = 1 ) uniform MaterialBlock\n"
+  "{\n"
+  "  bool isWireframeOverwrite;\n"
+  "  bool isEdgesVisible;\n"
+  "  bool isFlatFaces;\n"
+  "  bool isDiffuseTextureActive;\n"
+  "  bool isBumpMapActive;\n"
+  "  bool isPackedVertexFormat;\n"
+  "  bool isBumpMapTwoChannel;\n"
+  "  bool isDiffuseTextureVirtual;\n"
+  "};\n"
+  "layout( std140, binding = 2 ) uniform VirtualTextureBlock\n"
+  "{\n"
+  "  ivec4 virtualSize;\n"
+  "  ivec4 virtualLayout;\n"
+  "  ivec4 pageTableOffsets[16];\n"
+  "};\n"
+  "layout( binding = 0 ) uniform sampler2D diffuseTextureSampler;\n"
+  "layout( binding = 1 ) uniform sampler2D bumpMapSampler;\n"
+  "out vec4 color;\n"
+  "void main()\n"
+  "{\n"
+  "  vec3 diffuse = vec3(virtualSize.xyz + pageTableOffsets[virtualLayout.y].xyz);\n"
+  "  if(isDiffuseTextureActive) diffuse *= texture(diffuseTextureSampler, positionCSpace.xy).bgr;\n"
+  "  if(isBumpMapActive || isBumpMapTwoChannel) diffuse *= texture(bumpMapSampler, positionCSpace.xy).rgb;\n"
+  "  if(isWireframeOverwrite || isEdgesVisible || isFlatFaces || isDiffuseTextureVirtual) diffuse = 1.0 - diffuse;\n"
+  "  float lambert = max(dot(normalize(normalCSpace), vec3(0.0, 0.0, 1.0)), 0.0);\n"
+  "  color = vec4(diffuse * lambert, 1.0);\n"
+  "}\n";
+
+static bool linkProgram(QOpenGLShaderProgram& program, const char* vertexShader, const char* fragmentShader)
+{
+  return program.addShaderFromSourceCode(QOpenGLShader::Vertex, vertexShader)
+      && program.addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentShader)
+      && program.link();
+}
+
+// Same camera path for both, still or slowly dollying
+static glm::mat4 getFrameView(int frame, bool isMoving)
+{
+  glm::vec3 eye(0.0f, 0.0f, 3.0f + (isMoving ? frame * 1e-5f : 0.0f));
+  return glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+// paintGL before the uniform blocks
+static double runNameLookup(QOpenGLShaderProgram& program, bool isMoving)
+{
+  glm::mat4 proj = glm::perspective(0.8f, 1.5f, 0.1f, 100.0f);
+  glm::vec3 diffuseColor(0.5f);
+  float materialShininess = 32.0f;
+
+  program.bind();
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int frame = 0; frame < FRAMES; frame++)
+  {
+    glm::mat4 view = getFrameView(frame, isMoving);
+    glm::mat4 model = glm::mat4();
+
+    QMatrix4x4 m(glm::value_ptr(glm::transpose(model)));
+    QMatrix4x4 v(glm::value_ptr(glm::transpose(view)));
+    QMatrix4x4 p(glm::value_ptr(glm::transpose(proj)));
+
+    QMatrix4x4 mv = v * m;
+    QMatrix4x4 mvp = p * mv;
+    program.setUniformValue("mv", mv);
+    program.setUniformValue("mv_ti", mv.inverted().transposed());
+    program.setUniformValue("mvp", mvp);
+
+    program.setUniformValue("isWireframeOverwrite", false);
+    program.setUniformValue("isEdgesVisible", false);
+    program.setUniformValue("isFlatFaces", false);
+    program.setUniformValue("isDiffuseTextureActive", true);
+    program.setUniformValue("isBumpMapActive", true);
+    program.setUniformValue("isPackedVertexFormat", false);
+
+    program.setUniformValue("diffuseTextureSampler", 0);
+    program.setUniformValue("bumpMapSampler", 1);
+    program.setUniformValue("diffuseColor", QVector3D(diffuseColor[0], diffuseColor[1], diffuseColor[2]));
+    program.setUniformValue("materialShininess", materialShininess);
+  }
+  return elapsedMilliseconds(start) * 1e6 / FRAMES;
+}
+
+// paintGL with the uniform blocks
+static double runUniformBlocks(QOpenGLShaderProgram& program,
+                               QOpenGLExtraFunctions* gl,
+                               bool isMoving,
+                               unsigned int& uploadCount)
+{
+  glm::mat4 proj = glm::perspective(0.8f, 1.5f, 0.1f, 100.0f);
+
+  // Laid out as the RenderWidget blocks: two matrices, eight bools and the
+  // virtual texture description
+  UniformBuffer frameUniformBuffer(gl, 0, 2 * sizeof(glm::mat4));
+  UniformBuffer materialUniformBuffer(gl, 1, 8 * sizeof(int));
+  UniformBuffer virtualTextureUniformBuffer(gl, 2, 18 * sizeof(glm::ivec4));
+
+  program.bind();
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int frame = 0; frame < FRAMES; frame++)
+  {
+    glm::mat4 frameUniforms[2];
+    frameUniforms[0] = getFrameView(frame, isMoving);
+    frameUniforms[1] = proj * frameUniforms[0];
+    frameUniformBuffer.set(frameUniforms);
+    frameUniformBuffer.bind();
+
+    int material[8] = { 0, 0, 0, 1, 1, 0, 0, 0 };
+    materialUniformBuffer.set(material);
+    materialUniformBuffer.bind();
+    virtualTextureUniformBuffer.bind();
+  }
+  double nanoseconds = elapsedMilliseconds(start) * 1e6 / FRAMES;
+  uploadCount = frameUniformBuffer.getUploadCount() + materialUniformBuffer.getUploadCount();
+  return nanoseconds;
+}
+
+void runUniformBenchmark()
+{
+  // An OpenGL context needs a GUI application, headless runs can use
+  // QT_QPA_PLATFORM=offscreen
+  static int argc = 1;
+  static char name[] = "benchmarks";
+  static char* argv[] = { name, nullptr };
+  if (!QGuiApplication::instance())
+  {
+    new QGuiApplication(argc, argv);
+  }
+
+  QSurfaceFormat format;
+  format.setVersion(4, 2);
+  format.setProfile(QSurfaceFormat::CoreProfile);
+
+  QOffscreenSurface surface;
+  surface.setFormat(format);
+  surface.create();
+  QOpenGLContext context;
+  context.setFormat(format);
+  if (!context.create() || !context.makeCurrent(&surface) || !context.extraFunctions())
+  {
+    printf("no OpenGL 4.2 context, skipped\n");
+    reportFailure();
+    return;
+  }
+  QOpenGLExtraFunctions* gl = context.extraFunctions();
+  gl->initializeOpenGLFunctions();
+
+  QOpenGLShaderProgram nameLookupProgram;
+  QOpenGLShaderProgram blockProgram;
+  if (!linkProgram(nameLookupProgram, NAME_LOOKUP_VERTEX_SHADER, NAME_LOOKUP_FRAGMENT_SHADER)
+     || !linkProgram(blockProgram, BLOCK_VERTEX_SHADER, BLOCK_FRAGMENT_SHADER))
+  {
+    printf("shaders did not link, skipped\n");
+    reportFailure();
+    return;
+  }
+
+  printf("CPU time of the per-frame state update, %d frames\n", FRAMES);
+  for (int moving = 0; moving < 2; moving++)
+  {
+    unsigned int uploadCount = 0;
+    double nameLookupTime = runNameLookup(nameLookupProgram, moving != 0);
+    double blockTime = runUniformBlocks(blockProgram, gl, moving != 0, uploadCount);
+    printf("%s camera  name lookup %6.0f ns/frame  uniform blocks %6.0f ns/frame  %4.1fx  %u block uploads\n",
+           moving ? "moving" : "still ",
+           nameLookupTime,
+           blockTime,
+           nameLookupTime / blockTime,
+           uploadCount);
+  }
+  printf("%s\n", (const char*) gl->glGetString(GL_RENDERER));
+  context.doneCurrent();
+}
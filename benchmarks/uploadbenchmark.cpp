@@ -0,0 +1,170 @@
+#include "benchmarks.h"
+#include "indexbatcher.h"
+#include "normalmapbaker.h"
+#include "uvcubewrapper.h"
+#include "uvsphericalwrapper.h"
+#include "vertexpacker.h"
+
+#include <cstdio>
+#include <limits>
+#include <vector>
+
+// What a spherical/cube mapping toggle sends to the GPU for each vertex
+// layout of the renderer. The interleaved layouts reload the whole mesh,
+// vertices and 16-bit indices; the separate streams only rewrite the UV
+// and tangent streams.
+struct ToggleUpload
+{
+  size_t bytes;
+  double buildTime;
+};
+
+static void computeUVs(std::vector<glm::vec3>& positions, bool isSpherical, std::vector<glm::vec2>& UVs)
+{
+  UVSphericalWrapper sphericalWrapper;
+  UVCubeWrapper cubeWrapper;
+  cubeWrapper.runBoundingBox(positions);
+  UVs.resize(positions.size());
+  for (unsigned int v = 0; v < positions.size(); v++)
+  {
+    UVs[v] = isSpherical ? sphericalWrapper.uv(positions[v]) : cubeWrapper.uv(positions[v]);
+  }
+}
+
+static ToggleUpload buildInterleaved(bool isPacked,
+                                     const std::vector<glm::vec3>& positions,
+                                     const std::vector<glm::vec3>& normals,
+                                     const std::vector<glm::vec3>& tangents,
+                                     const std::vector<glm::vec3>& bitangents,
+                                     const std::vector<glm::vec2>& UVs,
+                                     const std::vector<unsigned short>& shortIndices)
+{
+  ToggleUpload upload;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  if (isPacked)
+  {
+    VertexPacker packer;
+    std::vector<PackedVertex> vertices;
+    packer.pack(positions, normals, tangents, bitangents, UVs, vertices);
+    upload.bytes = vertices.size() * sizeof(PackedVertex);
+  }
+  else
+  {
+    std::vector<InterleavedVertex> vertices;
+    VertexPacker::interleave(positions, normals, tangents, bitangents, UVs, vertices);
+    upload.bytes = vertices.size() * sizeof(InterleavedVertex);
+  }
+  upload.buildTime = elapsedMilliseconds(start);
+  upload.bytes += shortIndices.size() * sizeof(unsigned short);
+  return upload;
+}
+
+static ToggleUpload buildStreams(bool isPacked,
+                                 const std::vector<glm::vec3>& positions,
+                                 const std::vector<glm::vec3>& normals,
+                                 const std::vector<glm::vec3>& tangents,
+                                 const std::vector<glm::vec3>& bitangents,
+                                 const std::vector<glm::vec2>& UVs)
+{
+  ToggleUpload upload = { 0, 0.0 };
+  VertexPacker packer;
+  std::vector<unsigned char> stream;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  packer.buildStream(VertexPacker::UV_STREAM, isPacked, positions, normals, tangents, bitangents, UVs, stream);
+  upload.bytes += stream.size();
+  packer.buildStream(VertexPacker::TANGENT_STREAM, isPacked, positions, normals, tangents, bitangents, UVs, stream);
+  upload.bytes += stream.size();
+  upload.buildTime = elapsedMilliseconds(start);
+  return upload;
+}
+
+// The SSE2 normal encoder against the scalar one, over the mesh normals and
+// the inputs where they used to differ: degenerate normals, -0 components,
+// NaN and infinity. The count is kept a multiple of four so every normal
+// goes through the SIMD loop.
+static bool isNormalEncodingConsistent(const std::vector<glm::vec3>& meshNormals)
+{
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  const float infinity = std::numeric_limits<float>::infinity();
+  std::vector<glm::vec3> normals = {
+    glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(-0.0f, -0.0f, -0.0f),
+    glm::vec3(0.0f, 0.0f, -1e-25f), glm::vec3(1e-30f, -1e-30f, -1e-30f),
+    glm::vec3(-0.0f, 0.5f, -0.5f), glm::vec3(0.5f, -0.0f, -0.5f),
+    glm::vec3(-0.0f, -0.0f, -1.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+    glm::vec3(-0.0f, 1.0f, 0.0f), glm::vec3(1.0f, -0.0f, -0.0f),
+    glm::vec3(nan, 0.0f, 1.0f), glm::vec3(infinity, 0.0f, -1.0f)
+  };
+  normals.insert(normals.end(), meshNormals.begin(), meshNormals.end());
+  normals.resize(normals.size() / 4 * 4);
+
+  VertexPacker packer;
+  std::vector<glm::i16vec2> packed(normals.size());
+  packer.packNormals(normals, packed.data(), sizeof(glm::i16vec2));
+  for (size_t i = 0; i < normals.size(); i++)
+  {
+    if (packed[i] != VertexPacker::encodeOctahedral(normals[i]))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void runModel(const std::string& name)
+{
+  std::vector<glm::vec3> positions;
+  std::vector<unsigned int> indices;
+  std::vector<glm::vec3> normals;
+  if (!loadModel(name, positions, indices) || positions.empty())
+  {
+    return;
+  }
+  computeVertexNormals(positions, indices, normals);
+
+  // UVs and tangents of the new mapping, as RenderWidget::reloadUVs builds
+  // them before remapping to the 16-bit batches
+  std::vector<glm::vec2> UVs;
+  std::vector<glm::vec3> tangents;
+  std::vector<glm::vec3> bitangents;
+  computeUVs(positions, false, UVs);
+  NormalMapBaker::computeTangentBasis(positions, UVs, indices, tangents, bitangents);
+
+  IndexBatcher batcher;
+  std::vector<unsigned short> shortIndices;
+  std::vector<unsigned int> vertexRemap;
+  std::vector<Submesh> submeshes;
+  batcher.build(indices, (unsigned int) positions.size(), shortIndices, vertexRemap, submeshes);
+  if (!vertexRemap.empty())
+  {
+    IndexBatcher::remap(positions, vertexRemap);
+    IndexBatcher::remap(normals, vertexRemap);
+    IndexBatcher::remap(tangents, vertexRemap);
+    IndexBatcher::remap(bitangents, vertexRemap);
+    IndexBatcher::remap(UVs, vertexRemap);
+  }
+
+  ToggleUpload uploads[4] = {
+    buildInterleaved(false, positions, normals, tangents, bitangents, UVs, shortIndices),
+    buildInterleaved(true, positions, normals, tangents, bitangents, UVs, shortIndices),
+    buildStreams(false, positions, normals, tangents, bitangents, UVs),
+    buildStreams(true, positions, normals, tangents, bitangents, UVs)
+  };
+  printf("%-14s %7u vertices", name.c_str(), (unsigned int) positions.size());
+  for (int i = 0; i < 4; i++)
+  {
+    printf("  %8.1f KiB %6.2f ms", uploads[i].bytes / 1024.0, uploads[i].buildTime);
+  }
+  printf("  packed streams %4.1f%% of packed interleaved  %s\n",
+         100.0 * uploads[3].bytes / uploads[1].bytes,
+         isNormalEncodingConsistent(normals) ? "normals ok" : "NORMALS DIFFER");
+}
+
+void runUploadBenchmark()
+{
+  printf("bytes per spherical/cube toggle and the time to build them\n");
+  printf("%-14s %16s  %22s  %22s  %22s  %22s\n", "", "", "interleaved float", "interleaved packed", "streams float", "streams packed");
+  for (const std::string& name : getBundledModels())
+  {
+    runModel(name);
+  }
+}
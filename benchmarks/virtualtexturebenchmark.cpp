@@ -0,0 +1,328 @@
+#include "benchmarks.h"
+#include "pagefeedback.h"
+#include "pagefile.h"
+#include "virtualtexture.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+static const int SIZE = 8192;
+static const char* const PAGE_FILE_PATH = "benchmark.vtp";
+static const int VIEWPORT_WIDTH = 1280;
+static const int VIEWPORT_HEIGHT = 720;
+static const int NUM_FRAMES = 40;
+// Time left to the load threads between two frames
+static const int FRAME_MILLISECONDS = 16;
+
+// Rows of a texture too large to be kept whole, made up on the fly: cells
+// of hashed colors over a gradient
+static void readSyntheticRows(int y, int numRows, unsigned char* texels)
+{
+  for (int row = 0; row < numRows; row++)
+  {
+    int sourceY = y + row;
+    unsigned char* output = texels + (size_t) row * SIZE * 4;
+    for (int x = 0; x < SIZE; x++)
+    {
+      unsigned int hash = (unsigned int) (x >> 5) * 73856093u ^ (unsigned int) (sourceY >> 5) * 19349663u;
+      hash = (hash ^ (hash >> 13)) * 0x5bd1e995u;
+      output[4 * x] = (unsigned char) ((hash & 0x7f) + (x * 128 / SIZE));
+      output[4 * x + 1] = (unsigned char) (((hash >> 8) & 0x7f) + (sourceY * 128 / SIZE));
+      output[4 * x + 2] = (unsigned char) ((hash >> 16) & 0xff);
+      output[4 * x + 3] = 255;
+    }
+  }
+}
+
+static inline int wrap(int a, int size)
+{
+  a %= size;
+  return a < 0 ? a + size : a;
+}
+
+// Texel of a level as PageFile::build halves it, only the first two
+static void getSyntheticTexel(int level, int x, int y, unsigned char* texel)
+{
+  std::vector<unsigned char> rows(2 * SIZE * 4);
+  if (level == 0)
+  {
+    readSyntheticRows(y, 1, rows.data());
+    memcpy(texel, &rows[(size_t) x * 4], 4);
+    return;
+  }
+  readSyntheticRows(2 * y, 2, rows.data());
+  for (int c = 0; c < 4; c++)
+  {
+    int sum = rows[8 * x + c] + rows[8 * x + 4 + c] + rows[(size_t) SIZE * 4 + 8 * x + c] + rows[(size_t) SIZE * 4 + 8 * x + 4 + c];
+    texel[c] = (unsigned char) ((sum + 2) >> 2);
+  }
+}
+
+// The first two levels against the source, on the corner pages and a few
+// more, borders included. A sparse grid of texels keeps it short.
+static bool isPageFileTexelsValid(PageFile& pageFile)
+{
+  int pageSize = pageFile.getPageSize();
+  std::vector<unsigned char> page(pageFile.getPageBytes());
+  std::mt19937 random(2);
+  for (int level = 0; level < 2; level++)
+  {
+    int tilesWide = pageFile.getTilesWide(level);
+    int tilesHigh = pageFile.getTilesHigh(level);
+    std::vector<glm::ivec2> tiles = { glm::ivec2(0, 0), glm::ivec2(tilesWide - 1, 0), glm::ivec2(0, tilesHigh - 1), glm::ivec2(tilesWide - 1, tilesHigh - 1) };
+    for (int i = 0; i < 4; i++)
+    {
+      tiles.push_back(glm::ivec2(random() % tilesWide, random() % tilesHigh));
+    }
+    for (const glm::ivec2& tile : tiles)
+    {
+      if (!pageFile.readPage(level, tile.x, tile.y, page.data()))
+      {
+        return false;
+      }
+      for (int y = 0; y < pageSize; y += 3)
+      {
+        for (int x = 0; x < pageSize; x += 3)
+        {
+          unsigned char texel[4];
+          getSyntheticTexel(level,
+                            wrap(tile.x * PageFile::TILE_SIZE + x - PageFile::BORDER, pageFile.getLevelWidth(level)),
+                            wrap(tile.y * PageFile::TILE_SIZE + y - PageFile::BORDER, pageFile.getLevelHeight(level)),
+                            texel);
+          if (memcmp(texel, &page[((size_t) y * pageSize + x) * 4], 4) != 0)
+          {
+            return false;
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// The borders of every page repeat the texels of the pages around it,
+// across the edges of the texture too
+static bool isPageFileBordersValid(PageFile& pageFile)
+{
+  int pageSize = pageFile.getPageSize();
+  std::vector<unsigned char> page(pageFile.getPageBytes());
+  std::vector<unsigned char> right(pageFile.getPageBytes());
+  std::vector<unsigned char> below(pageFile.getPageBytes());
+  for (int level = 0; level < pageFile.getNumLevels(); level++)
+  {
+    int tilesWide = pageFile.getTilesWide(level);
+    int tilesHigh = pageFile.getTilesHigh(level);
+    // Full tiles only, the last ones of odd sizes wrap inside themselves
+    if (pageFile.getLevelWidth(level) % PageFile::TILE_SIZE != 0 || pageFile.getLevelHeight(level) % PageFile::TILE_SIZE != 0)
+    {
+      continue;
+    }
+    for (int ty = 0; ty < tilesHigh; ty++)
+    {
+      for (int tx = 0; tx < tilesWide; tx++)
+      {
+        if (!pageFile.readPage(level, tx, ty, page.data()) ||
+            !pageFile.readPage(level, (tx + 1) % tilesWide, ty, right.data()) ||
+            !pageFile.readPage(level, tx, (ty + 1) % tilesHigh, below.data()))
+        {
+          return false;
+        }
+        // The last columns of the page, its right border included, are the
+        // first columns of the next page, its left border included, and
+        // the same for the rows of the page below
+        for (int i = 0; i < pageSize; i++)
+        {
+          for (int j = 0; j < 2 * PageFile::BORDER; j++)
+          {
+            int overlap = PageFile::TILE_SIZE + j;
+            if (memcmp(&page[((size_t) i * pageSize + overlap) * 4], &right[((size_t) i * pageSize + j) * 4], 4) != 0 ||
+                memcmp(&page[((size_t) overlap * pageSize + i) * 4], &below[((size_t) j * pageSize + i) * 4], 4) != 0)
+            {
+              return false;
+            }
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// Every entry of the page table points at a slot holding a page the GPU
+// got, the one under the entry at its level
+static bool isPageTableValid(VirtualTexture& texture, const std::vector<unsigned int>& slotPages)
+{
+  const std::vector<unsigned char>& pageTable = texture.getPageTable();
+  const std::vector<int>& levelOffsets = texture.getLevelOffsets();
+  for (int level = 0; level < texture.getNumLevels(); level++)
+  {
+    int levelTilesWide = (std::max(texture.getWidth() >> level, 1) + PageFile::TILE_SIZE - 1) / PageFile::TILE_SIZE;
+    int levelTilesHigh = (std::max(texture.getHeight() >> level, 1) + PageFile::TILE_SIZE - 1) / PageFile::TILE_SIZE;
+    for (int y = 0; y < levelTilesHigh; y++)
+    {
+      for (int x = 0; x < levelTilesWide; x++)
+      {
+        const unsigned char* entry = &pageTable[((size_t) (levelOffsets[2 * level + 1] + y) * texture.getPageTableWidth() + levelOffsets[2 * level] + x) * 4];
+        unsigned int slot = entry[0] + entry[1] * texture.getSlotsWide();
+        if (entry[2] < level || entry[2] >= texture.getNumLevels() || slot >= slotPages.size() || slotPages[slot] == VirtualTexture::NO_PAGE)
+        {
+          return false;
+        }
+        int pageLevel;
+        int pageX;
+        int pageY;
+        VirtualTexture::unpackPage(slotPages[slot], pageLevel, pageX, pageY);
+        int shift = pageLevel - level;
+        int parentTilesWide = (std::max(texture.getWidth() >> pageLevel, 1) + PageFile::TILE_SIZE - 1) / PageFile::TILE_SIZE;
+        int parentTilesHigh = (std::max(texture.getHeight() >> pageLevel, 1) + PageFile::TILE_SIZE - 1) / PageFile::TILE_SIZE;
+        if (pageLevel != entry[2] ||
+            pageX != std::min(x >> shift, parentTilesWide - 1) ||
+            pageY != std::min(y >> shift, parentTilesHigh - 1))
+        {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// The sphere turning in front of the camera, the texture is closed on
+// return
+static void runFrames(const std::vector<glm::vec3>& positions,
+                      const std::vector<glm::vec2>& UVs,
+                      const std::vector<unsigned int>& indices,
+                      const glm::mat4& viewProjection)
+{
+  VirtualTexture texture;
+  texture.open(PAGE_FILE_PATH);
+  PageFeedback feedback;
+  std::vector<unsigned int> requests;
+  // The page each slot of the physical texture got, as uploaded
+  std::vector<unsigned int> slotPages(texture.getSlotsWide() * texture.getSlotsWide(), VirtualTexture::NO_PAGE);
+  double feedbackTime = 0.0;
+  double updateTime = 0.0;
+  int loadedPages = 0;
+  printf("%d physical pages, feedback %dx%d\n",
+         texture.getSlotsWide() * texture.getSlotsWide(),
+         VIEWPORT_WIDTH / PageFeedback::DOWNSCALE,
+         VIEWPORT_HEIGHT / PageFeedback::DOWNSCALE);
+  for (int frame = 0; frame < NUM_FRAMES; frame++)
+  {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<LoadedPage> pages = texture.takeLoadedPages();
+    for (const LoadedPage& page : pages)
+    {
+      slotPages[page.slot] = page.page;
+    }
+    loadedPages += (int) pages.size();
+    glm::mat4 model = glm::rotate(glm::mat4(1.0f), frame * 0.02f, glm::vec3(0.0f, 1.0f, 0.0f));
+    feedback.begin(&texture, VIEWPORT_WIDTH, VIEWPORT_HEIGHT);
+    feedback.draw(positions, UVs, indices, 0, (unsigned int) indices.size(), viewProjection * model);
+    feedback.end(requests);
+    feedbackTime += elapsedMilliseconds(start);
+
+    start = std::chrono::steady_clock::now();
+    texture.update(requests);
+    updateTime += elapsedMilliseconds(start);
+
+    if (frame % 5 == 0 || frame == NUM_FRAMES - 1)
+    {
+      printf("frame %2d: %4d pages sampled, %4d resident, %4d loading, %5d loaded so far\n",
+             frame,
+             (int) requests.size(),
+             texture.getNumResidentPages(),
+             texture.getNumLoadingPages(),
+             loadedPages);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(FRAME_MILLISECONDS));
+  }
+  printf("feedback %.2f ms, update %.3f ms per frame\n", feedbackTime / NUM_FRAMES, updateTime / NUM_FRAMES);
+
+  // Once the last loads are in
+  std::this_thread::sleep_for(std::chrono::milliseconds(10 * FRAME_MILLISECONDS));
+  for (const LoadedPage& page : texture.takeLoadedPages())
+  {
+    slotPages[page.slot] = page.page;
+  }
+  bool isValid = isPageTableValid(texture, slotPages);
+  printf("%s\n", isValid ? "page table ok" : "PAGE TABLE WRONG");
+  if (!isValid)
+  {
+    reportFailure();
+  }
+}
+
+void runVirtualTextureBenchmark()
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  if (!PageFile::build(PAGE_FILE_PATH, SIZE, SIZE, readSyntheticRows))
+  {
+    printf("could not write %s\n", PAGE_FILE_PATH);
+    return;
+  }
+  double buildTime = elapsedMilliseconds(start);
+
+  PageFile pageFile;
+  pageFile.open(PAGE_FILE_PATH);
+  long long numPages = 0;
+  for (int level = 0; level < pageFile.getNumLevels(); level++)
+  {
+    numPages += (long long) pageFile.getTilesWide(level) * pageFile.getTilesHigh(level);
+  }
+  printf("%dx%d source, %d levels, %lld pages of %dx%d: built in %.0f ms, %.1f MTexels/s\n",
+         SIZE,
+         SIZE,
+         pageFile.getNumLevels(),
+         numPages,
+         pageFile.getPageSize(),
+         pageFile.getPageSize(),
+         buildTime,
+         (double) SIZE * SIZE / (buildTime * 1000.0));
+
+  // Random reads over the first level, the file is likely in the OS cache
+  std::mt19937 random(1);
+  std::vector<unsigned char> page(pageFile.getPageBytes());
+  const int numReads = 2000;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < numReads; i++)
+  {
+    pageFile.readPage(0, random() % pageFile.getTilesWide(0), random() % pageFile.getTilesHigh(0), page.data());
+  }
+  double readTime = elapsedMilliseconds(start);
+  printf("random page reads %.1f us each, %.0f MB/s\n",
+         readTime * 1000.0 / numReads,
+         (double) numReads * page.size() / (readTime * 1000.0));
+
+  bool isTexelsValid = isPageFileTexelsValid(pageFile);
+  bool isBordersValid = isPageFileBordersValid(pageFile);
+  printf("%s %s\n", isTexelsValid ? "texels ok" : "TEXELS WRONG", isBordersValid ? "borders ok" : "BORDERS WRONG");
+  if (!isTexelsValid || !isBordersValid)
+  {
+    reportFailure();
+  }
+  pageFile.close();
+
+  // A sphere wrapped by the texture, seen up close while it turns
+  std::vector<InterleavedVertex> vertices;
+  std::vector<unsigned int> indices;
+  buildSphereMesh(128, 64, vertices, indices);
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec2> UVs;
+  for (unsigned int i = 0; i < vertices.size(); i++)
+  {
+    positions.push_back(vertices[i].pos);
+    UVs.push_back(vertices[i].uv);
+  }
+  glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 1.8f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+  glm::mat4 proj = glm::perspective(glm::radians(60.0f), (float) VIEWPORT_WIDTH / VIEWPORT_HEIGHT, 0.1f, 100.0f);
+
+  runFrames(positions, UVs, indices, proj * view);
+  std::remove(PAGE_FILE_PATH);
+}